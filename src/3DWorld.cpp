@@ -123,11 +123,11 @@ char player_name[MAX_CHARS] = "Player";
 bool vert_opt_flags[3] = {0}; // {enable, full_opt, verbose}
 
 
-extern bool clear_landscape_vbo, use_dense_voxels, tree_4th_branches, model_calc_tan_vect, water_is_lava, use_grass_tess, def_tex_compress, ship_cube_map_reflection, flashlight_on;
+extern bool clear_landscape_vbo, use_dense_voxels, tree_4th_branches, model_calc_tan_vect, water_is_lava, use_grass_tess, def_tex_compress, ship_cube_map_reflection, flashlight_on, lighting_work_stealing, benchmark_packet_rays, benchmark_cobj_bvh, cobj_bvh_refit, chunked_lighting_files, compact_lightmap, benchmark_erosion, parallel_smoke, benchmark_smoke, benchmark_model_welding, parallel_model_welding, benchmark_voxel_remesh, benchmark_sine_noise, async_planet_textures;
 extern int camera_flight, DISABLE_WATER, DISABLE_SCENERY, camera_invincible, onscreen_display, mesh_freq_filter, show_waypoints, last_inventory_frame;
 extern int tree_coll_level, GLACIATE, UNLIMITED_WEAPONS, destroy_thresh, MAX_RUN_DIST, mesh_gen_mode, mesh_gen_shape, map_drag_x, map_drag_y;
 extern unsigned NPTS, NRAYS, LOCAL_RAYS, GLOBAL_RAYS, DYNAMIC_RAYS, NUM_THREADS, MAX_RAY_BOUNCES, grass_density, max_unique_trees, shadow_map_sz;
-extern unsigned scene_smap_vbo_invalid, spheres_mode, max_cube_map_tex_sz, DL_GRID_BS;
+extern unsigned scene_smap_vbo_invalid, spheres_mode, max_cube_map_tex_sz, DL_GRID_BS, packet_light_rays, cobj_bvh_width, async_tile_gen_threads, planet_tex_cache_mb;
 extern float fticks, team_damage, self_damage, player_damage, smiley_damage, smiley_speed, tree_deadness, tree_dead_prob, lm_dz_adj, nleaves_scale, flower_density, universe_ambient_scale;
 extern float mesh_scale, tree_scale, mesh_height_scale, smiley_acc, hmv_scale, last_temp, grass_length, grass_width, branch_radius_scale, tree_height_scale, planet_update_rate;
 extern float MESH_START_MAG, MESH_START_FREQ, MESH_MAG_MULT, MESH_FREQ_MULT, def_tex_aniso;
@@ -136,7 +136,7 @@ extern point hmv_pos, camera_last_pos;
 extern colorRGBA sunlight_color;
 extern int coll_id[];
 extern float tree_lod_scales[4];
-extern string read_hmap_modmap_fn, write_hmap_modmap_fn, read_voxel_brush_fn, write_voxel_brush_fn, font_texture_atlas_fn;
+extern string read_hmap_modmap_fn, write_hmap_modmap_fn, read_voxel_brush_fn, write_voxel_brush_fn, font_texture_atlas_fn, model3d_cache_dir, building_layout_cache_dir, planet_tex_cache_dir;
 extern vector<bbox> team_starts;
 extern player_state *sstates;
 extern pt_line_drawer obj_pld;
@@ -1637,6 +1637,15 @@ int load_config(string const &config_file) {
 	kwmb.add("use_dense_voxels", use_dense_voxels);
 	kwmb.add("use_voxel_cobjs", use_voxel_cobjs);
 	kwmb.add("mt_cobj_tree_build", mt_cobj_tree_build);
+	kwmb.add("benchmark_cobj_bvh", benchmark_cobj_bvh);
+	kwmb.add("cobj_bvh_refit", cobj_bvh_refit);
+	kwmb.add("chunked_lighting_files", chunked_lighting_files);
+	kwmb.add("compact_lightmap", compact_lightmap);
+	kwmb.add("benchmark_erosion", benchmark_erosion);
+	kwmb.add("parallel_smoke", parallel_smoke);
+	kwmb.add("benchmark_smoke", benchmark_smoke);
+	kwmb.add("lighting_work_stealing", lighting_work_stealing);
+	kwmb.add("benchmark_packet_rays", benchmark_packet_rays);
 	kwmb.add("global_lighting_update", global_lighting_update);
 	kwmb.add("lighting_update_offline", lighting_update_offline);
 	kwmb.add("two_sided_lighting", two_sided_lighting);
@@ -1675,6 +1684,11 @@ int load_config(string const &config_file) {
 	kwmb.add("no_store_model_textures_in_memory", no_store_model_textures_in_memory);
 	kwmb.add("no_subdiv_model", no_subdiv_model);
 	kwmb.add("merge_model_objects", merge_model_objects);
+	kwmb.add("benchmark_model_welding", benchmark_model_welding);
+	kwmb.add("parallel_model_welding", parallel_model_welding);
+	kwmb.add("benchmark_voxel_remesh", benchmark_voxel_remesh);
+	kwmb.add("benchmark_sine_noise", benchmark_sine_noise);
+	kwmb.add("async_planet_textures", async_planet_textures);
 	kwmb.add("use_grass_tess", use_grass_tess);
 	kwmb.add("use_instanced_pine_trees", use_instanced_pine_trees);
 	kwmb.add("enable_dpart_shadows", enable_dpart_shadows);
@@ -1743,10 +1757,13 @@ int load_config(string const &config_file) {
 	kwmu.add("max_unique_trees", max_unique_trees);
 	kwmu.add("shadow_map_sz", shadow_map_sz);
 	kwmu.add("max_ray_bounces", MAX_RAY_BOUNCES);
+	kwmu.add("packet_light_rays", packet_light_rays);
+	kwmu.add("cobj_bvh_width", cobj_bvh_width);
 	kwmu.add("num_test_snowflakes", num_snowflakes);
 	kwmu.add("hmap_filter_width", hmap_filter_width);
 	kwmu.add("erosion_iters", erosion_iters);
 	kwmu.add("erosion_iters_tt", erosion_iters_tt);
+	kwmu.add("async_tile_gen_threads", async_tile_gen_threads);
 	kwmu.add("num_dynam_parts", num_dynam_parts);
 	kwmu.add("num_birds_per_tile", num_birds_per_tile);
 	kwmu.add("num_fish_per_tile", num_fish_per_tile);
@@ -1756,6 +1773,7 @@ int load_config(string const &config_file) {
 	kwmu.add("video_framerate", video_framerate);
 	kwmu.add("num_video_threads", num_video_threads);
 	kwmu.add("tiled_terrain_gen_heightmap_sz", tiled_terrain_gen_heightmap_sz);
+	kwmu.add("planet_tex_cache_mb", planet_tex_cache_mb);
 
 	kw_to_val_map_t<float> kwmf(error);
 	kwmf.add("gravity", base_gravity);
@@ -1863,6 +1881,9 @@ int load_config(string const &config_file) {
 	kwms.add("sphere_materials_fn", sphere_materials_fn);
 	kwms.add("write_heightmap_png", hmap_out_fn);
 	kwms.add("skybox_cube_map", skybox_cube_map_name);
+	kwms.add("model3d_cache_dir", model3d_cache_dir);
+	kwms.add("building_layout_cache_dir", building_layout_cache_dir);
+	kwms.add("planet_tex_cache_dir", planet_tex_cache_dir);
 
 	while (read_str(fp, strc)) { // slow but should be OK: these ones require special handling
 		string const str(strc);
@@ -2130,6 +2151,7 @@ int load_config(string const &config_file) {
 	} // while read
 	if (universe_only && disable_universe) {cout << "Error: universe_only and disable_universe are mutually exclusive" << endl; error = 1;}
 	if (mh_filename_tt != nullptr && tiled_terrain_gen_heightmap_sz > 0) {cout << "Error: can't specify both mh_filename_tiled_terrain and tiled_terrain_gen_heightmap_sz" << endl; error = 1;}
+	if (cobj_bvh_width != 0 && cobj_bvh_width != 4 && cobj_bvh_width != 8) {cout << "Error: cobj_bvh_width must be 0, 4, or 8" << endl; error = 1;}
 	checked_fclose(fp);
 	temperature    = init_temperature;
 	num_dodgeballs = max(num_dodgeballs, 1); // have to have at least 1
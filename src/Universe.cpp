@@ -40,6 +40,7 @@ unsigned const MAX_PLANETS_PER_SYSTEM  = 16;
 unsigned const MAX_MOONS_PER_PLANET    = 8;
 unsigned const GAS_GIANT_TSIZE         = 1024;
 unsigned const GAS_GIANT_BANDS         = 63;
+unsigned const PLACEHOLDER_TSIZE       = 32; // used for rocky planets and moons until the full size texture has been generated in the background
 
 int   const RAND_CONST       = 1;
 float const ROTREV_TIMESCALE = 1.0;
@@ -54,7 +55,7 @@ float const GAS_GIANT_MIN_REL_SZ = 0.34;
 unsigned const noise_tu_id = 11; // so as not to conflict with other ground mode textures when drawing plasma
 
 
-bool have_sun(1);
+bool have_sun(1), async_planet_textures(0);
 unsigned star_cache_ix(0);
 int uxyz[3] = {0, 0, 0};
 unsigned char water_c[3] = {0}, ice_c[3] = {0};
@@ -2071,24 +2072,52 @@ void urev_body::check_gen_texture(unsigned size) {
 	if (!glIsTexture(tid)) { // texture has not been generated
 		gen_surface();
 	}
-	else if (tsize0 != tsize) { // new texture size
-		::free_texture(tid); // delete old texture
-	}
-	else {
+	else if (tsize0 == tsize) {
 		return; // nothing to do
 	}
-	create_rocky_texture(tsize0); // new texture
+	create_rocky_texture(tsize0); // new texture size, or the full size texture may now be ready
 }
 
 
 void urev_body::create_rocky_texture(unsigned size) {
 
+	assert(size <= MAX_TEXTURE_SIZE);
+	assert(surface != nullptr);
+	surface_color_gen_t const cgen(get_color_gen());
+	float const mcut(max(water, lava));
+	surface_tex_key_t const key(rgen, size, cgen, mcut);
+	p_surface_tex_data data(surface_tex_cache.find(key));
+
+	if (data == nullptr) { // not cached
+		if (async_planet_textures && size > PLACEHOLDER_TSIZE) { // generate in the background
+			surface_tex_cache.request(key, this, *surface, cgen, mcut);
+			if (!glIsTexture(tid)) {create_rocky_texture(PLACEHOLDER_TSIZE);} // use a low resolution placeholder until it's ready
+			return; // else keep the current texture
+		}
+		data = surface_tex_cache.generate(key, *surface, cgen, mcut);
+	}
+	surface->setup(size, mcut, 1); // use_heightmap=1
+	assert(data->heightmap.size() == surface->heightmap.size() && data->tex_data.size() == 3*size*size);
+	surface->heightmap = data->heightmap;
+	surface->clear_draw_sphere(); // heightmap has changed
 	tsize = size;
-	assert(tsize <= MAX_TEXTURE_SIZE);
-	vector<unsigned char> data(3*tsize*tsize);
-	gen_texture_data_and_heightmap(&data.front(), tsize);
+	::free_texture(tid); // delete old texture, if any
 	setup_texture(tid, 0, 1, 0);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, tsize, tsize, 0, GL_RGB, GL_UNSIGNED_BYTE, &data.front());
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, tsize, tsize, 0, GL_RGB, GL_UNSIGNED_BYTE, data->tex_data.data());
+}
+
+
+surface_color_gen_t urev_body::get_color_gen() const {
+
+	surface_color_gen_t cgen;
+	get_colors(cgen.a, cgen.b);
+	cgen.temp        = temp;
+	cgen.water       = water;
+	cgen.lava        = lava;
+	cgen.atmos       = atmos;
+	cgen.snow_thresh = snow_thresh;
+	cgen.wr_scale    = 1.0/max(0.01, (1.0 - water));
+	return cgen;
 }
 
 
@@ -2136,7 +2165,7 @@ void urev_body::upload_colors_to_shader(shader_t &s) const {
 }
 
 
-void urev_body::get_surface_color(unsigned char *data, float val, float phi) const { // val in [0,1]
+void surface_color_gen_t::get_surface_color(unsigned char *data, float val, float phi) const { // val in [0,1]
 
 	bool const frozen(temp < FREEZE_TEMP);
 	unsigned char const white[3] = {255, 255, 255};
@@ -3361,6 +3390,7 @@ vector3d ustar::get_solar_wind_accel(point const &obj_pos, float obj_mass, float
 
 void urev_body::free_texture() { // and also free vbos
 
+	surface_tex_cache.cancel(this); // drop any pending background texture request
 	if (surface != nullptr) {surface->free_context();}
 	::free_texture(tid);
 	tsize = 0;
@@ -15,6 +15,10 @@
 #include "file_utils.h"
 #include "openal_wrap.h"
 #include <fstream>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <direct.h> // for _mkdir()
+#endif
 
 
 bool const MORE_COLL_TSTEPS       = 1; // slow
@@ -1197,6 +1201,30 @@ bool read_block_comment(FILE *fp) {
 	return 0; // never gets here
 }
 
+bool is_dir(string const &path) {
+	struct stat st;
+	return (stat(path.c_str(), &st) == 0 && (st.st_mode & S_IFDIR));
+}
+
+// creates dir and any missing parent dirs; returns true if dir exists on return; may be called concurrently for the same dir
+bool create_dir_if_needed(string const &dir) {
+
+	if (dir.empty() || is_dir(dir)) return 1;
+
+	for (size_t pos = dir.find_first_of("/\\", 1); ; pos = dir.find_first_of("/\\", pos+1)) {
+		string const path(dir.substr(0, pos));
+#ifdef _WIN32
+		_mkdir(path.c_str()); // ignore errors; the path may already exist or be a drive letter
+#else
+		mkdir(path.c_str(), 0755);
+#endif
+		if (pos == string::npos) break;
+	}
+	if (is_dir(dir)) return 1;
+	cerr << "Warning: Failed to create directory " << dir << endl;
+	return 0;
+}
+
 
 int read_coll_obj_file(const char *coll_obj_file, geom_xform_t xf, coll_obj cobj, bool has_layer, colorRGBA lcolor) {
 
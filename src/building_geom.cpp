@@ -2229,4 +2229,20 @@ void building_interior_t::finalize() {
 	remove_excess_cap(elevators);
 	for (unsigned d = 0; d < 2; ++d) {remove_excess_cap(walls[d]);}
 }
+void building_interior_t::copy_layout_from(building_interior_t const &src) { // everything but the room geom and nav graph, which are owned by src
+	floors      = src.floors;
+	ceilings    = src.ceilings;
+	for (unsigned d = 0; d < 2; ++d) {walls[d] = src.walls[d];}
+	stairwells  = src.stairwells;
+	doors       = src.doors;
+	door_stacks = src.door_stacks;
+	landings    = src.landings;
+	rooms       = src.rooms;
+	elevators   = src.elevators;
+	exclusion   = src.exclusion;
+	draw_range  = src.draw_range;
+	top_ceilings_mask  = src.top_ceilings_mask;
+	door_state_updated = src.door_state_updated;
+	is_unconnected     = src.is_unconnected;
+}
 
@@ -445,6 +445,7 @@ void building_t::toggle_door_state(unsigned door_ix, bool player_in_this_buildin
 	door.open ^= 1; // toggle open state
 	// we changed the door state, but navigation should adapt to this, except for doors on stairs (which are special)
 	if (door.on_stairs) {invalidate_nav_graph();} // any in-progress paths may have people walking to and stopping at closed/locked doors
+	else {invalidate_nav_graph_routes();} // cached room routes may pass through this door
 	interior->door_state_updated = 1; // required for AI navigation logic to adjust to this change
 	if (has_room_geom()) {interior->room_geom->mats_doors.clear();} // need to recreate doors VBO
 
@@ -0,0 +1,161 @@
+// 3D World - Building Layout Cache: saves generated building placement and geometry to disk so that it can be reloaded in place of regeneration
+
+#include "3DWorld.h"
+#include "function_registry.h"
+#include "buildings.h"
+#include "layout_cache.h"
+#include "file_utils.h"
+
+using std::string;
+using std::cerr;
+
+
+unsigned const LAYOUT_CACHE_MAGIC   = 0x42444C43; // "CLDB"
+unsigned const LAYOUT_CACHE_VERSION = 1; // increment when the file format or any serialized struct changes
+
+string building_layout_cache_dir; // if nonempty, generated building and city layouts are cached here
+
+
+bool layout_writer_t::write_file(string const &fn, char const *const desc) const {
+	if (!create_dir_if_needed(building_layout_cache_dir)) return 0;
+	string const tmp_fn(fn + ".tmp");
+	// write to a temp file and rename so that an interrupted write doesn't leave a partial cache file
+	FILE *fp(fopen(tmp_fn.c_str(), "wb"));
+	bool success(fp != nullptr);
+
+	if (success) {
+		success = (fwrite(buf.data(), 1, buf.size(), fp) == buf.size());
+		success &= (fclose(fp) == 0);
+	}
+	if (!success) {cerr << "Warning: Failed to write " << desc << " cache file " << tmp_fn << endl; remove(tmp_fn.c_str()); return 0;}
+	remove(fn.c_str()); // rename() fails on Windows if the destination exists
+	if (rename(tmp_fn.c_str(), fn.c_str()) != 0) {cerr << "Warning: Failed to rename " << desc << " cache file " << tmp_fn << endl; remove(tmp_fn.c_str()); return 0;}
+	return 1;
+}
+
+bool layout_reader_t::read_file(string const &fn) {
+	FILE *fp(fopen(fn.c_str(), "rb"));
+	if (fp == nullptr) return 0;
+	fseek(fp, 0, SEEK_END);
+	long const file_size(ftell(fp));
+	fseek(fp, 0, SEEK_SET);
+	bool success(file_size > 0);
+
+	if (success) {
+		buf.resize(file_size);
+		success = (fread(buf.data(), 1, buf.size(), fp) == buf.size());
+	}
+	fclose(fp);
+	return success;
+}
+bool layout_reader_t::header(unsigned magic, unsigned version, uint64_t key) {
+	unsigned file_magic(0), file_version(0);
+	uint64_t file_key(0);
+	pod(file_magic);
+	pod(file_version);
+	pod(file_key);
+	return (is_good() && file_magic == magic && file_version == version && file_key == key);
+}
+
+// returns the filename of the cache file for this key, or an empty string if caching is disabled
+string get_layout_cache_fn(string const &prefix, uint64_t key) {
+	if (building_layout_cache_dir.empty()) return string();
+	char hash_str[20] = {0};
+	sprintf(hash_str, "%016llx", (unsigned long long)key);
+	return building_layout_cache_dir + "/" + prefix + "_" + hash_str + ".bin";
+}
+
+
+// the same field list is used for both reading and writing so that they can't get out of sync;
+// room_geom, nav_graph, and draw ranges are created lazily at draw time and aren't saved
+template<typename S> void transfer_interior(S &s, building_interior_t &interior) {
+	s.vect(interior.floors);
+	s.vect(interior.ceilings);
+	s.vect(interior.walls[0]);
+	s.vect(interior.walls[1]);
+	s.vect(interior.stairwells);
+	s.vect(interior.doors);
+	s.vect(interior.door_stacks);
+	s.vect(interior.landings);
+	s.vect(interior.rooms);
+	s.vect(interior.elevators);
+	s.vect(interior.exclusion);
+	s.pod(interior.top_ceilings_mask);
+	s.pod(interior.door_state_updated);
+	s.pod(interior.is_unconnected);
+}
+template<typename S> void transfer_building(S &s, building_t &b) {
+	s.pod(static_cast<building_geom_t &>(b));
+	s.pod(b.mat_ix);
+	s.pod(b.hallway_dim);
+	s.pod(b.real_num_parts);
+	s.pod(b.roof_type);
+	s.pod(b.open_door_ix);
+	s.pod(b.basement_part_ix);
+	bool flags[8] = {b.is_house, b.has_chimney, b.has_garage, b.has_shed, b.has_courtyard, b.has_complex_floorplan, b.has_helipad, b.has_ac};
+	s.pod(flags);
+	b.is_house  = flags[0]; b.has_chimney = flags[1]; b.has_garage = flags[2]; b.has_shed = flags[3];
+	b.has_courtyard = flags[4]; b.has_complex_floorplan = flags[5]; b.has_helipad = flags[6]; b.has_ac = flags[7];
+	colorRGBA colors[5] = {b.side_color, b.roof_color, b.detail_color, b.door_color, b.wall_color};
+	s.pod(colors);
+	b.side_color = colors[0]; b.roof_color = colors[1]; b.detail_color = colors[2]; b.door_color = colors[3]; b.wall_color = colors[4];
+	s.pod(b.bcube);
+	s.pod(b.pri_hall);
+	s.pod(b.driveway);
+	s.vect(b.parts);
+	s.vect(b.fences);
+	s.vect(b.details);
+	s.vect(b.roof_tquads);
+	s.vect(b.doors);
+	s.pod(b.tree_pos);
+	s.pod(b.ao_bcz2);
+	s.pod(b.ground_floor_z1);
+	bool has_interior(b.has_interior());
+	s.pod(has_interior);
+	if (!has_interior) return;
+	if (!b.interior) {b.interior.reset(new building_interior_t);}
+	transfer_interior(s, *b.interior);
+}
+
+
+bool building_layout_cache_t::write(string const &fn, uint64_t key, vector<building_t> const &buildings) const {
+	layout_writer_t w;
+	w.header(LAYOUT_CACHE_MAGIC, LAYOUT_CACHE_VERSION, key);
+	w.pod(rseed1);
+	w.pod(rseed2);
+	w.pod(num_skip);
+	w.vect(place_bcubes);
+	w.pod(unsigned(bix_by_plot.size()));
+	for (auto i = bix_by_plot.begin(); i != bix_by_plot.end(); ++i) {w.vect(*i);}
+	w.pod(unsigned(buildings.size()));
+	// Note: transfer_building() takes a non-const reference so that it can be shared with the reader, but the writer never modifies it
+	for (auto b = buildings.begin(); b != buildings.end(); ++b) {transfer_building(w, const_cast<building_t &>(*b));}
+	return w.write_file(fn, "building layout");
+}
+
+bool building_layout_cache_t::read(string const &fn, uint64_t key, vector<building_t> &buildings) {
+	layout_reader_t r;
+	if (!r.read_file(fn)) return 0; // not yet cached
+	if (!r.header(LAYOUT_CACHE_MAGIC, LAYOUT_CACHE_VERSION, key)) return 0; // stale, let the caller overwrite it
+	unsigned num_plots(0), num_buildings(0);
+	r.pod(rseed1);
+	r.pod(rseed2);
+	r.pod(num_skip);
+	r.vect(place_bcubes);
+	r.pod(num_plots);
+	if (!r.is_good()) return 0;
+	bix_by_plot.resize(num_plots);
+	for (auto i = bix_by_plot.begin(); i != bix_by_plot.end() && r.is_good(); ++i) {r.vect(*i);}
+	r.pod(num_buildings);
+	if (!r.is_good() || num_buildings != place_bcubes.size()) return 0;
+	buildings.resize(num_buildings);
+	for (auto b = buildings.begin(); b != buildings.end() && r.is_good(); ++b) {transfer_building(r, *b);}
+
+	if (!r.is_good() || !r.at_end()) {
+		cerr << "Warning: Ignoring invalid building layout cache file " << fn << endl;
+		buildings.clear();
+		return 0;
+	}
+	return 1;
+}
+
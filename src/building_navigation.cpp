@@ -6,15 +6,30 @@
 #include "buildings.h"
 #include "city.h" // for pedestrian_t
 #include <queue>
+#include <cfloat> // for FLT_MAX
 
 
 bool const STAY_ON_ONE_FLOOR  = 0;
+bool const PRINT_ROUTE_STATS  = 0; // print route cache hit rate every 1000 frames
 float const COLL_RADIUS_SCALE = 0.75; // somewhat smaller than radius, but larger than PED_WIDTH_SCALE
 float const RETREAT_TIME      = 4.0f*TICKS_PER_SECOND; // 4s
+unsigned const NUM_NAV_LANDMARKS   = 8; // for the ALT A* heuristic
+unsigned const MAX_CACHED_ROUTES   = 4096; // per building nav graph
 
 int cpbl_update_frame(0);
 building_dest_t cur_player_building_loc, prev_player_building_loc;
 
+struct nav_route_stats_t { // across all buildings; only updated by the AI thread
+	unsigned num_queries, num_hits, num_searches, num_expanded;
+	nav_route_stats_t() : num_queries(0), num_hits(0), num_searches(0), num_expanded(0) {}
+
+	void print() const {
+		cout << "Building AI routes: " << num_queries << " queries, " << num_hits << " cache hits (" << 100.0*num_hits/max(num_queries, 1U) << "%), "
+			 << num_searches << " searches, " << float(num_expanded)/max(num_searches, 1U) << " nodes expanded per search" << endl;
+	}
+};
+nav_route_stats_t nav_route_stats;
+
 extern bool player_is_hiding;
 extern int frame_counter, display_mode, animate2;
 extern float fticks;
@@ -57,10 +72,30 @@ class building_nav_graph_t {
 		float g_score, h_score, f_score;
 		a_star_node_state_t() : came_from_ix(-1), g_score(0), h_score(0), f_score(0) {}
 	};
+	struct route_key_t { // room graph routes depend on door state per floor (zval), and on whether the person can get through locked doors
+		unsigned room1, room2;
+		float zval;
+		bool use_stairs, up_or_down, has_key;
+		route_key_t(unsigned r1, unsigned r2, float z, bool us, bool ud, bool hk) : room1(r1), room2(r2), zval(z), use_stairs(us), up_or_down(ud), has_key(hk) {}
+		bool operator<(route_key_t const &k) const {
+			if (room1 != k.room1) return (room1 < k.room1);
+			if (room2 != k.room2) return (room2 < k.room2);
+			if (zval  != k.zval ) return (zval  < k.zval );
+			return ((4*use_stairs + 2*up_or_down + has_key) < (4*k.use_stairs + 2*k.up_or_down + k.has_key));
+		}
+	};
+	struct cached_route_t {
+		unsigned door_state_ver;
+		vector<pair<unsigned, a_star_node_state_t>> states; // {node, state} from room2 back to room1; empty if there is no route
+		cached_route_t() : door_state_ver(0) {}
+	};
 
-	unsigned num_rooms, num_stairs;
+	unsigned num_rooms, num_stairs, door_state_ver;
 	float stairs_extend;
 	vector<node_t> nodes;
+	// lazily built search acceleration; mutable because it's created and used by const path finding queries, which are only called from the AI thread
+	mutable vector<float> landmark_dists[2]; // ALT lower bounds: graph distance from each landmark to each node, for {up, down} stairs entrances
+	mutable std::map<route_key_t, cached_route_t> route_cache;
 	node_t       &get_node(unsigned room)       {assert(room < nodes.size()); return nodes[room];}
 	node_t const &get_node(unsigned room) const {assert(room < nodes.size()); return nodes[room];}
 
@@ -74,7 +109,8 @@ class building_nav_graph_t {
 	}
 public:
 	bool invalid;
-	building_nav_graph_t(float stairs_extend_) : num_rooms(0), num_stairs(0), stairs_extend(stairs_extend_), invalid(0) {}
+	building_nav_graph_t(float stairs_extend_) : num_rooms(0), num_stairs(0), door_state_ver(1), stairs_extend(stairs_extend_), invalid(0) {}
+	void on_door_state_change() {++door_state_ver;} // invalidates all cached routes
 
 	void set_num_rooms(unsigned num_rooms_, unsigned num_stairs_) {
 		num_rooms  = num_rooms_;
@@ -166,6 +202,57 @@ public:
 	}
 	bool is_fully_connected() const {return (count_connected_components() == 1);}
 
+	// Dijkstra's algorithm over all connections, ignoring doors and the use_stairs restriction, so that distances are lower bounds for any path query
+	void calc_graph_dists(unsigned src, bool up_or_down, float *dists) const {
+		std::fill(dists, dists+nodes.size(), FLT_MAX);
+		std::priority_queue<pair<float, unsigned> > pend;
+		dists[src] = 0.0;
+		pend.push(make_pair(-0.0f, src));
+
+		while (!pend.empty()) {
+			float const dist(-pend.top().first);
+			unsigned const cur(pend.top().second);
+			pend.pop();
+			if (dist > dists[cur]) continue; // already found a shorter path
+			node_t const &node(get_node(cur));
+			point const center(node.get_center(0.0));
+
+			for (auto i = node.conn_rooms.begin(); i != node.conn_rooms.end(); ++i) {
+				vector2d const &pt(i->pt[up_or_down]);
+				float const new_dist(dist + p2p_dist_xy(center, pt) + p2p_dist_xy(pt, get_node(i->ix).get_center(0.0))); // same cost as in find_path_points()
+				if (new_dist < dists[i->ix]) {dists[i->ix] = new_dist; pend.push(make_pair(-new_dist, i->ix));}
+			}
+		} // end while()
+	}
+	void build_landmarks() const { // choose landmarks with farthest point selection, which also places one landmark in each connected component
+		unsigned const num_nodes(nodes.size()), num_landmarks(min(NUM_NAV_LANDMARKS, num_nodes));
+		vector<float> min_dist(num_nodes, FLT_MAX);
+		unsigned next(0);
+		for (unsigned d = 0; d < 2; ++d) {landmark_dists[d].resize(num_landmarks*num_nodes);}
+
+		for (unsigned l = 0; l < num_landmarks; ++l) {
+			for (unsigned d = 0; d < 2; ++d) {calc_graph_dists(next, d, &landmark_dists[d][l*num_nodes]);}
+			float const *const dists(&landmark_dists[0][l*num_nodes]);
+			float dmax(-1.0);
+
+			for (unsigned n = 0; n < num_nodes; ++n) {
+				min_eq(min_dist[n], dists[n]);
+				if (min_dist[n] > dmax) {dmax = min_dist[n]; next = n;}
+			}
+		} // for l
+	}
+	float get_heuristic(unsigned node_ix, unsigned goal, point const &center, point const &dest_pos, bool up_or_down) const {
+		float h(p2p_dist_xy(center, dest_pos)); // straight line distance
+		unsigned const num_nodes(nodes.size());
+		vector<float> const &dists(landmark_dists[up_or_down]);
+
+		for (unsigned l = 0; l < dists.size(); l += num_nodes) { // ALT: |d(L, goal) - d(L, node)| <= d(node, goal) by the triangle inequality
+			float const dn(dists[l + node_ix]), dg(dists[l + goal]);
+			if (dn < FLT_MAX && dg < FLT_MAX) {max_eq(h, fabs(dg - dn));}
+		}
+		return h;
+	}
+
 	static bool is_valid_pos(vect_cube_t const &avoid, point const &pos, float radius, float height) { // Note: assumes zvals are already checked
 		cube_t c(pos, pos);
 		c.expand_by_xy(radius);
@@ -418,12 +505,27 @@ public:
 		assert(room1 != room2);
 		path.clear();
 		vector<a_star_node_state_t> state(nodes.size());
+		// the room graph route only depends on the query and door state, so it can be reused; the path through each room is always recomputed for this person
+		if (route_cache.size() >= MAX_CACHED_ROUTES) {route_cache.clear();} // simple way to limit memory usage
+		cached_route_t &route(route_cache[route_key_t(room1, room2, cur_pt.z, use_stairs, up_or_down, has_key)]);
+		++nav_route_stats.num_queries;
+
+		if (route.door_state_ver == door_state_ver) { // cache hit
+			++nav_route_stats.num_hits;
+			if (route.states.empty()) return 0; // no path
+			for (auto i = route.states.begin(); i != route.states.end(); ++i) {state[i->first] = i->second;}
+			return reconstruct_path(state, avoid, cur_pt, radius, height, room2, room1, ped_ix, is_first_path, up_or_down, ped_rseed, path);
+		}
+		route.door_state_ver = door_state_ver;
+		route.states.clear();
+		++nav_route_stats.num_searches;
+		if (landmark_dists[0].empty()) {build_landmarks();}
 		vector<uint8_t> open(nodes.size(), 0), closed(nodes.size(), 0); // tentative/already evaluated nodes
 		std::priority_queue<pair<float, unsigned> > open_queue;
 		point const dest_pos(get_node(room2).get_center(cur_pt.z)); // Note: approximate, actual dest may be different
 		a_star_node_state_t &start(state[room1]);
 		start.g_score = 0.0;
-		start.h_score = start.f_score = p2p_dist_xy(get_node(room1).get_center(cur_pt.z), dest_pos); // estimated total cost from start to goal through current
+		start.h_score = start.f_score = get_heuristic(room1, room2, get_node(room1).get_center(cur_pt.z), dest_pos, up_or_down); // estimated total cost from start to goal
 		open[room1]   = 1;
 		open_queue.push(make_pair(-start.f_score, room1));
 
@@ -436,6 +538,7 @@ public:
 			assert(!closed[cur]);
 			closed[cur] = 1;
 			open[cur]   = 0;
+			++nav_route_stats.num_expanded;
 
 			for (auto i = cur_node.conn_rooms.begin(); i != cur_node.conn_rooms.end(); ++i) {
 				assert(i->ix < nodes.size());
@@ -453,10 +556,11 @@ public:
 				sn.path_pt.assign(pt.x, pt.y, cur_pt.z);
 				
 				if (i->ix == room2) { // done, reconstruct path (in reverse)
+					for (int n = room2; n >= 0; n = state[n].came_from_ix) {route.states.emplace_back(n, state[n]);} // cache the route, ending at room1
 					return reconstruct_path(state, avoid, cur_pt, radius, height, i->ix, room1, ped_ix, is_first_path, up_or_down, ped_rseed, path);
 				}
 				sn.g_score = new_g_score;
-				sn.h_score = p2p_dist_xy(conn_center, dest_pos);
+				sn.h_score = get_heuristic(i->ix, room2, conn_center, dest_pos, up_or_down);
 				sn.f_score = sn.g_score + sn.h_score;
 				open_queue.push(make_pair(-sn.f_score, i->ix));
 			} // for i
@@ -529,6 +633,9 @@ void building_t::build_nav_graph() const { // Note: does not depend on room geom
 void building_t::invalidate_nav_graph() { // Note: this is safe to call in one thread while using in another
 	if (interior && interior->nav_graph) {interior->nav_graph->invalid = 1;}
 }
+void building_t::invalidate_nav_graph_routes() { // called when a door is opened, closed, or unlocked; cheaper than invalidating the graph
+	if (interior && interior->nav_graph) {interior->nav_graph->on_door_state_change();}
+}
 
 unsigned building_t::count_connected_room_components() {
 	if (!interior) return 0;
@@ -1191,6 +1298,7 @@ void vect_building_t::ai_room_update(vector<building_ai_state_t> &ai_state, vect
 		assert(bix < size());
 		operator[](bix).ai_room_update(ai_state[i], rgen, people, delta_dir, i, STAY_ON_ONE_FLOOR); // dispatch to the correct building
 	}
+	if (PRINT_ROUTE_STATS && (frame_counter % 1000) == 0) {nav_route_stats.print();}
 }
 
 int building_t::get_room_containing_pt(point const &pt) const {
@@ -6,6 +6,7 @@
 #include "buildings.h"
 #include "scenery.h" // for s_plant
 #include "shaders.h"
+#include <mutex>
 
 bool const ADD_BOOK_COVERS = 1;
 bool const ADD_BOOK_TITLES = 1;
@@ -1886,11 +1887,13 @@ void building_room_geom_t::add_cubicle(room_object_t const &c, float tscale) {
 	surf_mat.add_cube_to_verts(surf3, surf_color, tex_origin, get_skip_mask_for_xy(!c.dim));
 }
 
-class sign_helper_t {
+class sign_helper_t { // text is registered during room geom generation, which may run in a background thread
 	map<string, unsigned> txt_to_id;
-	vector<string> text;
+	deque<string> text; // deque so that references returned by get_text() stay valid when text is added
+	std::mutex text_mutex;
 public:
 	unsigned register_text(string const &t) {
+		std::lock_guard<std::mutex> lock(text_mutex);
 		auto it(txt_to_id.find(t));
 		if (it != txt_to_id.end()) return it->second; // found
 		unsigned const id(text.size());
@@ -1899,7 +1902,8 @@ public:
 		assert(text.size() == txt_to_id.size());
 		return id;
 	}
-	string const &get_text(unsigned id) const {
+	string const &get_text(unsigned id) {
+		std::lock_guard<std::mutex> lock(text_mutex);
 		assert(id < text.size());
 		return text[id];
 	}
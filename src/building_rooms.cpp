@@ -144,7 +144,7 @@ vect_door_stack_t &building_t::get_doorways_for_room(room_t const &room, float z
 	cube_t room_exp(room);
 	room_exp.expand_by_xy(get_wall_thickness());
 	set_cube_zvals(room_exp, (zval + floor_thickness), (zval + get_window_vspace() - floor_thickness)); // clip to z-range of this floor
-	static vect_door_stack_t doorways; // reuse across rooms
+	thread_local vect_door_stack_t doorways; // reuse across rooms; thread_local because room geom can be generated in a background thread
 	doorways.clear();
 
 	for (auto i = interior->door_stacks.begin(); i != interior->door_stacks.end(); ++i) {
@@ -1164,7 +1164,7 @@ bool building_t::add_kitchen_objs(rand_gen_t rgen, room_t const &room, float zva
 		cube_t c;
 		set_cube_zvals(c, zval, zval+height);
 		set_cube_zvals(cabinet_area, zval, zval+vspace-get_floor_thickness());
-		static vect_cube_t blockers;
+		thread_local vect_cube_t blockers;
 		int const table_blocker_ix(gather_room_placement_blockers(cabinet_area, objs_start, blockers, 1, 1)); // inc_open_doors=1, ignore_chairs=1
 		bool is_sink(1), placed_mwave(0);
 
@@ -1869,6 +1869,17 @@ bool has_bcube_int_stairs_exp(cube_t const &bcube, vect_stairwell_t const &stair
 	return 0;
 }
 
+// lazily initialized state shared by all room geom generation; must be called on the main thread before room geom is generated in a background thread
+void setup_room_geom_gen_state() {
+	setup_bldg_obj_types();
+	building_obj_model_loader.ensure_models_loaded();
+}
+
+void building_t::gen_room_details(vect_cube_t const &ped_bcubes, unsigned building_ix) {
+	rand_gen_t rgen;
+	rgen.set_state(building_ix, parts.size()); // set to something canonical per building
+	gen_room_details(rgen, ped_bcubes, building_ix);
+}
 // Note: these three floats can be calculated from get_window_vspace(), but it's easier to change the constants if we just pass them in
 void building_t::gen_room_details(rand_gen_t &rgen, vect_cube_t const &ped_bcubes, unsigned building_ix) {
 
@@ -2410,7 +2421,7 @@ void building_t::add_wall_and_door_trim() { // and window trim
 	// Note: depth must be small to avoid object intersections; this applies to the windowsill as well
 	float const window_trim_width(0.75*wall_thickness), window_trim_depth(0.1*wall_thickness), windowsill_depth(0.1*wall_thickness);
 	float const window_offset(0.01*window_vspacing); // must match building_draw_t::add_section()
-	static vect_vnctcc_t wall_quad_verts;
+	thread_local vect_vnctcc_t wall_quad_verts;
 	wall_quad_verts.clear();
 	get_all_drawn_window_verts_as_quads(wall_quad_verts);
 	assert((wall_quad_verts.size() & 3) == 0); // must be a multiple of 4
@@ -2824,20 +2835,21 @@ void building_t::draw_room_geom(shader_t &s, occlusion_checker_noncity_t &oc, ve
 	if (ENABLE_MIRROR_REFLECTIONS && !shadow_only && !reflection_pass && player_in_building) {find_mirror_needing_reflection(xlate);}
 	interior->room_geom->draw(s, *this, oc, xlate, building_ix, shadow_only, reflection_pass, inc_small, player_in_building);
 }
+bool building_t::gen_room_geom_if_needed(vect_cube_t &ped_bcubes, unsigned building_ix, int ped_ix) { // returns true if room geom was generated
+	if (!interior || has_room_geom()) return 0;
+	if (!global_building_params.enable_rotated_room_geom && is_rotated()) return 0; // rotated buildings: need to fix texture coords, room object collision detection, mirrors, etc.
+	ped_bcubes.clear();
+	if (ped_ix >= 0) {get_ped_bcubes_for_building(ped_ix, building_ix, ped_bcubes);}
+	gen_room_details(ped_bcubes, building_ix);
+	assert(has_room_geom());
+	return 1;
+}
 void building_t::gen_and_draw_room_geom(shader_t &s, occlusion_checker_noncity_t &oc, vector3d const &xlate, vect_cube_t &ped_bcubes,
 	unsigned building_ix, int ped_ix, bool shadow_only, bool reflection_pass, bool inc_small, bool player_in_building)
 {
 	if (!interior) return;
 	if (!global_building_params.enable_rotated_room_geom && is_rotated()) return; // rotated buildings: need to fix texture coords, room object collision detection, mirrors, etc.
-
-	if (!has_room_geom()) {
-		rand_gen_t rgen;
-		rgen.set_state(building_ix, parts.size()); // set to something canonical per building
-		ped_bcubes.clear();
-		if (ped_ix >= 0) {get_ped_bcubes_for_building(ped_ix, building_ix, ped_bcubes);}
-		gen_room_details(rgen, ped_bcubes, building_ix); // generate so that we can draw it
-		assert(has_room_geom());
-	}
+	gen_room_geom_if_needed(ped_bcubes, building_ix, ped_ix); // generate so that we can draw it
 	draw_room_geom(s, oc, xlate, building_ix, shadow_only, reflection_pass, inc_small, player_in_building);
 }
 
@@ -14,6 +14,7 @@ unsigned const MAX_CYLIN_SIDES     = 36;
 unsigned const MAX_DRAW_BLOCKS     = 8; // for building interiors only; currently have floor, ceiling, walls, and doors
 unsigned const NUM_STAIRS_PER_FLOOR= 12;
 unsigned const NUM_STAIRS_PER_FLOOR_U = 16;
+unsigned const BUILDING_GEN_VERSION = 1; // increment when building placement or geometry generation changes so that stale layout cache files are regenerated
 float const FLOOR_THICK_VAL_HOUSE  = 0.10; // 10% of floor spacing
 float const FLOOR_THICK_VAL_OFFICE = 0.11; // thicker for office buildings
 float const WALL_THICK_VAL         = 0.05; // 5% of floor spacing
@@ -186,8 +187,8 @@ struct building_mat_t : public building_tex_params_t {
 struct building_params_t {
 
 	bool flatten_mesh, has_normal_map, tex_mirror, tex_inv_y, tt_only, infinite_buildings, dome_roof, onion_roof, enable_people_ai;
-	bool gen_building_interiors, add_city_interiors, enable_rotated_room_geom, add_secondary_buildings;
-	unsigned num_place, num_tries, cur_prob, max_shadow_maps, buildings_rand_seed;
+	bool gen_building_interiors, add_city_interiors, enable_rotated_room_geom, add_secondary_buildings, parallel_placement, prefetch_room_geom, print_gen_times;
+	unsigned num_place, num_tries, cur_prob, max_shadow_maps, buildings_rand_seed, room_geom_cache_mb;
 	float ao_factor, sec_extra_spacing, player_coll_radius_scale, interior_view_dist_scale;
 	float window_width, window_height, window_xspace, window_yspace; // windows
 	float wall_split_thresh, max_fp_wind_xscale, max_fp_wind_yscale, open_door_prob, locked_door_prob, basement_prob, ball_prob; // interiors
@@ -208,7 +209,7 @@ struct building_params_t {
 
 	building_params_t(unsigned num=0) : flatten_mesh(0), has_normal_map(0), tex_mirror(0), tex_inv_y(0), tt_only(0), infinite_buildings(0), dome_roof(0),
 		onion_roof(0), enable_people_ai(0), gen_building_interiors(1), add_city_interiors(0), enable_rotated_room_geom(0), add_secondary_buildings(0),
-		num_place(num), num_tries(10), cur_prob(1), max_shadow_maps(32), buildings_rand_seed(0), ao_factor(0.0), sec_extra_spacing(0.0), player_coll_radius_scale(1.0),
+		parallel_placement(0), prefetch_room_geom(0), print_gen_times(0), num_place(num), num_tries(10), cur_prob(1), max_shadow_maps(32), buildings_rand_seed(0), room_geom_cache_mb(0), ao_factor(0.0), sec_extra_spacing(0.0), player_coll_radius_scale(1.0),
 		interior_view_dist_scale(1.0), window_width(0.0), window_height(0.0), window_xspace(0.0), window_yspace(0.0), wall_split_thresh(4.0), max_fp_wind_xscale(0.0),
 		max_fp_wind_yscale(0.0), open_door_prob(1.0), locked_door_prob(0.0), basement_prob(0.5), ball_prob(0.3),
 		ai_target_player(1), ai_follow_player(0), ai_opens_doors(1), ai_player_vis_test(0), player_weight_limit(100.0), range_translate(zero_vector) {}
@@ -486,6 +487,7 @@ struct building_room_geom_t {
 
 	bool has_elevators, has_pictures, lights_changed, materials_invalid, modified_by_player;
 	unsigned char num_pic_tids;
+	int last_draw_frame; // used to free the room geom of the least recently drawn buildings
 	float obj_scale;
 	unsigned buttons_start, stairs_start; // index of first object of {TYPE_BUTTON, TYPE_STAIR}
 	point tex_origin;
@@ -498,7 +500,7 @@ struct building_room_geom_t {
 	vect_cube_t light_bcubes;
 
 	building_room_geom_t(point const &tex_origin_=all_zeros) : has_elevators(0), has_pictures(0), lights_changed(0), materials_invalid(0), modified_by_player(0),
-		num_pic_tids(0), obj_scale(1.0), buttons_start(0), stairs_start(0), tex_origin(tex_origin_), wood_color(WHITE) {}
+		num_pic_tids(0), last_draw_frame(0), obj_scale(1.0), buttons_start(0), stairs_start(0), tex_origin(tex_origin_), wood_color(WHITE) {}
 	bool empty() const {return objs.empty();}
 	void clear();
 	void clear_materials();
@@ -507,6 +509,7 @@ struct building_room_geom_t {
 	void clear_and_recreate_lights() {lights_changed = 1;} // cache the state and apply the change later in case this is called from a different thread
 	unsigned get_num_verts() const {return (mats_static.count_all_verts() + mats_small.count_all_verts() + mats_dynamic.count_all_verts() +
 		mats_lights.count_all_verts() + mats_plants.count_all_verts() + mats_alpha.count_all_verts() + mats_doors.count_all_verts());}
+	size_t get_mem_usage() const {return ((objs.capacity() + expanded_objs.capacity())*sizeof(room_object_t) + get_num_verts()*sizeof(rgeom_mat_t::vertex_t));} // approximate
 	rgeom_mat_t &get_material(tid_nm_pair_t const &tex, bool inc_shadows=0, bool dynamic=0, bool small=0, bool transparent=0);
 	rgeom_mat_t &get_untextured_material(bool inc_shadows=0, bool dynamic=0, bool small=0, bool transparent=0) {
 		return get_material(tid_nm_pair_t(-1, 1.0, inc_shadows), inc_shadows, dynamic, small, transparent);
@@ -744,6 +747,7 @@ struct building_interior_t {
 	bool is_blocked_by_stairs_or_elevator(cube_t const &c, float dmin=0.0f, bool elevators_only=0) const;
 	bool is_blocked_by_stairs_or_elevator_no_expand(cube_t const &c, float dmin=0.0f) const;
 	void finalize();
+	void copy_layout_from(building_interior_t const &src);
 	bool update_elevators(building_t const &building, point const &player_pos);
 	bool check_sphere_coll(building_t const &building, point &pos, point const &p_last, float radius,
 		vector<room_object_t>::const_iterator self, vector3d &cnorm, float &hardness, int &obj_ix) const;
@@ -885,6 +889,7 @@ struct building_t : public building_geom_t {
 		unsigned rooms_start, bool use_hallway, bool first_part_this_stack, float window_hspacing[2], float window_border);
 	void connect_stacked_parts_with_stairs(rand_gen_t &rgen, cube_t const &part);
 	void gen_room_details(rand_gen_t &rgen, vect_cube_t const &ped_bcubes, unsigned building_ix);
+	void gen_room_details(vect_cube_t const &ped_bcubes, unsigned building_ix);
 	void add_stairs_and_elevators(rand_gen_t &rgen);
 	void add_sign_by_door(tquad_with_ix_t const &door, bool outside, std::string const &text, colorRGBA const &color, bool emissive);
 	void add_exterior_door_signs(rand_gen_t &rgen);
@@ -918,6 +923,7 @@ struct building_t : public building_geom_t {
 	bool check_for_wall_ceil_floor_int(point const &p1, point const &p2) const;
 	bool maybe_use_last_pickup_room_object(point const &player_pos);
 	void draw_room_geom(shader_t &s, occlusion_checker_noncity_t &oc, vector3d const &xlate, unsigned building_ix, bool shadow_only, bool reflection_pass, bool inc_small, bool player_in_building);
+	bool gen_room_geom_if_needed(vect_cube_t &ped_bcubes, unsigned building_ix, int ped_ix);
 	void gen_and_draw_room_geom(shader_t &s, occlusion_checker_noncity_t &oc, vector3d const &xlate, vect_cube_t &ped_bcubes,
 		unsigned building_ix, int ped_ix, bool shadow_only, bool reflection_pass, bool inc_small, bool player_in_building);
 	void add_split_roof_shadow_quads(building_draw_t &bdraw) const;
@@ -957,6 +963,7 @@ struct building_t : public building_geom_t {
 	tquad_with_ix_t set_door_from_cube(cube_t const &c, bool dim, bool dir, unsigned type, float pos_adj,
 		bool exterior, bool opened, bool opens_out, bool opens_up, bool swap_sides) const;
 	void invalidate_nav_graph();
+	void invalidate_nav_graph_routes();
 	point local_to_camera_space(point const &pos) const;
 	void play_door_open_close_sound(point const &pos, bool open, float gain=1.0, float pitch=1.0) const;
 private:
@@ -1185,6 +1192,7 @@ int get_bath_wind_tid ();
 int get_int_door_tid  ();
 int get_normal_map_for_bldg_tid(int tid);
 unsigned register_sign_text(std::string const &text);
+void setup_room_geom_gen_state();
 void setup_building_draw_shader(shader_t &s, float min_alpha, bool enable_indir, bool force_tsl, bool use_texgen);
 void rotate_verts(vector<rgeom_mat_t::vertex_t> &verts, building_t const &building);
 void add_tquad_to_verts(building_geom_t const &bg, tquad_with_ix_t const &tquad, cube_t const &bcube, tid_nm_pair_t const &tex,
@@ -1193,6 +1201,17 @@ void get_driveway_sphere_coll_cubes(point const &pos, float radius, bool xy_only
 bool have_paint_for_building(bool exterior);
 void draw_building_interior_paint(unsigned int_ext_mask, building_t const *const building);
 void draw_building_interior_decals(building_t const *const building);
+// functions and classes in building_layout_cache.cpp
+struct building_layout_cache_t { // state from building_creator_t::gen() that's saved to disk so that placement and geometry generation can be skipped
+	long rseed1, rseed2; // placement random number generator state, used for later tree placement
+	unsigned num_skip;
+	vect_cube_t place_bcubes; // building bcubes as placed, before zval adjustment; used to rebuild the grid and reflatten the mesh
+	vector<vector<unsigned>> bix_by_plot;
+
+	building_layout_cache_t() : rseed1(0), rseed2(0), num_skip(0) {}
+	bool read (std::string const &fn, uint64_t key, vector<building_t> &buildings);
+	bool write(std::string const &fn, uint64_t key, vector<building_t> const &buildings) const;
+};
 // functions in city_gen.cc
 void city_shader_setup(shader_t &s, cube_t const &lights_bcube, bool use_dlights, int use_smap, int use_bmap,
 	float min_alpha=0.0, bool force_tsl=0, float pcf_scale=1.0, bool use_texgen=0, bool indir_lighting=0);
@@ -8,6 +8,7 @@
 #include "lightmap.h" // for light_source
 #include "profiler.h"
 #include <cfloat> // for FLT_MAX
+#include <queue>
 
 bool const DYNAMIC_HELICOPTERS = 1;
 float const MIN_CAR_STOP_SEP   = 0.25; // in units of car lengths
@@ -20,7 +21,16 @@ extern vector<light_source> dl_sources;
 extern city_params_t city_params;
 
 
-float car_t::get_max_lookahead_dist() const {return (get_length() + city_params.road_width);} // extend one car length + one road width in front
+// shared by the car_t and car_soa_t code paths so that they produce identical results
+float get_max_lookahead_dist(float length) {return (length + city_params.road_width);} // extend one car length + one road width in front
+
+float get_min_sep_dist(float len1, float len2, float speed1, float speed2, float max_speed1, bool add_one_car_len) {
+	float const avg_len(0.5f*(len1 + len2)); // average length of the two cars
+	float const min_speed(max(0.0f, (min(speed1, speed2) - 0.1f*max_speed1))); // relative to max speed of 1.0, clamped to 10% at bottom end for stability
+	return avg_len*(MIN_CAR_STOP_SEP + 1.11*min_speed + (add_one_car_len ? 1.0 : 0.0)); // 25% to 125% car length, depending on speed (2x on connector roads)
+}
+
+float car_t::get_max_lookahead_dist() const {return ::get_max_lookahead_dist(get_length());}
 float car_t::get_turn_rot_z(float dist_to_turn) const {return (1.0 - CLIP_TO_01(4.0f*fabs(dist_to_turn)/city_params.road_width));}
 
 bool car_t::headlights_on() const { // no headlights when parked
@@ -57,9 +67,7 @@ void car_t::destroy() { // Note: not calling create_explosion(), so no chain rea
 }
 
 float car_t::get_min_sep_dist_to_car(car_t const &c, bool add_one_car_len) const {
-	float const avg_len(0.5f*(get_length() + c.get_length())); // average length of the two cars
-	float const min_speed(max(0.0f, (min(cur_speed, c.cur_speed) - 0.1f*max_speed))); // relative to max speed of 1.0, clamped to 10% at bottom end for stability
-	return avg_len*(MIN_CAR_STOP_SEP + 1.11*min_speed + (add_one_car_len ? 1.0 : 0.0)); // 25% to 125% car length, depending on speed (2x on connector roads)
+	return get_min_sep_dist(get_length(), c.get_length(), cur_speed, c.cur_speed, max_speed, add_one_car_len);
 }
 
 string car_t::str() const {
@@ -115,7 +123,9 @@ bool car_t::front_intersects_car(car_t const &c) const {
 
 void car_t::honk_horn_if_close() const {
 	point const pos(get_center());
-	if (dist_less_than((pos + get_tiled_terrain_model_xlate()), get_camera_pos(), 1.0)) {gen_sound(SOUND_HORN, pos);}
+	if (!dist_less_than((pos + get_tiled_terrain_model_xlate()), get_camera_pos(), 1.0)) return;
+#pragma omp critical(gen_sound) // may be called from parallel car updates
+	gen_sound(SOUND_HORN, pos);
 }
 
 void car_t::honk_horn_if_close_and_fast() const {
@@ -469,6 +479,56 @@ void car_manager_t::init_cars(unsigned num) {
 	cars.reserve(num);
 	for (unsigned n = 0; n < num; ++n) {add_car();}
 	cout << "Dynamic Cars: " << cars.size() << endl;
+	if (city_params.benchmark_car_frames > 0) {run_car_update_benchmark(city_params.benchmark_car_frames);}
+}
+
+bool same_car_state(car_t const &a, car_t const &b) {
+	return (a.bcube == b.bcube && a.prev_bcube == b.prev_bcube && a.cur_speed == b.cur_speed && a.turn_val == b.turn_val && a.waiting_pos == b.waiting_pos &&
+		a.cur_city == b.cur_city && a.cur_road == b.cur_road && a.cur_seg == b.cur_seg && a.cur_road_type == b.cur_road_type && a.turn_dir == b.turn_dir &&
+		a.stopped_at_light == b.stopped_at_light && a.entering_city == b.entering_city && a.dest_valid == b.dest_valid && a.dest_city == b.dest_city &&
+		a.dest_isec == b.dest_isec && a.front_car_turn_dir == b.front_car_turn_dir);
+}
+
+// steps the same set of cars with the serial and parallel update paths from the same car and road network state, and checks that the results are identical
+void car_manager_t::run_car_update_benchmark(unsigned num_frames) {
+	unsigned const NUM_BENCH_CARS = 100000;
+	vector<car_t> const orig_cars(cars);
+	rand_gen_t const orig_rgen(rgen);
+	float const orig_fticks(fticks);
+	road_traffic_state_t traffic_state;
+	save_traffic_state(traffic_state);
+	fticks = 1.0; // fixed timestep
+	cars.clear();
+	cars.reserve(NUM_BENCH_CARS);
+	for (unsigned n = 0; n < NUM_BENCH_CARS; ++n) {add_car();}
+	vector<car_t> const start_cars(cars);
+	rand_gen_t const start_rgen(rgen);
+	vector<car_t> results[2];
+	int times_ms[2] = {0, 0};
+
+	for (unsigned parallel = 0; parallel < 2; ++parallel) {
+		cars = start_cars;
+		rgen = start_rgen;
+		restore_traffic_state(traffic_state);
+		int const start_ms(GET_TIME_MS());
+
+		for (unsigned f = 0; f < num_frames; ++f) {
+			move_cars_and_check_colls(CAR_SPEED_SCALE*city_params.car_speed, parallel);
+			update_cars(parallel);
+		}
+		times_ms[parallel] = (GET_TIME_MS() - start_ms);
+		results[parallel].swap(cars);
+	} // for parallel
+	assert(results[0].size() == results[1].size()); // cars aren't added or removed
+	unsigned num_diff(0);
+	for (unsigned i = 0; i < results[0].size(); ++i) {num_diff += !same_car_state(results[0][i], results[1][i]);} // both paths sort cars the same way
+	cout << "Car update benchmark: " << start_cars.size() << " cars, " << num_frames << " frames: serial " << times_ms[0] << "ms, parallel " << times_ms[1]
+		 << "ms; " << num_diff << " cars differ" << endl;
+	assert(num_diff == 0); // parallel results must be identical to serial
+	cars  = orig_cars;
+	rgen  = orig_rgen;
+	fticks = orig_fticks;
+	restore_traffic_state(traffic_state);
 }
 
 void car_manager_t::add_parked_cars(vector<car_t> const &new_cars, vect_cube_t const &garages) {
@@ -776,6 +836,120 @@ bool car_manager_t::check_car_for_ped_colls(car_t &car) const {
 	return 0;
 }
 
+void car_manager_t::check_same_road_colls(unsigned cix, unsigned end) { // checks cars after cix in sorted order, up to end
+	car_t &car(cars[cix]);
+	bool const on_conn_road(car.cur_city == CONN_CITY_IX);
+	float const length(car.get_length()), max_check_dist(max(3.0f*length, (length + car.get_max_lookahead_dist()))); // max of collision dist and car-in-front dist
+
+	for (auto j = cars.begin()+cix+1; j != cars.begin()+end; ++j) { // check for collisions with cars on the same road (can't test seg because they can be on diff segs but still collide)
+		if (car.cur_city != j->cur_city || car.cur_road != j->cur_road) break; // different cities or roads
+		if (!on_conn_road && car.cur_road_type == j->cur_road_type && abs((int)car.cur_seg - (int)j->cur_seg) > (on_conn_road ? 1 : 0)) break; // diff road segs or diff isects
+		check_collision(car, *j);
+		car.register_adj_car(*j);
+		j->register_adj_car(car);
+		if (!dist_xy_less_than(car.get_center(), j->get_center(), max_check_dist)) break;
+	}
+}
+
+void car_manager_t::check_entering_city_colls(unsigned cix) { // on connector road, check before entering intersection to a city
+	for (auto ix = entering_city.begin(); ix != entering_city.end(); ++ix) {
+		if (*ix != cix) {check_collision(cars[cix], cars[*ix]);}
+	}
+}
+
+void car_soa_t::resize(unsigned num) {
+	for (vector<float> *v : {&lo, &hi, &prev_lo, &prev_hi, &side_lo, &side_hi, &cur_speed, &max_speed}) {v->resize(num);}
+	car_in_front.resize(num);
+	for (vector<unsigned char> *v : {&dir, &turn_dir, &front_car_turn_dir}) {v->resize(num);}
+}
+void car_soa_t::gather(car_t const &car, unsigned ix) {
+	bool const dim(car.dim);
+	lo       [ix] = car.bcube.d[dim][0];
+	hi       [ix] = car.bcube.d[dim][1];
+	prev_lo  [ix] = car.prev_bcube.d[dim][0];
+	prev_hi  [ix] = car.prev_bcube.d[dim][1];
+	side_lo  [ix] = car.bcube.d[!dim][0];
+	side_hi  [ix] = car.bcube.d[!dim][1];
+	cur_speed[ix] = car.cur_speed;
+	max_speed[ix] = car.max_speed;
+	car_in_front[ix] = -1; // reset for this frame
+	dir               [ix] = car.dir;
+	turn_dir          [ix] = car.turn_dir;
+	front_car_turn_dir[ix] = car.front_car_turn_dir;
+}
+void car_soa_t::scatter(car_t &car, unsigned ix, vector<car_t> &cars) const { // writes back the fields that collision detection modifies
+	car.bcube.d[car.dim][0] = lo[ix];
+	car.bcube.d[car.dim][1] = hi[ix];
+	car.cur_speed           = cur_speed[ix];
+	car.front_car_turn_dir  = front_car_turn_dir[ix];
+	car.car_in_front        = ((car_in_front[ix] < 0) ? nullptr : &cars[car_in_front[ix]]);
+}
+float car_soa_t::get_center_dist_xy_sq(unsigned a, unsigned b, bool dim) const { // same as p2p_dist_xy_sq() of the two bcube centers
+	float const dd(0.5f*(lo[a] + hi[a]) - 0.5f*(lo[b] + hi[b])), ds(0.5f*(side_lo[a] + side_hi[a]) - 0.5f*(side_lo[b] + side_hi[b]));
+	return (dim ? (ds*ds + dd*dd) : (dd*dd + ds*ds)); // x then y
+}
+
+// car_soa_t versions of car_t::check_collision() and car_t::register_adj_car() for cars with the same dim that have only moved along it this frame;
+// these must produce results identical to the car_t versions
+bool car_manager_t::check_collision_soa(unsigned a, unsigned c, bool dim) {
+	car_soa_t &s(car_soa);
+	if (s.dir[a] != s.dir[c]) return 0; // traveling on opposite sides of the road
+	bool const dir(s.dir[a]);
+	float const sep_dist(get_min_sep_dist(s.get_length(a), s.get_length(c), s.cur_speed[a], s.cur_speed[c], s.max_speed[a], 0));
+	float const test_dist(0.999*sep_dist); // slightly smaller than separation distance
+	if (s.hi[c] < (s.lo[a] - test_dist) || s.lo[c] > (s.hi[a] + test_dist) || s.side_hi[c] < s.side_lo[a] || s.side_lo[c] > s.side_hi[a]) return 0; // no intersection
+	float const front(dir ? s.hi[a] : s.lo[a]), c_front(dir ? s.hi[c] : s.lo[c]);
+	bool const move_c((front < c_front) ^ dir); // move the car that's behind
+	unsigned const cmove(move_c ? c : a), cstay(move_c ? a : c);
+	s.cur_speed[cmove] = car_t::get_decel_speed(s.cur_speed[cmove], s.max_speed[cmove], ((s.cur_speed[cstay] == 0.0) ? 10.0 : 0.05)); // decelerate_fast() or decelerate()
+	float const dist((dir ? s.lo[cstay] : s.hi[cstay]) - (dir ? s.hi[cmove] : s.lo[cmove])); // signed distance between the back of the car in front and the front of the car in back
+	float delta(0.0);
+	delta += dist + (dir ? -sep_dist : sep_dist); // force separation between cars
+	cube_t const bcube(get_bcube_for_car(cars[cmove]));
+	if (s.max_speed[cstay] < s.max_speed[cmove]) {s.front_car_turn_dir[cmove] = s.turn_dir[cstay];}
+
+	if ((s.lo[cmove] + delta) < bcube.d[dim][0] || (s.hi[cmove] + delta) > bcube.d[dim][1] || s.side_lo[cmove] < bcube.d[!dim][0] || s.side_hi[cmove] > bcube.d[!dim][1]) {
+		if (s.lo[cmove] != s.prev_lo[cmove] || s.hi[cmove] != s.prev_hi[cmove]) { // try resetting to last frame's position
+			s.lo[cmove] = s.prev_lo[cmove];
+			s.hi[cmove] = s.prev_hi[cmove];
+			return 1;
+		}
+		else { // keep the car from moving outside its current segment (init collision case)
+			if (dir) {max_eq(delta, min(0.0f, 0.999f*(bcube.d[dim][0] - s.lo[cmove])));}
+			else     {min_eq(delta, max(0.0f, 0.999f*(bcube.d[dim][1] - s.hi[cmove])));}
+		}
+	}
+	s.lo[cmove] += delta;
+	s.hi[cmove] += delta;
+	return 1;
+}
+void car_manager_t::register_adj_car_soa(unsigned a, unsigned c, bool dim) {
+	car_soa_t &s(car_soa);
+	if (s.car_in_front[a] >= 0 && s.get_center_dist_xy_sq(a, c, dim) > s.get_center_dist_xy_sq(a, s.car_in_front[a], dim)) return; // already found a closer car
+	bool const dir(s.dir[a]);
+	float const front(dir ? s.hi[a] : s.lo[a]);
+	float ahead(front);
+	ahead += (dir ? 1.0 : -1.0)*get_max_lookahead_dist(s.get_length(a));
+	float const lo(dir ? front : ahead), hi(dir ? ahead : front);
+	if (s.hi[c] <= lo || s.lo[c] >= hi || s.side_hi[c] <= s.side_lo[a] || s.side_lo[c] >= s.side_hi[a]) return; // projected cube doesn't intersect other car
+	s.car_in_front[a] = c;
+}
+void car_manager_t::check_same_road_colls_soa(unsigned cix, unsigned end, bool dim) { // see check_same_road_colls()
+	car_t const &car(cars[cix]);
+	bool const on_conn_road(car.cur_city == CONN_CITY_IX);
+	float const length(car_soa.get_length(cix)), max_check_dist(max(3.0f*length, (length + get_max_lookahead_dist(length))));
+
+	for (unsigned j = cix+1; j < end; ++j) {
+		car_t const &c(cars[j]); // road fields aren't modified by collisions
+		if (car.cur_city != c.cur_city || car.cur_road != c.cur_road) break; // different cities or roads
+		if (!on_conn_road && car.cur_road_type == c.cur_road_type && abs((int)car.cur_seg - (int)c.cur_seg) > (on_conn_road ? 1 : 0)) break; // diff road segs or diff isects
+		check_collision_soa(cix, j, dim);
+		register_adj_car_soa(cix, j, dim);
+		register_adj_car_soa(j, cix, dim);
+		if (!(car_soa.get_center_dist_xy_sq(cix, j, dim) < max_check_dist*max_check_dist)) break;
+	}
+}
+
 void car_manager_t::next_frame(ped_manager_t const &ped_manager, float car_speed) {
 	if (!animate2) return;
 	helicopters_next_frame(car_speed);
@@ -783,6 +957,105 @@ void car_manager_t::next_frame(ped_manager_t const &ped_manager, float car_speed
 	// Warning: not really thread safe, but should be okay; the ped state should valid at all points (thought maybe inconsistent) and we don't need it to be exact every frame
 	ped_manager.get_peds_crossing_roads(peds_crossing_roads);
 	//timer_t timer("Update Cars"); // 4K cars = 0.7ms / 2.1ms with destinations + navigation
+	move_cars_and_check_colls(CAR_SPEED_SCALE*car_speed*fticks, city_params.parallel_car_update);
+	update_cars(city_params.parallel_car_update); // run update logic
+
+	if (map_mode) { // create cars_by_road
+		// cars have moved since the last sort and may no longer be in city/road order, but this algorithm doesn't require that;
+		// out-of-order cars will end up in their own blocks, which is less efficient but still correct
+		car_blocks_by_road.clear();
+		cars_by_road.clear();
+		unsigned cur_city(1<<31), cur_road(1<<31); // start at invalid values
+		bool saw_parked(0);
+
+		for (auto i = cars.begin(); i != cars.end(); ++i) {
+			if (i->cur_road_type == TYPE_BUILDING) continue; // ignore cars in buildings
+			bool const new_city(i->cur_city != cur_city), new_parked(!saw_parked && i->is_parked());
+			unsigned const cbr_ix(cars_by_road.size());
+			if (new_parked) {car_blocks_by_road.back().first_parked = cbr_ix; saw_parked = 1;}
+
+			if (new_city || new_parked || i->cur_road != cur_road) { // new city/road
+				if (new_city) { // new city
+					if (!saw_parked && !car_blocks_by_road.empty()) {car_blocks_by_road.back().first_parked = cbr_ix;} // no parked cars in prev city
+					saw_parked = 0; // reset for next city
+					car_blocks_by_road.emplace_back(cbr_ix, i->cur_city);
+				}
+				cars_by_road.emplace_back(i->bcube, (i - cars.begin())); // start a new block
+				cur_city = i->cur_city;
+				cur_road = i->cur_road;
+			}
+			else {cars_by_road.back().union_with_cube(i->bcube);}
+		} // for i
+		if (!saw_parked && !car_blocks_by_road.empty()) {car_blocks_by_road.back().first_parked = cars_by_road.size();} // no parked cars in final city
+		car_blocks_by_road.emplace_back(cars_by_road.size(), 0); // add terminator
+		cars_by_road.emplace_back(cube_t(), cars.size()); // add terminator
+	}
+}
+
+void car_manager_t::check_car_colls(unsigned cix, unsigned end) { // end is the end of this car's road run, or any later car
+	car_t &car(cars[cix]);
+	check_same_road_colls(cix, end);
+	if (car.cur_city == CONN_CITY_IX) {check_entering_city_colls(cix);}
+
+	if (car.in_isect()) {
+		int const next_car(find_next_car_after_turn(car)); // Note: calculates in car.car_in_front
+		if (next_car >= 0) {check_collision(car, cars[next_car]);} // make sure we collide with the correct car
+	}
+	if (!peds_crossing_roads.peds.empty()) {check_car_for_ped_colls(car);}
+}
+
+// returns the index of the road run of moving cars on this road, or -1 if there are no moving cars on it; road_ix is negative for connector roads
+int car_manager_t::find_road_run(unsigned city_ix, int road_ix) const {
+	if (road_ix < 0) {city_ix = CONN_CITY_IX; road_ix = decode_neg_ix(road_ix);}
+	auto const runs_end(road_runs.end()-1); // skip the terminator
+	auto it(std::lower_bound(road_runs.begin(), runs_end, 0, [&](unsigned ix, int) { // same order as comp_car_road_then_pos
+		car_t const &c(cars[ix]);
+		if (c.cur_city != city_ix) return (c.cur_city < city_ix);
+		return (!c.is_parked() && c.cur_road < road_ix); // parked cars are sorted last within a city
+	}));
+	if (it == runs_end) return -1;
+	car_t const &c(cars[*it]);
+	if (c.cur_city != city_ix || c.is_parked() || c.cur_road != road_ix) return -1;
+	return (it - road_runs.begin());
+}
+
+bool car_moved_only_along_dim(car_t const &car) { // bcube and prev_bcube only differ in dim, as required for car_soa_t
+	bool const dim(car.dim);
+	return (car.bcube.d[!dim][0] == car.prev_bcube.d[!dim][0] && car.bcube.d[!dim][1] == car.prev_bcube.d[!dim][1] &&
+		car.bcube.z1() == car.prev_bcube.z1() && car.bcube.z2() == car.prev_bcube.z2());
+}
+
+// marks runs whose cars can interact with cars on other roads: connector road cars and cars entering cities collide with each other,
+// and cars in intersections collide with cars on the roads they're turning onto; all roads leaving the intersection are marked since the turn may change;
+// runs with cars that can't be represented in car_soa_t (mixed dims or cars that moved across their dim) are also marked
+void car_manager_t::mark_serial_runs() {
+	unsigned const num_runs(road_runs.size() - 1);
+	serial_runs.assign(num_runs, 0);
+
+	for (unsigned r = 0; r < num_runs; ++r) {
+		bool const run_dim(cars[road_runs[r]].dim);
+
+		for (unsigned i = road_runs[r]; i < road_runs[r+1]; ++i) {
+			car_t const &car(cars[i]);
+			if (car.dim != run_dim || !car_moved_only_along_dim(car)) {serial_runs[r] = 1;}
+			if (car.is_parked()) continue;
+			if (car.cur_city == CONN_CITY_IX || car.entering_city) {serial_runs[r] = 1;}
+			if (!car.in_isect()) continue;
+			serial_runs[r] = 1;
+			road_isec_t const &isec(get_car_isec(car));
+
+			for (unsigned d = 0; d < 4; ++d) {
+				int const run(find_road_run(car.cur_city, isec.rix_xy[d]));
+				if (run >= 0) {serial_runs[run] = 1;}
+			}
+		} // for i
+	} // for r
+}
+
+// parallel mode: cars on different roads only interact at intersections and when entering a city from a connector road, so runs of cars on the same road
+// that can't interact with other runs are collided in parallel using car_soa_t; all other cars are processed serially in sorted order, the same as the serial path;
+// since the parallel runs share no cars with the serial ones, and each car's collisions with cars behind it in its run come first in both paths, the results are identical
+void car_manager_t::move_cars_and_check_colls(float speed, bool parallel) {
 #pragma omp critical(modify_car_data)
 	{
 		if (car_destroyed) {remove_destroyed_cars();} // at least one car was destroyed in the previous frame - remove it/them
@@ -790,10 +1063,14 @@ void car_manager_t::next_frame(ped_manager_t const &ped_manager, float car_speed
 	}
 	entering_city.clear();
 	car_blocks.clear();
-	float const speed(CAR_SPEED_SCALE*car_speed*fticks);
 	bool saw_parked(0);
-	//unsigned num_on_conn_road(0);
 
+	if (parallel) {
+#pragma omp parallel for schedule(static)
+		for (int i = 0; i < (int)cars.size(); ++i) {
+			if (!cars[i].is_parked()) {cars[i].move(speed);}
+		}
+	}
 	for (auto i = cars.begin(); i != cars.end(); ++i) { // move cars
 		unsigned const cix(i - cars.begin());
 		i->car_in_front = nullptr; // reset for this frame
@@ -807,7 +1084,7 @@ void car_manager_t::next_frame(ped_manager_t const &ped_manager, float car_speed
 			if (!saw_parked) {car_blocks.back().first_parked = cix; saw_parked = 1;}
 			continue; // no update for parked cars
 		}
-		i->move(speed);
+		if (!parallel) {i->move(speed);}
 		if (i->entering_city) {entering_city.push_back(cix);} // record for use in collision detection
 		if (!i->stopped_at_light && i->is_almost_stopped() && i->in_isect()) {get_car_isec(*i).stoplight.mark_blocked(i->dim, i->dir);} // blocking intersection
 		register_car_at_city(*i);
@@ -815,64 +1092,101 @@ void car_manager_t::next_frame(ped_manager_t const &ped_manager, float car_speed
 	if (!saw_parked && !car_blocks.empty()) {car_blocks.back().first_parked = cars.size();} // no parked cars in final city
 	car_blocks.emplace_back(cars.size(), 0); // add terminator
 
-	for (auto i = cars.begin(); i != cars.end(); ++i) { // collision detection
-		if (i->is_parked()) continue; // no collisions for parked cars
-		bool const on_conn_road(i->cur_city == CONN_CITY_IX);
-		float const length(i->get_length()), max_check_dist(max(3.0f*length, (length + i->get_max_lookahead_dist()))); // max of collision dist and car-in-front dist
-
-		for (auto j = i+1; j != cars.end(); ++j) { // check for collisions with cars on the same road (can't test seg because they can be on diff segs but still collide)
-			if (i->cur_city != j->cur_city || i->cur_road != j->cur_road) break; // different cities or roads
-			if (!on_conn_road && i->cur_road_type == j->cur_road_type && abs((int)i->cur_seg - (int)j->cur_seg) > (on_conn_road ? 1 : 0)) break; // diff road segs or diff isects
-			check_collision(*i, *j);
-			i->register_adj_car(*j);
-			j->register_adj_car(*i);
-			if (!dist_xy_less_than(i->get_center(), j->get_center(), max_check_dist)) break;
+	if (!parallel) {
+		for (unsigned i = 0; i < cars.size(); ++i) { // collision detection
+			if (!cars[i].is_parked()) {check_car_colls(i, cars.size());} // no collisions for parked cars
 		}
-		if (on_conn_road) { // on connector road, check before entering intersection to a city
-			for (auto ix = entering_city.begin(); ix != entering_city.end(); ++ix) {
-				if (*ix != unsigned(i - cars.begin())) {check_collision(*i, cars[*ix]);}
-			}
-			//++num_on_conn_road;
+		return;
+	}
+	road_runs.clear();
+
+	for (unsigned i = 0; i < cars.size(); ++i) {
+		if (i == 0 || cars[i].cur_city != cars[i-1].cur_city || cars[i].cur_road != cars[i-1].cur_road) {road_runs.push_back(i);}
+	}
+	road_runs.push_back(cars.size()); // add terminator
+	mark_serial_runs();
+	car_soa.resize(cars.size());
+	int const num_runs(road_runs.size() - 1);
+	// same road collisions only modify cars in the current run; runs vary widely in size, so use dynamic scheduling
+#pragma omp parallel for schedule(dynamic,4)
+	for (int r = 0; r < num_runs; ++r) {
+		if (serial_runs[r]) continue;
+		unsigned const start(road_runs[r]), end(road_runs[r+1]);
+		bool const dim(cars[start].dim); // same for all cars in the run
+		for (unsigned i = start; i < end; ++i) {car_soa.gather(cars[i], i);}
+
+		for (unsigned i = start; i < end; ++i) {
+			if (!cars[i].is_parked()) {check_same_road_colls_soa(i, end, dim);}
 		}
-		if (i->in_isect()) {
-			int const next_car(find_next_car_after_turn(*i)); // Note: calculates in i->car_in_front
-			if (next_car >= 0) {check_collision(*i, cars[next_car]);} // make sure we collide with the correct car
+		for (unsigned i = start; i < end; ++i) {car_soa.scatter(cars[i], i, cars);}
+	}
+	for (int r = 0; r < num_runs; ++r) { // remaining collisions in sorted car order; pedestrian collisions use a shared random number generator, so they're all done here
+		for (unsigned i = road_runs[r]; i < road_runs[r+1]; ++i) {
+			car_t &car(cars[i]);
+			if (car.is_parked()) continue;
+			if (serial_runs[r]) {check_car_colls(i, road_runs[r+1]);}
+			else if (!peds_crossing_roads.peds.empty()) {check_car_for_ped_colls(car);}
 		}
-		if (!peds_crossing_roads.peds.empty()) {check_car_for_ped_colls(*i);}
-	} // for i
-	update_cars(); // run update logic
+	}
+}
 
-	if (map_mode) { // create cars_by_road
-		// cars have moved since the last sort and may no longer be in city/road order, but this algorithm doesn't require that;
-		// out-of-order cars will end up in their own blocks, which is less efficient but still correct
-		car_blocks_by_road.clear();
-		cars_by_road.clear();
-		unsigned cur_city(1<<31), cur_road(1<<31); // start at invalid values
-		bool saw_parked(0);
+// parallel mode: uses the road runs from move_cars_and_check_colls(); cars with local updates (see car_update_is_local()) are updated per run in parallel,
+// and all other cars are added to per-intersection queues and updated after that; the queues are drained in car order because turns and stops use the shared rgen;
+// a local car's update reads the speed of its car in front, so the deferred set is extended until every such read sees the same value as in the serial path:
+// a local car is deferred if its car in front is deferred or in another run, and a deferred car's car in front is deferred if it comes later in car order
+void car_manager_t::update_cars(bool parallel) {
+	if (!parallel) {
+		for (auto i = cars.begin(); i != cars.end(); ++i) {update_car(*i);} // run update logic
+		return;
+	}
+	assert(!road_runs.empty() && road_runs.back() == cars.size());
+	int const num_cars(cars.size()), num_runs(road_runs.size() - 1);
+	update_deferred.resize(num_cars);
+#pragma omp parallel for schedule(static)
+	for (int i = 0; i < num_cars; ++i) {update_deferred[i] = !car_update_is_local(cars[i]);}
+
+	auto update_deps([&](unsigned i, unsigned r) { // returns 1 if something was deferred
+		car_t const &car(cars[i]);
+		if (car.is_parked() || car.car_in_front == nullptr) return 0; // parked car updates don't read other cars
+		unsigned const f(car.car_in_front - cars.data());
+		bool const same_run(f >= road_runs[r] && f < road_runs[r+1]);
+		if (!update_deferred[i] && (update_deferred[f] || !same_run)) {update_deferred[i] = 1; return 1;}
+		if (update_deferred[i] && f > i && !update_deferred[f] && !cars[f].is_parked()) {update_deferred[f] = 1; return 1;}
+		return 0;
+	});
+	for (bool changed = 1; changed;) { // iterate until no more cars are deferred; alternate directions since chains of cars can point either way
+		changed = 0;
+		for (int r = 0; r < num_runs; ++r) {
+			for (unsigned i = road_runs[r]; i < road_runs[r+1]; ++i) {changed |= update_deps(i, r);}
+		}
+		for (int r = num_runs-1; r >= 0; --r) {
+			for (unsigned i = road_runs[r+1]; i > road_runs[r]; --i) {changed |= update_deps(i-1, r);}
+		}
+	}
+#pragma omp parallel for schedule(dynamic,4)
+	for (int r = 0; r < num_runs; ++r) { // local updates, in car order within each run
+		for (unsigned i = road_runs[r]; i < road_runs[r+1]; ++i) {
+			if (!update_deferred[i]) {update_car(cars[i]);} // Note: doesn't use rgen
+		}
+	}
+	isec_queue_cars.clear();
 
-		for (auto i = cars.begin(); i != cars.end(); ++i) {
-			if (i->cur_road_type == TYPE_BUILDING) continue; // ignore cars in buildings
-			bool const new_city(i->cur_city != cur_city), new_parked(!saw_parked && i->is_parked());
-			unsigned const cbr_ix(cars_by_road.size());
-			if (new_parked) {car_blocks_by_road.back().first_parked = cbr_ix; saw_parked = 1;}
+	for (int i = 0; i < num_cars; ++i) {
+		if (update_deferred[i]) {isec_queue_cars.emplace_back(get_car_isec_key(cars[i]), i);}
+	}
+	sort(isec_queue_cars.begin(), isec_queue_cars.end()); // group into per-intersection queues, each in car order
+	typedef pair<unsigned, unsigned> car_queue_t; // {car index, queue position}
+	std::priority_queue<car_queue_t, vector<car_queue_t>, std::greater<car_queue_t>> queue_heads;
 
-			if (new_city || new_parked || i->cur_road != cur_road) { // new city/road
-				if (new_city) { // new city
-					if (!saw_parked && !car_blocks_by_road.empty()) {car_blocks_by_road.back().first_parked = cbr_ix;} // no parked cars in prev city
-					saw_parked = 0; // reset for next city
-					car_blocks_by_road.emplace_back(cbr_ix, i->cur_city);
-				}
-				cars_by_road.emplace_back(i->bcube, (i - cars.begin())); // start a new block
-				cur_city = i->cur_city;
-				cur_road = i->cur_road;
-			}
-			else {cars_by_road.back().union_with_cube(i->bcube);}
-		} // for i
-		if (!saw_parked && !car_blocks_by_road.empty()) {car_blocks_by_road.back().first_parked = cars_by_road.size();} // no parked cars in final city
-		car_blocks_by_road.emplace_back(cars_by_road.size(), 0); // add terminator
-		cars_by_road.emplace_back(cube_t(), cars.size()); // add terminator
+	for (unsigned n = 0; n < isec_queue_cars.size(); ++n) { // add the first car of each queue
+		if (n == 0 || isec_queue_cars[n].first != isec_queue_cars[n-1].first) {queue_heads.emplace(isec_queue_cars[n].second, n);}
+	}
+	while (!queue_heads.empty()) { // merge the queues in car order
+		unsigned const n(queue_heads.top().second);
+		queue_heads.pop();
+		update_car(cars[isec_queue_cars[n].second]);
+		if (n+1 < isec_queue_cars.size() && isec_queue_cars[n+1].first == isec_queue_cars[n].first) {queue_heads.emplace(isec_queue_cars[n+1].second, n+1);} // next car in this queue
 	}
-	//cout << TXT(cars.size()) << TXT(entering_city.size()) << TXT(in_isects.size()) << TXT(num_on_conn_road) << endl; // TESTING
 }
 
 // calculate max zval along line for buildings and terrain; this is not intended to be fast;
@@ -29,6 +29,8 @@ int       const FORCE_MODEL_ID = -1; // -1 disables
 unsigned  const NUM_CAR_COLORS = 10;
 colorRGBA const car_colors[NUM_CAR_COLORS] = {WHITE, GRAY_BLACK, GRAY, ORANGE, RED, DK_RED, DK_BLUE, colorRGBA(0.5, 0.9, 0.5), YELLOW, BROWN};
 
+unsigned const CITY_GEN_VERSION = 1; // increment when city, road, or parking lot generation changes so that stale layout cache files are regenerated
+
 float const ROAD_HEIGHT          = 0.002;
 float const PARK_SPACE_WIDTH     = 1.6;
 float const PARK_SPACE_LENGTH    = 1.8;
@@ -62,9 +64,9 @@ struct city_params_t {
 	float road_width, road_spacing, conn_road_seg_len, max_road_slope;
 	unsigned make_4_way_ints; // 0=all 3-way intersections; 1=allow 4-way; 2=all connector roads must have at least a 4-way on one end; 4=only 4-way (no straight roads)
 	// cars
-	unsigned num_cars;
+	unsigned num_cars, benchmark_car_frames; // benchmark_car_frames: 0=no benchmark
 	float car_speed, traffic_balance_val, new_city_prob, max_car_scale;
-	bool enable_car_path_finding, convert_model_files;
+	bool enable_car_path_finding, convert_model_files, parallel_car_update;
 	vector<city_model_t> car_model_files, ped_model_files, hc_model_files;
 	city_model_t fire_hydrant_model_file;
 	// parking lots
@@ -81,15 +83,15 @@ struct city_params_t {
 	// pedestrians
 	unsigned num_peds, num_building_peds;
 	float ped_speed;
-	bool ped_respawn_at_dest;
+	bool ped_respawn_at_dest, benchmark_peds;
 	// buildings; maybe should be building params, but we have the model loading code here
 	city_model_t building_models[NUM_OBJ_MODELS];
 
 	city_params_t() : num_cities(0), num_samples(100), num_conn_tries(50), city_size_min(0), city_size_max(0), city_border(0), road_border(0), slope_width(0),
-		num_rr_tracks(0), park_rate(0), road_width(0.0), road_spacing(0.0), conn_road_seg_len(1000.0), max_road_slope(1.0), make_4_way_ints(0), num_cars(0), car_speed(0.0),
-		traffic_balance_val(0.5), new_city_prob(1.0), max_car_scale(1.0), enable_car_path_finding(0), convert_model_files(0), min_park_spaces(12), min_park_rows(1),
+		num_rr_tracks(0), park_rate(0), road_width(0.0), road_spacing(0.0), conn_road_seg_len(1000.0), max_road_slope(1.0), make_4_way_ints(0), num_cars(0), benchmark_car_frames(0),
+		car_speed(0.0), traffic_balance_val(0.5), new_city_prob(1.0), max_car_scale(1.0), enable_car_path_finding(0), convert_model_files(0), parallel_car_update(0), min_park_spaces(12), min_park_rows(1),
 		min_park_density(0.0), max_park_density(1.0), car_shadows(0), max_lights(1024), max_shadow_maps(0), smap_size(0), max_trees_per_plot(0),
-		tree_spacing(1.0), max_benches_per_plot(0), num_peds(0), num_building_peds(0), ped_speed(0.0), ped_respawn_at_dest(0) {}
+		tree_spacing(1.0), max_benches_per_plot(0), num_peds(0), num_building_peds(0), ped_speed(0.0), ped_respawn_at_dest(0), benchmark_peds(0) {}
 	bool enabled() const {return (num_cities > 0 && city_size_min > 0);}
 	bool roads_enabled() const {return (road_width > 0.0 && road_spacing > 0.0);}
 	float get_road_ar() const {return round(road_spacing/road_width);} // round to nearest texture multiple
@@ -163,7 +165,8 @@ struct car_t : public car_base_t, public waiting_obj_t { // size = 92
 	void move(float speed_mult);
 	void maybe_accelerate(float mult=0.02);
 	void accelerate(float mult=0.02) {cur_speed = min(get_max_speed(), (cur_speed + mult*fticks*max_speed));}
-	void decelerate(float mult=0.05) {cur_speed = max(0.0f, (cur_speed - mult*fticks*max_speed));}
+	static float get_decel_speed(float cur_speed, float max_speed, float mult) {return max(0.0f, (cur_speed - mult*fticks*max_speed));}
+	void decelerate(float mult=0.05) {cur_speed = get_decel_speed(cur_speed, max_speed, mult);}
 	void decelerate_fast() {decelerate(10.0);} // Note: large decel to avoid stopping in an intersection
 	void park() {cur_speed = max_speed = 0.0;}
 	void stop() {cur_speed = 0.0;} // immediate stop
@@ -179,6 +182,20 @@ struct car_t : public car_base_t, public waiting_obj_t { // size = 92
 	float get_sum_len_space_for_cars_in_front(cube_t const &range) const;
 };
 
+// structure-of-arrays copy of the car fields read and written by parallel same-road collision detection, indexed the same as cars;
+// cars in a run share the same dim and only move along it, so bcube and prev_bcube are stored as their extents in dim plus the bcube extents across it
+struct car_soa_t {
+	vector<float> lo, hi, prev_lo, prev_hi, side_lo, side_hi, cur_speed, max_speed;
+	vector<int> car_in_front; // car index, or -1 if none
+	vector<unsigned char> dir, turn_dir, front_car_turn_dir;
+
+	void resize(unsigned num);
+	void gather (car_t const &car, unsigned ix);
+	void scatter(car_t &car, unsigned ix, vector<car_t> &cars) const;
+	float get_length(unsigned ix) const {return (hi[ix] - lo[ix]);}
+	float get_center_dist_xy_sq(unsigned a, unsigned b, bool dim) const;
+};
+
 struct car_city_vect_t {
 	vector<car_base_t> cars[2][2]; // {dim x dir}
 	vector<cube_with_ix_t> parked_car_bcubes; // stores car bcube + plot_ix
@@ -357,6 +374,7 @@ namespace stoplight_ns {
 		}
 		void reset_blocked() {UNROLL_4X(blocked[i_] = 0;)}
 		void mark_blocked(bool dim, bool dir) const {blocked[2*dim + dir] = 1;} // Note: not actually const, but blocked is mutable
+		void copy_car_state_from(stoplight_t const &s) const {car_waiting_sr = s.car_waiting_sr; car_waiting_left = s.car_waiting_left; cw_in_use = s.cw_in_use; UNROLL_4X(blocked[i_] = s.blocked[i_];)}
 		bool is_blocked(bool dim, bool dir) const {return (blocked[2*dim + dir] != 0);}
 		void mark_crosswalk_in_use(bool dim, bool dir) const {cw_in_use |= (1 << (2*dim + dir));}
 		void init(uint8_t num_conn_, uint8_t conn_);
@@ -486,6 +504,41 @@ struct road_isec_t : public cube_t {
 };
 
 
+// graph of the intersections in a city used for car path finding; nodes use the index space of road_network_t::get_isec_by_ix();
+// routes to each destination are computed on first use and cached for all source intersections, so queries are a table lookup;
+// Note: not thread safe, must only be queried from the car update thread
+class car_route_graph_t {
+	struct edge_t {
+		unsigned short node; // source node for in_edges
+		unsigned char orient; // orient that a car leaves the source node in, which is also the orient it arrives at the dest node in
+		float cost;
+		edge_t(unsigned short node_, unsigned char orient_, float cost_) : node(node_), orient(orient_), cost(cost_) {}
+	};
+	struct state_t {
+		float dist;
+		unsigned ix;
+		state_t(float dist_, unsigned ix_) : dist(dist_), ix(ix_) {}
+		bool operator<(state_t const &s) const {return (dist > s.dist);} // for min heap
+	};
+	vector<unsigned char> node_conn; // isec conn bits, per node
+	vector<vector<edge_t>> in_edges; // per dest node
+	float turn_cost[3]; // extra cost for {straight, left, right}
+	// route cache: next_orient[dest][4*node + arrival_orient] = orient to leave node in, or 255 if there's no path; empty if not yet computed
+	mutable vector<vector<unsigned char>> next_orient;
+	mutable vector<float> dist; // reused temporaries
+	mutable vector<state_t> heap;
+
+	void calc_routes_to(unsigned dest) const;
+public:
+	car_route_graph_t() {turn_cost[0] = turn_cost[1] = turn_cost[2] = 0.0;}
+	void init(unsigned num_nodes, float left_turn_cost, float right_turn_cost);
+	void set_node_conn(unsigned node, unsigned char conn) {assert(node < node_conn.size()); node_conn[node] = conn;}
+	void add_edge(unsigned from, unsigned to, unsigned orient, float cost);
+	unsigned size() const {return node_conn.size();}
+	int get_next_orient(unsigned cur_node, unsigned arrival_orient, unsigned dest_node) const;
+};
+
+
 struct road_connector_t : public road_t, public streetlights_t {
 	road_t src_road;
 
@@ -592,6 +645,14 @@ public:
 
 
 // forward declarations of some classes
+// road network state that's modified by car updates; saved and restored so that benchmarks can run the same frames more than once
+struct road_traffic_state_t {
+	vector<stoplight_ns::stoplight_t> stoplights;
+	vector<unsigned short> seg_car_counts;
+	vector<unsigned> city_num_cars;
+	rand_gen_t car_dest_rgen;
+};
+
 class city_road_gen_t;
 struct pedestrian_t;
 class ped_manager_t;
@@ -629,6 +690,11 @@ class car_manager_t { // and trucks and helicopters
 	car_draw_state_t dstate;
 	rand_gen_t rgen;
 	vector<unsigned> entering_city;
+	vector<unsigned> road_runs; // start index of each run of cars on the same city and road, plus a terminator; for parallel updates
+	vector<unsigned char> serial_runs; // per road run: 1 if its cars can interact with cars in other runs; for parallel updates
+	car_soa_t car_soa; // hot kinematic fields of cars in parallel runs
+	vector<unsigned char> update_deferred; // per car: 1 if its update must run after the parallel update, in car order; for parallel updates
+	vector<pair<uint64_t, unsigned>> isec_queue_cars; // {intersection key, car index} of deferred car updates, sorted into per-intersection queues
 	cube_t garages_bcube;
 	unsigned first_parked_car, first_garage_car;
 	bool car_destroyed;
@@ -636,12 +702,28 @@ class car_manager_t { // and trucks and helicopters
 	cube_t get_cb_bcube(car_block_t const &cb ) const;
 	road_isec_t const &get_car_isec(car_t const &car) const;
 	bool check_collision(car_t &c1, car_t &c2) const;
+	cube_t get_bcube_for_car(car_t const &car) const;
+	bool car_update_is_local(car_t const &car) const;
+	uint64_t get_car_isec_key(car_t const &car) const;
+	void update_car(car_t &car);
 	void register_car_at_city(car_t const &car);
 	void add_car();
+	void save_traffic_state(road_traffic_state_t &state) const;
+	void restore_traffic_state(road_traffic_state_t const &state) const;
 	void get_car_ix_range_for_cube(vector<car_block_t>::const_iterator cb, cube_t const &bc, unsigned &start, unsigned &end) const;
 	void remove_destroyed_cars();
-	void update_cars();
+	void update_cars(bool parallel);
 	int find_next_car_after_turn(car_t &car);
+	void check_same_road_colls(unsigned cix, unsigned end);
+	bool check_collision_soa(unsigned a, unsigned c, bool dim);
+	void register_adj_car_soa(unsigned a, unsigned c, bool dim);
+	void check_same_road_colls_soa(unsigned cix, unsigned end, bool dim);
+	void check_entering_city_colls(unsigned cix);
+	void check_car_colls(unsigned cix, unsigned end);
+	int find_road_run(unsigned city_ix, int road_ix) const;
+	void mark_serial_runs();
+	void move_cars_and_check_colls(float speed, bool parallel);
+	void run_car_update_benchmark(unsigned num_frames);
 	vector3d get_helicopter_size(unsigned model_id);
 	void draw_helicopters(bool shadow_only);
 public:
@@ -706,9 +788,11 @@ struct pedestrian_t : public waiting_obj_t {
 	void go();
 	void wait_for(float seconds);
 	bool check_for_safe_road_crossing(ped_manager_t const &ped_mgr, cube_t const &plot_bcube, cube_t const &next_plot_bcube, vect_cube_t *dbg_cubes=nullptr) const;
+	float get_prox_radius() const;
+	bool check_ped_ped_coll_pair(pedestrian_t &ped, unsigned pid, unsigned ped_ix, float prox_radius, vector3d &force);
 	bool check_ped_ped_coll_range(vector<pedestrian_t> &peds, unsigned pid, unsigned ped_start, unsigned target_plot, float prox_radius, vector3d &force);
 	bool check_ped_ped_coll(ped_manager_t const &ped_mgr, vector<pedestrian_t> &peds, unsigned pid, float delta_dir);
-	bool check_ped_ped_coll_stopped(vector<pedestrian_t> &peds, unsigned pid);
+	bool check_ped_ped_coll_stopped(ped_manager_t const &ped_mgr, vector<pedestrian_t> &peds, unsigned pid);
 	bool check_inside_plot(ped_manager_t &ped_mgr, point const &prev_pos, cube_t const &plot_bcube, cube_t const &next_plot_bcube);
 	bool check_road_coll(ped_manager_t const &ped_mgr, cube_t const &plot_bcube, cube_t const &next_plot_bcube) const;
 	bool is_valid_pos(vect_cube_t const &colliders, bool &ped_at_dest, ped_manager_t const *const ped_mgr) const;
@@ -758,6 +842,71 @@ public:
 	unsigned run(point const &pos_, point const &dest_, cube_t const &plot_bcube_, float gap_, point &new_dest);
 };
 
+// uniform grid of pedestrian indices, rebuilt each frame; used to accelerate ped-ped collisions and other queries;
+// queries may return peds that are outside the query region, so the caller must do the final distance test
+class ped_grid_t {
+	vector<unsigned> cell_start, ped_ixs, ped_cell, cell_pos; // cell_start is indexed by cell, with a terminator; cell_pos is a temporary
+	cube_t bcube; // bounds of all peds at build time
+	float cell_sz, inv_cell_sz, margin; // margin is the max distance a ped can move before the next rebuild
+	unsigned nx, ny;
+
+	unsigned get_cell_x(float v) const {return max(0, min(int(nx)-1, int((v - bcube.x1())*inv_cell_sz)));}
+	unsigned get_cell_y(float v) const {return max(0, min(int(ny)-1, int((v - bcube.y1())*inv_cell_sz)));}
+	template<typename F> void iter_cell(unsigned x, unsigned y, F &f) const {
+		unsigned const cix(y*nx + x);
+		for (unsigned i = cell_start[cix]; i < cell_start[cix+1]; ++i) {if (f(ped_ixs[i])) return;}
+	}
+public:
+	ped_grid_t() : bcube(all_zeros), cell_sz(0.0), inv_cell_sz(0.0), margin(0.0), nx(0), ny(0) {}
+	bool empty() const {return ped_ixs.empty();}
+	void clear() {cell_start.clear(); ped_ixs.clear(); ped_cell.clear(); nx = ny = 0;}
+	void build(vector<pedestrian_t> const &peds, float cell_size, float margin_);
+
+	// calls f(ped_ix) for each ped in the cells overlapping the XY range [lo, hi] expanded by the margin; stops when f returns true
+	template<typename F> void query_range(point const &lo, point const &hi, F f) const {
+		if (empty()) return;
+		unsigned const x1(get_cell_x(lo.x - margin)), y1(get_cell_y(lo.y - margin)), x2(get_cell_x(hi.x + margin)), y2(get_cell_y(hi.y + margin));
+		// Note: must return after f() returns true, which isn't possible from within iter_cell(), so use a flag
+		bool done(0);
+		auto f2 = [&](unsigned ix) {done = f(ix); return done;};
+
+		for (unsigned y = y1; y <= y2 && !done; ++y) {
+			for (unsigned x = x1; x <= x2 && !done; ++x) {iter_cell(x, y, f2);}
+		}
+	}
+	template<typename F> void query_sphere(point const &pos, float radius, F f) const {
+		query_range(point(pos.x-radius, pos.y-radius, 0.0), point(pos.x+radius, pos.y+radius, 0.0), f);
+	}
+	// calls f(ped_ix) for each ped in cells within radius of the XY projection of the line p1-p2, walking along the major axis
+	template<typename F> void query_line(point const &p1, point const &p2, float radius, F f) const {
+		if (empty()) return;
+		float const pad(radius + margin);
+		bool const dim(fabs(p2.y - p1.y) > fabs(p2.x - p1.x)); // major axis
+		float const d1(p1[dim]), d2(p2[dim]), delta(d2 - d1);
+
+		if (fabs(delta) < cell_sz) { // short line, use the bounding box
+			query_range(point(min(p1.x, p2.x)-radius, min(p1.y, p2.y)-radius, 0.0), point(max(p1.x, p2.x)+radius, max(p1.y, p2.y)+radius, 0.0), f);
+			return;
+		}
+		unsigned const num(dim ? ny : nx);
+		float const lo(min(d1, d2) - pad), hi(max(d1, d2) + pad), start(bcube.d[dim][0]);
+		unsigned const c1(dim ? get_cell_y(lo) : get_cell_x(lo)), c2(dim ? get_cell_y(hi) : get_cell_x(hi));
+		bool done(0);
+		auto f2 = [&](unsigned ix) {done = f(ix); return done;};
+
+		for (unsigned c = c1; c <= c2 && c < num && !done; ++c) { // for each row/column that the line passes through
+			float const cv1(max(lo, start + c*cell_sz)), cv2(min(hi, start + (c+1)*cell_sz));
+			float const t1(CLIP_TO_01((cv1 - d1)/delta)), t2(CLIP_TO_01((cv2 - d1)/delta));
+			float const o1(p1[!dim] + t1*(p2[!dim] - p1[!dim])), o2(p1[!dim] + t2*(p2[!dim] - p1[!dim]));
+			unsigned const oc1(dim ? get_cell_x(min(o1, o2) - pad) : get_cell_y(min(o1, o2) - pad)), oc2(dim ? get_cell_x(max(o1, o2) + pad) : get_cell_y(max(o1, o2) + pad));
+
+			for (unsigned oc = oc1; oc <= oc2 && !done; ++oc) {
+				if (dim) {iter_cell(oc, c, f2);} else {iter_cell(c, oc, f2);}
+			}
+		}
+	}
+};
+
 class ped_manager_t { // pedestrians
 
 	struct city_ixs_t {
@@ -771,6 +920,7 @@ class ped_manager_t { // pedestrians
 	vector<pedestrian_t> peds, peds_b; // dynamic city, static building
 	vector<city_ixs_t> by_city; // first ped/plot index for each city
 	vector<unsigned> by_plot;
+	ped_grid_t ped_grid;
 	vector<unsigned char> need_to_sort_city;
 	vector<car_city_vect_t> cars_by_city;
 	vector<point> bldg_ppl_pos;
@@ -785,6 +935,7 @@ class ped_manager_t { // pedestrians
 	void expand_cube_for_ped(cube_t &cube) const;
 	void remove_destroyed_peds();
 	void sort_by_city_and_plot();
+	void build_ped_grid();
 	road_isec_t const &get_car_isec(car_base_t const &car) const;
 	void register_ped_new_plot(pedestrian_t const &ped);
 	int get_road_ix_for_ped_crossing(pedestrian_t const &ped, bool road_dim) const;
@@ -798,6 +949,7 @@ public:
 	cube_t get_expanded_city_bcube_for_peds(unsigned city_ix) const;
 	cube_t get_expanded_city_plot_bcube_for_peds(unsigned city_ix, unsigned plot_ix) const;
 	car_manager_t const &get_car_manager() const {return car_manager;}
+	ped_grid_t const &get_ped_grid() const {return ped_grid;}
 	void choose_new_ped_plot_pos(pedestrian_t &ped);
 	bool check_isec_sphere_coll(pedestrian_t const &ped) const;
 	bool check_streetlight_sphere_coll(pedestrian_t const &ped) const;
@@ -814,8 +966,9 @@ public:
 		road_gen(road_gen_), car_manager(car_manager_), selected_ped_ssn(-1), animation_id(1), ped_destroyed(0), need_to_sort_peds(0) {}
 	void next_animation();
 	static float get_ped_radius();
+	static void run_ped_grid_benchmark();
 	bool empty() const {return (peds.empty() && peds_b.empty());}
-	void clear() {peds.clear(); peds_b.clear(); by_city.clear();}
+	void clear() {peds.clear(); peds_b.clear(); by_city.clear(); ped_grid.clear();}
 	unsigned get_model_gpu_mem() const {return ped_model_loader.get_gpu_mem();}
 	void init(unsigned num_city, unsigned num_building);
 	bool proc_sphere_coll(point &pos, float radius, vector3d *cnorm) const;
@@ -823,7 +976,6 @@ public:
 	void destroy_peds_in_radius(point const &pos_in, float radius);
 	void next_frame();
 	pedestrian_t const *get_ped_at(point const &p1, point const &p2) const;
-	unsigned get_first_ped_at_plot(unsigned plot) const {assert(plot < by_plot.size()); return by_plot[plot];}
 	void get_peds_crossing_roads(ped_city_vect_t &pcv) const;
 	void draw(vector3d const &xlate, bool use_dlights, bool shadow_only, bool is_dlight_shadows);
 	void draw_peds_in_building(int first_ped_ix, ped_draw_vars_t const &pdv);
@@ -84,6 +84,12 @@ bool city_params_t::read_option(FILE *fp) {
 	else if (str == "enable_car_path_finding") {
 		if (!read_bool(fp, enable_car_path_finding)) {return read_error(str);}
 	}
+	else if (str == "parallel_car_update") {
+		if (!read_bool(fp, parallel_car_update)) {return read_error(str);}
+	}
+	else if (str == "benchmark_car_frames") { // run the serial vs. parallel car update benchmark at startup for this many frames
+		if (!read_uint(fp, benchmark_car_frames)) {return read_error(str);}
+	}
 	else if (str == "convert_model_files") {
 		if (!read_bool(fp, convert_model_files)) {return read_error(str);}
 	}
@@ -119,6 +125,9 @@ bool city_params_t::read_option(FILE *fp) {
 	else if (str == "ped_respawn_at_dest") {
 		if (!read_bool(fp, ped_respawn_at_dest)) {return read_error(str);}
 	}
+	else if (str == "benchmark_peds") { // run the ped collision grid benchmark at startup
+		if (!read_bool(fp, benchmark_peds)) {return read_error(str);}
+	}
 	// parking lots
 	else if (str == "min_park_spaces") { // with default road parameters, can be up to 28
 		if (!read_uint(fp, min_park_spaces)) {return read_error(str);}
@@ -288,6 +297,18 @@ bool parse_buildings_option(FILE *fp) {
 	else if (str == "add_secondary_buildings") {
 		if (!read_bool(fp, global_building_params.add_secondary_buildings)) {buildings_file_err(str, error);}
 	}
+	else if (str == "parallel_placement") {
+		if (!read_bool(fp, global_building_params.parallel_placement)) {buildings_file_err(str, error);}
+	}
+	else if (str == "prefetch_room_geom") {
+		if (!read_bool(fp, global_building_params.prefetch_room_geom)) {buildings_file_err(str, error);}
+	}
+	else if (str == "print_gen_times") {
+		if (!read_bool(fp, global_building_params.print_gen_times)) {buildings_file_err(str, error);}
+	}
+	else if (str == "room_geom_cache_mb") {
+		if (!read_uint(fp, global_building_params.room_geom_cache_mb)) {buildings_file_err(str, error);}
+	}
 	else if (str == "enable_people_ai") {
 		if (!read_bool(fp, global_building_params.enable_people_ai)) {buildings_file_err(str, error);}
 	}
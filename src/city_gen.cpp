@@ -9,6 +9,7 @@
 #include "buildings.h"
 #include "tree_3dw.h"
 #include "profiler.h"
+#include "layout_cache.h"
 #include <cfloat> // for FLT_MAX
 
 using std::string;
@@ -18,6 +19,10 @@ float const OUTSIDE_TERRAIN_HEIGHT  = 0.0;
 float const CAR_LANE_OFFSET         = 0.15; // in units of road width
 float const CITY_LIGHT_FALLOFF      = 0.2;
 
+unsigned const CITY_LAYOUT_CACHE_MAGIC   = 0x44524C43; // "CLRD"
+unsigned const CITY_PARKING_CACHE_MAGIC  = 0x4B504C43; // "CLPK"
+unsigned const CITY_LAYOUT_CACHE_VERSION = 1; // increment when the file format or any serialized struct changes
+
 
 float city_dlight_pcf_offset_scale(1.0);
 city_params_t city_params;
@@ -30,6 +35,7 @@ extern float water_plane_z, shadow_map_pcf_offset, cobj_z_bias, fticks;
 extern vector<light_source> dl_sources;
 extern tree_placer_t tree_placer;
 extern object_model_loader_t building_obj_model_loader;
+extern string building_layout_cache_dir;
 
 
 void add_dynamic_lights_city(cube_t const &scene_bcube, float &dlight_add_thresh);
@@ -756,6 +762,11 @@ class city_road_gen_t : public road_gen_base_t {
 
 	class city_obj_placer_t {
 	public: // road network needs access to parking lots for drawing
+		struct plot_parking_t { // parking lots, parked cars, and colliders generated for one plot; saved in the city parking lot cache
+			vector<parking_lot_t> lots;
+			vector<car_t> cars;
+			vect_cube_t colliders;
+		};
 		vector<parking_lot_t> parking_lots;
 	private:
 		vector<bench_t> benches;
@@ -881,6 +892,18 @@ class city_road_gen_t : public road_gen_base_t {
 			} // for c
 			return has_parking;
 		}
+		// replays the output of gen_parking_lots_for_plot() for this plot from the cache, in the same order
+		bool add_cached_parking_lots(plot_parking_t const &pp, vector<car_t> &cars, vect_cube_t &bcubes, vect_cube_t &colliders, bool is_new_tile) {
+			for (auto p = pp.lots.begin(); p != pp.lots.end(); ++p) {
+				add_obj_to_group(*p, *p, parking_lots, parking_lot_groups, is_new_tile);
+				bcubes.push_back(*p); // add to list of blocker bcubes so that trees and detail objects don't overlap this parking lot
+				num_spaces += p->row_sz*p->num_rows;
+			}
+			vector_add_to(pp.cars, cars);
+			vector_add_to(pp.colliders, colliders);
+			filled_spaces += pp.cars.size();
+			return !pp.cars.empty();
+		}
 		static bool check_pt_and_place_blocker(point const &pos, vect_cube_t &blockers, float radius, float blocker_spacing) {
 			cube_t bc(pos);
 			if (has_bcube_int_xy(bc, blockers, radius)) return 0; // intersects a building or parking lot - skip
@@ -1039,7 +1062,10 @@ class city_road_gen_t : public road_gen_base_t {
 		struct cube_by_x1 {
 			bool operator()(cube_t const &a, cube_t const &b) const {return (a.x1() < b.x1());}
 		};
-		void gen_parking_and_place_objects(vector<road_plot_t> &plots, vector<vect_cube_t> &plot_colliders, vector<car_t> &cars, unsigned city_id, bool have_cars) {
+		// parking: if non-null, per-plot parking lots are replayed from it when from_cache=1, and recorded into it otherwise
+		void gen_parking_and_place_objects(vector<road_plot_t> &plots, vector<vect_cube_t> &plot_colliders, vector<car_t> &cars, unsigned city_id, bool have_cars,
+			vector<plot_parking_t> *parking, bool from_cache)
+		{
 			// Note: fills in plots.has_parking
 			//timer_t timer("Gen Parking Lots and Place Objects");
 			vect_cube_t bcubes; // local blockers for this plot; reused across calls
@@ -1052,6 +1078,8 @@ class city_road_gen_t : public road_gen_base_t {
 			if (city_params.max_trees_per_plot > 0) {tree_placer.begin_block(0); tree_placer.begin_block(1);} // both small and large trees
 			bool const add_parking_lots(have_cars && city_params.min_park_spaces > 0 && city_params.min_park_rows > 0);
 			uint64_t prev_tile_id(0);
+			assert(!from_cache || (parking != nullptr && parking->size() == plots.size()));
+			if (parking && !from_cache) {parking->clear(); parking->resize(plots.size());}
 
 			for (auto i = plots.begin(); i != plots.end(); ++i) {
 				uint64_t const tile_id(road_network_t::get_tile_id_for_cube(*i));
@@ -1062,7 +1090,20 @@ class city_road_gen_t : public road_gen_base_t {
 				size_t const plot_id(i - plots.begin());
 				assert(plot_id < plot_colliders.size());
 				vect_cube_t &colliders(plot_colliders[plot_id]);
-				if (add_parking_lots && !i->is_park) {i->has_parking = gen_parking_lots_for_plot(*i, cars, city_id, plot_id, bcubes, colliders, rgen, is_new_tile);}
+				if (add_parking_lots && !i->is_park) {
+					if (from_cache) {i->has_parking = add_cached_parking_lots((*parking)[plot_id], cars, bcubes, colliders, is_new_tile);}
+					else {
+						size_t const lots_start(parking_lots.size()), cars_start(cars.size()), colliders_start(colliders.size());
+						i->has_parking = gen_parking_lots_for_plot(*i, cars, city_id, plot_id, bcubes, colliders, rgen, is_new_tile);
+
+						if (parking) { // record for the cache
+							plot_parking_t &pp((*parking)[plot_id]);
+							pp.lots     .assign((parking_lots.begin() + lots_start),      parking_lots.end());
+							pp.cars     .assign((cars        .begin() + cars_start),      cars        .end());
+							pp.colliders.assign((colliders   .begin() + colliders_start), colliders   .end());
+						}
+					}
+				}
 				place_trees_in_plot (*i, bcubes, colliders, tree_pos, detail_rgen);
 				place_detail_objects(*i, bcubes, colliders, tree_pos, detail_rgen, is_new_tile);
 				sort(colliders.begin(), colliders.end(), cube_by_x1());
@@ -1185,6 +1226,8 @@ class city_road_gen_t : public road_gen_base_t {
 		set<unsigned> connected_to; // vector?
 		map<uint64_t, unsigned> tile_to_block_map;
 		map<unsigned, road_isec_t const *> cix_to_isec; // maps city_ix to intersection
+		car_route_graph_t route_graph; // for car path finding
+		vector<unsigned short> plot_dest_isec; // car destination intersection for each plot
 		vector<vect_cube_t> plot_colliders;
 		plot_xy_t plot_xy;
 		unsigned city_id, cluster_id, plot_id_offset;
@@ -1246,6 +1289,7 @@ class city_road_gen_t : public road_gen_base_t {
 		unsigned num_roads() const {return roads.size();}
 		vector<road_t> const &get_roads() const {return roads;} // used for connecting roads between cities with 4-way intersections
 		bool empty() const {return roads.empty();}
+		unsigned num_plots() const {return plots.size();}
 		plot_xy_t const &get_plot_xy() const {return plot_xy;}
 		bool has_tunnels() const {return !tunnels.empty();}
 		void set_cluster(unsigned id) {cluster_id = id;}
@@ -1270,6 +1314,58 @@ class city_road_gen_t : public road_gen_base_t {
 			tile_blocks.clear();
 			plot_colliders.clear();
 		}
+		// the same field list is used for both reading and writing the city layout cache; this is the state after connect_all_cities(),
+		// so streetlights, tile blocks, segment/intersection connectivity, and the route graph are recomputed from it rather than saved
+		template<typename S> void transfer_layout(S &s) {
+			s.vect(roads);
+			s.vect(segs);
+			s.vect(conn_roads);
+			for (unsigned i = 0; i < 3; ++i) {s.vect(isecs[i]);}
+			s.vect(plots);
+			s.vect(tracks);
+			s.vect(track_segs);
+			s.vect(parks);
+			s.vect(road_to_city);
+			s.pod(bcube);
+			s.pod(city_id);
+			s.pod(cluster_id);
+			s.pod(plot_xy.nx);
+			s.pod(plot_xy.ny);
+			vector<unsigned> conn(connected_to.begin(), connected_to.end());
+			s.vect(conn);
+			connected_to = set<unsigned>(conn.begin(), conn.end());
+			unsigned num_bridges(bridges.size()), num_tunnels(tunnels.size());
+			s.pod(num_bridges);
+
+			for (unsigned i = 0; i < num_bridges && s.is_good(); ++i) {
+				if (i == bridges.size()) {bridges.emplace_back(road_t(cube_t(), 0));} // reading; fields are filled in below
+				bridge_t &b(bridges[i]);
+				s.pod(static_cast<road_t &>(b));
+				s.pod(b.src_road);
+				s.pod(b.make_bridge);
+			}
+			s.pod(num_tunnels);
+
+			for (unsigned i = 0; i < num_tunnels && s.is_good(); ++i) {
+				if (i == tunnels.size()) {tunnels.emplace_back(road_t(cube_t(), 0));} // reading; fields are filled in below
+				tunnel_t &t(tunnels[i]);
+				s.pod(static_cast<road_t &>(t));
+				s.pod(t.src_road);
+				s.pod(t.ends);
+				s.pod(t.radius);
+				s.pod(t.height);
+				s.pod(t.facade_height);
+			}
+			plot_colliders.resize(plots.size());
+		}
+		void add_building_bcubes_hash(layout_hash_t &hash, vect_cube_t &bcubes) const { // for the parking lot cache key; bcubes is a temporary
+			for (auto i = plots.begin(); i != plots.end(); ++i) {
+				bcubes.clear();
+				get_building_bcubes(*i, bcubes);
+				hash.add(unsigned(bcubes.size()));
+				hash.add(bcubes.data(), bcubes.size()*sizeof(cube_t));
+			}
+		}
 		bool gen_road_grid(float road_width, float road_spacing) {
 			if (city_params.road_width > 0.5*city_params.road_spacing) {
 				cerr << "Error: City road_width should not be set larger than half the road spacing" << endl;
@@ -1585,6 +1681,60 @@ class city_road_gen_t : public road_gen_base_t {
 				} // for i
 			} // for n
 			for (auto r = roads.begin(); r != roads.end(); ++r) {tot_road_len += r->get_length();} // calculate tot_road_len
+			if (!is_global_rn) {build_route_graph();}
+		}
+		unsigned get_isec_ix(unsigned type, unsigned ix) const { // inverse of get_isec_by_ix()
+			assert(type < 3 && ix < isecs[type].size());
+			for (unsigned n = 0; n < type; ++n) {ix += isecs[n].size();}
+			return ix;
+		}
+		unsigned get_isec_ix(road_isec_t const *isec) const {
+			for (unsigned n = 0; n < 3; ++n) {
+				if (!isecs[n].empty() && isec >= &isecs[n].front() && isec <= &isecs[n].back()) {return get_isec_ix(n, (isec - &isecs[n].front()));}
+			}
+			assert(0); // not found
+			return 0;
+		}
+		void build_route_graph() { // must be called after segments and intersections are connected
+			unsigned const num_isecs(isecs[0].size() + isecs[1].size() + isecs[2].size());
+			float const road_width(city_params.road_width);
+			route_graph.init(num_isecs, 1.0*road_width, 0.25*road_width); // left turns may wait for oncoming traffic; right turns are slower than straight
+
+			for (unsigned n = 0; n < 3; ++n) { // 2-way, 3-way, 4-way
+				for (unsigned i = 0; i < isecs[n].size(); ++i) {
+					road_isec_t const &isec(isecs[n][i]);
+					unsigned const node(get_isec_ix(n, i));
+					route_graph.set_node_conn(node, isec.conn);
+
+					for (unsigned orient = 0; orient < 4; ++orient) {
+						if (!(isec.conn & (1<<orient)) || isec.conn_ix[orient] < 0) continue; // no connection, or connector road to another city (handled by the caller)
+						bool const dir(orient & 1);
+						unsigned seg_ix(isec.conn_ix[orient]);
+
+						for (unsigned num = 0; ; ++num) { // follow the chain of segments to the next intersection
+							assert(num < segs.size()); // no loops
+							assert(seg_ix < segs.size());
+							road_seg_t const &seg(segs[seg_ix]);
+							if (seg.conn_type[dir] == TYPE_RSEG) {seg_ix = seg.conn_ix[dir]; continue;}
+							assert(is_isect(seg.conn_type[dir]));
+							unsigned const dest(get_isec_ix((seg.conn_type[dir] - TYPE_ISEC2), seg.conn_ix[dir]));
+							route_graph.add_edge(node, dest, orient, p2p_dist_xy(isec.get_cube_center(), get_isec_by_ix(dest).get_cube_center()));
+							break;
+						} // for num
+					} // for orient
+				} // for i
+			} // for n
+			plot_dest_isec.resize(plots.size());
+
+			for (unsigned p = 0; p < plots.size(); ++p) { // cars drive to the intersection closest to the center of their destination plot
+				point const center(plots[p].get_cube_center());
+				float dmin_sq(0.0);
+
+				for (unsigned i = 0; i < num_isecs; ++i) {
+					float const dist_sq(p2p_dist_xy_sq(center, get_isec_by_ix(i).get_cube_center()));
+					if (dmin_sq == 0.0 || dist_sq < dmin_sq) {dmin_sq = dist_sq; plot_dest_isec[p] = i;}
+				}
+			} // for p
 		}
 		bool check_valid_conn_intersection(cube_t const &c, bool dim, bool dir, bool is_4_way) const {
 			return (is_4_way ? (find_3way_int_at(c, dim, dir) >= 0) : (find_conn_int_seg(c, dim, dir) >= 0));
@@ -1756,8 +1906,8 @@ class city_road_gen_t : public road_gen_base_t {
 			plot_xy.gen_adj_plots(plots);
 			//cout << "tile_to_block_map: " << tile_to_block_map.size() << ", tile_blocks: " << tile_blocks.size() << endl;
 		}
-		void gen_parking_lots_and_place_objects(vector<car_t> &cars, bool have_cars) {
-			city_obj_placer.gen_parking_and_place_objects(plots, plot_colliders, cars, city_id, have_cars);
+		void gen_parking_lots_and_place_objects(vector<car_t> &cars, bool have_cars, vector<city_obj_placer_t::plot_parking_t> *parking, bool from_cache) {
+			city_obj_placer.gen_parking_and_place_objects(plots, plot_colliders, cars, city_id, have_cars, parking, from_cache);
 			add_tile_blocks(city_obj_placer.parking_lots, tile_to_block_map, TYPE_PARK_LOT); // need to do this later, after gen_tile_blocks()
 			tile_to_block_map.clear(); // no longer needed
 		}
@@ -2340,7 +2490,17 @@ class city_road_gen_t : public road_gen_base_t {
 					orients[TURN_RIGHT] = stoplight_ns::conn_right[orient_in];
 
 					// use dest_seg.car_count to estimate traffic and route around?
-					if (car.dest_valid && car.cur_city != CONN_CITY_IX) { // Note: don't need to update dest logic on connector roads since there are no choices to make
+					int const route_orient((car.dest_valid && car.cur_city != CONN_CITY_IX) ? car_rn.get_car_route_orient(car, road_networks, global_rn) : -1);
+					bool use_route(0);
+
+					for (unsigned tdir = 0; tdir < 3 && route_orient >= 0; ++tdir) { // follow the shortest route if we can turn that way
+						if (orients[tdir] != (unsigned)route_orient || !isec.is_orient_currently_valid(orients[tdir], tdir)) continue;
+						car.turn_dir = tdir;
+						use_route    = 1;
+						break;
+					}
+					if (use_route) {} // done
+					else if (car.dest_valid && car.cur_city != CONN_CITY_IX) { // at dest, or no route; Note: don't need to update dest logic on connector roads since there are no choices to make
 						point const dest_pos(car_rn.get_car_dest_isec_center(car, road_networks, global_rn));
 						vector3d const dest_dir(dest_pos - car.get_center());
 						bool const pri_dim(fabs(dest_dir.x) < fabs(dest_dir.y)), pri_dir(dest_dir[pri_dim] > 0), sec_dir(dest_dir[!pri_dim] > 0);
@@ -2386,6 +2546,18 @@ class city_road_gen_t : public road_gen_base_t {
 			assert(get_car_rn(car, road_networks, global_rn).get_road_bcube_for_car(car, global_rn).intersects_xy(car.bcube)); // sanity check
 		}
 	private:
+		int get_car_route_orient(car_t &car, vector<road_network_t> const &road_networks, road_network_t const &global_rn) const { // returns -1 if there's no route
+			unsigned dest_node(car.dest_isec);
+
+			if (car.dest_city != city_id) { // destination in another city; route to the intersection with the connector road to that city
+				assert(car.dest_city < road_networks.size());
+				road_isec_t const *const isec(find_isec_to_dest_city(car, road_networks[car.dest_city], global_rn));
+				if (isec == nullptr) return -1;
+				dest_node = get_isec_ix(isec);
+			}
+			unsigned const cur_node(get_isec_ix(car.get_isec_type(), car.cur_seg));
+			return route_graph.get_next_orient(cur_node, car.get_orient(), dest_node);
+		}
 		point get_car_dest_isec_center(car_t &car, vector<road_network_t> const &road_networks, road_network_t const &global_rn) const {
 			if (car.dest_city == city_id) {return get_isec_by_ix(car.dest_isec).get_cube_center();} // local destination within the current city
 			assert(car.dest_city < road_networks.size());
@@ -2404,6 +2576,10 @@ class city_road_gen_t : public road_gen_base_t {
 		}
 	public:
 		bool choose_new_car_dest(car_t &car, rand_gen_t &rgen) const {
+			if (!plot_dest_isec.empty()) { // choose a random plot (buildings, parking lot, or park) as the destination
+				car.dest_isec = plot_dest_isec[rgen.rand() % plot_dest_isec.size()];
+				return 1;
+			}
 			unsigned const num_tot(isecs[0].size() + isecs[1].size() + isecs[2].size());
 			if (num_tot == 0) return 0; // no isecs to select
 			car.dest_isec = (unsigned short)(rgen.rand() % num_tot);
@@ -2429,6 +2605,27 @@ class city_road_gen_t : public road_gen_base_t {
 			//cout << TXT(city_id) << TXT(tot_road_len) << TXT(num_cars) << TXT(get_traffic_density()) << endl;
 			num_cars = 0;
 		}
+		void save_traffic_state(road_traffic_state_t &state) const {
+			for (unsigned n = 0; n < 3; ++n) {
+				for (auto i = isecs[n].begin(); i != isecs[n].end(); ++i) {state.stoplights.push_back(i->stoplight);}
+			}
+			for (auto i = segs.begin(); i != segs.end(); ++i) {state.seg_car_counts.push_back(i->car_count);}
+			state.city_num_cars.push_back(num_cars);
+		}
+		void restore_traffic_state(road_traffic_state_t const &state, unsigned &light_ix, unsigned &seg_ix, unsigned &rn_ix) const { // Note: only modifies mutable state
+			for (unsigned n = 0; n < 3; ++n) {
+				for (auto i = isecs[n].begin(); i != isecs[n].end(); ++i) {
+					assert(light_ix < state.stoplights.size());
+					i->stoplight.copy_car_state_from(state.stoplights[light_ix++]);
+				}
+			}
+			for (auto i = segs.begin(); i != segs.end(); ++i) {
+				assert(seg_ix < state.seg_car_counts.size());
+				i->car_count = state.seg_car_counts[seg_ix++];
+			}
+			assert(rn_ix < state.city_num_cars.size());
+			num_cars = state.city_num_cars[rn_ix++];
+		}
 		static road_network_t const &get_car_rn(car_base_t const &car, vector<road_network_t> const &road_networks, road_network_t const &global_rn) {
 			if (car.cur_city == CONN_CITY_IX) return global_rn;
 			assert(car.cur_city < road_networks.size());
@@ -2495,9 +2692,79 @@ class city_road_gen_t : public road_gen_base_t {
 	road_network_t global_rn; // connects cities together; no plots
 	road_draw_state_t dstate;
 	rand_gen_t rgen;
+	mutable rand_gen_t car_dest_rgen; // mutable so that it can be used in const car update logic
+	uint64_t layout_cache_key; // nonzero if the road layout is cached, in which case parking lots are cached as well
+
+	typedef city_obj_placer_t::plot_parking_t plot_parking_t;
 
 	static float rgen_uniform(float val1, float val2, rand_gen_t &rgen) {return (val1 + (val2 - val1)*rgen.rand_float());}
 
+	template<typename S> static void transfer_parking_lot(S &s, parking_lot_t &lot) {
+		s.pod(static_cast<cube_t &>(lot));
+		s.pod(lot.dim);
+		s.pod(lot.dir);
+		s.pod(lot.row_sz);
+		s.pod(lot.num_rows);
+		s.vect(lot.used_spaces);
+	}
+	template<typename S> static void transfer_parking(S &s, vector<vector<plot_parking_t>> &parking) { // indexed by city, then plot
+		unsigned num_cities(parking.size());
+		s.pod(num_cities);
+
+		for (unsigned c = 0; c < num_cities && s.is_good(); ++c) {
+			if (c == parking.size()) {parking.emplace_back();} // reading
+			vector<plot_parking_t> &city(parking[c]);
+			unsigned num_plots(city.size());
+			s.pod(num_plots);
+
+			for (unsigned p = 0; p < num_plots && s.is_good(); ++p) {
+				if (p == city.size()) {city.emplace_back();} // reading
+				plot_parking_t &pp(city[p]);
+				unsigned num_lots(pp.lots.size());
+				s.pod(num_lots);
+
+				for (unsigned i = 0; i < num_lots && s.is_good(); ++i) {
+					if (i == pp.lots.size()) {pp.lots.emplace_back(cube_t(), 0, 0);} // reading
+					transfer_parking_lot(s, pp.lots[i]);
+				}
+				s.vect(pp.cars);
+				s.vect(pp.colliders);
+			} // for p
+		} // for c
+	}
+	// hash of the road layout, the building bcubes in each plot, and the parking lot params; must be called after buildings are placed
+	uint64_t get_parking_cache_key(bool have_cars) const {
+		assert(layout_cache_key != 0);
+		layout_hash_t hash;
+		unsigned const uvals[5] = {CITY_GEN_VERSION, unsigned(have_cars), city_params.min_park_spaces, city_params.min_park_rows, unsigned(sizeof(car_t))};
+		float const fvals[3] = {city_params.min_park_density, city_params.max_park_density, get_min_obj_spacing()};
+		hash.add(layout_cache_key);
+		hash.add(uvals);
+		hash.add(fvals);
+		vect_cube_t bcubes;
+		for (auto i = road_networks.begin(); i != road_networks.end(); ++i) {i->add_building_bcubes_hash(hash, bcubes);}
+		return hash.get();
+	}
+	bool read_parking_cache(string const &fn, uint64_t key, vector<vector<plot_parking_t>> &parking) const {
+		layout_reader_t r;
+		if (!r.read_file(fn)) return 0; // not yet cached
+		if (!r.header(CITY_PARKING_CACHE_MAGIC, CITY_LAYOUT_CACHE_VERSION, key)) return 0; // stale, overwrite it
+		transfer_parking(r, parking);
+		bool valid(r.is_good() && r.at_end() && parking.size() == road_networks.size());
+
+		for (unsigned i = 0; i < parking.size() && valid; ++i) {
+			valid = (parking[i].size() == road_networks[i].num_plots());
+
+			for (auto p = parking[i].begin(); p != parking[i].end() && valid; ++p) {
+				for (auto l = p->lots.begin(); l != p->lots.end(); ++l) {valid &= (l->used_spaces.size() == unsigned(l->row_sz*l->num_rows));}
+			}
+		}
+		if (valid) return 1;
+		cerr << "Warning: Ignoring invalid city parking lot cache file " << fn << endl;
+		parking.clear();
+		return 0;
+	}
+
 	void assign_city_clusters() {
 		vector<unsigned char> used(road_networks.size(), 0);
 		vector<unsigned> pend;
@@ -2525,8 +2792,30 @@ class city_road_gen_t : public road_gen_base_t {
 	}
 
 public:
+	city_road_gen_t() : layout_cache_key(0) {}
 	bool empty() const {return road_networks.empty();}
 	bool has_tunnels() const {return global_rn.has_tunnels();}
+	void set_layout_cache_key(uint64_t key) {layout_cache_key = key;}
+
+	// the same field list is used for both reading and writing the city layout cache; called after connect_all_cities()
+	template<typename S> void transfer_layout(S &s) {
+		unsigned num_cities(road_networks.size());
+		s.pod(num_cities);
+
+		for (unsigned i = 0; i < num_cities && s.is_good(); ++i) {
+			if (i == road_networks.size()) {road_networks.emplace_back();} // reading; city_id and bcube are filled in by transfer_layout()
+			road_networks[i].transfer_layout(s);
+		}
+		global_rn.transfer_layout(s);
+		s.pod(rgen.rseed1);
+		s.pod(rgen.rseed2);
+	}
+	void finalize_cached_layout() {global_rn.finalize_bridges_and_tunnels();} // the part of connect_all_cities() that isn't saved
+	void clear_layout() { // used after a failed cache read
+		road_networks.clear();
+		global_rn = road_network_t();
+		rgen = rand_gen_t();
+	}
 	bool point_in_tunnel(point const &pos) const {return global_rn.point_in_tunnel(pos);}
 
 	road_network_t const &get_city(unsigned city_ix) const {
@@ -2746,7 +3035,22 @@ public:
 		for (auto i = road_networks.begin(); i != road_networks.end(); ++i) {i->calc_ix_values(road_networks, global_rn, global_plot_id);}
 	}
 	void gen_parking_lots_and_place_objects(vector<car_t> &cars, bool have_cars) {
-		for (auto i = road_networks.begin(); i != road_networks.end(); ++i) {i->gen_parking_lots_and_place_objects(cars, have_cars);}
+		// parking lots depend on building placement, so they're cached in a separate file from the road layout
+		uint64_t const cache_key(layout_cache_key ? get_parking_cache_key(have_cars) : 0);
+		string const cache_fn(cache_key ? get_layout_cache_fn("city_parking", cache_key) : string());
+		vector<vector<plot_parking_t>> parking;
+		bool const from_cache(!cache_fn.empty() && read_parking_cache(cache_fn, cache_key, parking));
+		if (from_cache) {cout << "Read city parking lot cache file " << cache_fn << endl;}
+		else if (!cache_fn.empty()) {parking.resize(road_networks.size());} // record parking lots for the cache
+
+		for (unsigned i = 0; i < road_networks.size(); ++i) {
+			road_networks[i].gen_parking_lots_and_place_objects(cars, have_cars, (parking.empty() ? nullptr : &parking[i]), from_cache);
+		}
+		if (cache_fn.empty() || from_cache) return;
+		layout_writer_t w;
+		w.header(CITY_PARKING_CACHE_MAGIC, CITY_LAYOUT_CACHE_VERSION, cache_key);
+		transfer_parking(w, parking);
+		if (w.write_file(cache_fn, "city parking lot")) {cout << "Wrote city parking lot cache file " << cache_fn << endl;}
 	}
 	void get_city_bcubes(vect_cube_t &bcubes) const {
 		for (auto r = road_networks.begin(); r != road_networks.end(); ++r) {bcubes.push_back(r->get_bcube());}
@@ -2820,6 +3124,19 @@ public:
 		global_rn.next_frame(); // not needed since there are no 3/4-way intersections/stoplights?
 	}
 	void register_car_at_city(unsigned city_id) const {get_city(city_id).register_car();} // Note: must be const
+	void save_traffic_state(road_traffic_state_t &state) const {
+		state = road_traffic_state_t();
+		for (auto r = road_networks.begin(); r != road_networks.end(); ++r) {r->save_traffic_state(state);}
+		global_rn.save_traffic_state(state);
+		state.car_dest_rgen = car_dest_rgen;
+	}
+	void restore_traffic_state(road_traffic_state_t const &state) const { // Note: only modifies mutable state
+		unsigned light_ix(0), seg_ix(0), rn_ix(0);
+		for (auto r = road_networks.begin(); r != road_networks.end(); ++r) {r->restore_traffic_state(state, light_ix, seg_ix, rn_ix);}
+		global_rn.restore_traffic_state(state, light_ix, seg_ix, rn_ix);
+		assert(light_ix == state.stoplights.size() && seg_ix == state.seg_car_counts.size() && rn_ix == state.city_num_cars.size());
+		car_dest_rgen = state.car_dest_rgen;
+	}
 	
 	bool add_car(car_t &car, rand_gen_t &rgen) const {
 		if (road_networks.empty()) return 0; // no cities to add cars to
@@ -2837,8 +3154,7 @@ public:
 		if (car.is_parked()) return 0; // no dest for parked cars
 		if (car.dest_valid && !car_at_dest(car)) return 0; // not yet at destination, keep existing dest
 		assert(!car.dest_valid || car.dest_city == car.cur_city); // sanity check
-		static rand_gen_t rgen; // reused across calls
-		choose_new_car_dest(car, rgen);
+		choose_new_car_dest(car, car_dest_rgen);
 		return 1;
 	}
 	void choose_new_car_dest(car_t &car, rand_gen_t &rgen) const {
@@ -2879,6 +3195,24 @@ public:
 		get_car_rn(car).update_car(car, rgen, road_networks, global_rn);
 		if (city_params.enable_car_path_finding) {update_car_dest(car);}
 	}
+	// returns 1 if update_car() only changes this car's speed and height and doesn't use a shared rgen or intersection state;
+	// such a car stays in its current road segment, and only reads the speed and position of its car in front
+	bool car_update_is_local(car_t const &car) const {
+		if (car.cur_city == NO_CITY_IX || car.is_parked()) return 1; // no update
+		if (car.in_isect() || car.stopped_at_light) return 0; // uses stoplights, turns, and may hand off to the next road segment
+		if (city_params.enable_car_path_finding && (!car.dest_valid || car_at_dest(car))) return 0; // chooses a new destination using car_dest_rgen
+		return get_road_bcube_for_car(car).contains_cube_xy(car.bcube); // not moving into an intersection
+	}
+	uint64_t get_car_isec_key(car_t const &car) const { // identifies the intersection the car is in or is driving toward
+		unsigned isec_type(car.cur_road_type), isec_ix(car.cur_seg);
+
+		if (!car.in_isect()) {
+			road_seg_t const &seg(get_car_rn(car).get_car_seg(car));
+			isec_type = seg.conn_type[car.dir];
+			isec_ix   = seg.conn_ix  [car.dir];
+		}
+		return ((uint64_t(car.cur_city) << 32) | (isec_type << 16) | isec_ix);
+	}
 	void update_car_seg_stats(car_base_t const &car) const {get_car_rn(car).update_car_seg_stats(car);}
 	road_isec_t const &get_car_isec(car_base_t const &car) const {return get_car_rn(car).get_car_isec(car);}
 	cube_t get_road_bcube_for_car(car_base_t const &car) const {return get_car_rn(car).get_road_bcube_for_car(car);}
@@ -2894,15 +3228,18 @@ cube_t car_manager_t::get_cb_bcube(car_block_t const &cb ) const {
 road_isec_t const &car_manager_t::get_car_isec(car_t const &car) const {return road_gen.get_car_isec(car);}
 bool car_manager_t::check_collision(car_t &c1, car_t &c2)        const {return c1.check_collision(c2, road_gen);}
 void car_manager_t::register_car_at_city(car_t const &car) {road_gen.register_car_at_city(car.cur_city);}
+void car_manager_t::save_traffic_state(road_traffic_state_t &state) const {road_gen.save_traffic_state(state);}
+void car_manager_t::restore_traffic_state(road_traffic_state_t const &state) const {road_gen.restore_traffic_state(state);}
 
 void car_manager_t::add_car() {
 	car_t car;
 	if (road_gen.add_car(car, rgen)) {cars.push_back(car);}
 }
 
-void car_manager_t::update_cars() {
-	for (auto i = cars.begin(); i != cars.end(); ++i) {road_gen.update_car(*i, rgen);} // run update logic
-}
+cube_t car_manager_t::get_bcube_for_car(car_t const &car) const {return road_gen.get_bcube_for_car(car);}
+bool car_manager_t::car_update_is_local(car_t const &car) const {return road_gen.car_update_is_local(car);}
+uint64_t car_manager_t::get_car_isec_key(car_t const &car) const {return road_gen.get_car_isec_key(car);}
+void car_manager_t::update_car(car_t &car) {road_gen.update_car(car, rgen);}
 
 void car_manager_t::get_car_ix_range_for_cube(vector<car_block_t>::const_iterator cb, cube_t const &bc, unsigned &start, unsigned &end) const {
 	start = cb->start; end = (cb+1)->start;
@@ -3095,15 +3432,91 @@ public:
 		if (params.roads_enabled()) {road_gen.gen_roads(pos_range, params.road_width, params.road_spacing);}
 		return 1;
 	}
+	// hash of everything city placement and road generation depend on, including the heightmap before flattening, used as the layout cache key
+	uint64_t get_layout_cache_key(city_params_t const &params) const {
+		layout_hash_t hash;
+		unsigned const uvals[20] = {CITY_GEN_VERSION, unsigned(sizeof(road_t)), unsigned(sizeof(road_seg_t)), unsigned(sizeof(road_isec_t)), unsigned(sizeof(road_plot_t)),
+			params.num_cities, params.num_samples, params.num_conn_tries, params.city_size_min, params.city_size_max, params.city_border, params.road_border,
+			params.slope_width, params.num_rr_tracks, params.park_rate, params.make_4_way_ints, xsize, ysize, unsigned(rgen.rseed1), unsigned(rgen.rseed2)};
+		float const fvals[9] = {params.road_width, params.road_spacing, params.conn_road_seg_len, params.max_road_slope, X_SCENE_SIZE, Y_SCENE_SIZE, DX_VAL, DY_VAL, water_plane_z};
+		hash.add(uvals);
+		hash.add(fvals);
+		hash.add(heightmap, size_t(xsize)*ysize*sizeof(float));
+		return hash.get();
+	}
+	// the same field list is used for both reading and writing the city layout cache
+	template<typename S> void transfer_layout(S &s, cube_t &cities_bcube) {
+		s.vect(used);
+		s.vect(plots);
+		s.pod(bcube);
+		s.pod(rgen.rseed1);
+		s.pod(rgen.rseed2);
+		s.pod(cities_bcube);
+		road_gen.transfer_layout(s);
+	}
+	bool write_layout_cache(string const &fn, uint64_t key, cube_t cities_bcube, vector<float> const &orig_heightmap) {
+		layout_writer_t w;
+		w.header(CITY_LAYOUT_CACHE_MAGIC, CITY_LAYOUT_CACHE_VERSION, key);
+		transfer_layout(w, cities_bcube);
+		vector<unsigned> hmap_ixs; // heightmap delta from city, road, and track flattening
+		vector<float> hmap_vals;
+
+		for (unsigned i = 0; i < orig_heightmap.size(); ++i) {
+			if (heightmap[i] != orig_heightmap[i]) {hmap_ixs.push_back(i); hmap_vals.push_back(heightmap[i]);}
+		}
+		w.vect(hmap_ixs);
+		w.vect(hmap_vals);
+		return w.write_file(fn, "city layout");
+	}
+	bool read_layout_cache(string const &fn, uint64_t key, cube_t &cities_bcube) {
+		layout_reader_t r;
+		if (!r.read_file(fn)) return 0; // not yet cached
+		if (!r.header(CITY_LAYOUT_CACHE_MAGIC, CITY_LAYOUT_CACHE_VERSION, key)) return 0; // stale, overwrite it
+		rand_gen_t const orig_rgen(rgen);
+		transfer_layout(r, cities_bcube);
+		vector<unsigned> hmap_ixs;
+		vector<float> hmap_vals;
+		r.vect(hmap_ixs);
+		r.vect(hmap_vals);
+		bool valid(r.is_good() && r.at_end() && hmap_ixs.size() == hmap_vals.size());
+		for (auto i = hmap_ixs.begin(); i != hmap_ixs.end() && valid; ++i) {valid = (*i < xsize*ysize);}
+
+		if (!valid) {
+			cerr << "Warning: Ignoring invalid city layout cache file " << fn << endl;
+			used.clear();
+			plots.clear();
+			bcube = cities_bcube = cube_t(all_zeros);
+			rgen = orig_rgen;
+			road_gen.clear_layout();
+			return 0;
+		}
+		for (unsigned i = 0; i < hmap_ixs.size(); ++i) {heightmap[hmap_ixs[i]] = hmap_vals[i];}
+		road_gen.finalize_cached_layout();
+		return 1;
+	}
 	void gen_cities(city_params_t const &params) {
 		if (params.num_cities == 0) return;
 		cube_t cities_bcube(all_zeros);
-		{ // open a scope
+		// the cache is only used when generating from scratch; the key hashes the entire heightmap, so only compute it if caching is enabled
+		bool const can_cache(!building_layout_cache_dir.empty() && road_gen.empty() && plots.empty());
+		uint64_t const cache_key(can_cache ? get_layout_cache_key(params) : 0);
+		string const cache_fn(can_cache ? get_layout_cache_fn("city_roads", cache_key) : string());
+		bool const from_cache(!cache_fn.empty() && read_layout_cache(cache_fn, cache_key, cities_bcube));
+		vector<float> orig_heightmap; // for the heightmap delta saved to the cache
+
+		if (from_cache) {cout << "Read city layout cache file " << cache_fn << endl;}
+		else {
+			if (!cache_fn.empty()) {orig_heightmap.assign(heightmap, (heightmap + size_t(xsize)*ysize));}
 			timer_t t("Choose City Location");
 			for (unsigned n = 0; n < params.num_cities; ++n) {gen_city(params, cities_bcube);}
 		}
 		if (!cities_bcube.is_all_zeros()) {set_buildings_pos_range(cities_bcube);}
-		road_gen.connect_all_cities(heightmap, xsize, ysize, params.road_width, params.road_spacing);
+
+		if (!from_cache) {
+			road_gen.connect_all_cities(heightmap, xsize, ysize, params.road_width, params.road_spacing);
+			if (!cache_fn.empty() && write_layout_cache(cache_fn, cache_key, cities_bcube, orig_heightmap)) {cout << "Wrote city layout cache file " << cache_fn << endl;}
+		}
+		road_gen.set_layout_cache_key(cache_key); // enables the parking lot cache
 		road_gen.add_streetlights();
 		road_gen.gen_tile_blocks();
 		car_manager.init_cars(city_params.num_cars);
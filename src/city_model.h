@@ -28,9 +28,9 @@ struct city_model_t {
 class city_model_loader_t : public model3ds {
 protected:
 	vector<int> models_valid;
-	void ensure_models_loaded() {if (empty()) {load_models();}}
 public:
 	virtual ~city_model_loader_t() {}
+	void ensure_models_loaded() {if (empty()) {load_models();}}
 	virtual bool has_low_poly_model() {return 0;}
 	virtual unsigned num_models() const = 0;
 	virtual city_model_t const &get_model(unsigned id) const = 0;
@@ -4,12 +4,25 @@
 
 #include "3DWorld.h"
 #include "cobj_bsp_tree.h"
+#include "profiler.h"
+#include <cfloat> // for FLT_MAX
+
+#if defined(__AVX__) || defined(__AVX2__)
+#include <immintrin.h>
+#define BVH_PACKET_AVX
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define BVH_PACKET_SSE
+#endif
 
 
 unsigned const MAX_LEAF_SIZE = 2;
 float const POLY_TOLER       = 1.0E-6;
 float const OVERLAP_AMT      = 0.02;
 
+bool benchmark_cobj_bvh(0), cobj_bvh_refit(0);
+unsigned cobj_bvh_width(0); // 0 = binary BVH, 4 or 8 = SAH wide BVH for the static cobj tree
+float const REFIT_MAX_AREA_GROWTH = 2.0; // rebuild refit subtrees whose bounds have grown by more than this factor in area
 
 extern bool mt_cobj_tree_build, begin_motion;
 extern int display_mode, frame_counter, cobj_counter;
@@ -362,6 +375,257 @@ void cobj_tree_sphere_t::get_ids_int_sphere(point const &center, float radius, v
 }
 
 
+// *** cobj_wide_bvh_t ***
+
+
+unsigned const SAH_NUM_BINS  = 16;
+unsigned const SAH_MAX_LEAF  = 8;
+unsigned const SAH_MAX_DEPTH = cobj_wide_bvh_t::MAX_DEPTH/2; // switch to median splits below this depth, which halve the object count at each level
+float const SAH_TRAVERSE_COST = 1.0;
+float const SAH_ISECT_COST    = 1.0;
+
+void cobj_wide_bvh_t::clear() {
+	nodes.clear();
+	cixs.clear();
+	width = max_depth = num_leaves = 0;
+	sah_cost = 0.0;
+}
+
+void cobj_wide_bvh_t::build(vector<unsigned> const &cids, coll_obj_group const &cobjs, unsigned width_) {
+
+	assert(width_ >= 2 && width_ <= MAX_WIDTH);
+	clear();
+	if (cids.empty()) return;
+	width = width_;
+	unsigned const num(cids.size());
+	obj_bcubes.resize(num);
+	obj_centers.resize(num);
+	order.resize(num);
+
+	for (unsigned i = 0; i < num; ++i) {
+		obj_bcubes [i] = cobjs[cids[i]];
+		obj_centers[i] = obj_bcubes[i].get_cube_center();
+		order      [i] = i;
+	}
+	bnodes.reserve(2*num);
+	build_binary(0, num, 1);
+	bcube = bnodes[0].bc;
+	cixs.resize(num);
+	for (unsigned i = 0; i < num; ++i) {cixs[i] = cids[order[i]];} // leaf order
+	nodes.reserve(bnodes.size()/(width - 1) + 1);
+
+	if (bnodes[0].is_leaf()) { // single leaf: add a root node with one leaf child so that queries don't need a special case
+		nodes.emplace_back();
+		node_t &root(nodes.back());
+		root.set_kid_bcube(0, bcube);
+		root.kid  [0] = 0;
+		root.count[0] = num;
+		root.num_kids = 1;
+		num_leaves    = max_depth = 1;
+		sah_cost      = SAH_TRAVERSE_COST + SAH_ISECT_COST*num;
+	}
+	else {collapse(0, 1);}
+	float const root_area(max(bcube.get_area(), TOLERANCE));
+	sah_cost /= root_area; // normalize by root area
+	vector<build_node_t>().swap(bnodes); // free temporary data
+	vector<cube_t>().swap(obj_bcubes);
+	vector<point >().swap(obj_centers);
+	vector<unsigned>().swap(order);
+}
+
+unsigned cobj_wide_bvh_t::build_binary(unsigned start, unsigned end, unsigned depth) { // binned SAH build over [start, end) of order
+
+	unsigned const bnix(bnodes.size()), num(end - start);
+	cube_t bc(obj_bcubes[order[start]]), cbc(obj_centers[order[start]]); // bounds and centroid bounds
+
+	for (unsigned i = start+1; i < end; ++i) {
+		bc .union_with_cube(obj_bcubes [order[i]]);
+		cbc.union_with_pt  (obj_centers[order[i]]);
+	}
+	bnodes.emplace_back(bc, start, num);
+	if (num <= 2) return bnix; // small leaf
+	if (depth >= MAX_DEPTH) return bnix; // depth limit, so that traversal stacks can't overflow; not reached in practice due to the median splits below
+
+	if (depth >= SAH_MAX_DEPTH) { // deep subtree from unbalanced SAH splits; split by count to bound the depth
+		if (num <= SAH_MAX_LEAF) return bnix;
+		unsigned const mid(start + num/2);
+		unsigned const dim(get_max_dim(cbc.get_size()));
+		std::nth_element((order.data() + start), (order.data() + mid), (order.data() + end), [&](unsigned a, unsigned b) {return (obj_centers[a][dim] < obj_centers[b][dim]);});
+		int const kid0(build_binary(start, mid, depth+1)), kid1(build_binary(mid, end, depth+1)); // Note: invalidates references into bnodes
+		bnodes[bnix].kids[0] = kid0;
+		bnodes[bnix].kids[1] = kid1;
+		return bnix;
+	}
+
+	struct bin_t {
+		cube_t bc;
+		unsigned count=0;
+		void add(cube_t const &c) {if (count++ == 0) {bc = c;} else {bc.union_with_cube(c);}}
+	};
+	float best_cost(FLT_MAX), best_sval(0.0);
+	unsigned best_dim(0);
+
+	for (unsigned dim = 0; dim < 3; ++dim) {
+		float const lo(cbc.d[dim][0]), extent(cbc.d[dim][1] - lo);
+		if (extent <= 0.0) continue; // all centers are equal in this dim
+		float const bin_scale(SAH_NUM_BINS/extent);
+		bin_t bins[SAH_NUM_BINS];
+
+		for (unsigned i = start; i < end; ++i) {
+			unsigned const bix(min(SAH_NUM_BINS-1, unsigned((obj_centers[order[i]][dim] - lo)*bin_scale)));
+			bins[bix].add(obj_bcubes[order[i]]);
+		}
+		// sweep from the right to compute suffix areas and counts, then from the left to evaluate each split
+		float right_area[SAH_NUM_BINS];
+		unsigned right_count[SAH_NUM_BINS];
+		bin_t acc;
+
+		for (unsigned b = SAH_NUM_BINS-1; b > 0; --b) {
+			if (bins[b].count > 0) {acc.add(bins[b].bc); acc.count += bins[b].count - 1;}
+			right_area [b] = ((acc.count > 0) ? acc.bc.get_area() : 0.0);
+			right_count[b] = acc.count;
+		}
+		acc = bin_t();
+
+		for (unsigned b = 0; b+1 < SAH_NUM_BINS; ++b) { // split between b and b+1
+			if (bins[b].count > 0) {acc.add(bins[b].bc); acc.count += bins[b].count - 1;}
+			if (acc.count == 0 || right_count[b+1] == 0) continue;
+			float const cost(acc.bc.get_area()*acc.count + right_area[b+1]*right_count[b+1]);
+			if (cost < best_cost) {best_cost = cost; best_dim = dim; best_sval = lo + (b+1)/bin_scale;}
+		}
+	}
+	float const leaf_cost(SAH_ISECT_COST*num), split_cost(SAH_TRAVERSE_COST + SAH_ISECT_COST*best_cost/max(bc.get_area(), TOLERANCE));
+	if (num <= SAH_MAX_LEAF && (best_cost == FLT_MAX || leaf_cost <= split_cost)) return bnix; // leaf is cheaper
+	unsigned mid(start);
+
+	if (best_cost == FLT_MAX) { // all centers are the same; split by count
+		mid = start + num/2;
+	}
+	else {
+		unsigned *const split(std::partition((order.data() + start), (order.data() + end), [&](unsigned i) {return (obj_centers[i][best_dim] < best_sval);}));
+		mid = unsigned(split - order.data());
+		if (mid == start || mid == end) {mid = start + num/2;} // FP rounding at bin boundary
+	}
+	int const kid0(build_binary(start, mid, depth+1)), kid1(build_binary(mid, end, depth+1)); // Note: invalidates references into bnodes
+	bnodes[bnix].kids[0] = kid0;
+	bnodes[bnix].kids[1] = kid1;
+	return bnix;
+}
+
+unsigned cobj_wide_bvh_t::collapse(unsigned bnix, unsigned depth) { // returns the wide node index
+
+	assert(!bnodes[bnix].is_leaf());
+	assert(depth <= MAX_DEPTH); // wide depth is no greater than binary depth
+	max_depth = max(max_depth, depth);
+	unsigned kids[MAX_WIDTH] = {unsigned(bnodes[bnix].kids[0]), unsigned(bnodes[bnix].kids[1])}, num_kids(2);
+
+	while (num_kids < width) { // open the internal child with the largest surface area
+		int best(-1);
+		float best_area(0.0);
+
+		for (unsigned k = 0; k < num_kids; ++k) {
+			build_node_t const &bn(bnodes[kids[k]]);
+			if (bn.is_leaf()) continue;
+			float const area(bn.bc.get_area());
+			if (best < 0 || area > best_area) {best = k; best_area = area;}
+		}
+		if (best < 0) break; // all leaves
+		build_node_t const &bn(bnodes[kids[best]]);
+		kids[best]       = bn.kids[0];
+		kids[num_kids++] = bn.kids[1];
+	}
+	unsigned const nix(nodes.size());
+	nodes.emplace_back();
+	nodes[nix].num_kids = num_kids;
+	sah_cost += SAH_TRAVERSE_COST*bnodes[bnix].bc.get_area();
+
+	for (unsigned k = 0; k < num_kids; ++k) {
+		build_node_t const &bn(bnodes[kids[k]]);
+		nodes[nix].set_kid_bcube(k, bn.bc);
+
+		if (bn.is_leaf()) {
+			assert(bn.count < 65536);
+			nodes[nix].kid  [k] = bn.start;
+			nodes[nix].count[k] = bn.count;
+			sah_cost += SAH_ISECT_COST*bn.bc.get_area()*bn.count;
+			++num_leaves;
+		}
+		else {
+			unsigned const kid(collapse(kids[k], depth+1)); // Note: invalidates references into nodes
+			nodes[nix].kid  [k] = kid;
+			nodes[nix].count[k] = 0;
+		}
+	}
+	return nix;
+}
+
+void cobj_wide_bvh_t::print_stats() const {
+	cout << "wide BVH: width: " << width << ", objects: " << cixs.size() << ", nodes: " << nodes.size() << ", leaves: " << num_leaves
+		 << ", depth: " << max_depth << ", SAH cost: " << sah_cost << ", mem: " << (nodes.size()*sizeof(node_t) + cixs.size()*sizeof(unsigned)) << endl;
+}
+
+// returns a bitmask of child bboxes intersected by the line segment, and the entry t values of those children;
+// unused kids have empty bounds, so the SIMD paths can test all lanes
+unsigned cobj_wide_bvh_t::node_t::line_clip_mask(point const &p1, vector3d const &dinv, bool const neg[3], float tmax_, float tnear[MAX_WIDTH]) const {
+
+	unsigned mask(0);
+	float const *const near_planes[3] = {(neg[0] ? hi[0] : lo[0]), (neg[1] ? hi[1] : lo[1]), (neg[2] ? hi[2] : lo[2])};
+	float const *const far_planes [3] = {(neg[0] ? lo[0] : hi[0]), (neg[1] ? lo[1] : hi[1]), (neg[2] ? lo[2] : hi[2])};
+#if defined(BVH_PACKET_AVX)
+	__m256 tmin(_mm256_setzero_ps()), tmax(_mm256_set1_ps(tmax_));
+
+	for (unsigned dim = 0; dim < 3; ++dim) {
+		__m256 const orig(_mm256_set1_ps(p1[dim])), di(_mm256_set1_ps(dinv[dim]));
+		__m256 const t1(_mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(near_planes[dim]), orig), di));
+		__m256 const t2(_mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(far_planes [dim]), orig), di));
+		tmax = _mm256_min_ps(t2, tmax);
+		tmin = _mm256_max_ps(t1, tmin);
+	}
+	_mm256_storeu_ps(tnear, tmin);
+	mask = _mm256_movemask_ps(_mm256_cmp_ps(tmin, tmax, _CMP_LT_OQ));
+#elif defined(BVH_PACKET_SSE)
+	for (unsigned i = 0; i < MAX_WIDTH; i += 4) {
+		__m128 tmin(_mm_setzero_ps()), tmax(_mm_set1_ps(tmax_));
+
+		for (unsigned dim = 0; dim < 3; ++dim) {
+			__m128 const orig(_mm_set1_ps(p1[dim])), di(_mm_set1_ps(dinv[dim]));
+			__m128 const t1(_mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(near_planes[dim]+i), orig), di));
+			__m128 const t2(_mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(far_planes [dim]+i), orig), di));
+			tmax = _mm_min_ps(t2, tmax);
+			tmin = _mm_max_ps(t1, tmin);
+		}
+		_mm_storeu_ps(tnear+i, tmin);
+		mask |= unsigned(_mm_movemask_ps(_mm_cmplt_ps(tmin, tmax))) << i;
+		if (i+4 >= num_kids) break; // no more valid kids
+	}
+#else
+	for (unsigned k = 0; k < num_kids; ++k) {
+		float tmin(0.0), tmax(tmax_);
+
+		for (unsigned dim = 0; dim < 3; ++dim) {
+			float const t1((near_planes[dim][k] - p1[dim])*dinv[dim]), t2((far_planes[dim][k] - p1[dim])*dinv[dim]);
+			if (t2 < tmax) {tmax = t2;} if (t1 > tmin) {tmin = t1;}
+		}
+		tnear[k] = tmin;
+		if (tmin < tmax) {mask |= (1U << k);}
+	}
+#endif
+	return (mask & ((1U << num_kids) - 1)); // mask off unused kids
+}
+
+unsigned cobj_wide_bvh_t::node_t::cube_overlap_mask(cube_t const &c) const { // includes adjacency, like cube_t::intersects()
+
+	unsigned mask(0);
+
+	for (unsigned k = 0; k < num_kids; ++k) {
+		bool ret(1);
+		UNROLL_3X(ret &= !(c.d[i_][1] < lo[i_][k] || c.d[i_][0] > hi[i_][k]);)
+		if (ret) {mask |= (1U << k);}
+	}
+	return mask;
+}
+
+
 // *** cobj_bvh_tree ***
 
 
@@ -396,11 +660,23 @@ void cobj_bvh_tree::clear() {
 
 	cobj_tree_base::clear();
 	cixs.resize(0);
+	wide_bvh.clear();
+	refit_cids.clear();
+	build_area.clear();
+	++version;
 }
 
 
-void cobj_bvh_tree::add_cobjs(bool verbose) {
+void cobj_bvh_tree::add_cobjs(bool verbose, bool allow_refit) {
 
+	if (allow_refit) {
+		vector<unsigned> cids;
+		cixs.swap(cids); // save the current leaves
+		create_cixs();
+		cixs.swap(cids); // restore the current leaves; cids is now the new cobj list
+		update_from_cids(cids, 1);
+		return;
+	}
 	RESET_TIME;
 	clear();
 	if (!create_cixs()) return; // nothing to be done
@@ -412,6 +688,10 @@ void cobj_bvh_tree::add_cobjs(bool verbose) {
 		cout << "cobjs: " << cobjs->size() << ", leaves: " << cixs.size() << ", nodes: " << nodes.size()
 				<< ", depth: " << max_depth << ", max_leaves: " << max_leaf_count << ", leaf_nodes: " << num_leaf_nodes << endl;
 	}
+	if (cobj_bvh_width > 0 && is_static && !occluders_only) { // only for the static tree, which is used for ray tracing
+		build_wide_bvh(cobj_bvh_width, verbose);
+		if (benchmark_cobj_bvh && !benchmark_done) {benchmark_queries(100000); benchmark_done = 1;} // run once per tree, on its first build
+	}
 }
 
 
@@ -435,9 +715,102 @@ void cobj_bvh_tree::build_tree_from_cixs(bool do_mt_build) {
 }
 
 
+// refits the tree in place if it was built from this same set of cobjs, otherwise does a full rebuild
+void cobj_bvh_tree::update_from_cids(vector<unsigned> const &cids, bool allow_refit) {
+
+	if (allow_refit && !nodes.empty() && cids == refit_cids) {refit_tree(); return;} // common case for moving platforms
+	clear();
+	if (cids.empty()) return;
+	add_cobj_ids(cids);
+	build_tree_from_cixs(0);
+	if (!allow_refit) return;
+	refit_cids = cids;
+	record_build_areas();
+}
+
+void cobj_bvh_tree::record_build_areas() {
+
+	build_area.resize(nodes.size());
+	for (unsigned i = 0; i < nodes.size(); ++i) {build_area[i] = nodes[i].get_area();}
+}
+
+void cobj_bvh_tree::refit_tree() {
+
+	assert(build_area.size() == nodes.size());
+	++version;
+
+	for (unsigned nix = (unsigned)nodes.size(); nix-- > 0;) { // update bounds bottom-up; kids always come after their parent
+		tree_node &n(nodes[nix]);
+		if (n.start < n.end) {calc_node_bbox(n); continue;} // leaf
+		unsigned kid(nix+1);
+		assert(kid < n.next_node_id);
+		n.copy_from(nodes[kid]);
+		for (kid = nodes[kid].next_node_id; kid < n.next_node_id; kid = nodes[kid].next_node_id) {n.union_with_cube(nodes[kid]);}
+	}
+	for (unsigned nix = 0; nix < nodes.size();) { // rebuild the largest subtrees that have degraded, top-down
+		tree_node const &n(nodes[nix]);
+		if (n.start < n.end || build_area[nix] == 0.0 || n.get_area() <= REFIT_MAX_AREA_GROWTH*build_area[nix]) {++nix; continue;}
+		rebuild_subtree(nix);
+		nix = nodes[nix].next_node_id; // skip the new subtree
+	}
+}
+
+void cobj_bvh_tree::rebuild_subtree(unsigned nix) {
+
+	unsigned const old_end(nodes[nix].next_node_id);
+	unsigned start(cixs.size()), end(0);
+
+	for (unsigned i = nix; i < old_end; ++i) { // leaves of a subtree are contiguous in cixs
+		if (nodes[i].start < nodes[i].end) {start = min(start, nodes[i].start); end = max(end, nodes[i].end);}
+	}
+	assert(start < end);
+	// build the new subtree into temporary nodes at the end, then move it into place
+	unsigned const tmp_base(nodes.size());
+	nodes.resize(tmp_base + get_conservative_num_nodes(end - start));
+	nodes[tmp_base] = tree_node(start, end);
+	per_thread_data ptd(tmp_base+1, nodes.size(), 1);
+	build_tree(tmp_base, 0, 0, ptd);
+	unsigned const new_end(ptd.get_next_node_ix());
+	nodes[tmp_base].next_node_id = new_end;
+	vector<tree_node> sub(nodes.begin()+tmp_base, nodes.begin()+new_end);
+	nodes.resize(tmp_base);
+	int const delta(int(sub.size()) - int(old_end - nix));
+
+	for (unsigned i = 0; i < nix; ++i) { // ancestors skip past the subtree
+		if (nodes[i].next_node_id >= old_end) {nodes[i].next_node_id += delta;}
+	}
+	for (unsigned i = old_end; i < nodes.size(); ++i) {nodes[i].next_node_id += delta;}
+	for (auto i = sub.begin(); i != sub.end(); ++i) {i->next_node_id = i->next_node_id - tmp_base + nix;}
+	nodes.erase (nodes.begin()+nix, nodes.begin()+old_end);
+	nodes.insert(nodes.begin()+nix, sub.begin(), sub.end());
+	build_area.erase (build_area.begin()+nix, build_area.begin()+old_end);
+	build_area.insert(build_area.begin()+nix, sub.size(), 0.0);
+	for (unsigned i = nix; i < nix + sub.size(); ++i) {build_area[i] = nodes[i].get_area();}
+}
+
+
+bool cobj_bvh_tree::skip_line_cobj(coll_obj const &c, point const &p1, int test_alpha, float max_alpha, bool skip_non_drawn, bool skip_init_colls, bool skip_movable) const {
+
+	if (!obj_ok(c))                  return 1;
+	if (skip_non_drawn  && !c.cp.might_be_drawn())                    return 1;
+	if (skip_movable    && c.is_movable())                            return 1;
+	if (test_alpha == 1 && c.is_semi_trans())                         return 1; // semi-transparent, can see through
+	if (test_alpha == 2 && c.cp.color.alpha <= max_alpha)             return 1; // lower alpha than an earlier object
+	if (test_alpha == 3 && c.cp.color.alpha < MIN_SHADOW_ALPHA)       return 1; // less than min alpha
+	if (skip_init_colls && c.contains_pt(p1) && c.contains_point(p1)) return 1;
+	return 0;
+}
+
 // test_alpha: 0 = allow any alpha value, 1 = require alpha = 1.0, 2 = get intersected cobj with max alpha, 3 = require alpha >= MIN_SHADOW_ALPHA
 bool cobj_bvh_tree::check_coll_line(point const &p1, point const &p2, point &cpos, vector3d &cnorm, int &cindex,
 	int ignore_cobj, bool exact, int test_alpha, bool skip_non_drawn, bool skip_init_colls, bool skip_movable) const
+{
+	if (!wide_bvh.empty()) {return check_coll_line_wide  (p1, p2, cpos, cnorm, cindex, ignore_cobj, exact, test_alpha, skip_non_drawn, skip_init_colls, skip_movable);}
+	else                   {return check_coll_line_binary(p1, p2, cpos, cnorm, cindex, ignore_cobj, exact, test_alpha, skip_non_drawn, skip_init_colls, skip_movable);}
+}
+
+bool cobj_bvh_tree::check_coll_line_binary(point const &p1, point const &p2, point &cpos, vector3d &cnorm, int &cindex,
+	int ignore_cobj, bool exact, int test_alpha, bool skip_non_drawn, bool skip_init_colls, bool skip_movable) const
 {
 	if (nodes.empty()) return 0;
 	bool ret(0);
@@ -454,14 +827,8 @@ bool cobj_bvh_tree::check_coll_line(point const &p1, point const &p2, point &cpo
 			// Note: we probably don't need to return cnorm and cpos in inexact mode, but it shouldn't be too expensive to do so
 			if ((int)cixs[i] == ignore_cobj) continue;
 			coll_obj const &c(get_cobj(i));
-			if (!obj_ok(c))                  continue;
-			if (skip_non_drawn  && !c.cp.might_be_drawn())                    continue;
-			if (skip_movable    && c.is_movable())                            continue;
-			if (test_alpha == 1 && c.is_semi_trans())                         continue; // semi-transparent, can see through
-			if (test_alpha == 2 && c.cp.color.alpha <= max_alpha)             continue; // lower alpha than an earlier object
-			if (test_alpha == 3 && c.cp.color.alpha < MIN_SHADOW_ALPHA)       continue; // less than min alpha
-			if (skip_init_colls && c.contains_pt(p1) && c.contains_point(p1)) continue;
-			if (!c.line_int_exact(p1, p2, t, cnorm, tmin, tmax))              continue;
+			if (skip_line_cobj(c, p1, test_alpha, max_alpha, skip_non_drawn, skip_init_colls, skip_movable)) continue;
+			if (!c.line_int_exact(p1, p2, t, cnorm, tmin, tmax)) continue;
 			cindex = cixs[i];
 			cpos   = p1 + (p2 - p1)*t;
 			//if (c.type == COLL_POLYGON && dot_product((p2 - p1), c.norm) < 0.0) {} // back-facing polygon test
@@ -477,6 +844,288 @@ bool cobj_bvh_tree::check_coll_line(point const &p1, point const &p2, point &cpo
 }
 
 
+bool cobj_bvh_tree::check_coll_line_wide(point const &p1, point const &p2, point &cpos, vector3d &cnorm, int &cindex,
+	int ignore_cobj, bool exact, int test_alpha, bool skip_non_drawn, bool skip_init_colls, bool skip_movable) const
+{
+	unsigned const STACK_SIZE(cobj_wide_bvh_t::STACK_SIZE);
+	struct stack_entry_t {unsigned nix; float tnear;};
+	stack_entry_t stack[STACK_SIZE];
+	unsigned stack_sz(0);
+	bool ret(0);
+	float t(0.0), tmax(1.0), max_alpha(0.0);
+	vector3d dinv(p2 - p1);
+	dinv.invert();
+	bool const neg[3] = {(dinv.x < 0.0f), (dinv.y < 0.0f), (dinv.z < 0.0f)};
+	stack[stack_sz++] = {0, 0.0f}; // root
+
+	while (stack_sz > 0) {
+		stack_entry_t const se(stack[--stack_sz]);
+		if (se.tnear >= tmax) continue; // beyond the closest hit so far
+		cobj_wide_bvh_t::node_t const &n(wide_bvh.nodes[se.nix]);
+		float tnear[cobj_wide_bvh_t::MAX_WIDTH];
+		unsigned const mask(n.line_clip_mask(p1, dinv, neg, tmax, tnear));
+		if (mask == 0) continue;
+		unsigned order[cobj_wide_bvh_t::MAX_WIDTH], num_hit(0);
+
+		for (unsigned k = 0; k < n.num_kids; ++k) { // insertion sort hit kids near to far
+			if (!(mask & (1U << k))) continue;
+			unsigned pos(num_hit++);
+			for (; pos > 0 && tnear[order[pos-1]] > tnear[k]; --pos) {order[pos] = order[pos-1];}
+			order[pos] = k;
+		}
+		for (unsigned i = 0; i < num_hit; ++i) { // test leaves near to far
+			unsigned const k(order[i]);
+			if (!n.is_leaf(k)) continue;
+			if (tnear[k] >= tmax) break; // remaining kids are farther than the closest hit
+
+			for (unsigned j = n.kid[k]; j < n.kid[k] + n.count[k]; ++j) {
+				unsigned const cix(wide_bvh.cixs[j]);
+				if ((int)cix == ignore_cobj) continue;
+				coll_obj const &c((*cobjs)[cix]);
+				if (skip_line_cobj(c, p1, test_alpha, max_alpha, skip_non_drawn, skip_init_colls, skip_movable)) continue;
+				if (!c.line_int_exact(p1, p2, t, cnorm, 0.0, tmax)) continue;
+				cindex = cix;
+				cpos   = p1 + (p2 - p1)*t;
+				if (!exact && test_alpha != 2) return 1; // return first hit
+				max_alpha = c.cp.color.alpha; // we need all intersections to find the max alpha
+				tmax = t;
+				ret  = 1;
+			}
+		}
+		for (unsigned i = num_hit; i > 0; --i) { // push internal kids far to near so that the nearest is popped first
+			unsigned const k(order[i-1]);
+			if (n.is_leaf(k) || tnear[k] >= tmax) continue;
+			assert(stack_sz < STACK_SIZE);
+			stack[stack_sz++] = {n.kid[k], tnear[k]};
+		}
+	}
+	return ret;
+}
+
+
+float cobj_bvh_tree::calc_binary_sah_cost() const { // same cost model as cobj_wide_bvh_t, normalized by root area
+
+	if (nodes.empty()) return 0.0;
+	float cost(0.0);
+
+	for (auto i = nodes.begin(); i != nodes.end(); ++i) {
+		float const area(i->get_area());
+		cost += area*((i->end > i->start) ? (i->end - i->start) : 1.0f); // leaf intersection cost or internal node traversal cost
+	}
+	return cost/max(nodes[0].get_area(), TOLERANCE);
+}
+
+
+void cobj_bvh_tree::build_wide_bvh(unsigned width, bool verbose) {
+
+	if (cixs.empty()) return;
+	RESET_TIME;
+	wide_bvh.build(cixs, *cobjs, width);
+
+	if (verbose) {
+		PRINT_TIME(" Wide Cobj BVH Create");
+		wide_bvh.print_stats();
+		cout << "binary BVH: nodes: " << nodes.size() << ", leaves: " << num_leaf_nodes << ", depth: " << max_depth << ", SAH cost: " << calc_binary_sah_cost() << endl;
+	}
+}
+
+
+// compares query time and results of the binary and wide BVHs for random lines and spheres within the scene bounds
+void cobj_bvh_tree::benchmark_queries(unsigned num_queries) const {
+
+	if (nodes.empty() || wide_bvh.empty()) return;
+	cube_t const &bc(nodes[0]);
+	rand_gen_t rgen;
+	vector<point> pts(2*num_queries);
+	for (auto i = pts.begin(); i != pts.end(); ++i) {*i = rgen.gen_rand_cube_point(bc);}
+	float const radius(0.01*bc.get_size().get_max_val());
+	vector<int> bin_cix(num_queries), wide_cix(num_queries);
+	unsigned bin_sphere_count(0), wide_sphere_count(0), num_mismatch(0);
+	point cpos;
+	vector3d cnorm;
+	auto count_bin ([&bin_sphere_count ](unsigned) {++bin_sphere_count; });
+	auto count_wide([&wide_sphere_count](unsigned) {++wide_sphere_count;});
+	double t_line[2] = {0.0}, t_sphere[2] = {0.0};
+
+	for (unsigned pass = 0; pass < 2; ++pass) { // 0=binary, 1=wide
+		bool const wide(pass == 1);
+		vector<int> &cix(wide ? wide_cix : bin_cix);
+		auto const start_time(high_resolution_clock::now());
+
+		for (unsigned i = 0; i < num_queries; ++i) {
+			cix[i] = -1;
+			if (wide) {check_coll_line_wide  (pts[2*i], pts[2*i+1], cpos, cnorm, cix[i], -1, 1, 0, 0, 0, 0);}
+			else      {check_coll_line_binary(pts[2*i], pts[2*i+1], cpos, cnorm, cix[i], -1, 1, 0, 0, 0, 0);}
+		}
+		auto const line_end_time(high_resolution_clock::now());
+
+		for (unsigned i = 0; i < num_queries; ++i) {
+			cube_t sbc(pts[2*i], pts[2*i]);
+			sbc.expand_by(radius);
+			if (wide) {get_coll_sphere_cobjs_wide  (sbc, -1, count_wide);}
+			else      {get_coll_sphere_cobjs_binary(sbc, -1, count_bin );}
+		}
+		t_line  [pass] = duration_cast<duration<double>>(line_end_time - start_time).count();
+		t_sphere[pass] = duration_cast<duration<double>>(high_resolution_clock::now() - line_end_time).count();
+	}
+	for (unsigned i = 0; i < num_queries; ++i) {num_mismatch += (bin_cix[i] != wide_cix[i]);} // can differ for coplanar cobjs
+	cout << "BVH benchmark with " << num_queries << " queries: line binary: " << 1000.0*t_line[0] << "ms, wide: " << 1000.0*t_line[1]
+		 << "ms; sphere binary: " << 1000.0*t_sphere[0] << "ms, wide: " << 1000.0*t_sphere[1] << "ms; line mismatches: " << num_mismatch
+		 << ", sphere candidates: " << bin_sphere_count << " / " << wide_sphere_count << endl;
+}
+
+
+// *** packet line queries ***
+
+
+bool line_query_packet_t::is_coherent() const {
+
+	if (num < 2) return 0; // not worth using a packet
+	vector3d const dir0(p2[0] - p1[0]);
+	vector3d avg_dir(zero_vector);
+
+	for (unsigned r = 0; r < num; ++r) {
+		vector3d const dir(p2[r] - p1[r]);
+		UNROLL_3X(if ((dir[i_] < 0.0) != (dir0[i_] < 0.0)) return 0;) // all rays must have the same direction signs so that slab near/far planes agree
+		avg_dir += dir.get_norm();
+	}
+	avg_dir.normalize();
+
+	for (unsigned r = 0; r < num; ++r) {
+		if (dot_product((p2[r] - p1[r]).get_norm(), avg_dir) < 0.9) return 0; // diverging rays would visit too many nodes
+	}
+	return 1;
+}
+
+struct packet_lanes_t { // SoA ray origins and inverse directions, padded to a multiple of the SIMD width
+	alignas(32) float ox[line_query_packet_t::MAX_RAYS], oy[line_query_packet_t::MAX_RAYS], oz[line_query_packet_t::MAX_RAYS];
+	alignas(32) float ix[line_query_packet_t::MAX_RAYS], iy[line_query_packet_t::MAX_RAYS], iz[line_query_packet_t::MAX_RAYS];
+	unsigned num_lanes; // rounded up to SIMD width
+	bool neg[3]; // shared direction signs
+
+	void set_lane(unsigned r, point const &p1, vector3d dinv) {
+		dinv.invert(); // same as node_ix_mgr
+		ox[r] = p1.x; oy[r] = p1.y; oz[r] = p1.z;
+		ix[r] = dinv.x; iy[r] = dinv.y; iz[r] = dinv.z;
+	}
+	void init(line_query_packet_t const &lqp) {
+		num_lanes = min(((lqp.num + 7) & ~7U), line_query_packet_t::MAX_RAYS);
+		for (unsigned r = 0; r < lqp.num; ++r) {set_lane(r, lqp.p1[r], (lqp.p2[r] - lqp.p1[r]));}
+		for (unsigned r = lqp.num; r < num_lanes; ++r) {set_lane(r, lqp.p1[0], (lqp.p2[0] - lqp.p1[0]));} // pad with copies of the first ray; masked off later
+		vector3d const dinv(lqp.p2[0] - lqp.p1[0]);
+		UNROLL_3X(neg[i_] = (dinv[i_] < 0.0);)
+	}
+	// returns a bitmask of lanes that intersect the cube; equivalent to get_line_clip() applied to each lane
+	unsigned line_clip_mask(float const d[3][2]) const {
+		unsigned mask(0);
+#if defined(BVH_PACKET_AVX)
+		for (unsigned i = 0; i < num_lanes; i += 8) {
+			__m256 tmin(_mm256_setzero_ps()), tmax(_mm256_set1_ps(1.0f));
+			float const *const o[3] = {ox+i, oy+i, oz+i}, *const di[3] = {ix+i, iy+i, iz+i};
+
+			for (unsigned dim = 0; dim < 3; ++dim) {
+				__m256 const orig(_mm256_load_ps(o[dim])), dinv(_mm256_load_ps(di[dim]));
+				__m256 const t1(_mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(d[dim][neg[dim]]), orig), dinv));
+				__m256 const t2(_mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(d[dim][!neg[dim]]), orig), dinv));
+				tmax = _mm256_min_ps(t2, tmax); // Note: returns tmax if t2 is NaN, matching the scalar comparison
+				tmin = _mm256_max_ps(t1, tmin);
+			}
+			mask |= unsigned(_mm256_movemask_ps(_mm256_cmp_ps(tmin, tmax, _CMP_LT_OQ))) << i;
+		}
+#elif defined(BVH_PACKET_SSE)
+		for (unsigned i = 0; i < num_lanes; i += 4) {
+			__m128 tmin(_mm_setzero_ps()), tmax(_mm_set1_ps(1.0f));
+			float const *const o[3] = {ox+i, oy+i, oz+i}, *const di[3] = {ix+i, iy+i, iz+i};
+
+			for (unsigned dim = 0; dim < 3; ++dim) {
+				__m128 const orig(_mm_load_ps(o[dim])), dinv(_mm_load_ps(di[dim]));
+				__m128 const t1(_mm_mul_ps(_mm_sub_ps(_mm_set1_ps(d[dim][neg[dim]]), orig), dinv));
+				__m128 const t2(_mm_mul_ps(_mm_sub_ps(_mm_set1_ps(d[dim][!neg[dim]]), orig), dinv));
+				tmax = _mm_min_ps(t2, tmax); // Note: returns tmax if t2 is NaN, matching the scalar comparison
+				tmin = _mm_max_ps(t1, tmin);
+			}
+			mask |= unsigned(_mm_movemask_ps(_mm_cmplt_ps(tmin, tmax))) << i;
+		}
+#else // portable fallback
+		for (unsigned i = 0; i < num_lanes; ++i) {
+			float const o[3] = {ox[i], oy[i], oz[i]}, di[3] = {ix[i], iy[i], iz[i]};
+			float tmin(0.0), tmax(1.0);
+
+			for (unsigned dim = 0; dim < 3; ++dim) {
+				float const t1((d[dim][neg[dim]] - o[dim])*di[dim]), t2((d[dim][!neg[dim]] - o[dim])*di[dim]);
+				if (t2 < tmax) {tmax = t2;} if (t1 > tmin) {tmin = t1;}
+			}
+			if (tmin < tmax) {mask |= (1U << i);}
+		}
+#endif
+		return mask;
+	}
+};
+
+// traverses all rays of the packet together, testing each node's bbox against every active ray at once;
+// results for each ray are identical to calling check_coll_line() with that ray, since child bboxes are contained in parent bboxes;
+// falls back to per-ray scalar traversal if the rays aren't coherent
+unsigned cobj_bvh_tree::check_coll_line_packet(line_query_packet_t &lqp, bool exact, int test_alpha, bool skip_non_drawn, bool skip_movable) const {
+
+	unsigned const num(lqp.num);
+	unsigned num_hits(0);
+	if (nodes.empty() || num == 0) return 0;
+
+	if (!lqp.is_coherent()) { // scalar fallback
+		for (unsigned r = 0; r < num; ++r) {
+			lqp.coll[r] = check_coll_line(lqp.p1[r], lqp.p2[r], lqp.cpos[r], lqp.cnorm[r], lqp.cindex[r], lqp.ignore_cobj[r], exact, test_alpha, skip_non_drawn, lqp.skip_init_colls[r], skip_movable);
+			num_hits += lqp.coll[r];
+		}
+		return num_hits;
+	}
+	packet_lanes_t lanes;
+	lanes.init(lqp);
+	float tmax[line_query_packet_t::MAX_RAYS], max_alpha[line_query_packet_t::MAX_RAYS];
+	for (unsigned r = 0; r < num; ++r) {tmax[r] = 1.0; max_alpha[r] = 0.0;}
+	unsigned active((1U << num) - 1); // rays that may still have hits
+	unsigned const num_nodes((unsigned)nodes.size());
+	float t(0.0);
+
+	for (unsigned nix = 0; nix < num_nodes && active;) {
+		tree_node const &n(nodes[nix]);
+		unsigned const node_mask(lanes.line_clip_mask(n.d) & active);
+
+		if (node_mask == 0) {
+			assert(n.next_node_id > nix);
+			nix = n.next_node_id; // all rays failed the bbox test
+			continue;
+		}
+		++nix;
+
+		for (unsigned i = n.start; i < n.end; ++i) { // check leaves
+			coll_obj const &c(get_cobj(i));
+			if (!obj_ok(c))                                             continue;
+			if (skip_non_drawn  && !c.cp.might_be_drawn())              continue;
+			if (skip_movable    && c.is_movable())                      continue;
+			if (test_alpha == 1 && c.is_semi_trans())                   continue; // semi-transparent, can see through
+			if (test_alpha == 3 && c.cp.color.alpha < MIN_SHADOW_ALPHA) continue; // less than min alpha
+
+			for (unsigned r = 0; r < num; ++r) {
+				if (!(node_mask & active & (1U << r))) continue; // this ray missed the node or is done
+				point const &p1(lqp.p1[r]), &p2(lqp.p2[r]);
+				if ((int)cixs[i] == lqp.ignore_cobj[r])                                   continue;
+				if (test_alpha == 2 && c.cp.color.alpha <= max_alpha[r])                  continue; // lower alpha than an earlier object
+				if (lqp.skip_init_colls[r] && c.contains_pt(p1) && c.contains_point(p1)) continue;
+				if (!c.line_int_exact(p1, p2, t, lqp.cnorm[r], 0.0, tmax[r]))             continue;
+				lqp.cindex[r] = cixs[i];
+				lqp.cpos  [r] = p1 + (p2 - p1)*t;
+				if (!lqp.coll[r]) {lqp.coll[r] = 1; ++num_hits;}
+				if (!exact && test_alpha != 2) {active &= ~(1U << r); continue;} // first hit only
+				max_alpha[r] = c.cp.color.alpha; // we need all intersections to find the max alpha
+				lanes.set_lane(r, p1, (lqp.cpos[r] - p1)); // shorten the ray
+				tmax[r] = t;
+			}
+		}
+	}
+	return num_hits;
+}
+
+
 bool cobj_bvh_tree::check_point_contained(point const &p, int &cindex) const {
 
 	unsigned const num_nodes((unsigned)nodes.size());
@@ -587,10 +1236,17 @@ void cobj_bvh_tree::get_coll_line_cobjs(point const &pos1, point const &pos2, in
 // Note: actually, this only returns sphere intersection candidates
 void cobj_bvh_tree::get_coll_sphere_cobjs(point const &center, float radius, int ignore_cobj, vert_coll_detector &vcd) const {
 
-	if (nodes.empty()) return;
-	unsigned const num_nodes((unsigned)nodes.size());
 	cube_t bcube(center, center);
 	bcube.expand_by(radius);
+	auto check_cobj([&vcd](unsigned cid) {vcd.check_cobj(cid);});
+	if (!wide_bvh.empty()) {get_coll_sphere_cobjs_wide  (bcube, ignore_cobj, check_cobj);}
+	else                   {get_coll_sphere_cobjs_binary(bcube, ignore_cobj, check_cobj);}
+}
+
+template<typename F> void cobj_bvh_tree::get_coll_sphere_cobjs_binary(cube_t const &bcube, int ignore_cobj, F &func) const {
+
+	if (nodes.empty()) return;
+	unsigned const num_nodes((unsigned)nodes.size());
 
 	for (unsigned nix = 0; nix < num_nodes;) {
 		tree_node const &n(nodes[nix]);
@@ -603,7 +1259,34 @@ void cobj_bvh_tree::get_coll_sphere_cobjs(point const &center, float radius, int
 		++nix;
 		
 		for (unsigned i = n.start; i < n.end; ++i) { // check leaves
-			if ((int)cixs[i] != ignore_cobj && get_cobj(i).intersects(bcube)) vcd.check_cobj(cixs[i]);
+			if ((int)cixs[i] != ignore_cobj && get_cobj(i).intersects(bcube)) {func(cixs[i]);}
+		}
+	}
+}
+
+template<typename F> void cobj_bvh_tree::get_coll_sphere_cobjs_wide(cube_t const &bcube, int ignore_cobj, F &func) const {
+
+	unsigned const STACK_SIZE(cobj_wide_bvh_t::STACK_SIZE);
+	unsigned stack[STACK_SIZE], stack_sz(0);
+	stack[stack_sz++] = 0; // root
+
+	while (stack_sz > 0) {
+		cobj_wide_bvh_t::node_t const &n(wide_bvh.nodes[stack[--stack_sz]]);
+		unsigned const mask(n.cube_overlap_mask(bcube));
+
+		for (unsigned k = 0; k < n.num_kids; ++k) {
+			if (!(mask & (1U << k))) continue;
+
+			if (n.is_leaf(k)) {
+				for (unsigned j = n.kid[k]; j < n.kid[k] + n.count[k]; ++j) {
+					unsigned const cix(wide_bvh.cixs[j]);
+					if ((int)cix != ignore_cobj && (*cobjs)[cix].intersects(bcube)) {func(cix);}
+				}
+			}
+			else {
+				assert(stack_sz < STACK_SIZE);
+				stack[stack_sz++] = n.kid[k];
+			}
 		}
 	}
 }
@@ -755,6 +1438,11 @@ cobj_bvh_tree cobj_tree_static (&coll_objects, 1, 0, 0, 0, 0); // does not inclu
 cobj_bvh_tree cobj_tree_dynamic(&coll_objects, 0, 1, 0, 0, 0);
 cobj_bvh_tree cobj_tree_occlude(&coll_objects, 1, 0, 1, 0, 0);
 cobj_bvh_tree cobj_tree_static_moving(&coll_objects, 1, 0, 0, 0, 0);
+coll_obj_group static_moving_snap_cobjs; // copies of static moving cobjs for async lighting threads
+cobj_bvh_tree cobj_tree_static_moving_snap(&static_moving_snap_cobjs, 1, 0, 0, 0, 0);
+vector<unsigned> static_moving_snap_cids; // maps snapshot cobj index to coll_objects index
+vector<int> static_moving_snap_slots; // maps coll_objects index to snapshot cobj index, or -1 if not in the snapshot
+unsigned static_moving_snap_version(0);
 //cobj_tree_tquads_t cobj_tree_triangles;
 
 
@@ -764,7 +1452,6 @@ cobj_bvh_tree &get_tree(bool dynamic) {
 
 void build_static_moving_cobj_tree() {
 
-	cobj_tree_static_moving.clear();
 	vector<unsigned> moving_cids(falling_cobjs);
 		
 	for (auto i = moving_cobjs.begin(); i != moving_cobjs.end(); ++i) {
@@ -773,10 +1460,43 @@ void build_static_moving_cobj_tree() {
 	for (platform_cont::const_iterator i = platforms.begin(); i != platforms.end(); ++i) {
 		copy(i->cobjs.begin(), i->cobjs.end(), back_inserter(moving_cids));
 	}
-	if (!moving_cids.empty()) {
-		cobj_tree_static_moving.add_cobj_ids(moving_cids);
-		cobj_tree_static_moving.build_tree_from_cixs(0);
+	cobj_tree_static_moving.update_from_cids(moving_cids, cobj_bvh_refit);
+}
+
+// copies the static moving cobjs and their BVH so that async lighting threads can query them while the originals move;
+// must be called when no lighting threads are running
+void update_static_moving_cobj_snapshot() {
+
+	if (!cobj_bvh_refit) return;
+	unsigned const version(cobj_tree_static_moving.get_version());
+	if (version == static_moving_snap_version) return; // up to date
+	static_moving_snap_version = version;
+	static_moving_snap_cids    = cobj_tree_static_moving.get_cobj_ids();
+	unsigned const num(static_moving_snap_cids.size());
+	static_moving_snap_cobjs.resize(num);
+	static_moving_snap_slots.clear();
+	vector<unsigned> snap_ids(num);
+
+	for (unsigned i = 0; i < num; ++i) {
+		unsigned const cid(static_moving_snap_cids[i]);
+		static_moving_snap_cobjs[i] = coll_objects.get_cobj(cid);
+		if (cid >= static_moving_snap_slots.size()) {static_moving_snap_slots.resize(cid+1, -1);}
+		static_moving_snap_slots[cid] = i;
+		snap_ids[i] = i;
 	}
+	cobj_tree_static_moving_snap.update_from_cids(snap_ids, 0);
+}
+
+bool check_coll_line_static_moving(point const &p1, point const &p2, point &cpos, vector3d &cnorm, int &cindex, int ignore_cobj,
+	int test_alpha, bool skip_non_drawn, bool skip_init_colls, bool skip_movable, bool no_stat_moving)
+{
+	if (!no_stat_moving) {return cobj_tree_static_moving.check_coll_line(p1, p2, cpos, cnorm, cindex, ignore_cobj, 1, test_alpha, skip_non_drawn, skip_init_colls, skip_movable);}
+	if (static_moving_snap_cids.empty()) return 0; // no snapshot
+	int snap_cindex(-1);
+	int const snap_ignore((ignore_cobj >= 0 && (unsigned)ignore_cobj < static_moving_snap_slots.size()) ? static_moving_snap_slots[ignore_cobj] : -1); // convert to a snapshot index
+	if (!cobj_tree_static_moving_snap.check_coll_line(p1, p2, cpos, cnorm, snap_cindex, snap_ignore, 1, test_alpha, skip_non_drawn, skip_init_colls, skip_movable)) return 0;
+	cindex = static_moving_snap_cids[snap_cindex];
+	return 1;
 }
 
 void build_cobj_tree(bool dynamic, bool verbose) {
@@ -788,7 +1508,7 @@ void build_cobj_tree(bool dynamic, bool verbose) {
 		//cobj_tree_triangles.add_cobjs(coll_objects, verbose);
 	}
 	else { // dynamic
-		if (begin_motion) {get_tree(1).add_cobjs(verbose);}
+		if (begin_motion) {get_tree(1).add_cobjs(verbose, cobj_bvh_refit);}
 		//build_static_moving_cobj_tree();
 	}
 }
@@ -800,11 +1520,29 @@ bool check_coll_line_exact_tree(point const &p1, point const &p2, point &cpos, v
 	cindex = -1;
 	//return cobj_tree_triangles.check_coll_line(p1, p2, cpos, cnorm, cindex, ignore_cobj, 1);
 	bool ret(get_tree(dynamic).check_coll_line(p1, p2, cpos, cnorm, cindex, ignore_cobj, 1, test_alpha, skip_non_drawn, skip_init_colls, skip_movable));
-	if (!dynamic && !no_stat_moving) {ret |= cobj_tree_static_moving.check_coll_line(p1, (ret ? cpos : p2), cpos, cnorm, cindex, ignore_cobj, 1, test_alpha, skip_non_drawn, skip_init_colls, skip_movable);}
+	if (!dynamic) {ret |= check_coll_line_static_moving(p1, (ret ? cpos : p2), cpos, cnorm, cindex, ignore_cobj, test_alpha, skip_non_drawn, skip_init_colls, skip_movable, no_stat_moving);}
 	if (!dynamic && include_voxels) {ret |= check_voxel_coll_line(p1, (ret ? cpos : p2), cpos, cnorm, cindex, ignore_cobj, 1);}
 	return ret;
 }
 
+// packet version of check_coll_line_exact_tree() for static cobjs, used for coherent ray tracing lighting rays; results are returned in lqp
+unsigned check_coll_line_exact_tree_packet(line_query_packet_t &lqp, int test_alpha, bool skip_non_drawn, bool include_voxels, bool skip_movable, bool no_stat_moving) {
+
+	unsigned num_hits(get_tree(0).check_coll_line_packet(lqp, 1, test_alpha, skip_non_drawn, skip_movable));
+	bool const check_stat_moving(!no_stat_moving || !static_moving_snap_cids.empty());
+	if (!check_stat_moving && !include_voxels) return num_hits;
+
+	for (unsigned r = 0; r < lqp.num; ++r) { // the static moving and voxel trees are small or rarely used, so process those rays individually
+		bool ret(lqp.coll[r]);
+		point const &p1(lqp.p1[r]);
+		int const ignore_cobj(lqp.ignore_cobj[r]);
+		if (check_stat_moving) {ret |= check_coll_line_static_moving(p1, (ret ? lqp.cpos[r] : lqp.p2[r]), lqp.cpos[r], lqp.cnorm[r], lqp.cindex[r], ignore_cobj, test_alpha, skip_non_drawn, lqp.skip_init_colls[r], skip_movable, no_stat_moving);}
+		if (include_voxels)  {ret |= check_voxel_coll_line(p1, (ret ? lqp.cpos[r] : lqp.p2[r]), lqp.cpos[r], lqp.cnorm[r], lqp.cindex[r], ignore_cobj, 1);}
+		if (ret && !lqp.coll[r]) {lqp.coll[r] = 1; ++num_hits;}
+	}
+	return num_hits;
+}
+
 // can use with snow shadows, grass shadows, tree leaf shadows
 bool check_coll_line_tree(point const &p1, point const &p2, int &cindex, int ignore_cobj, bool dynamic,
 	int test_alpha, bool skip_non_drawn, bool include_voxels, bool skip_init_colls, bool skip_movable)
@@ -4,6 +4,7 @@
 #pragma once
 
 #include "physics_objects.h"
+#include <cfloat> // for FLT_MAX
 
 
 class cobj_tree_base {
@@ -104,11 +105,91 @@ public:
 };
 
 
+struct line_query_packet_t { // a batch of coherent line queries that are traversed through the BVH together
+
+	static unsigned const MAX_RAYS = 16;
+	unsigned num=0;
+	point p1[MAX_RAYS], p2[MAX_RAYS], cpos[MAX_RAYS];
+	vector3d cnorm[MAX_RAYS];
+	int cindex[MAX_RAYS], ignore_cobj[MAX_RAYS];
+	bool skip_init_colls[MAX_RAYS], coll[MAX_RAYS];
+
+	bool empty() const {return (num == 0);}
+	bool full () const {return (num == MAX_RAYS);}
+	void clear() {num = 0;}
+
+	void add(point const &p1_, point const &p2_, int ignore_cobj_=-1, bool skip_init_colls_=0) {
+		assert(num < MAX_RAYS);
+		p1[num] = p1_; p2[num] = cpos[num] = p2_; cnorm[num] = zero_vector; cindex[num] = -1;
+		ignore_cobj[num] = ignore_cobj_; skip_init_colls[num] = skip_init_colls_; coll[num] = 0;
+		++num;
+	}
+	bool is_coherent() const;
+};
+
+unsigned check_coll_line_exact_tree_packet(line_query_packet_t &lqp, int test_alpha=0, bool skip_non_drawn=0, bool include_voxels=1, bool skip_movable=0, bool no_stat_moving=0);
+
+
+class cobj_wide_bvh_t { // built with the binned surface area heuristic, then collapsed to 4 or 8 children per node
+
+public:
+	static unsigned const MAX_WIDTH = 8;
+	static unsigned const MAX_DEPTH = 64; // the build makes a leaf rather than exceeding this depth
+	static unsigned const STACK_SIZE = MAX_DEPTH*(MAX_WIDTH - 1) + 1; // traversal pushes at most MAX_WIDTH-1 siblings per level
+
+	struct node_t { // size = 244
+		float lo[3][MAX_WIDTH], hi[3][MAX_WIDTH]; // SoA child bounds
+		unsigned kid[MAX_WIDTH]; // child node index, or start index into cixs for leaf children
+		unsigned short count[MAX_WIDTH]; // number of cobjs for leaf children, 0 for internal children
+		unsigned num_kids;
+
+		node_t() : num_kids(0) { // unused kids get empty bounds that no line intersects so that SIMD tests can load all lanes
+			for (unsigned k = 0; k < MAX_WIDTH; ++k) {UNROLL_3X(lo[i_][k] = FLT_MAX; hi[i_][k] = -FLT_MAX;) kid[k] = 0; count[k] = 0;}
+		}
+		bool is_leaf(unsigned k) const {return (count[k] > 0);}
+		void set_kid_bcube(unsigned k, cube_t const &c) {UNROLL_3X(lo[i_][k] = c.d[i_][0]; hi[i_][k] = c.d[i_][1];)}
+		unsigned line_clip_mask(point const &p1, vector3d const &dinv, bool const neg[3], float tmax, float tnear[MAX_WIDTH]) const;
+		unsigned cube_overlap_mask(cube_t const &c) const;
+	};
+	vector<node_t> nodes;
+	vector<unsigned> cixs; // cobj indices in leaf order
+	cube_t bcube; // root bounds
+	unsigned width=0, max_depth=0, num_leaves=0;
+	float sah_cost=0.0;
+
+	bool empty() const {return nodes.empty();}
+	void clear();
+	void build(vector<unsigned> const &cids, coll_obj_group const &cobjs, unsigned width_);
+	void print_stats() const;
+
+private:
+	struct build_node_t {
+		cube_t bc;
+		unsigned start, count;
+		int kids[2];
+		build_node_t(cube_t const &bc_, unsigned s, unsigned c) : bc(bc_), start(s), count(c) {kids[0] = kids[1] = -1;}
+		bool is_leaf() const {return (kids[0] < 0);}
+	};
+	vector<build_node_t> bnodes;
+	vector<cube_t> obj_bcubes;
+	vector<point> obj_centers;
+	vector<unsigned> order;
+
+	unsigned build_binary(unsigned start, unsigned end, unsigned depth);
+	unsigned collapse(unsigned bnix, unsigned depth);
+};
+
+
 class cobj_bvh_tree : public cobj_tree_base {
 
 	coll_obj_group const *cobjs;
 	vector<unsigned> cixs;
 	bool is_static, is_dynamic, occluders_only, cubes_only, inc_voxel_cobjs;
+	cobj_wide_bvh_t wide_bvh; // optional, used for line and sphere queries when built
+	vector<unsigned> refit_cids; // cobj IDs of the last full build in original order, used to detect when a refit is sufficient
+	vector<float> build_area; // node surface areas at build time, used to detect subtrees that have degraded after refits
+	unsigned version=0; // incremented each time the tree is rebuilt or refit
+	bool benchmark_done=0; // benchmark_queries() has been run for this tree
 
 	struct per_thread_data {
 		vector<unsigned> temp_bins[3];
@@ -128,6 +209,17 @@ class cobj_bvh_tree : public cobj_tree_base {
 	void calc_node_bbox(tree_node &n) const;
 	void build_tree_top_level_omp();
 	void build_tree(unsigned nix, unsigned skip_dims, unsigned depth, per_thread_data &ptd);
+	bool skip_line_cobj(coll_obj const &c, point const &p1, int test_alpha, float max_alpha, bool skip_non_drawn, bool skip_init_colls, bool skip_movable) const;
+	bool check_coll_line_binary(point const &p1, point const &p2, point &cpos, vector3d &cnorm, int &cindex, int ignore_cobj,
+		bool exact, int test_alpha, bool skip_non_drawn, bool skip_init_colls, bool skip_movable) const;
+	bool check_coll_line_wide(point const &p1, point const &p2, point &cpos, vector3d &cnorm, int &cindex, int ignore_cobj,
+		bool exact, int test_alpha, bool skip_non_drawn, bool skip_init_colls, bool skip_movable) const;
+	template<typename F> void get_coll_sphere_cobjs_binary(cube_t const &bcube, int ignore_cobj, F &func) const;
+	template<typename F> void get_coll_sphere_cobjs_wide  (cube_t const &bcube, int ignore_cobj, F &func) const;
+	float calc_binary_sah_cost() const;
+	void record_build_areas();
+	void refit_tree();
+	void rebuild_subtree(unsigned nix);
 
 	bool obj_ok(coll_obj const &c) const {
 		return (((is_static && c.status == COLL_STATIC) || (is_dynamic && c.status == COLL_DYNAMIC) || (!is_static && !is_dynamic)) &&
@@ -140,12 +232,18 @@ public:
 		: cobjs(cobjs_), is_static(s), is_dynamic(d), occluders_only(o), cubes_only(c), inc_voxel_cobjs(v) {assert(cobjs);}
 
 	unsigned get_num_objs() const {return cixs.size();}
+	unsigned get_version () const {return version;}
+	vector<unsigned> const &get_cobj_ids() const {return cixs;}
 	void clear();
 	void add_cobj_ids(vector<unsigned> const &cids) {assert(cixs.empty() && !cids.empty()); cixs = cids;}
-	void add_cobjs(bool verbose);
+	void add_cobjs(bool verbose, bool allow_refit=0);
+	void update_from_cids(vector<unsigned> const &cids, bool allow_refit);
 	void build_tree_from_cixs(bool do_mt_build);
+	void build_wide_bvh(unsigned width, bool verbose);
+	void benchmark_queries(unsigned num_queries) const;
 	bool check_coll_line(point const &p1, point const &p2, point &cpos, vector3d &cnorm, int &cindex, int ignore_cobj,
 		bool exact, int test_alpha, bool skip_non_drawn, bool skip_init_colls, bool skip_movable) const;
+	unsigned check_coll_line_packet(line_query_packet_t &lqp, bool exact, int test_alpha, bool skip_non_drawn, bool skip_movable) const;
 	bool check_point_contained(point const &p, int &cindex) const;
 	void get_intersecting_cobjs(cube_t const &cube, vector<unsigned> &cobjs, int ignore_cobj, float toler, bool check_ccounter, int id_for_cobj_int) const;
 	bool is_cobj_contained(point const &viewer, point const *const pts, unsigned npts, int ignore_cobj, int &cobj) const;
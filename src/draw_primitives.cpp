@@ -158,6 +158,8 @@ void sd_sphere_d::gen_points_norms(sphere_point_norm &cur_spn, float s_beg, floa
 	s1 = min(ndiv, s1+1);   // allow for sn
 	t1 = min(ndiv, t1+1);   // allow for tn
 	float sin_t0((t0 == 0) ? 0.0 : sin(t0*cs_scale)), cos_t0((t0 == 0) ? 1.0 : cos(t0*cs_scale));
+	vector<float> heights;
+	if (surf) {heights.resize(t1 - t0 + 1);}
 
 	for (unsigned s = s0; s < s1; ++s) { // build points and normals table
 		float const theta(s*cs_scale2), tvc(cos(theta)), tvs(sin(theta)); // theta1, theta2
@@ -174,7 +176,10 @@ void sd_sphere_d::gen_points_norms(sphere_point_norm &cur_spn, float s_beg, floa
 			pt   *= radius;
 			pt   += pos;
 			if (perturb_map) {pt += cur_spn.norms[s][t]*perturb_map[t+soff];}
-			if (surf)        {pt += cur_spn.norms[s][t]*surf->get_height_at(pt);}
+		}
+		if (surf) { // evaluate the surface height for the entire row at once
+			surf->get_heights_at(&cur_spn.points[s][t0], heights.size(), heights.data());
+			for (unsigned t = t0; t <= t1; ++t) {cur_spn.points[s][t] += cur_spn.norms[s][t]*heights[t - t0];}
 		}
 	}
 	if (perturb_map || surf) { // recalculate vertex/surface normals
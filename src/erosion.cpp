@@ -5,75 +5,106 @@
 #include "3DWorld.h"
 #include "mesh.h"
 #include <cfloat> // for FLT_EPSILON
+#include <atomic>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 
+int const EROSION_PAD        = 4; // pad mesh on each side to create a buffer of trash around the edges that can be discarded
+unsigned const EROSION_BATCH = 32;  // droplets per batch in parallel mode; fixed so that results don't depend on thread count
+
+bool benchmark_erosion(0);
+std::atomic<bool> erosion_benchmark_done(0); // the benchmark is only run on the first call to apply_erosion(); tiles may be generated on multiple threads
+
 extern float erode_amount, water_plane_z;
 
 
 // see http://ranmantaru.com/blog/2011/10/08/water-erosion-on-heightmap-terrain/
-void apply_erosion(float *heightmap, int xsize, int ysize, float min_zval, unsigned num_iters) {
 
-	if (num_iters == 0 || erode_amount <= 0.0) return; // erosion disabled
-	RESET_TIME;
-	// Kq and minSlope are for soil carry capacity.
-	// Kw is water evaporation speed.
-	// Kr is erosion speed (how fast the soil is removed).
-	// Kd is deposition speed (how fast the extra sediment is dropped).
-	// Ki is direction inertia. Higher values make channel turns smoother.
-	// g is gravity that accelerates the flows.
-	float const Kq=10, Kw=0.001f, Kr=0.9f, Kd=0.02f, Ki=0.1f, minSlope=0.05f, g=20, Kg=g*2;
-	int const PAD(4), NX(xsize+2*PAD), NY(ysize+2*PAD);
-	unsigned const MAX_PATH_LEN(4*NX*NY);
-	vector<vector2d> erosion(NX*NY, vector2d(0.0, 0.0));
-	vector<float> mh_padded(NX*NY);
-
-	// pad mesh by 1 unit on each side to create a buffer of trash around the edges that can be discarded
-	for (int y = 0; y < NY; ++y) {
-		int const offset(max(min(y-PAD, ysize-1), 0)*xsize);
-
-		for (int x = 0; x < NX; ++x) {
-			mh_padded[y*NX + x] = heightmap[max(min(x-PAD, xsize-1), 0) + offset];
+// Kq and minSlope are for soil carry capacity.
+// Kw is water evaporation speed.
+// Kr is erosion speed (how fast the soil is removed).
+// Kd is deposition speed (how fast the extra sediment is dropped).
+// Ki is direction inertia. Higher values make channel turns smoother.
+// g is gravity that accelerates the flows.
+float const Kq=10, Kw=0.001f, Kr=0.9f, Kd=0.02f, Ki=0.1f, minSlope=0.05f, g=20, Kg=g*2;
+
+struct erosion_op_t {
+	int x, z;
+	float delta;
+	bool is_erode;
+	erosion_op_t(int x_, int z_, float delta_, bool is_erode_) : x(x_), z(z_), delta(delta_), is_erode(is_erode_) {}
+};
+
+struct erosion_map_t {
+	int NX, NY;
+	vector<vector2d> erosion;
+	vector<float> mh_padded;
+
+	erosion_map_t(float const *heightmap, int xsize, int ysize) : NX(xsize+2*EROSION_PAD), NY(ysize+2*EROSION_PAD), erosion(NX*NY, vector2d(0.0, 0.0)), mh_padded(NX*NY) {
+		for (int y = 0; y < NY; ++y) {
+			int const offset(max(min(y-EROSION_PAD, ysize-1), 0)*xsize);
+
+			for (int x = 0; x < NX; ++x) {
+				mh_padded[y*NX + x] = heightmap[max(min(x-EROSION_PAD, xsize-1), 0) + offset];
+			}
 		}
 	}
+	int clamp_x(int x) const {return max(min(x, NX-1), 0);}
+	int clamp_y(int y) const {return max(min(y, NY-1), 0);}
+	unsigned index(int x, int y) const {return NX*clamp_y(y) + clamp_x(x);}
+	float get(int x, int y) const {return mh_padded[index(x, y)];}
 
-#define HMAP_INDEX(x, y) (NX*max(min(y, NY-1), 0) + max(min(x, NX-1), 0))
-#define HMAP(x, y) mh_padded[HMAP_INDEX(x, y)]
-
-#define DEPOSIT_AT(X, Z, W) { \
-	float const delta = ds*erode_amount*(W); \
-	unsigned const ix(HMAP_INDEX((X), (Z))); \
-	erosion[ix].y += delta; \
-	if (!(X < 0 || Z < 0 || X >= NX || Z >= NY)) {mh_padded[ix] += delta;} \
-}
+	void deposit_at(int X, int Z, float delta) {
+		unsigned const ix(index(X, Z));
+		erosion[ix].y += delta;
+		if (!(X < 0 || Z < 0 || X >= NX || Z >= NY)) {mh_padded[ix] += delta;}
+	}
+	void deposit(int xi, int zi, float xf, float zf, float ds) {
+		float const d(ds*erode_amount);
+		deposit_at(xi  , zi  , d*((1-xf)*(1-zf)));
+		deposit_at(xi+1, zi  , d*(   xf *(1-zf)));
+		deposit_at(xi  , zi+1, d*((1-xf)*   zf ));
+		deposit_at(xi+1, zi+1, d*(   xf *   zf ));
+	}
+	void erode(int X, int Z, float delta) {
+		unsigned const ix(index(X, Z));
+		mh_padded[ix] -= delta;
+		vector2d &e(erosion[ix]);
+		float r(e.x), d(e.y);
+		if (delta <= d) {d -= delta;} else {r += delta-d; d = 0;}
+		e.x = r; e.y = d;
+	}
+	void apply_op(erosion_op_t const &op) {
+		if (op.is_erode) {erode(op.x, op.z, op.delta);} else {deposit_at(op.x, op.z, op.delta);}
+	}
+	void write_to_heightmap(float *heightmap, int xsize, int ysize, float min_zval) const { // remove padding and clamp to min_zval
+		for (int y = 0; y < ysize; ++y) {
+			for (int x = 0; x < xsize; ++x) {
+				heightmap[y*xsize + x] = max(min_zval, mh_padded[(y+EROSION_PAD)*NX + x+EROSION_PAD]);
+			}
+		}
+	}
+};
 
-#define DEPOSIT(H) \
-	DEPOSIT_AT(xi  , zi  , (1-xf)*(1-zf)) \
-	DEPOSIT_AT(xi+1, zi  ,    xf *(1-zf)) \
-	DEPOSIT_AT(xi  , zi+1, (1-xf)*   zf ) \
-	DEPOSIT_AT(xi+1, zi+1,    xf *   zf ) \
-	(H)+=ds;
-
-#define ERODE(X, Z, W) { \
-	float const delta=ds*erode_amount*(W); \
-	unsigned const ix(HMAP_INDEX((X), (Z))); \
-	mh_padded[ix]-=delta; \
-	vector2d &e=erosion[ix]; \
-	float r=e.x, d=e.y; \
-	if (delta<=d) {d-=delta;} else {r+=delta-d; d=0;} \
-	e.x=r; e.y=d; \
-}
+struct erosion_droplet_t {
+	unsigned iter, num_moves;
+	rand_gen_t rgen;
+	int xi, zi;
+	float xp, zp, xf, zf, s, v, w, dx, dz, h, h00, h10, h01, h11;
 
-#pragma omp parallel for schedule(dynamic,1)
-	for (int iter=0; iter < (int)num_iters; ++iter) {
-		rand_gen_t rgen;
+	erosion_droplet_t(unsigned iter_, int xsize, int ysize) : iter(iter_), num_moves(0), xf(0), zf(0), s(0), v(0), w(1), dx(0), dz(0) {
 		rgen.set_state(iter+11, 79*iter+121);
-		int xi = PAD + (rgen.rand()%xsize);
-		int zi = PAD + (rgen.rand()%ysize);
-		float xp=xi, zp=zi, xf=0, zf=0, s=0, v=0, w=1, dx=0, dz=0;
-		float h=HMAP(xi, zi), h00=h, h10=HMAP(xi+1, zi), h01=HMAP(xi, zi+1), h11=HMAP(xi+1, zi+1);
+		xi = EROSION_PAD + (rgen.rand()%xsize);
+		zi = EROSION_PAD + (rgen.rand()%ysize);
+		xp = xi; zp = zi;
+		h = h00 = h10 = h01 = h11 = 0.0; // set in run()
+	}
+	template<typename M> void run(M &m, unsigned max_path_len) { // M is erosion_map_t or erosion_view_t
+		h = h00 = m.get(xi, zi); h10 = m.get(xi+1, zi); h01 = m.get(xi, zi+1); h11 = m.get(xi+1, zi+1);
 
-		unsigned numMoves=0;
-		for (; numMoves<MAX_PATH_LEN; ++numMoves) {
+		for (; num_moves < max_path_len; ++num_moves) {
 			// calc gradient
 			float gx=h00+h01-h10-h11, gz=h00+h10-h01-h11;
 			// calc next pos
@@ -92,23 +123,25 @@ void apply_erosion(float *heightmap, int xsize, int ysize, float min_zval, unsig
 			// sample next height
 			int nxi=floor(nxp), nzi=floor(nzp);
 			float nxf=nxp-nxi, nzf=nzp-nzi;
-			float nh00=HMAP(nxi, nzi), nh10=HMAP(nxi+1, nzi), nh01=HMAP(nxi, nzi+1), nh11=HMAP(nxi+1, nzi+1);
+			float nh00=m.get(nxi, nzi), nh10=m.get(nxi+1, nzi), nh01=m.get(nxi, nzi+1), nh11=m.get(nxi+1, nzi+1);
 			float nh=(nh00*(1-nxf)+nh10*nxf)*(1-nzf)+(nh01*(1-nxf)+nh11*nxf)*nzf;
 			// adjust by HALF_DXY = average mesh texel size - this is river depth
-			if (max(max(nh00, nh10), max(nh01, nh11)) < water_plane_z - HALF_DXY) break; // reached ocean water, stop and ignore sediment
+			if (max(max(nh00, nh10), max(nh01, nh11)) < water_plane_z - HALF_DXY) return; // reached ocean water, stop and ignore sediment
 
 			// if higher than current, try to deposit sediment up to neighbour height
-			bool const outside(xi < 0 || zi < 0 || xi >= NX || zi >= NY);
+			bool const outside(xi < 0 || zi < 0 || xi >= m.NX || zi >= m.NY);
 			if (nh>=h || outside) {
 				float ds=(nh-h)+0.001f;
 
 				if (ds>=s || outside) {
 					ds=s;
-					DEPOSIT(h) // deposit all sediment
+					m.deposit(xi, zi, xf, zf, ds); // deposit all sediment
+					h+=ds;
 					s=0;
-					break; // stop
+					return; // stop
 				}
-				DEPOSIT(h)
+				m.deposit(xi, zi, xf, zf, ds);
+				h+=ds;
 				s-=ds;
 				v=0;
 			}
@@ -123,23 +156,24 @@ void apply_erosion(float *heightmap, int xsize, int ysize, float min_zval, unsig
 			if (ds>=0) { // deposit
 				ds*=Kd;
 				//ds=minval(ds, 1.0f);
-				DEPOSIT(dh)
+				m.deposit(xi, zi, xf, zf, ds);
+				dh+=ds;
 				s-=ds;
 			}
 			else { // erode
 				ds*=-Kr;
-				ds=min(ds, dh*0.99f);
 				ds*=((get_bare_ls_tid(nh) == ROCK_TEX) ? 0.5 : 2.0); // rock erodes slower than dirt/sand
+				ds=min(ds, dh*0.99f); // must be applied after the rock/dirt scale, otherwise dh can go negative and the sqrt() below returns NaN
 
 				for (int z=zi-1; z<=zi+2; ++z) {
 					float zo=z-zp, zo2=zo*zo;
 
 					for (int x=xi-1; x<=xi+2; ++x) {
 						float xo=x-xp;
-						float w=1-(xo*xo+zo2)*0.25f;
-						if (w<=0) continue;
-						w*=0.1591549430918953f;
-						ERODE(x, z, w)
+						float wt=1-(xo*xo+zo2)*0.25f;
+						if (wt<=0) continue;
+						wt*=0.1591549430918953f;
+						m.erode(x, z, ds*erode_amount*wt);
 					}
 				}
 				dh-=ds;
@@ -150,16 +184,157 @@ void apply_erosion(float *heightmap, int xsize, int ysize, float min_zval, unsig
 			w*=1-Kw;
 			xp=nxp; zp=nzp; xi=nxi; zi=nzi; xf=nxf; zf=nzf;
 			h=nh; h00=nh00; h10=nh10; h01=nh01; h11=nh11;
-		} // for numMoves
-		if (numMoves>=MAX_PATH_LEN) {cout << "droplet path is too long: " << iter << endl;}
-	} // for iter
-
-	// remove padding and clamp to min_zval
-	for (int y = 0; y < ysize; ++y) {
-		for (int x = 0; x < xsize; ++x) {
-			heightmap[y*xsize + x] = max(min_zval, mh_padded[(y+PAD)*NX + x+PAD]);
+		} // for num_moves
+		cout << "droplet path is too long: " << iter << endl;
+	}
+};
+
+
+void apply_erosion_serial(erosion_map_t &m, int xsize, int ysize, unsigned num_iters, unsigned max_path_len) {
+	for (unsigned iter = 0; iter < num_iters; ++iter) {
+		erosion_droplet_t droplet(iter, xsize, ysize);
+		droplet.run(m, max_path_len);
+	}
+}
+
+struct erosion_droplet_log_t {
+	vector<erosion_op_t> ops; // changes, in order
+	vector<unsigned> reads; // map indices of heights read; may contain duplicates
+};
+
+// read-only view of the map used by one thread in parallel mode: the droplet sees the map as of the start of the batch plus its own changes,
+// which are recorded in order so that they can be applied to the real map later
+struct erosion_view_t {
+	erosion_map_t const &m;
+	int NX, NY;
+	vector<float> hlocal; // heights modified by this droplet; stores values rather than deltas so that rounding agrees with serial mode
+	vector<unsigned char> is_local;
+	vector<unsigned> touched;
+	erosion_droplet_log_t *log;
+
+	erosion_view_t(erosion_map_t const &m_) : m(m_), NX(m.NX), NY(m.NY), hlocal(m.mh_padded.size(), 0.0), is_local(m.mh_padded.size(), 0), log(nullptr) {}
+
+	void start_droplet(erosion_droplet_log_t &log_) {
+		for (auto i = touched.begin(); i != touched.end(); ++i) {is_local[*i] = 0;}
+		touched.clear();
+		log = &log_;
+		log->ops.clear();
+		log->reads.clear();
+	}
+	float get_height(unsigned ix) const {return (is_local[ix] ? hlocal[ix] : m.mh_padded[ix]);}
+
+	void add_hdelta(unsigned ix, float delta) {
+		hlocal[ix] = get_height(ix) + delta;
+		if (!is_local[ix]) {is_local[ix] = 1; touched.push_back(ix);}
+	}
+	float get(int x, int y) {
+		unsigned const ix(m.index(x, y));
+		log->reads.push_back(ix);
+		return get_height(ix);
+	}
+	void deposit_at(int X, int Z, float delta) {
+		log->ops.emplace_back(X, Z, delta, 0);
+		if (!(X < 0 || Z < 0 || X >= NX || Z >= NY)) {add_hdelta(m.index(X, Z), delta);}
+	}
+	void deposit(int xi, int zi, float xf, float zf, float ds) { // must agree with erosion_map_t::deposit()
+		float const d(ds*erode_amount);
+		deposit_at(xi  , zi  , d*((1-xf)*(1-zf)));
+		deposit_at(xi+1, zi  , d*(   xf *(1-zf)));
+		deposit_at(xi  , zi+1, d*((1-xf)*   zf ));
+		deposit_at(xi+1, zi+1, d*(   xf *   zf ));
+	}
+	void erode(int X, int Z, float delta) {
+		log->ops.emplace_back(X, Z, delta, 1);
+		add_hdelta(m.index(X, Z), -delta);
+	}
+};
+
+// deterministic parallel erosion: droplets are simulated in fixed size batches against a snapshot of the map taken at the start of each batch,
+// and each droplet records the texels it reads and the changes it makes; changes are then applied serially in droplet order; a droplet that
+// read or modified a texel that was modified by an earlier droplet of the same batch saw stale data, so it's discarded and simulated again
+// on the updated map; this produces the same result as serial mode, independent of the number of threads; it's only faster if conflicts are rare
+unsigned apply_erosion_parallel(erosion_map_t &m, int xsize, int ysize, unsigned num_iters, unsigned max_path_len) { // returns the number of droplets rerun
+	vector<erosion_droplet_log_t> logs(EROSION_BATCH);
+	vector<int> last_writer(m.mh_padded.size(), -1); // droplet index of the last change to each texel
+	erosion_view_t merge_view(m);
+	unsigned num_rerun(0);
+
+#pragma omp parallel
+	{
+		erosion_view_t view(m); // one per thread, since it's large
+
+		for (unsigned batch_start = 0; batch_start < num_iters; batch_start += EROSION_BATCH) {
+			int const batch_sz(min(num_iters - batch_start, EROSION_BATCH));
+#pragma omp for schedule(dynamic,1)
+			for (int i = 0; i < batch_sz; ++i) {
+				view.start_droplet(logs[i]);
+				erosion_droplet_t droplet(batch_start + i, xsize, ysize);
+				droplet.run(view, max_path_len);
+			}
+#pragma omp single
+			for (int i = 0; i < batch_sz; ++i) { // merge
+				erosion_droplet_log_t &log(logs[i]);
+				bool conflict(0);
+
+				for (auto r = log.reads.begin(); r != log.reads.end() && !conflict; ++r) {conflict |= (last_writer[*r] >= (int)batch_start);}
+				for (auto op = log.ops.begin(); op != log.ops.end() && !conflict; ++op) {conflict |= (last_writer[m.index(op->x, op->z)] >= (int)batch_start);}
+
+				if (conflict) { // simulate again on the current map
+					merge_view.start_droplet(log);
+					erosion_droplet_t droplet(batch_start + i, xsize, ysize);
+					droplet.run(merge_view, max_path_len);
+					++num_rerun;
+				}
+				for (auto op = log.ops.begin(); op != log.ops.end(); ++op) {
+					m.apply_op(*op);
+					last_writer[m.index(op->x, op->z)] = batch_start + i;
+				}
+			} // for i
+		} // for batch_start
+	} // omp parallel
+	return num_rerun;
+}
+
+
+void apply_erosion(float *heightmap, int xsize, int ysize, float min_zval, unsigned num_iters) {
+
+	if (num_iters == 0 || erode_amount <= 0.0) return; // erosion disabled
+	RESET_TIME;
+	erosion_map_t m(heightmap, xsize, ysize);
+	unsigned const max_path_len(4*m.NX*m.NY);
+#ifdef _OPENMP
+	bool const use_parallel(omp_get_max_threads() > 1);
+#else
+	bool const use_parallel(0);
+#endif
+
+	if (benchmark_erosion && !erosion_benchmark_done.exchange(1)) { // compare against the serial version, and check that two parallel runs are identical
+		erosion_map_t ms(m), mt2(m);
+		unsigned num_rerun(0);
+		auto run_timed = [&](erosion_map_t &em, bool par) {
+			int const start_ms(GET_TIME_MS());
+			if (par) {num_rerun = apply_erosion_parallel(em, xsize, ysize, num_iters, max_path_len);} else {apply_erosion_serial(em, xsize, ysize, num_iters, max_path_len);}
+			return 0.001*(GET_TIME_MS() - start_ms);
+		};
+		double const t_serial(run_timed(ms, 0)), t_par(run_timed(m, 1));
+		run_timed(mt2, 1);
+		double max_diff(0.0), sum_diff(0.0);
+
+		for (int y = 0; y < ysize; ++y) {
+			for (int x = 0; x < xsize; ++x) {
+				unsigned const ix((y+EROSION_PAD)*m.NX + x+EROSION_PAD);
+				double const diff(fabs(m.mh_padded[ix] - ms.mh_padded[ix]));
+				max_diff  = max(max_diff, diff);
+				sum_diff += diff;
+			}
 		}
+		cout << "Erosion benchmark " << xsize << "x" << ysize << ", " << num_iters << " droplets: serial " << num_iters/max(t_serial, 0.001) << " droplets/s, parallel "
+			 << num_iters/max(t_par, 0.001) << " droplets/s (" << t_serial/max(t_par, 0.001) << "x), height diff vs. serial max " << max_diff << " mean "
+			 << sum_diff/max(1, xsize*ysize) << ", rerun " << num_rerun << ", deterministic: " << ((m.mh_padded == mt2.mh_padded) ? "yes" : "NO") << endl;
 	}
+	else if (use_parallel) {apply_erosion_parallel(m, xsize, ysize, num_iters, max_path_len);}
+	else {apply_erosion_serial  (m, xsize, ysize, num_iters, max_path_len);} // same result, but less overhead
+	m.write_to_heightmap(heightmap, xsize, ysize, min_zval);
 	PRINT_TIME("Erosion");
 }
 
@@ -7,8 +7,28 @@
 #include <iostream>
 #include "3DWorld.h"
 
+using std::string;
+
 unsigned const FILE_BUF_SZ = 4096;
 
+class mapped_file_t { // read only memory map of an entire file
+
+	char const *data;
+	size_t size;
+	void *file_handle, *map_handle; // only used on Windows
+
+	mapped_file_t(mapped_file_t const &) = delete; // forbidden
+	void operator=(mapped_file_t const &) = delete; // forbidden
+public:
+	mapped_file_t() : data(nullptr), size(0), file_handle(nullptr), map_handle(nullptr) {}
+	~mapped_file_t() {close();}
+	bool open(std::string const &fn, size_t min_size=1); // returns 0 if the file can't be mapped or is smaller than min_size
+	void close();
+	bool is_open() const {return (data != nullptr);}
+	char const *get_data() const {return data;}
+	size_t get_size() const {return size;}
+};
+
 class base_file_reader {
 
 protected:
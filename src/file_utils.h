@@ -18,6 +18,7 @@ inline bool read_zero_one_float(FILE *fp, float &val) {return (read_float(fp, va
 inline bool read_str  (FILE *fp, char     *val) {return (fscanf(fp, "%255s", val) == 1);}
 
 inline bool check_file_exists(std::string const &fn) {return std::ifstream(fn).good();}
+bool create_dir_if_needed(std::string const &dir);
 
 inline unsigned read_binary_uint(FILE *fp) {
 	unsigned v(0);
@@ -9,6 +9,7 @@ struct xform_matrix;
 struct cube_with_zval_t;
 
 int omp_get_thread_num_3dw();
+int omp_get_max_threads_3dw();
 
 // function prototypes - main (3DWorld.cpp, etc.)
 bool get_gl_error(unsigned loc_id=0);
@@ -445,6 +446,7 @@ void free_cobj_draw_group_vbos();
 
 // function prototypes - coll_cell_search
 void build_static_moving_cobj_tree();
+void update_static_moving_cobj_snapshot();
 void build_cobj_tree(bool dynamic=0, bool verbose=1);
 bool check_coll_line_exact_tree(point const &p1, point const &p2, point &cpos, vector3d &cnorm, int &cindex, int ignore_cobj,
 	bool dynamic=0, int test_alpha=0, bool skip_non_drawn=0, bool include_voxels=1, bool skip_init_colls=0, bool skip_movable=0, bool no_stat_moving=0);
@@ -6,11 +6,14 @@
 #include "function_registry.h"
 #include "shaders.h"
 #include "buildings.h"
+#include "layout_cache.h"
 #include "mesh.h"
 #include "draw_utils.h" // for point_sprite_drawer_sized
 #include "subdiv.h" // for sd_sphere_d
 #include "tree_3dw.h" // for tree_placer_t
 #include "profiler.h"
+#include <thread>
+#include <atomic>
 
 using std::string;
 
@@ -29,10 +32,11 @@ building_t const *player_building(nullptr);
 extern bool start_in_inf_terrain, draw_building_interiors, flashlight_on, enable_use_temp_vbo, toggle_room_light, toggle_door_open_state;
 extern bool teleport_to_screenshot, enable_dlight_bcubes, player_in_elevator;
 extern unsigned room_mirror_ref_tid;
-extern int rand_gen_index, display_mode, window_width, window_height, camera_surf_collide, animate2;
+extern int rand_gen_index, display_mode, window_width, window_height, camera_surf_collide, animate2, frame_counter;
 extern float CAMERA_RADIUS, city_dlight_pcf_offset_scale, fticks, FAR_CLIP;
 extern point sun_pos, pre_smap_player_pos;
 extern vector<light_source> dl_sources;
+extern string building_layout_cache_dir;
 extern tree_placer_t tree_placer;
 extern shader_t reflection_shader;
 
@@ -1484,6 +1488,153 @@ void building_t::write_basement_entrance_depth_pass(shader_t &s) const {
 	disable_blend();
 }
 
+// flat uniform grid of building bcubes used to accelerate overlap queries during parallel placement;
+// each cell is the head of a singly linked list of entries, all of which are stored contiguously in a single vector
+class building_place_hash_t {
+	struct entry_t {
+		unsigned bix;
+		int next; // -1 is end of list
+		entry_t(unsigned bix_, int next_) : bix(bix_), next(next_) {}
+	};
+	cube_t bcube;
+	unsigned nxy[2];
+	float cell_sz_inv[2];
+	vector<int> heads; // first entry of each cell; -1 is empty
+	vector<entry_t> entries;
+
+	void get_cell_range(cube_t const &c, unsigned ixr[2][2]) const { // {lo,hi}x{x,y}; clamped to the grid
+		for (unsigned d = 0; d < 2; ++d) {
+			for (unsigned e = 0; e < 2; ++e) {
+				float const v((c.d[d][e] - bcube.d[d][0])*cell_sz_inv[d]);
+				ixr[e][d] = ((v <= 0.0) ? 0 : min(unsigned(v), nxy[d]-1));
+			}
+		}
+	}
+public:
+	building_place_hash_t(cube_t const &bcube_, float cell_sz, unsigned max_dim) : bcube(bcube_) {
+		assert(cell_sz > 0.0 && max_dim > 0);
+
+		for (unsigned d = 0; d < 2; ++d) {
+			float const sz(bcube.get_sz_dim(d));
+			assert(sz > 0.0);
+			nxy[d] = max(1U, min(max_dim, unsigned(sz/cell_sz)));
+			cell_sz_inv[d] = nxy[d]/sz;
+		}
+		heads.resize(nxy[0]*nxy[1], -1);
+	}
+	void add(cube_t const &c, unsigned bix) {
+		unsigned ixr[2][2];
+		get_cell_range(c, ixr);
+
+		for (unsigned y = ixr[0][1]; y <= ixr[1][1]; ++y) {
+			for (unsigned x = ixr[0][0]; x <= ixr[1][0]; ++x) {
+				int &head(heads[y*nxy[0] + x]);
+				entries.emplace_back(bix, head);
+				head = int(entries.size() - 1);
+			}
+		}
+	}
+	template<typename F> bool any_of(cube_t const &c, F const &f) const { // returns true if f(bix) is true for any building in a cell overlapping c
+		unsigned ixr[2][2];
+		get_cell_range(c, ixr);
+
+		for (unsigned y = ixr[0][1]; y <= ixr[1][1]; ++y) {
+			for (unsigned x = ixr[0][0]; x <= ixr[1][0]; ++x) {
+				for (int e = heads[y*nxy[0] + x]; e >= 0; e = entries[e].next) {
+					if (f(entries[e].bix)) return 1;
+				}
+			}
+		}
+		return 0;
+	}
+};
+
+unsigned const MAX_PLACE_TILES_PER_DIM  = 32;
+unsigned const MAX_PLACE_HASH_DIM       = 2048; // for the global hash; tile hashes use 1/4 this value
+float    const PLACE_BUILDINGS_PER_TILE = 64.0; // target number of buildings per placement tile
+float    const ROOM_GEOM_PREFETCH_FRAMES = 60.0; // how far ahead to predict camera motion for room geom prefetch
+
+class room_geom_prefetch_t {
+	point last_camera;
+	vector3d camera_vel; // smoothed camera motion per frame
+public:
+	room_geom_prefetch_t() : last_camera(all_zeros), camera_vel(zero_vector) {}
+
+	point update_and_predict_camera_pos(point const &camera, float max_dist) { // should be called once per frame
+		vector3d const camera_delta(camera - last_camera);
+		last_camera = camera;
+		if (camera_delta.mag() > max_dist) {camera_vel = zero_vector;} // teleport or first frame
+		else {camera_vel = 0.9f*camera_vel + 0.1f*camera_delta;} // smoothed
+		vector3d pred_delta(ROOM_GEOM_PREFETCH_FRAMES*camera_vel);
+		if (pred_delta.mag() > 0.5f*max_dist) {pred_delta *= 0.5f*max_dist/pred_delta.mag();} // limit prediction distance
+		return (camera + pred_delta);
+	}
+};
+room_geom_prefetch_t room_geom_prefetch;
+
+class building_creator_t;
+
+// generates the room objects of one building in a background thread; the thread works on a copy of the building and its interior layout
+// so that it never touches state that the draw thread reads, and the result is moved into the real building on the draw thread
+class room_geom_gen_thread_t {
+	building_t work_building; // copy of the building with its own interior, which is where the room geom is generated
+	std::shared_ptr<building_interior_t> orig_interior; // used to check that the building wasn't regenerated or deleted while the thread was running
+	vect_cube_t ped_bcubes;
+	building_creator_t *bc;
+	unsigned bix;
+	std::atomic<bool> is_running;
+	bool needs_to_join;
+	std::thread gen_thread;
+
+	void gen_room_details() {
+		work_building.gen_room_details(ped_bcubes, bix); // same random seed as when generated on the draw thread, so the results are identical
+		is_running = 0;
+	}
+public:
+	room_geom_gen_thread_t() : bc(nullptr), bix(0), is_running(0), needs_to_join(0) {}
+	~room_geom_gen_thread_t() {wait();}
+	bool is_busy() const {return needs_to_join;} // started, and the result hasn't been taken yet
+	bool is_done() const {return (needs_to_join && !is_running);}
+	bool is_gen_for(building_creator_t const *bc_, unsigned bix_) const {return (needs_to_join && bc == bc_ && bix == bix_);}
+	building_creator_t *get_creator() const {return bc;}
+	unsigned get_bix() const {return bix;}
+
+	void start(building_creator_t *bc_, building_t const &b, unsigned bix_, vect_cube_t const &ped_bcubes_) {
+		assert(!needs_to_join && b.interior && !b.has_room_geom());
+		setup_room_geom_gen_state(); // lazily initialized state must be set up here rather than in the thread
+		bc  = bc_;
+		bix = bix_;
+		ped_bcubes    = ped_bcubes_;
+		orig_interior = b.interior;
+		work_building = b; // shares the interior until it's replaced below
+		work_building.interior.reset(new building_interior_t);
+		work_building.interior->copy_layout_from(*b.interior);
+		is_running = needs_to_join = 1;
+		gen_thread = std::thread(&room_geom_gen_thread_t::gen_room_details, this);
+	}
+	void wait() {
+		if (!needs_to_join) return;
+		gen_thread.join();
+		needs_to_join = 0;
+	}
+	// must be called after wait(); moves the room geom and the room types assigned during generation into b if it's still the building that the thread
+	// was started for and its room geom hasn't been generated for drawing in the meantime; returns true if the result was used
+	bool apply_to(building_t *b) {
+		assert(!needs_to_join);
+		bool const valid(b != nullptr && b->interior == orig_interior && !b->has_room_geom());
+
+		if (valid) {
+			assert(b->interior->rooms.size() == work_building.interior->rooms.size());
+			b->interior->rooms = work_building.interior->rooms; // same size, so the existing storage is reused
+			b->interior->room_geom.swap(work_building.interior->room_geom);
+		}
+		work_building.interior.reset(); // frees the copy, including any unused room geom
+		orig_interior.reset();
+		bc = nullptr;
+		return valid;
+	}
+};
+room_geom_gen_thread_t room_geom_gen_thread;
 
 class building_creator_t {
 
@@ -1610,15 +1761,20 @@ class building_creator_t {
 		} // for bix
 	}
 
-	bool check_valid_building_placement(building_params_t const &params, building_t const &b, vect_cube_t const &avoid_bcubes, cube_t const &avoid_bcubes_bcube,
-		float min_building_spacing, unsigned plot_ix, bool non_city_only, bool use_city_plots, bool check_plot_coll)
-	{
-		float const expand_val(b.is_rotated() ? 0.05 : 0.1); // expand by 5-10% (relative - multiplied by building size)
+	static cube_t get_placement_test_bcube(building_t const &b, float min_building_spacing, float &expand_val) {
+		expand_val = (b.is_rotated() ? 0.05 : 0.1); // expand by 5-10% (relative - multiplied by building size)
 		vector3d const b_sz(b.bcube.get_size());
 		vector3d expand(expand_val*b_sz);
 		for (unsigned d = 0; d < 2; ++d) {max_eq(expand[d], min_building_spacing);} // ensure the min building spacing (only applies to the current building)
 		cube_t test_bc(b.bcube);
 		test_bc.expand_by_xy(expand);
+		return test_bc;
+	}
+	bool check_valid_building_placement(building_params_t const &params, building_t const &b, vect_cube_t const &avoid_bcubes, cube_t const &avoid_bcubes_bcube,
+		float min_building_spacing, unsigned plot_ix, bool non_city_only, bool use_city_plots, bool check_plot_coll)
+	{
+		float expand_val(0.0);
+		cube_t test_bc(get_placement_test_bcube(b, min_building_spacing, expand_val));
 
 		if (use_city_plots) {
 			assert(plot_ix < bix_by_plot.size());
@@ -1653,6 +1809,273 @@ class building_creator_t {
 		~building_cand_t() {parts.swap(temp_parts);} // memory returned from parts to temp_parts
 	};
 
+	struct placement_ctx_t { // read-only state shared by all placement attempts in gen()
+		building_params_t const &params;
+		vect_cube_with_zval_t const &city_plot_bcubes;
+		vector<unsigned> const &valid_city_plot_ixs;
+		vect_cube_t const &avoid_bcubes;
+		cube_t avoid_bcubes_bcube;
+		vector3d delta_range, xlate;
+		float def_water_level, min_building_spacing;
+		bool city_only, non_city_only, is_tile, use_city_plots, check_plot_coll;
+	};
+	struct place_tile_t { // output of parallel placement for one tile of the placement range
+		cube_t bcube;
+		vect_building_t buildings;
+		vector<unsigned char> on_border; // one per building; 1 if the building's spacing bcube extends outside this tile
+		unsigned num_tries, num_gen, max_consec_fail;
+		place_tile_t() : num_tries(0), num_gen(0), max_consec_fail(0) {}
+	};
+
+	// generates a single candidate building, restricting its center to tile if nonzero, and tests it with check_overlap(b, plot_ix);
+	// returns 0 if the candidate was rejected and another try can be made, 1 on success, and 2 if the placement failed due to altitude
+	template<typename F> unsigned try_gen_building(building_cand_t &b, placement_ctx_t const &ctx, cube_t const *tile, rand_gen_t &rgen, F const &check_overlap) const {
+		building_params_t const &params(ctx.params);
+		b.mat_ix = params.choose_rand_mat(rgen, ctx.city_only, ctx.non_city_only); // set material
+		building_mat_t const &mat(b.get_material());
+		cube_t pos_range;
+		point center(all_zeros);
+		unsigned plot_ix(0);
+
+		if (ctx.use_city_plots) { // select a random plot, if available
+			plot_ix   = ctx.valid_city_plot_ixs[rgen.rand() % ctx.valid_city_plot_ixs.size()];
+			assert(plot_ix < ctx.city_plot_bcubes.size());
+			pos_range = ctx.city_plot_bcubes[plot_ix];
+			center.z  = ctx.city_plot_bcubes[plot_ix].zval; // optimization: take zval from plot rather than calling get_exact_zval()
+			pos_range.expand_by_xy(-ctx.min_building_spacing); // force min spacing between building and edge of plot
+		}
+		else {
+			pos_range = mat.pos_range + ctx.delta_range;
+		}
+		vector3d const pos_range_sz(pos_range.get_size());
+		assert(pos_range_sz.x > 0.0 && pos_range_sz.y > 0.0);
+		point const place_center(pos_range.get_cube_center());
+		cube_t center_range(pos_range); // range of building centers
+
+		if (tile) { // sizes and place_radius still use the full pos_range
+			if (!tile->intersects_xy(pos_range)) return 0; // this material isn't placed in this tile
+			center_range.intersect_with_cube_xy(*tile);
+		}
+		bool keep(0);
+
+		for (unsigned m = 0; m < params.num_tries; ++m) {
+			for (unsigned d = 0; d < 2; ++d) {center[d] = rgen.rand_uniform(center_range.d[d][0], center_range.d[d][1]);} // x,y
+			if (ctx.is_tile || mat.place_radius == 0.0 || dist_xy_less_than(center, place_center, mat.place_radius)) {keep = 1; break;} // place_radius ignored for tiles
+		}
+		if (!keep) return 0; // placement failed, skip
+		b.is_house = (mat.house_prob > 0.0 && rgen.rand_float() < mat.house_prob);
+		float const size_scale(b.is_house ? mat.gen_size_scale(rgen) : 1.0);
+
+		for (unsigned d = 0; d < 2; ++d) { // x,y
+			float const sz(0.5*size_scale*rgen.rand_uniform(min(mat.sz_range.d[d][0], 0.3f*pos_range_sz[d]),
+				                                            min(mat.sz_range.d[d][1], 0.5f*pos_range_sz[d]))); // use pos range size for max
+			b.bcube.d[d][0] = center[d] - sz;
+			b.bcube.d[d][1] = center[d] + sz;
+		}
+		if ((ctx.use_city_plots || ctx.is_tile) && !pos_range.contains_cube_xy(b.bcube)) return 0; // not completely contained in plot/tile (pre-rot)
+		if (!ctx.use_city_plots) {b.gen_rotation(rgen);} // city plots are Manhattan (non-rotated) - must rotate before bcube checks below
+		if (ctx.is_tile && !pos_range.contains_cube_xy(b.bcube)) return 0; // not completely contained in tile
+		if (start_in_inf_terrain && b.bcube.contains_pt_xy(get_camera_pos())) return 0; // don't place a building over the player appearance spot
+		if (!check_overlap(b, plot_ix)) return 0; // check overlap
+		if (!ctx.use_city_plots) {center.z = get_exact_zval(center.x+ctx.xlate.x, center.y+ctx.xlate.y);} // only calculate when needed
+		float const z_sea_level(center.z - ctx.def_water_level);
+		if (z_sea_level < 0.0) return 2; // skip underwater buildings, failed placement
+		if (z_sea_level < mat.min_alt || z_sea_level > mat.max_alt) return 2; // skip bad altitude buildings, failed placement
+		float const hmin(ctx.use_city_plots ? pos_range.z1() : 0.0), hmax(ctx.use_city_plots ? pos_range.z2() : 1.0);
+		assert(hmin <= hmax);
+		float const height_range(mat.sz_range.dz());
+		assert(height_range >= 0.0);
+		float const z_size_scale(size_scale*(b.is_house ? rgen.rand_uniform(0.6, 0.8) : 1.0)); // make houses slightly shorter on average to offset extra height added by roof
+		float const height_val(z_size_scale*(mat.sz_range.z1() + height_range*rgen.rand_uniform(hmin, hmax)));
+		assert(height_val > 0.0);
+		b.set_z_range(center.z, (center.z + 0.5*height_val));
+		assert(b.bcube.is_strictly_normalized());
+		mat.side_color.gen_color(b.side_color, rgen);
+		mat.roof_color.gen_color(b.roof_color, rgen);
+		return 1;
+	}
+	void add_building_bcube(cube_t const &bcube, unsigned bix) { // adds to the grid and updates max_extent
+		add_to_grid(bcube, bix, 0);
+		vector3d const sz(bcube.get_size());
+		float const mult[3] = {0.5, 0.5, 1.0}; // half in X,Y and full in Z
+		UNROLL_3X(max_extent[i_] = max(max_extent[i_], mult[i_]*sz[i_]);)
+	}
+	void add_building(building_t const &b) {
+		add_building_bcube(b.bcube, buildings.size());
+		buildings.push_back(b);
+	}
+	static unsigned get_num_place_tiles_per_dim(unsigned num_place) { // depends only on num_place so that results are independent of thread count
+		return min(MAX_PLACE_TILES_PER_DIM, unsigned(sqrt(num_place/PLACE_BUILDINGS_PER_TILE)));
+	}
+	static float get_place_hash_cell_size(building_params_t const &params) { // the size of the largest building footprint
+		float cell_sz(0.0);
+
+		for (auto m = params.materials.begin(); m != params.materials.end(); ++m) {
+			float const house_scale(max(1.0f, m->house_scale_max));
+			for (unsigned d = 0; d < 2; ++d) {max_eq(cell_sz, house_scale*m->sz_range.d[d][1]);}
+		}
+		return cell_sz;
+	}
+
+	// places buildings by dividing the placement range into tiles that are filled in parallel, each with its own deterministic random seed;
+	// buildings that don't cross a tile border can't conflict and are all added first, then the rest are checked in a fixed order and added if valid
+	void place_buildings_parallel(placement_ctx_t const &ctx, int rseed, unsigned &num_tries, unsigned &num_gen, unsigned &max_consec_fail) {
+		building_params_t const &params(ctx.params);
+		unsigned const tiles_per_dim(get_num_place_tiles_per_dim(params.num_place)), num_tiles(tiles_per_dim*tiles_per_dim);
+		unsigned const max_tile_consec_fail(max(50U, 5000U/num_tiles));
+		float const extra_spacing(ctx.non_city_only ? params.sec_extra_spacing : 0.0), expand_abs(max(ctx.min_building_spacing, extra_spacing));
+		float const cell_sz(max(get_place_hash_cell_size(params), 0.001f*max(range_sz.x, range_sz.y)));
+		vector3d const tile_sz(range_sz.x/tiles_per_dim, range_sz.y/tiles_per_dim, 0.0);
+		vector<place_tile_t> tiles(num_tiles);
+		assert(tiles_per_dim > 1);
+
+#pragma omp parallel for schedule(dynamic,1)
+		for (int t = 0; t < (int)num_tiles; ++t) {
+			place_tile_t &tile(tiles[t]);
+			unsigned const tx(t%tiles_per_dim), ty(t/tiles_per_dim), num_place(params.num_place/num_tiles + (unsigned(t) < params.num_place%num_tiles));
+			tile.bcube = range;
+			tile.bcube.x1() = range.x1() + tx*tile_sz.x;
+			tile.bcube.y1() = range.y1() + ty*tile_sz.y;
+			if (tx+1 < tiles_per_dim) {tile.bcube.x2() = tile.bcube.x1() + tile_sz.x;} // last tile ends exactly at the range edge
+			if (ty+1 < tiles_per_dim) {tile.bcube.y2() = tile.bcube.y1() + tile_sz.y;}
+			rand_gen_t rgen;
+			rgen.set_state(3145739*(t+1) + rand_gen_index, 1572869*(t+1) + rseed); // per-tile seed, independent of thread assignment
+			building_place_hash_t hash(tile.bcube, cell_sz, MAX_PLACE_HASH_DIM/4);
+			vect_cube_t temp_parts;
+			vector<point> points; // thread-local temporary
+			unsigned num_consec_fail(0);
+
+			auto check_overlap([&](building_t const &b, unsigned plot_ix) {
+				float expand_val(0.0);
+				cube_t test_bc(get_placement_test_bcube(b, ctx.min_building_spacing, expand_val));
+				if (ctx.check_plot_coll && ctx.avoid_bcubes_bcube.intersects_xy(test_bc) && has_bcube_int_xy(test_bc, ctx.avoid_bcubes, params.sec_extra_spacing)) return false;
+				test_bc.expand_by_xy(extra_spacing);
+				return !hash.any_of(test_bc, [&](unsigned ix) {
+					building_t const &ob(tile.buildings[ix]);
+					return (test_bc.intersects_xy(ob.bcube) && ob.check_bcube_overlap_xy(b, expand_val, expand_abs, points));
+				});
+			});
+			for (unsigned i = 0; i < num_place; ++i) {
+				bool success(0);
+
+				for (unsigned n = 0; n < params.num_tries; ++n) {
+					building_cand_t b(temp_parts);
+					++tile.num_tries;
+					unsigned const ret(try_gen_building(b, ctx, &tile.bcube, rgen, check_overlap));
+					if (ret == 0) continue; // try again
+					++tile.num_gen;
+					if (ret == 2) break; // failed placement
+					float expand_val(0.0);
+					cube_t test_bc(get_placement_test_bcube(b, ctx.min_building_spacing, expand_val));
+					test_bc.expand_by_xy(extra_spacing);
+					hash.add(b.bcube, tile.buildings.size());
+					tile.on_border.push_back(!tile.bcube.contains_cube_xy(test_bc));
+					tile.buildings.push_back(b);
+					success = 1;
+					break; // done
+				} // for n
+				if (success) {num_consec_fail = 0; continue;}
+				++num_consec_fail;
+				max_eq(tile.max_consec_fail, num_consec_fail);
+				if (num_consec_fail >= max_tile_consec_fail) break; // too many failures - give up on this tile
+			} // for i
+		} // for t
+		// merge tiles in a fixed order so that the results are deterministic
+		building_place_hash_t hash(range, cell_sz, MAX_PLACE_HASH_DIM);
+		unsigned num_border(0), num_conflicts(0);
+
+		for (auto t = tiles.begin(); t != tiles.end(); ++t) { // add interior buildings first; these never overlap buildings in other tiles
+			num_tries += t->num_tries;
+			num_gen   += t->num_gen;
+			max_eq(max_consec_fail, t->max_consec_fail);
+
+			for (unsigned i = 0; i < t->buildings.size(); ++i) {
+				if (t->on_border[i]) {++num_border; continue;}
+				hash.add(t->buildings[i].bcube, buildings.size());
+				add_building(t->buildings[i]);
+			}
+		}
+		for (auto t = tiles.begin(); t != tiles.end(); ++t) { // resolve conflicts between buildings crossing tile borders
+			for (unsigned i = 0; i < t->buildings.size(); ++i) {
+				if (!t->on_border[i]) continue;
+				building_t const &b(t->buildings[i]);
+				float expand_val(0.0);
+				cube_t test_bc(get_placement_test_bcube(b, ctx.min_building_spacing, expand_val));
+				test_bc.expand_by_xy(extra_spacing);
+				bool const overlaps(hash.any_of(test_bc, [&](unsigned ix) {
+					building_t const &ob(get_building(ix));
+					return (test_bc.intersects_xy(ob.bcube) && ob.check_bcube_overlap_xy(b, expand_val, expand_abs, points));
+				}));
+				if (overlaps) {++num_conflicts; continue;}
+				hash.add(b.bcube, buildings.size());
+				add_building(b);
+			} // for i
+		} // for t
+		cout << "Parallel building placement: " << num_tiles << " tiles, " << num_border << " border buildings, " << num_conflicts << " border conflicts" << endl;
+	}
+
+	// hash of everything that building placement and geometry generation depend on, used as the layout cache key; texture IDs are excluded
+	uint64_t get_layout_cache_key(placement_ctx_t const &ctx, vector<unsigned> const &mat_ix_list, bool allow_flatten, int rseed) const {
+		layout_hash_t hash;
+		building_params_t const &params(ctx.params);
+		unsigned const sizes[6] = {BUILDING_GEN_VERSION, sizeof(building_t), sizeof(building_interior_t), sizeof(room_t), sizeof(door_t), sizeof(stairwell_t)}; // catch generator and struct changes
+		bool const flags[14] = {params.flatten_mesh, params.dome_roof, params.onion_roof, params.enable_people_ai, params.gen_building_interiors,
+			params.add_city_interiors, params.enable_rotated_room_geom, params.add_secondary_buildings, params.parallel_placement,
+			ctx.city_only, ctx.non_city_only, allow_flatten, has_city_trees(), bool(DRAW_WINDOWS_AS_HOLES)};
+		int const ivals[6] = {rseed, rand_gen_index, world_mode, xoff2, yoff2, int(params.windows_enabled())};
+		unsigned const uvals[3] = {params.num_place, params.num_tries, params.buildings_rand_seed};
+		float const fvals[13] = {params.sec_extra_spacing, params.window_width, params.window_height, params.window_xspace, params.window_yspace,
+			params.wall_split_thresh, params.max_fp_wind_xscale, params.max_fp_wind_yscale, params.open_door_prob, params.locked_door_prob,
+			params.basement_prob, ctx.def_water_level, ctx.min_building_spacing};
+		vector3d const car_sz(get_nom_car_size());
+		hash.add(sizes);
+		hash.add(flags);
+		hash.add(ivals);
+		hash.add(uvals);
+		hash.add(fvals);
+		hash.add(car_sz);
+		hash.add(range);
+		hash.add(mat_ix_list.data(), mat_ix_list.size()*sizeof(unsigned));
+
+		for (auto m = params.materials.begin(); m != params.materials.end(); ++m) {
+			bool const mflags[3] = {m->no_city, m->add_windows, m->add_wind_lights};
+			unsigned const mcounts[4] = {m->min_levels, m->max_levels, m->min_sides, m->max_sides};
+			float const mvals[28] = {m->place_radius, m->max_delta_z, m->max_rot_angle, m->min_level_height, m->min_alt, m->max_alt, m->house_prob,
+				m->house_scale_min, m->house_scale_max, m->split_prob, m->cube_prob, m->round_prob, m->asf_prob, m->min_fsa, m->max_fsa, m->min_asf,
+				m->max_asf, m->wind_xscale, m->wind_yscale, m->wind_xoff, m->wind_yoff, m->floor_spacing, m->floorplan_wind_xscale,
+				m->side_color.grayscale_rand, m->roof_color.grayscale_rand, m->pos_range.z1(), m->pos_range.z2(), 0.0f};
+			cube_t const mcubes[2] = {m->pos_range, m->sz_range};
+			colorRGBA const mcolors[10] = {m->side_color.cmin, m->side_color.cmax, m->roof_color.cmin, m->roof_color.cmax, m->window_color,
+				m->wall_color, m->ceil_color, m->floor_color, m->house_ceil_color, m->house_floor_color};
+			hash.add(mflags);
+			hash.add(mcounts);
+			hash.add(mvals);
+			hash.add(mcubes);
+			hash.add(mcolors);
+		}
+		for (auto i = ctx.city_plot_bcubes.begin(); i != ctx.city_plot_bcubes.end(); ++i) { // hash fields separately to skip padding
+			hash.add(static_cast<cube_t const &>(*i));
+			hash.add(i->zval);
+			hash.add(i->is_park);
+		}
+		hash.add(ctx.avoid_bcubes.data(), ctx.avoid_bcubes.size()*sizeof(cube_t));
+		// hash the terrain height at every mesh grid point in the placement range, which is the resolution of the heightmap that get_exact_zval() reads;
+		// rows are hashed in parallel and then combined in order so that the key doesn't depend on the thread count
+		int const x1(int(floor((range.x1() + ctx.xlate.x + X_SCENE_SIZE)*DX_VAL_INV)) - 1), x2(int(ceil((range.x2() + ctx.xlate.x + X_SCENE_SIZE)*DX_VAL_INV)) + 1);
+		int const y1(int(floor((range.y1() + ctx.xlate.y + Y_SCENE_SIZE)*DY_VAL_INV)) - 1), y2(int(ceil((range.y2() + ctx.xlate.y + Y_SCENE_SIZE)*DY_VAL_INV)) + 1);
+		vector<uint64_t> row_hashes(max(0, (y2 - y1 + 1)));
+
+#pragma omp parallel for schedule(static)
+		for (int y = y1; y <= y2; ++y) {
+			layout_hash_t row_hash;
+			float const yval(y*DY_VAL - Y_SCENE_SIZE);
+			for (int x = x1; x <= x2; ++x) {row_hash.add(get_exact_zval((x*DX_VAL - X_SCENE_SIZE), yval));}
+			row_hashes[y - y1] = row_hash.get();
+		}
+		hash.add(row_hashes.data(), row_hashes.size()*sizeof(uint64_t));
+		return hash.get();
+	}
+
 public:
 	building_creator_t(bool is_city=0) : grid_sz(1), gpu_mem_usage(0), max_extent(zero_vector), building_draw(is_city), building_draw_vbo(is_city),
 		use_smap_this_frame(0), has_interior_geom(0) {}
@@ -1740,77 +2163,42 @@ public:
 		}
 		bool const use_city_plots(!valid_city_plot_ixs.empty()), check_plot_coll(!avoid_bcubes.empty());
 		bix_by_plot.resize(city_plot_bcubes.size());
-		point center(all_zeros);
 		unsigned num_consec_fail(0), max_consec_fail(0);
 		vect_cube_t temp_parts;
-
-		for (unsigned i = 0; i < params.num_place; ++i) {
+		placement_ctx_t const ctx{params, city_plot_bcubes, valid_city_plot_ixs, avoid_bcubes, avoid_bcubes_bcube, delta_range, xlate,
+			def_water_level, min_building_spacing, city_only, non_city_only, is_tile, use_city_plots, check_plot_coll};
+		// placement and geometry of non-tiled buildings can be loaded from the layout cache in place of generation
+		building_layout_cache_t layout_cache;
+		uint64_t const cache_key((is_tile || building_layout_cache_dir.empty()) ? 0 : get_layout_cache_key(ctx, mat_ix_list, allow_flatten, rseed));
+		string const cache_fn((is_tile || building_layout_cache_dir.empty()) ? string() : get_layout_cache_fn("buildings", cache_key));
+		bool const from_cache(!cache_fn.empty() && layout_cache.read(cache_fn, cache_key, buildings) && layout_cache.bix_by_plot.size() == bix_by_plot.size());
+
+		if (from_cache) {
+			for (unsigned i = 0; i < buildings.size(); ++i) {add_building_bcube(layout_cache.place_bcubes[i], i);}
+			bix_by_plot.swap(layout_cache.bix_by_plot);
+			rgen.set_state(layout_cache.rseed1, layout_cache.rseed2);
+			num_skip = layout_cache.num_skip;
+			cout << "Loaded " << buildings.size() << " buildings from layout cache file " << cache_fn << endl;
+		}
+		else {buildings.clear();} // in case of a partial read
+		// parallel placement doesn't support city plots, which are already small and have their own overlap lists
+		bool const parallel_place(!from_cache && params.parallel_placement && !is_tile && !use_city_plots && get_num_place_tiles_per_dim(params.num_place) > 1);
+		if (parallel_place) {place_buildings_parallel(ctx, rseed, num_tries, num_gen, max_consec_fail);}
+
+		auto check_overlap([&](building_t const &b, unsigned plot_ix) {
+			return check_valid_building_placement(params, b, avoid_bcubes, avoid_bcubes_bcube, min_building_spacing, plot_ix, non_city_only, use_city_plots, check_plot_coll);
+		});
+		for (unsigned i = 0; i < ((parallel_place || from_cache) ? 0U : params.num_place); ++i) {
 			bool success(0);
 
 			for (unsigned n = 0; n < params.num_tries; ++n) { // 10 tries to find a non-overlapping building placement
 				building_cand_t b(temp_parts);
-				b.mat_ix = params.choose_rand_mat(rgen, city_only, non_city_only); // set material
-				building_mat_t const &mat(b.get_material());
-				cube_t pos_range;
-				unsigned plot_ix(0);
-				
-				if (use_city_plots) { // select a random plot, if available
-					plot_ix   = valid_city_plot_ixs[rgen.rand() % valid_city_plot_ixs.size()];
-					assert(plot_ix < city_plot_bcubes.size());
-					pos_range = city_plot_bcubes[plot_ix];
-					center.z  = city_plot_bcubes[plot_ix].zval; // optimization: take zval from plot rather than calling get_exact_zval()
-					pos_range.expand_by_xy(-min_building_spacing); // force min spacing between building and edge of plot
-				}
-				else {
-					pos_range = mat.pos_range + delta_range;
-				}
-				vector3d const pos_range_sz(pos_range.get_size());
-				assert(pos_range_sz.x > 0.0 && pos_range_sz.y > 0.0);
-				point const place_center(pos_range.get_cube_center());
-				bool keep(0);
 				++num_tries;
-
-				for (unsigned m = 0; m < params.num_tries; ++m) {
-					for (unsigned d = 0; d < 2; ++d) {center[d] = rgen.rand_uniform(pos_range.d[d][0], pos_range.d[d][1]);} // x,y
-					if (is_tile || mat.place_radius == 0.0 || dist_xy_less_than(center, place_center, mat.place_radius)) {keep = 1; break;} // place_radius ignored for tiles
-				}
-				if (!keep) continue; // placement failed, skip
-				b.is_house = (mat.house_prob > 0.0 && rgen.rand_float() < mat.house_prob);
-				float const size_scale(b.is_house ? mat.gen_size_scale(rgen) : 1.0);
-				
-				for (unsigned d = 0; d < 2; ++d) { // x,y
-					float const sz(0.5*size_scale*rgen.rand_uniform(min(mat.sz_range.d[d][0], 0.3f*pos_range_sz[d]),
-						                                            min(mat.sz_range.d[d][1], 0.5f*pos_range_sz[d]))); // use pos range size for max
-					b.bcube.d[d][0] = center[d] - sz;
-					b.bcube.d[d][1] = center[d] + sz;
-				}
-				if ((use_city_plots || is_tile) && !pos_range.contains_cube_xy(b.bcube)) continue; // not completely contained in plot/tile (pre-rot)
-				if (!use_city_plots) {b.gen_rotation(rgen);} // city plots are Manhattan (non-rotated) - must rotate before bcube checks below
-				if (is_tile && !pos_range.contains_cube_xy(b.bcube)) continue; // not completely contained in tile
-				if (start_in_inf_terrain && b.bcube.contains_pt_xy(get_camera_pos())) continue; // don't place a building over the player appearance spot
-				if (!check_valid_building_placement(params, b, avoid_bcubes, avoid_bcubes_bcube,
-					min_building_spacing, plot_ix, non_city_only, use_city_plots, check_plot_coll)) continue; // check overlap
+				unsigned const ret(try_gen_building(b, ctx, nullptr, rgen, check_overlap));
+				if (ret == 0) continue; // try again
 				++num_gen;
-				if (!use_city_plots) {center.z = get_exact_zval(center.x+xlate.x, center.y+xlate.y);} // only calculate when needed
-				float const z_sea_level(center.z - def_water_level);
-				if (z_sea_level < 0.0) break; // skip underwater buildings, failed placement
-				if (z_sea_level < mat.min_alt || z_sea_level > mat.max_alt) break; // skip bad altitude buildings, failed placement
-				float const hmin(use_city_plots ? pos_range.z1() : 0.0), hmax(use_city_plots ? pos_range.z2() : 1.0);
-				assert(hmin <= hmax);
-				float const height_range(mat.sz_range.dz());
-				assert(height_range >= 0.0);
-				float const z_size_scale(size_scale*(b.is_house ? rgen.rand_uniform(0.6, 0.8) : 1.0)); // make houses slightly shorter on average to offset extra height added by roof
-				float const height_val(z_size_scale*(mat.sz_range.z1() + height_range*rgen.rand_uniform(hmin, hmax)));
-				assert(height_val > 0.0);
-				b.set_z_range(center.z, (center.z + 0.5*height_val));
-				assert(b.bcube.is_strictly_normalized());
-				mat.side_color.gen_color(b.side_color, rgen);
-				mat.roof_color.gen_color(b.roof_color, rgen);
-				add_to_grid(b.bcube, buildings.size(), 0);
-				vector3d const sz(b.bcube.get_size());
-				float const mult[3] = {0.5, 0.5, 1.0}; // half in X,Y and full in Z
-				UNROLL_3X(max_extent[i_] = max(max_extent[i_], mult[i_]*sz[i_]);)
-				buildings.push_back(b);
+				if (ret == 2) break; // failed placement
+				add_building(b);
 				success = 1;
 				break; // done
 			} // for n
@@ -1830,6 +2218,12 @@ public:
 		for (auto i = bix_by_plot.begin(); i != bix_by_plot.end(); ++i) {sort(i->begin(), i->end(), cmp_x1);}
 		if (!is_tile) {timer.end();} // use a single timer for tile mode
 
+		if (!cache_fn.empty() && !from_cache) { // record placed bcubes and RNG state before they're modified by zval adjustment and geometry generation
+			for (auto b = buildings.begin(); b != buildings.end(); ++b) {layout_cache.place_bcubes.push_back(b->bcube);}
+			layout_cache.rseed1 = rgen.rseed1;
+			layout_cache.rseed2 = rgen.rseed2;
+		}
+
 		if (params.flatten_mesh && !use_city_plots) { // not needed for city plots, which are already flat
 			timer_t timer("Gen Building Zvals", !is_tile);
 			bool const do_flatten(allow_flatten && using_tiled_terrain_hmap_tex()); // can't always flatten terrain when using tiles
@@ -1840,9 +2234,9 @@ public:
 
 				if (do_flatten) { // flatten the mesh under the bcube to a height of mesh_zval
 					//assert(!b.is_rotated()); // too strong?
-					flatten_hmap_region(b.bcube);
+					flatten_hmap_region(from_cache ? layout_cache.place_bcubes[i] : b.bcube); // cached buildings have final bcubes, so use the placed bcube
 				}
-				else { // extend building bottom downward to min mesh height
+				else if (!from_cache) { // extend building bottom downward to min mesh height; cached buildings were already extended
 					bool const shift_top(DRAW_WINDOWS_AS_HOLES); // shift is required to preserve height for floor alignment of building interiors
 					float &zmin(b.bcube.z1()); // Note: grid bcube z0 value won't be correct, but will be fixed conservatively below
 					float const orig_zmin(zmin);
@@ -1873,12 +2267,27 @@ public:
 				for (auto i = grid.begin(); i != grid.end(); ++i) {i->bcube.z1() = def_water_level;}
 			}
 		} // if flatten_mesh
-		{ // open a scope
+		if (!from_cache) { // cached buildings already have geometry
 			timer_t timer2("Gen Building Geometry", !is_tile);
 			bool const use_mt(!is_tile || global_building_params.gen_building_interiors); // only single threaded for tiles with no interiors, which is a fast case anyway
-#pragma omp parallel for schedule(static,1) num_threads(2) if (use_mt)
-			for (int i = 0; i < (int)buildings.size(); ++i) {buildings[i].gen_geometry(i, 1337*i+rseed);}
-		} // close the scope
+			// tiles are created along with terrain tiles, so limit them to two threads; building cost varies widely, so use dynamic scheduling
+			int const num_gen_threads(is_tile ? 2 : omp_get_max_threads_3dw());
+			bool const print_times(!is_tile && global_building_params.print_gen_times);
+			vector<float> gen_times_ms(print_times ? buildings.size() : 0); // per-building, for finding slow floorplans
+#pragma omp parallel for schedule(dynamic,1) num_threads(num_gen_threads) if (use_mt)
+			for (int i = 0; i < (int)buildings.size(); ++i) {
+				if (!print_times) {buildings[i].gen_geometry(i, 1337*i+rseed); continue;}
+				auto const start_time(high_resolution_clock::now());
+				buildings[i].gen_geometry(i, 1337*i+rseed);
+				gen_times_ms[i] = duration_cast<duration<float, std::milli>>(high_resolution_clock::now() - start_time).count();
+			}
+			if (print_times) {print_gen_time_histogram(gen_times_ms);}
+		}
+		if (!cache_fn.empty() && !from_cache) { // save for next time
+			layout_cache.num_skip    = num_skip;
+			layout_cache.bix_by_plot = bix_by_plot;
+			if (layout_cache.write(cache_fn, cache_key, buildings)) {cout << "Wrote building layout cache file " << cache_fn << endl;}
+		}
 		if (0 && non_city_only) { // perform room graph analysis
 			timer_t timer3("Building Room Graph Analysis");
 			for (auto b = buildings.begin(); b != buildings.end(); ++b) {
@@ -1917,6 +2326,36 @@ public:
 		create_vbos(is_tile);
 	} // end gen()
 
+	void print_gen_time_histogram(vector<float> const &times_ms) const { // log scale histogram of gen_geometry() times, followed by the slowest buildings
+		unsigned const NUM_BINS = 7, NUM_SLOWEST = 5;
+		float const bin_ends[NUM_BINS-1] = {0.1, 0.3, 1.0, 3.0, 10.0, 30.0}; // in ms; last bin is unbounded
+		unsigned counts[NUM_BINS] = {};
+		vector<pair<float, unsigned>> by_time; // {time, bix}
+
+		for (unsigned i = 0; i < times_ms.size(); ++i) {
+			unsigned bin(0);
+			while (bin+1 < NUM_BINS && times_ms[i] >= bin_ends[bin]) {++bin;}
+			++counts[bin];
+			by_time.emplace_back(times_ms[i], i);
+		}
+		cout << "Building geometry gen times (ms):";
+
+		for (unsigned n = 0; n < NUM_BINS; ++n) {
+			cout << " ";
+			if (n == 0) {cout << "<" << bin_ends[0];} else if (n+1 == NUM_BINS) {cout << ">=" << bin_ends[n-1];} else {cout << bin_ends[n-1] << "-" << bin_ends[n];}
+			cout << ": " << counts[n];
+		}
+		cout << endl;
+		unsigned const num_slowest(min(NUM_SLOWEST, (unsigned)by_time.size()));
+		partial_sort(by_time.begin(), (by_time.begin() + num_slowest), by_time.end(), std::greater<pair<float, unsigned>>());
+
+		for (unsigned n = 0; n < num_slowest; ++n) {
+			building_t const &b(get_building(by_time[n].second));
+			cout << "Slow building " << by_time[n].second << ": " << by_time[n].first << "ms, " << TXT(b.is_house) << "rooms: " << (b.interior ? b.interior->rooms.size() : 0)
+				 << " center: " << b.bcube.get_cube_center().str() << endl;
+		}
+	}
+
 	struct pt_by_xval {
 		bool operator()(point const &a, point const &b) const {return (a.x < b.x);}
 	};
@@ -2117,6 +2556,105 @@ public:
 	}
 
 	// reflection_pass: 0 = not reflection pass, 1 = reflection for room with exterior wall, 2 = reflection for room with interior wall, 3 = reflection from mirror in a house
+	// starts generating room geom in the background thread for the building nearest to where the camera is predicted to be in the near future but that
+	// isn't drawn yet, so that this expensive step is done ahead of time rather than when a dense block first comes into range;
+	// only the grid cells within the room geom draw distance of pred_pos are searched
+	static void prefetch_room_geom(vector<building_creator_t *> const &bcs, point const &pred_pos, float room_geom_draw_dist, vect_cube_t &ped_bcubes) {
+		if (room_geom_gen_thread.is_busy()) return; // one building at a time
+		building_creator_t *best_bc(nullptr);
+		unsigned best_bix(0);
+		float dmin_sq(0.0);
+
+		for (auto i = bcs.begin(); i != bcs.end(); ++i) {
+			if ((*i)->grid.empty()) continue; // no buildings
+			float const ddist_scale((*i)->building_draw_windows.empty() ? 0.05 : 1.0), max_dist(ddist_scale*room_geom_draw_dist);
+			cube_t search_area(pred_pos);
+			search_area.expand_by_xy(max_dist);
+			if (!search_area.intersects_xy((*i)->range)) continue; // too far
+			unsigned ixr[2][2];
+			(*i)->get_grid_range(search_area, ixr);
+
+			for (unsigned y = ixr[0][1]; y <= ixr[1][1]; ++y) {
+				for (unsigned x = ixr[0][0]; x <= ixr[1][0]; ++x) {
+					grid_elem_t const &ge((*i)->get_grid_elem(x, y));
+					if (ge.bc_ixs.empty() || !ge.bcube.closest_dist_less_than(pred_pos, max_dist)) continue; // empty or too far
+
+					for (auto bi = ge.bc_ixs.begin(); bi != ge.bc_ixs.end(); ++bi) {
+						building_t const &b((*i)->get_building(bi->ix));
+						if (!b.interior || b.has_room_geom() || !b.has_windows()) continue; // no interior, already generated, or can't be seen from outside
+						if (!global_building_params.enable_rotated_room_geom && b.is_rotated()) continue; // room geom not supported
+						if (!b.bcube.closest_dist_less_than(pred_pos, max_dist)) continue; // too far away
+						float const dsq(p2p_dist_sq(pred_pos, b.bcube.closest_pt(pred_pos)));
+						if (best_bc != nullptr && dsq >= dmin_sq) continue; // not closer
+						best_bc = *i; best_bix = bi->ix; dmin_sq = dsq;
+					} // for bi
+				} // for x
+			} // for y
+		} // for i
+		if (best_bc == nullptr) return; // nothing to prefetch
+		int const ped_ix(best_bc->get_ped_ix_for_bix(best_bix));
+		ped_bcubes.clear();
+		if (ped_ix >= 0) {get_ped_bcubes_for_building(ped_ix, best_bix, ped_bcubes);} // must match building_t::gen_room_geom_if_needed()
+		room_geom_gen_thread.start(best_bc, best_bc->get_building(best_bix), best_bix, ped_bcubes);
+	}
+
+	// moves the room geom generated by the background thread into its building once the thread has finished, or waits for it if wait=1;
+	// the room objects are generated off-thread, so all that's left for the draw thread is creating the VBOs when the building is drawn;
+	// the result is dropped if the building's creator isn't in bcs, since it may have been deleted; returns true if room geom was added
+	static bool finish_room_geom_prefetch(vector<building_creator_t *> const &bcs, bool wait) {
+		if (!(wait ? room_geom_gen_thread.is_busy() : room_geom_gen_thread.is_done())) return 0; // not started or still running
+		room_geom_gen_thread.wait();
+		building_creator_t *const bc(room_geom_gen_thread.get_creator());
+		unsigned const bix(room_geom_gen_thread.get_bix());
+		bool const bc_valid(find(bcs.begin(), bcs.end(), bc) != bcs.end() && bix < bc->buildings.size());
+		building_t *const b(bc_valid ? &bc->buildings[bix] : nullptr);
+		if (!room_geom_gen_thread.apply_to(b)) return 0; // building was deleted or regenerated, or its room geom was generated for drawing first
+		b->interior->room_geom->last_draw_frame = frame_counter; // not drawn yet, but don't free it right away
+
+		for (auto g = bc->grid_by_tile.begin(); g != bc->grid_by_tile.end(); ++g) { // mark the tile so that the room geom is freed when it goes out of range
+			if (!g->bcube.contains_cube_xy(b->bcube)) continue; // not this tile
+			for (auto bi = g->bc_ixs.begin(); bi != g->bc_ixs.end(); ++bi) {if (bi->ix == bix) {g->has_room_geom = 1; return 1;}}
+		}
+		return 1;
+	}
+
+	// frees the room geom of the least recently drawn buildings until memory usage is under the budget;
+	// only buildings in tiles with room geom are checked, and buildings drawn this frame or last frame are kept
+	static void free_lru_room_geom(vector<building_creator_t *> const &bcs, size_t mem_budget) {
+		struct lru_entry_t {
+			building_room_geom_t *rgeom;
+			building_t *building;
+			size_t mem;
+			lru_entry_t(building_room_geom_t *rgeom_, building_t *building_, size_t mem_) : rgeom(rgeom_), building(building_), mem(mem_) {}
+			bool operator<(lru_entry_t const &e) const {return (rgeom->last_draw_frame < e.rgeom->last_draw_frame);}
+		};
+		vector<lru_entry_t> lru;
+		size_t mem_usage(0);
+
+		for (auto i = bcs.begin(); i != bcs.end(); ++i) {
+			for (auto g = (*i)->grid_by_tile.begin(); g != (*i)->grid_by_tile.end(); ++g) {
+				if (!g->has_room_geom) continue;
+
+				for (auto bi = g->bc_ixs.begin(); bi != g->bc_ixs.end(); ++bi) {
+					building_t &b((*i)->get_building(bi->ix));
+					if (!b.has_room_geom()) continue;
+					building_room_geom_t *const rgeom(b.interior->room_geom.get());
+					size_t const mem(rgeom->get_mem_usage());
+					mem_usage += mem;
+					if (!rgeom->modified_by_player) {lru.emplace_back(rgeom, &b, mem);} // buildings modified by the player are never freed
+				}
+			} // for g
+		} // for i
+		if (mem_usage <= mem_budget) return; // under budget
+		sort(lru.begin(), lru.end()); // least recently drawn first
+
+		for (auto i = lru.begin(); i != lru.end() && mem_usage > mem_budget; ++i) {
+			if (i->rgeom->last_draw_frame + 1 >= frame_counter) break; // drawn in the current or previous frame; keep it
+			mem_usage -= i->mem;
+			i->building->clear_room_geom(0); // force=0
+		}
+	}
+
 	static void multi_draw(int shadow_only, int reflection_pass, vector3d const &xlate, vector<building_creator_t *> const &bcs) {
 		if (bcs.empty()) return;
 
@@ -2210,6 +2748,7 @@ public:
 			vector<point> points; // reused temporary
 			vect_cube_t ped_bcubes; // reused temporary
 			int indir_bcs_ix(-1), indir_bix(-1);
+			bool room_geom_gen_this_frame(0);
 
 			if (draw_interior) {
 				per_bcs_exclude.resize(bcs.size());
@@ -2252,8 +2791,12 @@ public:
 						int const ped_ix((*i)->get_ped_ix_for_bix(bi->ix)); // Note: assumes only one building_draw has people
 						bool const inc_small(b.bcube.closest_dist_less_than(camera_xlated, ddist_scale*room_geom_sm_draw_dist));
 						bool const player_in_building_bcube(b.bcube.contains_pt_xy(camera_xlated)); // player is within the building's bcube
+						// if the background thread is generating room geom for this building, wait for it rather than generating it again
+						if (!b.has_room_geom() && room_geom_gen_thread.is_gen_for(*i, bi->ix)) {finish_room_geom_prefetch(bcs, 1);} // wait=1
+						room_geom_gen_this_frame |= !b.has_room_geom();
 						b.gen_and_draw_room_geom(s, oc, xlate, ped_bcubes, bi->ix, ped_ix, 0, reflection_pass, inc_small, player_in_building_bcube); // shadow_only=0
 						g->has_room_geom = 1;
+						if (b.has_room_geom()) {b.interior->room_geom->last_draw_frame = frame_counter;}
 						if (!draw_interior) continue;
 						if (ped_ix >= 0) {draw_peds_in_building(ped_ix, ped_draw_vars_t(b, oc, s, xlate, bi->ix, 0, reflection_pass));} // draw people in this building
 						// check the bcube rather than check_point_or_cylin_contained() so that it works with roof doors that are outside any part?
@@ -2300,6 +2843,17 @@ public:
 					} // for bi
 				} // for g
 			} // for i
+			if (!reflection_pass) {
+				if (global_building_params.prefetch_room_geom) {
+					point const pred_pos(room_geom_prefetch.update_and_predict_camera_pos(camera_xlated, room_geom_draw_dist));
+					room_geom_gen_this_frame |= finish_room_geom_prefetch(bcs, 0); // wait=0
+					prefetch_room_geom(bcs, pred_pos, room_geom_draw_dist, ped_bcubes);
+				}
+				// room geom memory mostly grows when a building's room geom is generated, so only check the budget then rather than every frame
+				if (global_building_params.room_geom_cache_mb > 0 && room_geom_gen_this_frame) {
+					free_lru_room_geom(bcs, (size_t(global_building_params.room_geom_cache_mb) << 20));
+				}
+			}
 			if (ADD_ROOM_LIGHTS) {glDepthFunc(GL_LESS);} // restore
 			glDisable(GL_CULL_FACE);
 
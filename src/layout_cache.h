@@ -0,0 +1,79 @@
+// 3D World - Layout Cache: binary serialization shared by the building and city layout caches
+#pragma once
+
+#include "3DWorld.h"
+#include <type_traits>
+
+
+// the entire file is built in memory and written with a single fwrite()
+class layout_writer_t {
+	vector<char> buf;
+public:
+	bool is_good() const {return 1;} // for symmetry with layout_reader_t in shared transfer functions
+
+	template<typename T> void pod(T const &v) {
+		static_assert(std::is_trivially_copyable<T>::value, "layout cache values must be trivially copyable");
+		char const *const p((char const *)&v);
+		buf.insert(buf.end(), p, p+sizeof(T));
+	}
+	template<typename T> void vect(vector<T> const &v) {
+		static_assert(std::is_trivially_copyable<T>::value, "layout cache values must be trivially copyable");
+		pod(unsigned(v.size()));
+		if (v.empty()) return;
+		char const *const p((char const *)v.data());
+		buf.insert(buf.end(), p, p+v.size()*sizeof(T));
+	}
+	void header(unsigned magic, unsigned version, uint64_t key) {pod(magic); pod(version); pod(key);}
+	bool write_file(std::string const &fn, char const *const desc) const;
+};
+
+// the entire file is read with a single fread(); any truncated or out of range value marks the reader as bad, and all later reads are skipped
+class layout_reader_t {
+	vector<char> buf;
+	size_t pos;
+	bool bad;
+
+	bool can_read(size_t sz) {
+		if (sz > buf.size() - pos) {bad = 1;} // truncated or corrupt file
+		return !bad;
+	}
+public:
+	layout_reader_t() : pos(0), bad(0) {}
+	bool is_good() const {return !bad;}
+	bool at_end () const {return (pos == buf.size());}
+	bool read_file(std::string const &fn);
+	bool header(unsigned magic, unsigned version, uint64_t key); // returns 0 if the file is for a different key or version
+
+	template<typename T> void pod(T &v) {
+		static_assert(std::is_trivially_copyable<T>::value, "layout cache values must be trivially copyable");
+		if (!can_read(sizeof(T))) return;
+		memcpy(&v, &buf[pos], sizeof(T));
+		pos += sizeof(T);
+	}
+	template<typename T> void vect(vector<T> &v) {
+		static_assert(std::is_trivially_copyable<T>::value, "layout cache values must be trivially copyable");
+		unsigned sz(0);
+		pod(sz);
+		if (!can_read(size_t(sz)*sizeof(T))) return;
+		v.clear();
+		v.reserve(sz);
+
+		for (unsigned i = 0; i < sz; ++i, pos += sizeof(T)) { // copy through aligned storage since some types (elevator_t, road_t) have no default constructor
+			typename std::aligned_storage<sizeof(T), alignof(T)>::type val;
+			memcpy(&val, &buf[pos], sizeof(T));
+			v.push_back(*reinterpret_cast<T const *>(&val));
+		}
+	}
+};
+
+// FNV-1a hash of everything a layout depends on, used as the cache key
+class layout_hash_t {
+	uint64_t hash;
+public:
+	layout_hash_t() : hash(14695981039346656037ULL) {}
+	uint64_t get() const {return hash;}
+	void add(void const *data, size_t sz) {for (size_t i = 0; i < sz; ++i) {hash = (hash ^ ((unsigned char const *)data)[i])*1099511628211ULL;}}
+	template<typename T> void add(T const &v) {add(&v, sizeof(T));} // Note: T should have no padding
+};
+
+std::string get_layout_cache_fn(std::string const &prefix, uint64_t key); // returns an empty string if caching is disabled
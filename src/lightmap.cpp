@@ -8,6 +8,7 @@
 #include "shaders.h"
 #include "binary_file_io.h"
 #include <functional>
+#include <glm/gtc/packing.hpp>
 
 using std::cerr;
 
@@ -20,7 +21,7 @@ colorRGBA const flashlight_colors[2] = {colorRGBA(1.0, 0.8, 0.5, 1.0), colorRGBA
 
 
 bool using_lightmap(0), lm_alloc(0), has_dl_sources(0), has_spotlights(0), has_line_lights(0), use_dense_voxels(0), has_indir_lighting(0);
-bool dl_smap_enabled(0), flashlight_on(0), enable_dlight_bcubes(0);
+bool dl_smap_enabled(0), flashlight_on(0), enable_dlight_bcubes(0), chunked_lighting_files(0), compact_lightmap(0);
 unsigned dl_tid(0), elem_tid(0), gb_tid(0), dl_bc_tid(0), DL_GRID_BS(0), flashlight_color_id(0);
 float DZ_VAL2(0.0), DZ_VAL_INV2(0.0);
 float czmin0(0.0), lm_dz_adj(0.0);
@@ -36,7 +37,7 @@ indir_dlight_group_manager_t indir_dlight_group_manager;
 
 extern int animate2, display_mode, frame_counter, camera_coll_id, scrolling, read_light_files[], write_light_files[];
 extern unsigned create_voxel_landscape;
-extern bool disable_dlights;
+extern bool disable_dlights, global_lighting_update;
 extern float czmin, czmax, fticks, zbottom, ztop, XY_SCENE_SIZE, FAR_CLIP, CAMERA_RADIUS, indir_light_exp, light_int_scale[], force_czmin, force_czmax;
 extern colorRGB cur_ambient, cur_diffuse;
 extern coll_obj_group coll_objects;
@@ -205,24 +206,146 @@ void lmcell::set_outside_colors() {
 
 
 inline bool is_inside_lmap(int x, int y, int z) {return (z >= 0 && z < MESH_SIZE[2] && !point_outside_mesh(x, y));}
-bool lmap_manager_t::is_valid_cell(int x, int y, int z) const {return (is_inside_lmap(x, y, z) && vlmap[y][x] != NULL);}
+bool lmap_manager_t::is_valid_cell(int x, int y, int z) const {return (is_inside_lmap(x, y, z) && has_column(x, y));}
 
 // Note: only intended to work in ground mode where sizes are MESH_X_SIZE and MESH_Y_SIZE
 lmcell *lmap_manager_t::get_lmcell_round_down(point const &p) { // round down
+	assert(!is_compact());
 	int const x(get_xpos_round_down(p.x)), y(get_ypos_round_down(p.y)), z(get_zpos(p.z));
 	return (is_valid_cell(x, y, z) ? &vlmap[y][x][z] : NULL);
 }
 lmcell *lmap_manager_t::get_lmcell(point const &p) { // round to center
+	assert(!is_compact());
 	int const x(get_xpos(p.x)), y(get_ypos(p.y)), z(get_zpos(p.z));
 	return (is_valid_cell(x, y, z) ? &vlmap[y][x][z] : NULL);
 }
 
 void lmap_manager_t::reset_all(lmcell const &init_lmcell) {
+	assert(!is_compact());
 	for (auto i = vldata_alloc.begin(); i != vldata_alloc.end(); ++i) {*i = init_lmcell;}
 }
 
-template<typename T> void lmap_manager_t::alloc(unsigned nbins, unsigned xsize, unsigned ysize, unsigned zsize, T **nonempty_bins, lmcell const &init_lmcell) {
 
+// *** Compact Lightmap Storage ***
+
+unsigned const PACKED_COL_EMPTY   = 0xFFFFFFFF;
+unsigned const PACKED_COL_UNIFORM = 0x80000000; // column stored as a single cell
+
+void lmcell_packed::pack(lmcell const &c) {
+	// lighting values are non-negative; RGB9E5 shares one exponent across the three color channels
+	sc    = glm::packF3x9_E1x5(glm::vec3(c.sc[0], c.sc[1], c.sc[2]));
+	gc    = glm::packF3x9_E1x5(glm::vec3(c.gc[0], c.gc[1], c.gc[2]));
+	lc    = glm::packF3x9_E1x5(glm::vec3(c.lc[0], c.lc[1], c.lc[2]));
+	sv    = glm::packHalf1x16(c.sv);
+	gv    = glm::packHalf1x16(c.gv);
+	smoke = glm::packHalf1x16(c.smoke);
+	UNROLL_3X(pflow[i_] = c.pflow[i_];)
+}
+
+void lmcell_packed::unpack(lmcell &c) const {
+	glm::vec3 const sc_(glm::unpackF3x9_E1x5(sc)), gc_(glm::unpackF3x9_E1x5(gc)), lc_(glm::unpackF3x9_E1x5(lc));
+	UNROLL_3X(c.sc[i_] = sc_[i_]; c.gc[i_] = gc_[i_]; c.lc[i_] = lc_[i_]; c.pflow[i_] = pflow[i_];)
+	c.sv    = glm::unpackHalf1x16(sv);
+	c.gv    = glm::unpackHalf1x16(gv);
+	c.smoke = glm::unpackHalf1x16(smoke);
+}
+
+bool lmap_manager_t::has_column(int x, int y) const {
+	return (is_compact() ? (packed_cols[y*lm_xsize + x] != PACKED_COL_EMPTY) : (vlmap[y][x] != NULL));
+}
+
+lmcell const *lmap_manager_t::get_column_decoded(int x, int y, lmcell *buf) const {
+
+	if (!is_compact()) {return vlmap[y][x];} // no decode needed
+	unsigned const col(packed_cols[y*lm_xsize + x]);
+	if (col == PACKED_COL_EMPTY) return NULL;
+	assert(buf != nullptr);
+
+	if (col & PACKED_COL_UNIFORM) {
+		packed_alloc[col & ~PACKED_COL_UNIFORM].unpack(buf[0]);
+		for (unsigned z = 1; z < lm_zsize; ++z) {buf[z] = buf[0];}
+	}
+	else {
+		for (unsigned z = 0; z < lm_zsize; ++z) {packed_alloc[col + z].unpack(buf[z]);}
+	}
+	return buf;
+}
+
+bool lmap_manager_t::get_cell_decoded(int x, int y, int z, lmcell &cell) const {
+
+	if (!is_compact()) {
+		if (vlmap[y][x] == NULL) return 0;
+		cell = vlmap[y][x][z];
+		return 1;
+	}
+	unsigned const col(packed_cols[y*lm_xsize + x]);
+	if (col == PACKED_COL_EMPTY) return 0;
+	packed_alloc[(col & PACKED_COL_UNIFORM) ? (col & ~PACKED_COL_UNIFORM) : (col + z)].unpack(cell);
+	return 1;
+}
+
+// converts the float cells to the packed format once lighting has been computed; columns where every cell packs to the same value are stored once
+void lmap_manager_t::compact_cells(bool verbose) {
+
+	if (is_compact() || vldata_alloc.empty()) return;
+	RESET_TIME;
+	unsigned const ncols(lm_xsize*lm_ysize);
+	vector<lmcell_packed> col_cells(lm_zsize);
+	packed_cols.resize(ncols, PACKED_COL_EMPTY);
+	packed_alloc.reserve(vldata_alloc.size());
+	double max_err[4] = {0.0}, sum_err[4] = {0.0}; // sky, global, local, smoke
+	unsigned num_uniform(0);
+
+	for (unsigned y = 0; y < lm_ysize; ++y) {
+		for (unsigned x = 0; x < lm_xsize; ++x) {
+			lmcell const *const vlm(vlmap[y][x]);
+			if (vlm == NULL) continue; // empty column
+			bool uniform(1);
+
+			for (unsigned z = 0; z < lm_zsize; ++z) {
+				col_cells[z].pack(vlm[z]);
+				uniform &= (col_cells[z] == col_cells[0]);
+				lmcell dec;
+				col_cells[z].unpack(dec);
+				double const errs[4] = {max(fabs(dec.sv - vlm[z].sv), max(fabs(dec.sc[0] - vlm[z].sc[0]), max(fabs(dec.sc[1] - vlm[z].sc[1]), fabs(dec.sc[2] - vlm[z].sc[2])))),
+										max(fabs(dec.gv - vlm[z].gv), max(fabs(dec.gc[0] - vlm[z].gc[0]), max(fabs(dec.gc[1] - vlm[z].gc[1]), fabs(dec.gc[2] - vlm[z].gc[2])))),
+										max(fabs(dec.lc[0] - vlm[z].lc[0]), max(fabs(dec.lc[1] - vlm[z].lc[1]), fabs(dec.lc[2] - vlm[z].lc[2]))), fabs(dec.smoke - vlm[z].smoke)};
+				for (unsigned i = 0; i < 4; ++i) {max_err[i] = max(max_err[i], errs[i]); sum_err[i] += errs[i];}
+			}
+			unsigned const start(packed_alloc.size());
+			assert(start < PACKED_COL_UNIFORM);
+
+			if (uniform) {
+				packed_cols[y*lm_xsize + x] = (start | PACKED_COL_UNIFORM);
+				packed_alloc.push_back(col_cells[0]);
+				++num_uniform;
+			}
+			else {
+				packed_cols[y*lm_xsize + x] = start;
+				packed_alloc.insert(packed_alloc.end(), col_cells.begin(), col_cells.end());
+			}
+			vlmap[y][x] = NULL; // column pointers no longer valid
+		} // for x
+	} // for y
+	packed_alloc.shrink_to_fit();
+
+	if (verbose) {
+		size_t const num_cells(vldata_alloc.size()), float_bytes(num_cells*sizeof(lmcell)), packed_bytes(packed_alloc.size()*sizeof(lmcell_packed) + packed_cols.size()*sizeof(unsigned));
+		string const names[4] = {"sky", "global", "local", "smoke"};
+		cout << "Compact lightmap: " << float_bytes/1024 << "KB => " << packed_bytes/1024 << "KB (" << 100.0*packed_bytes/max(float_bytes, (size_t)1) << "%), "
+			 << num_uniform << " uniform columns; error max/mean:";
+		for (unsigned i = 0; i < 4; ++i) {cout << " " << names[i] << " " << max_err[i] << "/" << sum_err[i]/max(num_cells, (size_t)1);}
+		cout << endl;
+	}
+	vector<lmcell>().swap(vldata_alloc); // free float data
+	if (verbose) {PRINT_TIME(" Lightmap Compaction");}
+}
+
+
+template<typename T> void lmap_manager_t::alloc(unsigned nbins, unsigned xsize, unsigned ysize, unsigned zsize, T **nonempty_bins, lmcell const &init_lmcell, bool compact) {
+
+	packed_alloc.clear(); packed_cols.clear(); // drop any compact data from a previous scene
+	use_compact = compact; // compact_cells() is called by the owner once lighting has been computed
 	lm_xsize = xsize; lm_ysize = ysize; lm_zsize = zsize;
 	if (vlmap == NULL) {matrix_gen_2d(vlmap, lm_xsize, lm_ysize);} // create column headers once
 	vldata_alloc.resize(max(nbins, 1U), init_lmcell); // make size at least 1, even if there are no bins, so we can test on emptiness
@@ -243,13 +366,14 @@ template<typename T> void lmap_manager_t::alloc(unsigned nbins, unsigned xsize,
 	assert(cur_v == nbins);
 }
 
-template void lmap_manager_t::alloc(unsigned nbins, unsigned xsize, unsigned ysize, unsigned zsize, unsigned char **nonempty_bins, lmcell const &init_lmcell); // explicit instantiation
+template void lmap_manager_t::alloc(unsigned nbins, unsigned xsize, unsigned ysize, unsigned zsize, unsigned char **nonempty_bins, lmcell const &init_lmcell, bool compact); // explicit instantiation
 
 
 void lmap_manager_t::init_from(lmap_manager_t const &src) {
 
 	//assert(!is_allocated());
 	//clear_cells(); // probably unnecessary
+	assert(!src.is_compact());
 	alloc(src.vldata_alloc.size(), src.lm_xsize, src.lm_ysize, src.lm_zsize, src.vlmap, lmcell());
 	copy_data(src);
 }
@@ -259,6 +383,7 @@ void lmap_manager_t::init_from(lmap_manager_t const &src) {
 void lmap_manager_t::copy_data(lmap_manager_t const &src, float blend_weight) {
 
 	assert(vlmap && src.vlmap);
+	assert(!is_compact() && !src.is_compact());
 	assert(src.lm_xsize == lm_xsize && src.lm_ysize == lm_ysize && src.lm_zsize == lm_zsize);
 	assert(src.vldata_alloc.size() == vldata_alloc.size());
 	assert(blend_weight >= 0.0);
@@ -329,6 +454,17 @@ void light_volume_local::add_lighting(colorRGB &color, int x, int y, int z) cons
 bool light_volume_local::read(string const &filename) {
 
 	assert(!is_allocated());
+	chunked_lighting_file_t clf;
+
+	if (clf.open(filename)) {
+		memcpy(bounds, clf.get_header().bounds, sizeof(bounds));
+		if (get_num_data() > 0) {data.resize(get_num_data());} // else empty volume
+		if (!clf.read_cells(filename, LIGHTING_LOCAL, (data.empty() ? nullptr : data.front().lc), data.size(), 3)) {data.clear(); return 0;}
+		compressed = 1; // llvols are always written compressed
+		changed    = 1;
+		cout << "Read light volume file '" << filename << "'." << endl;
+		return 1;
+	}
 	binary_file_reader reader;
 	if (!reader.open(filename)) return 0;
 
@@ -353,6 +489,12 @@ bool light_volume_local::write(string const &filename) const {
 
 	assert(is_allocated());
 	assert(compressed); // llvols are always written compressed
+
+	if (chunked_lighting_files && !binary_file_io::is_gz_file(filename)) {
+		if (!chunked_lighting_file_t::write(filename, LIGHTING_LOCAL, data.front().lc, data.size(), 3, 3, bounds)) return 0;
+		cout << "Wrote light volume file '" << filename << "'." << endl;
+		return 1;
+	}
 	binary_file_writer writer;
 	if (!writer.open(filename)) return 0;
 
@@ -368,6 +510,134 @@ bool light_volume_local::write(string const &filename) const {
 	return 1;
 }
 
+
+// chunked_lighting_file_t
+
+
+unsigned const LIGHTING_FILE_CHUNK_CELLS = 4096;
+
+unsigned get_chunk_mask_bytes(unsigned chunk_cells) {return 4*((chunk_cells + 31)/32);} // padded to keep data 4-byte aligned
+
+bool chunked_lighting_file_t::open(string const &fn) {
+
+	close();
+	if (binary_file_io::is_gz_file(fn)) return 0; // compressed files can't be mapped
+	if (!file.open(fn, sizeof(lighting_file_header_t))) return 0;
+	if (get_header().magic != LIGHTING_FILE_MAGIC) {close(); return 0;} // legacy format
+	return 1;
+}
+
+// data points to the first float of the first cell, and cells are stride floats apart; all chunks are decoded in parallel when the file is read;
+// every chunk is validated before any cell is written, so a corrupt file leaves data unmodified
+bool chunked_lighting_file_t::read_cells(string const &fn, int ltype, float *data, unsigned num_cells, unsigned stride) const {
+
+	lighting_file_header_t const &h(get_header());
+	unsigned const dsz(lmcell::get_dsz(ltype));
+	unsigned char const *const map_data((unsigned char const *)file.get_data());
+	size_t const map_size(file.get_size());
+
+	if (h.version != LIGHTING_FILE_VERSION || h.ltype != (unsigned)ltype || h.dsz != dsz || h.chunk_cells == 0) {
+		cerr << "Error: Lighting file " << fn << " has version " << h.version << ", ltype " << h.ltype << ", and data size " << h.dsz
+			 << ", but expected version " << LIGHTING_FILE_VERSION << ", ltype " << ltype << ", and data size " << dsz << ". Ignoring file." << endl;
+		return 0;
+	}
+	if (h.num_cells != num_cells) {
+		cerr << "Error: Lighting file " << fn << " data size of " << h.num_cells << " does not equal the expected size of " << num_cells << ". Ignoring file." << endl;
+		return 0;
+	}
+	if (h.num_chunks != (num_cells + h.chunk_cells - 1)/h.chunk_cells || sizeof(lighting_file_header_t) + h.num_chunks*sizeof(lighting_file_chunk_t) > map_size) {
+		cerr << "Error: Lighting file " << fn << " has an invalid chunk table. Ignoring file." << endl;
+		return 0;
+	}
+	lighting_file_chunk_t const *const chunks((lighting_file_chunk_t const *)(map_data + sizeof(lighting_file_header_t)));
+	unsigned const mask_bytes(get_chunk_mask_bytes(h.chunk_cells));
+	unsigned num_bad(0);
+
+#pragma omp parallel for schedule(dynamic) reduction(+:num_bad)
+	for (int c = 0; c < (int)h.num_chunks; ++c) { // validate sizes, checksums, and bitmasks
+		lighting_file_chunk_t const &chunk(chunks[c]);
+		unsigned const start(c*h.chunk_cells), end(min(num_cells, start + h.chunk_cells));
+		size_t const payload_sz(mask_bytes + size_t(chunk.num_nonempty)*dsz*sizeof(float));
+		if (chunk.num_nonempty > end - start || chunk.offset + payload_sz > map_size) {++num_bad; continue;}
+		unsigned char const *const payload(map_data + chunk.offset);
+		if (crc32(0L, payload, (uInt)payload_sz) != chunk.crc) {++num_bad; continue;}
+		unsigned num_set(0);
+		for (unsigned bit = 0; bit < end - start; ++bit) {num_set += ((payload[bit >> 3] >> (bit & 7)) & 1);}
+		if (num_set != chunk.num_nonempty) {++num_bad;}
+	}
+	if (num_bad > 0) {
+		cerr << "Error: Lighting file " << fn << " has " << num_bad << " corrupt chunks out of " << h.num_chunks << ". Ignoring file." << endl;
+		return 0;
+	}
+#pragma omp parallel for schedule(dynamic)
+	for (int c = 0; c < (int)h.num_chunks; ++c) { // decode
+		unsigned const start(c*h.chunk_cells), end(min(num_cells, start + h.chunk_cells));
+		unsigned char const *const payload(map_data + chunks[c].offset);
+		float const *src((float const *)(payload + mask_bytes));
+
+		for (unsigned i = start; i < end; ++i) {
+			float *const dest(data + size_t(i)*stride);
+			unsigned const bit(i - start);
+
+			if (payload[bit >> 3] & (1 << (bit & 7))) {
+				for (unsigned n = 0; n < dsz; ++n) {dest[n] = *(src++);}
+			}
+			else {
+				for (unsigned n = 0; n < dsz; ++n) {dest[n] = 0.0;}
+			}
+		}
+	}
+	return 1;
+}
+
+bool chunked_lighting_file_t::write(string const &fn, int ltype, float const *data, unsigned num_cells, unsigned dsz, unsigned stride, int const bounds[3][2]) {
+
+	lighting_file_header_t h = {};
+	h.magic       = LIGHTING_FILE_MAGIC;
+	h.version     = LIGHTING_FILE_VERSION;
+	h.ltype       = ltype;
+	h.dsz         = dsz;
+	h.num_cells   = num_cells;
+	h.chunk_cells = LIGHTING_FILE_CHUNK_CELLS;
+	h.num_chunks  = (num_cells + h.chunk_cells - 1)/h.chunk_cells;
+	if (bounds) {memcpy(h.bounds, bounds, sizeof(h.bounds));}
+	unsigned const mask_bytes(get_chunk_mask_bytes(h.chunk_cells));
+	vector<lighting_file_chunk_t> chunks(h.num_chunks);
+	vector<vector<unsigned char>> payloads(h.num_chunks);
+	unsigned long long offset(sizeof(lighting_file_header_t) + h.num_chunks*sizeof(lighting_file_chunk_t));
+
+#pragma omp parallel for schedule(dynamic)
+	for (int c = 0; c < (int)h.num_chunks; ++c) {
+		unsigned const start(c*h.chunk_cells), end(min(num_cells, start + h.chunk_cells));
+		vector<unsigned char> &payload(payloads[c]);
+		payload.resize(mask_bytes, 0);
+		unsigned num_nonempty(0);
+
+		for (unsigned i = start; i < end; ++i) {
+			float const *const src(data + size_t(i)*stride);
+			bool nonempty(0);
+			for (unsigned n = 0; n < dsz; ++n) {nonempty |= (src[n] != 0.0);}
+			if (!nonempty) continue;
+			unsigned const bit(i - start);
+			payload[bit >> 3] |= (1 << (bit & 7));
+			payload.insert(payload.end(), (unsigned char const *)src, (unsigned char const *)(src + dsz));
+			++num_nonempty;
+		}
+		chunks[c].num_nonempty = num_nonempty;
+		chunks[c].crc = crc32(0L, payload.data(), (uInt)payload.size());
+	}
+	for (unsigned c = 0; c < h.num_chunks; ++c) { // assign offsets in order
+		chunks[c].offset = offset;
+		offset += payloads[c].size();
+	}
+	binary_file_writer writer;
+	if (!writer.open(fn)) return 0;
+	bool ok(writer.write(&h, sizeof(h), 1) && (chunks.empty() || writer.write(chunks.data(), sizeof(lighting_file_chunk_t), chunks.size())));
+	for (unsigned c = 0; c < h.num_chunks && ok; ++c) {ok = writer.write(payloads[c].data(), 1, payloads[c].size());}
+	if (!ok) {cerr << "Error writing data to lighting file " << fn << endl;}
+	return ok;
+}
+
 void light_volume_local::set_bounds(int x1, int x2, int y1, int y2, int z1, int z2) {
 	bounds[0][0] = x1; bounds[0][1] = x2; bounds[1][0] = y1; bounds[1][1] = y2; bounds[2][0] = z1; bounds[2][1] = z2;
 }
@@ -700,7 +970,10 @@ void build_lightmap(bool verbose) {
 		init_lmcell.sv = init_lmcell.gv = DEF_SKY_GLOBAL_LT;
 		UNROLL_3X(init_lmcell.sc[i_] = init_lmcell.gc[i_] = 1.0;)
 	}
-	lmap_manager.alloc(nbins, MESH_X_SIZE, MESH_Y_SIZE, zsize, need_lmcell, init_lmcell);
+	// compact storage is read-only, so it can't be used with any runtime lightmap updates (global/cobj accum ray tracing, voxel edits)
+	bool const compact(compact_lightmap && !global_lighting_update && !raytrace_lights[LIGHTING_COBJ_ACCUM] && !create_voxel_landscape);
+	if (compact_lightmap && !compact) {cout << "Warning: compact_lightmap is not supported with global_lighting_update, cobj accum lighting, or voxel terrain" << endl;}
+	lmap_manager.alloc(nbins, MESH_X_SIZE, MESH_Y_SIZE, zsize, need_lmcell, init_lmcell, compact);
 	assert(lmap_manager.is_allocated());
 	using_lightmap = (nonempty > 0);
 	lm_alloc       = 1;
@@ -768,6 +1041,7 @@ void build_lightmap(bool verbose) {
 				if (verbose) {PRINT_TIME((type_names[ltype] + " Lighting Load/Ray Trace").c_str());}
 			}
 		}
+		if (lmap_manager.wants_compact()) {lmap_manager.compact_cells(verbose);}
 	}
 	reset_cobj_counters();
 	matrix_delete_2d(need_lmcell);
@@ -783,6 +1057,7 @@ void update_flow_for_voxels(vector<cube_t> const &cubes) {
 
 	//RESET_TIME;
 	if (!lm_alloc || !lmap_manager.is_allocated() || cubes.empty()) return;
+	assert(!lmap_manager.is_compact()); // compact lightmaps are disabled for voxel terrain
 	cube_t bcube(cubes.front());
 	for (auto i = cubes.begin()+1; i != cubes.end(); ++i) {bcube.union_with_cube(*i);}
 	int const bcx1(get_clamped_xpos(bcube.d[0][0])), bcx2(get_clamped_xpos(bcube.d[0][1]));
@@ -820,9 +1095,11 @@ void update_indir_light_tex_range(lmap_manager_t const &lmap, vector<unsigned ch
 
 #pragma omp parallel for schedule(static) if (mt)
 	for (int y = y1; y < (int)y2; ++y) {
+		vector<lmcell> decode_buf(lmap.is_compact() ? zsize : 0); // only used in compact mode
+
 		for (unsigned x = 0; x < xsize; ++x) {
 			unsigned const off(zsize*(y*xsize + x));
-			lmcell const *const vlm(lmap.get_column(x, y));
+			lmcell const *const vlm(lmap.get_column_decoded(x, y, decode_buf.data()));
 			assert(vlm != nullptr); // not supported in this flow
 			colorRGB color;
 
@@ -1335,8 +1612,10 @@ void get_indir_light(colorRGBA &a, point const &p) { // used for particle clouds
 	if (!point_outside_mesh(x, y) && p.z > czmin0) { // inside the mesh range and above the lowest cobj
 		float val(get_voxel_terrain_ao_lighting_val(p));
 		
-		if (using_lightmap && p.z < czmax && lmap_manager.get_column(x, y) != NULL) { // not above all collision objects and not empty cell
-			lmap_manager.get_lmcell(x, y, z).get_final_color(cscale, 0.5, val);
+		lmcell lmc;
+
+		if (using_lightmap && p.z < czmax && lmap_manager.get_cell_decoded(x, y, z, lmc)) { // not above all collision objects and not empty cell
+			lmc.get_final_color(cscale, 0.5, val);
 		}
 		else if (val < 1.0) {
 			cscale *= val;
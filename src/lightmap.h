@@ -6,6 +6,7 @@
 
 #include "3DWorld.h"
 #include "trigger.h"
+#include "file_reader.h" // for mapped_file_t
 
 extern int MESH_X_SIZE, MESH_Y_SIZE, MESH_SIZE[3];
 
@@ -42,13 +43,57 @@ struct lmcell { // size = 52
 	void set_outside_colors();
 	void mix_lighting_with(lmcell const &lmc, float val);
 };
+static_assert(sizeof(lmcell) % sizeof(float) == 0, "lmcell must be a multiple of float size for strided file I/O");
+
+struct lmcell_packed { // size = 24; compact read-only copy of an lmcell: colors as RGB9E5, scalars as half floats
+	unsigned sc, gc, lc;
+	unsigned short sv, gv, smoke;
+	unsigned char pflow[3];
+
+	void pack(lmcell const &c);
+	void unpack(lmcell &c) const;
+	bool operator==(lmcell_packed const &c) const {
+		return (sc == c.sc && gc == c.gc && lc == c.lc && sv == c.sv && gv == c.gv && smoke == c.smoke && pflow[0] == c.pflow[0] && pflow[1] == c.pflow[1] && pflow[2] == c.pflow[2]);
+	}
+};
+
+
+unsigned const LIGHTING_FILE_MAGIC   = 0x4C573344; // "D3WL"
+unsigned const LIGHTING_FILE_VERSION = 1;
+
+struct lighting_file_header_t { // size = 56
+	unsigned magic, version, ltype, dsz, num_cells, chunk_cells, num_chunks, flags;
+	int bounds[3][2]; // only used for local light volumes
+};
+
+struct lighting_file_chunk_t { // size = 16
+	unsigned long long offset; // from the start of the file
+	unsigned num_nonempty, crc;
+};
+
+// chunked lighting file, read through a memory map: header, chunk table, then per-chunk {nonempty cell bitmask, nonempty cell data};
+// empty (all zero) cells are not stored, and each chunk has a CRC32 checksum; the whole file is decoded into the lightmap on read
+class chunked_lighting_file_t {
+
+	mapped_file_t file;
+
+public:
+	bool open(std::string const &fn); // returns 0 if the file can't be mapped or isn't a chunked lighting file
+	void close() {file.close();}
+	lighting_file_header_t const &get_header() const {assert(file.is_open()); return *(lighting_file_header_t const *)file.get_data();}
+	bool read_cells(std::string const &fn, int ltype, float *data, unsigned num_cells, unsigned stride) const;
+	static bool write(std::string const &fn, int ltype, float const *data, unsigned num_cells, unsigned dsz, unsigned stride, int const bounds[3][2]=nullptr);
+};
 
 
 class lmap_manager_t {
 
 	vector<lmcell> vldata_alloc;
+	vector<lmcell_packed> packed_alloc; // compact mode cell data
+	vector<unsigned> packed_cols; // compact mode, per x/y column: start index into packed_alloc, PACKED_COL_UNIFORM flag, or PACKED_COL_EMPTY
 	unsigned lm_xsize, lm_ysize, lm_zsize;
-	lmcell ***vlmap; // y, x, z (size is determined by {MESH_Y_SIZE, MESH_X_SIZE, MESH_Z_SIZE}
+	lmcell ***vlmap; // y, x, z (size is determined by {MESH_Y_SIZE, MESH_X_SIZE, MESH_Z_SIZE}; column pointers are invalid in compact mode
+	bool use_compact;
 
 	lmap_manager_t(lmap_manager_t const &) = delete; // forbidden
 	void operator=(lmap_manager_t const &) = delete; // forbidden
@@ -57,21 +102,28 @@ public:
 	bool was_updated;
 	cube_t update_bcube;
 
-	lmap_manager_t() : lm_xsize(0), lm_ysize(0), lm_zsize(0), vlmap(NULL), was_updated(0) {update_bcube.set_to_zeros();}
-	void clear_cells() {vldata_alloc.clear();} // vlmap matrix headers are not cleared
-	bool is_allocated() const {return (vlmap != NULL && !vldata_alloc.empty());}
+	lmap_manager_t() : lm_xsize(0), lm_ysize(0), lm_zsize(0), vlmap(NULL), use_compact(0), was_updated(0) {update_bcube.set_to_zeros();}
+	void clear_cells() {vldata_alloc.clear(); packed_alloc.clear(); packed_cols.clear();} // vlmap matrix headers are not cleared
+	bool is_allocated() const {return (vlmap != NULL && (!vldata_alloc.empty() || is_compact()));}
+	bool is_compact() const {return !packed_cols.empty();}
+	bool wants_compact() const {return use_compact;}
 	size_t size() const {return vldata_alloc.size();}
 	bool read_data_from_file(char const *const fn, int ltype);
 	bool write_data_to_file(char const *const fn, int ltype) const;
 	void clear_lighting_values(int ltype);
 	bool is_valid_cell(int x, int y, int z) const;
-	lmcell const *get_column(int x, int y) const {return vlmap[y][x];} // Note: no bounds checking
-	lmcell *get_column(int x, int y) {return vlmap[y][x];} // Note: no bounds checking
+	lmcell const *get_column(int x, int y) const {assert(!is_compact()); return vlmap[y][x];} // Note: no bounds checking
+	lmcell *get_column(int x, int y) {assert(!is_compact()); return vlmap[y][x];} // Note: no bounds checking
 	lmcell &get_lmcell(int x, int y, int z) {return get_column(x, y)[z];} // Note: no bounds checking
+	// read-only accessors that work in both modes; compact mode decodes into buf/cell
+	bool has_column(int x, int y) const;
+	lmcell const *get_column_decoded(int x, int y, lmcell *buf) const; // buf must have space for lm_zsize cells; Note: no bounds checking
+	bool get_cell_decoded(int x, int y, int z, lmcell &cell) const; // Note: no bounds checking
 	lmcell *get_lmcell_round_down(point const &p);
 	lmcell *get_lmcell(point const &p);
 	void reset_all(lmcell const &init_lmcell=lmcell());
-	template<typename T> void alloc(unsigned nbins, unsigned xsize, unsigned ysize, unsigned zsize, T **nonempty_bins, lmcell const &init_lmcell);
+	template<typename T> void alloc(unsigned nbins, unsigned xsize, unsigned ysize, unsigned zsize, T **nonempty_bins, lmcell const &init_lmcell, bool compact=0);
+	void compact_cells(bool verbose);
 	void init_from(lmap_manager_t const &src);
 	void copy_data(lmap_manager_t const &src, float blend_weight=1.0);
 };
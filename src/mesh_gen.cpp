@@ -6,6 +6,7 @@
 #include "mesh.h"
 #include "textures.h"
 #include "sinf.h"
+#include "sine_simd.h"
 #include "heightmap.h"
 #include "shaders.h"
 #include "gl_ext_arb.h"
@@ -770,16 +771,7 @@ float mesh_xy_grid_cache_t::eval_index(unsigned x, unsigned y, int min_start_sin
 		float const *const xptr(&xyterms.front() + x*F_TABLE_SIZE);
 		float const *const yptr(&xyterms.front() + yterms_start + y*F_TABLE_SIZE);
 		int const start_ix(max(start_eval_sin, min_start_sin));
-		// performance critical
-		if (start_ix == 0) { // common case
-			for (int i = 0; i < F_TABLE_SIZE; ++i) {zval += xptr[i]*yptr[i];}
-		}
-		else if (start_ix == 50) { // another common case
-			for (int i = 50; i < F_TABLE_SIZE; ++i) {zval += xptr[i]*yptr[i];}
-		}
-		else {
-			for (int i = start_ix; i < F_TABLE_SIZE; ++i) {zval += xptr[i]*yptr[i];}
-		}
+		if (start_ix < F_TABLE_SIZE) {zval += sum_of_products(xptr+start_ix, yptr+start_ix, (F_TABLE_SIZE - start_ix));} // performance critical
 		apply_noise_shape_final(zval, gen_shape);
 	}
 	if (do_glaciate) {
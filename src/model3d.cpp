@@ -654,16 +654,12 @@ template<typename T> unsigned indexed_vntc_vect_t<T>::add_vertex(T const &v, ver
 
 	T v2(v);
 	if (vmap.get_average_normals()) {v2.n = zero_vector;}
-	auto it(vmap.find(v2));
-	unsigned ix;
+	unsigned const ix(vmap.find_or_insert(v2, (unsigned)size()));
 
-	if (it == vmap.end()) { // not found
-		ix = (unsigned)size();
+	if (ix == size()) { // not found, add it
 		this->push_back(v);
-		vmap[v2] = ix;
 	}
 	else { // found
-		ix = it->second;
 		assert(ix < size());
 
 		if (vmap.get_average_normals()) {
@@ -1276,24 +1272,38 @@ unsigned model3d::add_triangles(vector<triangle> const &triangles, colorRGBA con
 
 unsigned model3d::add_polygon(polygon_t const &poly, vntc_map_t vmap[2], vntct_map_t vmap_tan[2], int mat_id, unsigned obj_id) {
 	
+	split_polygons_buffer.resize(0);
+	unsigned const num_added(split_polygon_and_update_bbox(poly, mat_id, split_polygons_buffer));
+	add_split_polygons_mt(split_polygons_buffer.data(), num_added, vmap, vmap_tan, mat_id, obj_id);
+	return num_added;
+}
+
+// appends poly split into triangles and quads to split_polys and returns the number added; also updates the bbox;
+// not thread safe, since split_polygon() uses the global GLU tessellator for polygons with more than 4 vertices and non-convex quads
+unsigned model3d::split_polygon_and_update_bbox(polygon_t const &poly, int mat_id, vector<polygon_t> &split_polys) {
+
+	size_t const prev_size(split_polys.size());
+	split_polygon(poly, split_polys, 0.0, allow_model3d_quads);
+	if (mat_id < 0 || !materials[mat_id].skip) {update_bbox(poly);} // don't include skipped materials in the bbox
+	return unsigned(split_polys.size() - prev_size);
+}
+
+// adds the polygons from one call to split_polygon_and_update_bbox(); thread safe as long as each thread adds to a different material with its own vertex maps
+void model3d::add_split_polygons_mt(polygon_t const *polys, unsigned num, vntc_map_t vmap[2], vntct_map_t vmap_tan[2], int mat_id, unsigned obj_id) {
+	
 	for (unsigned d = 0; d < 2; ++d) {
 		vmap[d].check_for_clear(mat_id);
 		vmap_tan[d].check_for_clear(mat_id);
 	}
-	split_polygons_buffer.resize(0);
-	split_polygon(poly, split_polygons_buffer, 0.0, allow_model3d_quads);
-
-	for (vector<polygon_t>::iterator i = split_polygons_buffer.begin(); i != split_polygons_buffer.end(); ++i) {
+	for (unsigned i = 0; i < num; ++i) {
 		if (mat_id < 0) {
-			unbound_geom.add_poly(*i, vmap, obj_id);
+			unbound_geom.add_poly(polys[i], vmap, obj_id);
 		}
 		else {
 			assert((unsigned)mat_id < materials.size());
-			materials[mat_id].add_poly(*i, vmap, vmap_tan, obj_id);
+			materials[mat_id].add_poly(polys[i], vmap, vmap_tan, obj_id);
 		}
 	}
-	if (mat_id < 0 || !materials[mat_id].skip) {update_bbox(poly);} // don't include skipped materials in the bbox
-	return (unsigned)split_polygons_buffer.size();
 }
 
 
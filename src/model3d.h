@@ -181,21 +181,76 @@ template<typename T> struct hash_by_bytes { // should work with all packed verte
 	//uint32_t operator()(T const &v) const {return jenkins_one_at_a_time_hash((const uint32_t*)&v, sizeof(T)>>2);} // faster but lower quality hash
 };
 
-//template<typename T> class vertex_map_t : public unordered_map<T, unsigned, hash_by_bytes<T>> {
-template<typename T> class vertex_map_t : public map<T, unsigned> {
+// open addressing hash table with linear probing, used to weld duplicate vertices; vertices are compared by value, the same as the map<T, unsigned> this replaced
+template<typename T> class vertex_map_t {
 
+	struct entry_t {
+		T v;
+		unsigned ix, gen; // entry is empty unless gen == cur_gen
+		entry_t() : ix(0), gen(0) {}
+	};
+	vector<entry_t> table; // size is a power of 2
+	unsigned num_entries, cur_gen;
 	int last_mat_id;
 	unsigned last_obj_id;
 	bool average_normals;
 
+	static uint32_t hash(T const &v) { // hashes each float component; -0.0 and 0.0 compare equal, so they must hash the same
+		static_assert((sizeof(T) & 3) == 0, "vertex_map_t requires vertex types made of floats");
+		float const *const vals((float const *)&v);
+		uint32_t h(0);
+
+		for (unsigned i = 0; i < sizeof(T)/sizeof(float); ++i) {
+			float const val(vals[i] + 0.0f); // converts -0.0 to 0.0
+			uint32_t bits;
+			memcpy(&bits, &val, sizeof(bits));
+			h = (h ^ bits) * 0x9E3779B1U;
+			h ^= (h >> 15);
+		}
+		h ^= (h >> 16); h *= 0x85EBCA6BU; h ^= (h >> 13); // final mix so that all bits affect the low bits used for the slot
+		return h;
+	}
+	void grow() {
+		vector<entry_t> old_table(max(size_t(1024), 2*table.size()));
+		old_table.swap(table);
+		unsigned const mask(table.size() - 1);
+
+		for (auto i = old_table.begin(); i != old_table.end(); ++i) { // reinsert current entries
+			if (i->gen != cur_gen) continue;
+			unsigned slot(hash(i->v) & mask);
+			while (table[slot].gen == cur_gen) {slot = (slot + 1) & mask;}
+			table[slot] = *i;
+		}
+	}
 public:
-	vertex_map_t(bool average_normals_=0) : last_mat_id(-1), last_obj_id(0), average_normals(average_normals_) {}
+	vertex_map_t(bool average_normals_=0) : num_entries(0), cur_gen(1), last_mat_id(-1), last_obj_id(0), average_normals(average_normals_) {}
 	bool get_average_normals() const {return average_normals;}
-	
+	unsigned size() const {return num_entries;}
+	bool empty() const {return (num_entries == 0);}
+
+	void clear() { // constant time unless the generation counter wraps
+		if (num_entries == 0) return;
+		num_entries = 0;
+		if (++cur_gen == 0) {table.clear(); cur_gen = 1;} // wraparound; free the table and start over
+	}
+	void reset() {clear(); last_mat_id = -1;}
+
+	// returns the index of an existing equal vertex, or inserts v with index ix and returns ix
+	unsigned find_or_insert(T const &v, unsigned ix) {
+		if (4*(num_entries + 1) > 3*table.size()) {grow();} // max load factor of 75%
+		unsigned const mask(table.size() - 1);
+
+		for (unsigned slot = (hash(v) & mask); ; slot = ((slot + 1) & mask)) {
+			entry_t &e(table[slot]);
+			if (e.gen != cur_gen) {e.v = v; e.ix = ix; e.gen = cur_gen; ++num_entries; return ix;} // empty slot, not found
+			if (e.v == v) return e.ix; // found
+		}
+		return ix; // never gets here
+	}
 	void check_for_clear(int mat_id) {
-		if (mat_id != last_mat_id || this->size() >= MAX_VMAP_SIZE) {
+		if (mat_id != last_mat_id || size() >= MAX_VMAP_SIZE) {
 			last_mat_id = mat_id;
-			this->clear();
+			clear();
 		}
 	}
 };
@@ -526,6 +581,8 @@ public:
 	void add_transform(model3d_xform_t const &xf) {transforms.push_back(xf);}
 	unsigned add_triangles(vector<triangle> const &triangles, colorRGBA const &color, int mat_id=-1, unsigned obj_id=0);
 	unsigned add_polygon(polygon_t const &poly, vntc_map_t vmap[2], vntct_map_t vmap_tan[2], int mat_id=-1, unsigned obj_id=0);
+	unsigned split_polygon_and_update_bbox(polygon_t const &poly, int mat_id, vector<polygon_t> &split_polys);
+	void add_split_polygons_mt(polygon_t const *polys, unsigned num, vntc_map_t vmap[2], vntct_map_t vmap_tan[2], int mat_id, unsigned obj_id);
 	void add_triangle(polygon_t const &tri, vntc_map_t &vmap, int mat_id=-1, unsigned obj_id=0);
 	void get_polygons(vector<coll_tquad> &polygons, bool quads_only=0, bool apply_transforms=0, unsigned lod_level=0) const;
 	void get_transformed_bcubes(vector<cube_t> &bcubes) const;
@@ -10,12 +10,27 @@
 #include <algorithm> // for transform()
 #include <cctype> // for tolower()
 #include "fast_atof.h"
+#include "file_utils.h"
+#include <sys/stat.h>
+#include <climits>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 
 extern bool use_obj_file_bump_grayscale, model_calc_tan_vect;
 extern float model_auto_tc_scale, model_mat_lod_thresh;
 extern model3ds all_models;
 
+string model3d_cache_dir; // if nonempty, object files are cached here in model3d format
+bool benchmark_model_welding(0), parallel_model_welding(0);
+
+size_t const OBJ_FILE_MT_MIN_SIZE = (1 << 20); // 1MB; smaller object files are parsed serially
+
 // hack to avoid slow multithreaded locking in getc()/ungetc() in MSVC++
 #ifndef _getc_nolock
 #define _getc_nolock   getc
@@ -31,6 +46,50 @@ bool base_file_reader::open_file(bool binary) {
 	return (fp != 0);
 }
 
+bool mapped_file_t::open(string const &fn, size_t min_size) {
+	close();
+	if (fn.empty()) return 0;
+	min_size = max(min_size, size_t(1)); // empty files can't be mapped
+#ifdef _WIN32
+	HANDLE const fh(CreateFileA(fn.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL));
+	if (fh == INVALID_HANDLE_VALUE) return 0;
+	LARGE_INTEGER fsize;
+	if (!GetFileSizeEx(fh, &fsize) || (size_t)fsize.QuadPart < min_size) {CloseHandle(fh); return 0;}
+	HANDLE const mh(CreateFileMappingA(fh, NULL, PAGE_READONLY, 0, 0, NULL));
+	if (mh == NULL) {CloseHandle(fh); return 0;}
+	void const *const ptr(MapViewOfFile(mh, FILE_MAP_READ, 0, 0, 0));
+	if (ptr == NULL) {CloseHandle(mh); CloseHandle(fh); return 0;}
+	file_handle = fh;
+	map_handle  = mh;
+	size        = (size_t)fsize.QuadPart;
+#else
+	int const fd(::open(fn.c_str(), O_RDONLY));
+	if (fd < 0) return 0;
+	struct stat st;
+	if (fstat(fd, &st) != 0 || (size_t)st.st_size < min_size) {::close(fd); return 0;}
+	void *const ptr(mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0));
+	::close(fd); // the mapping stays valid after the file is closed
+	if (ptr == MAP_FAILED) return 0;
+	size = st.st_size;
+#endif
+	data = (char const *)ptr;
+	return 1;
+}
+
+void mapped_file_t::close() {
+	if (data == nullptr) return;
+#ifdef _WIN32
+	UnmapViewOfFile(data);
+	CloseHandle((HANDLE)map_handle);
+	CloseHandle((HANDLE)file_handle);
+	file_handle = map_handle = nullptr;
+#else
+	munmap((void *)data, size);
+#endif
+	data = nullptr;
+	size = 0;
+}
+
 void base_file_reader::close_file() {
 	if (fp) {checked_fclose(fp);}
 	fp = NULL;
@@ -225,6 +284,161 @@ public:
 };
 
 
+// tokenized line aligned chunk of an object file, used by the parallel parser;
+// vertex data is parsed and transformed here, while faces and state changes are recorded in file order for a serial replay
+struct obj_file_chunk_t {
+
+	enum {CMD_FACE=0, CMD_USEMTL, CMD_MTLLIB, CMD_SMOOTH, CMD_OBJECT, CMD_GROUP, CMD_UNKNOWN};
+	static int const NO_IX = INT_MIN; // tc or normal index not specified
+
+	struct cmd_t {
+		unsigned char type;
+		unsigned line, start, npts; // start: face_ixs triple index for faces, strs index for names, or smoothing group
+		unsigned nv, ntc, nn; // chunk vertex/tex coord/normal counts at this command, for resolving relative indices
+		cmd_t(unsigned char type_, unsigned line_, unsigned start_=0, unsigned npts_=0) : type(type_), line(line_), start(start_), npts(npts_), nv(0), ntc(0), nn(0) {}
+	};
+	vector<point> v;
+	vector<colorRGB> colors; // empty if no vertex colors in this chunk
+	vector<point2d<float> > tc;
+	vector<vector3d> n;
+	vector<cmd_t> cmds;
+	vector<int> face_ixs; // {vix, tix, nix} triples as written in the file
+	vector<string> strs;
+	unsigned num_lines = 0, error_line = 0;
+	string error;
+
+	static bool is_ws(char c) {return (c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f');}
+	static bool is_num_start(char c) {return ((c >= '0' && c <= '9') || c == '.' || c == '-' || c == '+');}
+	static char const *skip_ws(char const *s, char const *end) {while (s < end && is_ws(*s)) {++s;} return s;}
+	static char const *skip_to_ws(char const *s, char const *end) {while (s < end && !is_ws(*s)) {++s;} return s;}
+
+	static unsigned read_floats(char const *s, char const *end, float *vals, unsigned max_vals) {
+		unsigned num(0);
+
+		for (; num < max_vals; ++num) {
+			s = skip_ws(s, end);
+			if (s == end || !is_num_start(*s)) break;
+			char const *const tend(skip_to_ws(s, end));
+			size_t const len(tend - s);
+			char token[64]; // null terminated copy for fast_atof on the stack; very long tokens are rare and use a heap allocated string
+
+			if (len < sizeof(token)) {
+				memcpy(token, s, len);
+				token[len] = 0;
+				vals[num] = Assimp::fast_atof(token);
+			}
+			else {vals[num] = Assimp::fast_atof(string(s, tend).c_str());}
+			s = tend;
+		}
+		return num;
+	}
+	static bool read_int(char const *&s, char const *end, int &val) {
+		bool neg(0);
+		if (s < end && *s == '-') {neg = 1; ++s;}
+		if (s == end || !(*s >= '0' && *s <= '9')) return 0;
+		val = 0;
+		for (; s < end && *s >= '0' && *s <= '9'; ++s) {val = 10*val + int(*s - '0');}
+		if (neg) {val = -val;}
+		return 1;
+	}
+	static string read_str_to_eol(char const *s, char const *end) {
+		s = skip_ws(s, end);
+		while (end > s && is_ws(end[-1])) {--end;}
+		return string(s, end);
+	}
+	void set_error(string const &str) {
+		if (error.empty()) {error = str; error_line = num_lines;}
+	}
+	void add_cmd(unsigned char type, unsigned start=0, unsigned npts=0) {
+		cmds.emplace_back(type, num_lines, start, npts);
+		cmds.back().nv = v.size(); cmds.back().ntc = tc.size(); cmds.back().nn = n.size();
+	}
+
+	void parse(char const *s, char const *const end, geom_xform_t const &xf, bool recalc_normals) {
+		while (s < end && error.empty()) {
+			char const *eol((char const *)memchr(s, '\n', end - s));
+			if (eol == nullptr) {eol = end;}
+			++num_lines;
+			char const *const kw(skip_ws(s, eol)), *const kw_end(skip_to_ws(kw, eol));
+			unsigned const kw_len(kw_end - kw);
+			char const *const args(kw_end);
+			s = eol + 1; // next line
+			if (kw_len == 0 || *kw == '#') continue; // empty line or comment
+
+			if (kw_len == 1 && *kw == 'f') { // face
+				unsigned const start(face_ixs.size()/3);
+				unsigned npts(0);
+
+				for (char const *p = skip_ws(args, eol); p < eol; p = skip_ws(p, eol)) {
+					int vix(0), tix(NO_IX), nix(NO_IX);
+					if (!read_int(p, eol, vix)) break; // not a vertex index
+					
+					if (p < eol && *p == '/') {
+						++p;
+						read_int(p, eol, tix); // ok to fail
+						if (p < eol && *p == '/') {++p; read_int(p, eol, nix);} // ok to fail
+					}
+					face_ixs.push_back(vix); face_ixs.push_back(tix); face_ixs.push_back(nix);
+					++npts;
+				}
+				add_cmd(CMD_FACE, start, npts);
+			}
+			else if (kw_len == 1 && *kw == 'v') { // vertex
+				float vals[6];
+				unsigned const num(read_floats(args, eol, vals, 6));
+				if (num < 3) {set_error("Error reading vertex"); break;}
+				if (num > 3 && num < 6) {set_error("Error reading vertex color"); break;}
+				
+				if (num == 6) {
+					if (colors.empty()) {colors.resize(v.size(), WHITE);} // pad colors up to this point with white
+					colors.push_back(colorRGB(vals[3], vals[4], vals[5]));
+				}
+				else if (!colors.empty()) {colors.push_back(WHITE);} // color not specified, and in colors mode, pad with white
+				v.emplace_back(vals[0], vals[1], vals[2]);
+				xf.xform_pos(v.back());
+			}
+			else if (kw_len == 2 && kw[0] == 'v' && kw[1] == 't') { // tex coord
+				float vals[3];
+				if (read_floats(args, eol, vals, 3) < 2) {set_error("Error reading texture coord"); break;}
+				tc.emplace_back(vals[0], vals[1]); // discard z
+			}
+			else if (kw_len == 2 && kw[0] == 'v' && kw[1] == 'n') { // normal
+				float vals[3];
+				if (read_floats(args, eol, vals, 3) < 3) {set_error("Error reading normal"); break;}
+				
+				if (!recalc_normals) {
+					n.emplace_back(vals[0], vals[1], vals[2]);
+					xf.xform_pos_rm(n.back());
+				}
+			}
+			else if (kw_len == 1 && *kw == 'l') {} // line - ignore
+			else if (kw_len == 1 && *kw == 'o') {add_cmd(CMD_OBJECT);} // object definition
+			else if (kw_len == 1 && *kw == 'g') {add_cmd(CMD_GROUP );} // group
+			else if (kw_len == 1 && *kw == 's') { // smoothing/shading (off/on or 0/1)
+				char const *p(skip_ws(args, eol));
+				int group(0);
+				if (read_int(p, eol, group) && group >= 0) {add_cmd(CMD_SMOOTH, group);}
+				else if (read_str_to_eol(args, eol) == "off") {add_cmd(CMD_SMOOTH, 0);}
+				else {set_error("Error reading smoothing group"); break;}
+			}
+			else if (kw_len == 6 && strncmp(kw, "usemtl", 6) == 0) { // use material
+				add_cmd(CMD_USEMTL, strs.size());
+				strs.push_back(read_str_to_eol(args, eol));
+			}
+			else if (kw_len == 6 && strncmp(kw, "mtllib", 6) == 0) { // material library
+				add_cmd(CMD_MTLLIB, strs.size());
+				strs.push_back(read_str_to_eol(args, eol));
+			}
+			else {
+				add_cmd(CMD_UNKNOWN, strs.size());
+				strs.push_back(string(kw, kw_end));
+			}
+		} // while
+		if (!colors.empty()) {colors.resize(v.size(), WHITE);} // pad the end
+	}
+};
+
+
 // ************************************************
 
 
@@ -282,6 +496,18 @@ bool endswith(string const &value, string const &ending) {
 class object_file_reader_model : public object_file_reader, public model_from_file_t {
 
 	bool had_empty_mat_error;
+	// parse state, shared by the serial and parallel parsers
+	int cur_mat_id;
+	unsigned smoothing_group, prev_smoothing_group, num_faces, num_objects, num_groups, obj_group_id;
+	bool is_textured, had_npts_error;
+	vector<point> v; // vertices
+	vector<vector3d> n; // normals
+	// weighted_normal can also be used, but doesn't work well; see face_weight_avg mode selected by recalc_normals==2
+	vector<counted_normal> vn; // vertex normals
+	vector<point2d<float> > tc; // texture coords
+	vector<colorRGB> colors; // vertex colors
+	deque<poly_data_block> pblocks;
+	set<string> loaded_mat_libs;
 
 	bool read_map_name(ifstream &in, string &name, float *scale=nullptr) {
 		if (!(in >> name)) {return 0;} // no name read (EOF?)
@@ -317,7 +543,8 @@ class object_file_reader_model : public object_file_reader, public model_from_fi
 	}
 
 public:
-	object_file_reader_model(string const &fn, model3d &model_) : object_file_reader(fn), model_from_file_t(fn, model_), had_empty_mat_error(0) {}
+	object_file_reader_model(string const &fn, model3d &model_) : object_file_reader(fn), model_from_file_t(fn, model_), had_empty_mat_error(0),
+		cur_mat_id(-1), smoothing_group(0), prev_smoothing_group(0), num_faces(0), num_objects(0), num_groups(0), obj_group_id(0), is_textured(0), had_npts_error(0) {}
 
 	bool load_mat_lib(string const &fn) { // Note: could cache filename, but seems to never be included more than once
 		ifstream mat_in;
@@ -482,9 +709,11 @@ public:
 		read_to_newline(mat_in); // ignore
 	}
 
-	bool load_from_model3d_file(bool verbose) {
-		if (!model.read_from_disk(filename)) {
-			cerr << "Error reading model3d file " << filename << endl;
+	bool load_from_model3d_file(bool verbose, string const &fn_override="") { // fn_override is used for cached model3d files of object files
+		string const &fn(fn_override.empty() ? filename : fn_override);
+
+		if (!model.read_from_disk(fn)) {
+			cerr << "Error reading model3d file " << fn << endl;
 			return 0;
 		}
 		{ // open a scope
@@ -527,27 +756,91 @@ public:
 		return 1;
 	}
 
-	bool read(geom_xform_t const &xf, int recalc_normals, bool verbose) {
-		RESET_TIME;
-		if (!open_file()) return 0;
-		cout << "Reading object file " << filename << endl;
+	poly_data_block &start_face() {
 		unsigned const block_size = (1 << 18); // 256K
-		int cur_mat_id(-1);
-		unsigned smoothing_group(0), prev_smoothing_group(0), num_faces(0), num_objects(0), num_groups(0), obj_group_id(0);
-		vector<point> v; // vertices
-		vector<vector3d> n; // normals
-		// weighted_normal can also be used, but doesn't work well; see face_weight_avg mode selected by recalc_normals==2
-		vector<counted_normal> vn; // vertex normals
-		vector<point2d<float> > tc; // texture coords
-		vector<colorRGB> colors; // vertex colors
-		deque<poly_data_block> pblocks;
-		set<string> loaded_mat_libs;
+		model.mark_mat_as_used(cur_mat_id);
+
+		if (pblocks.empty() || pblocks.back().pts.size() >= block_size || smoothing_group != prev_smoothing_group) { // create a new block
+			if (!pblocks.empty()) {
+				remove_excess_cap(pblocks.back().polys);
+				remove_excess_cap(pblocks.back().pts);
+			}
+			pblocks.push_back(poly_data_block());
+			prev_smoothing_group = smoothing_group;
+		}
+		poly_data_block &pb(pblocks.back());
+		pb.polys.push_back(poly_header_t(cur_mat_id, obj_group_id));
+		return pb;
+	}
+	void end_face(poly_data_block &pb, unsigned pix, int recalc_normals, unsigned approx_line) { // pix is the first point of this face
+		unsigned const npts(pb.polys.back().npts);
+
+		if (npts < 3) {
+			if (!had_npts_error) {cerr << "Error near line " << approx_line << ": face has only " << npts << " vertices." << endl; had_npts_error = 1;}
+			pb.pts.resize(pix);
+			pb.polys.pop_back(); // remove pts and polygon
+			return; // skip it
+		}
+		vector3d &normal(pb.polys.back().n);
+				
+		for (unsigned i = pix; i < pix+npts-2; ++i) { // find a nonzero normal
+			normal = cross_product((v[pb.pts[i+1].vix] - v[pb.pts[i].vix]), (v[pb.pts[i+2].vix] - v[pb.pts[i].vix])); // backwards?
+			// if we disable this normalize() we will weight normal contributions by polygon area,
+			// but we have to change the code below and it causes problems with vertex uniquing
+			normal.normalize();
+			if (normal != zero_vector) break; // got a good normal
+		}
+		if (recalc_normals) {
+			bool const face_weight_avg(recalc_normals == 2 && (npts == 3 || npts == 4)); // only works for quads and triangles
+			float face_area(0.0);
+
+			if (face_weight_avg) {
+				point face_pts[4];
+				for (unsigned i = 0; i < npts; ++i) {face_pts[i] = v[pb.pts[i+pix].vix];}
+				face_area = polygon_area(face_pts, npts);
+			}
+			for (unsigned i = pix; i < pix+npts; ++i) {
+				unsigned const vix(pb.pts[i].vix);
+				assert((unsigned)vix < vn.size());
+				bool const using_texgen(is_textured && model_auto_tc_scale > 0.0 && pb.pts[i].tix == 0);
+
+				if (vn[vix].is_valid() && (using_texgen || dot_product(normal, vn[vix].get_norm()) < 0.25)) { // normals in disagreement (or using texgen)
+					vn[vix] = zero_vector; // zero it out so that it becomes invalid later
+				}
+				else if (face_weight_avg) {vn[vix].add_normal(face_area*normal);} // face weighted average
+				else {vn[vix].add_normal(normal);} // unweighted average of normals
+			}
+		}
+	}
+	bool use_material(string const &material_name, unsigned approx_line) {
+		if (material_name.empty()) {
+			if (!had_empty_mat_error) {cerr << "Error reading material from object file " << filename << " near line " << approx_line << endl;}
+			had_empty_mat_error = 1;
+			return 0;
+		}
+		cur_mat_id = model.find_material(material_name);
+				
+		if (cur_mat_id >= 0) { // material was valid
+			int const tid(model.get_material(cur_mat_id).d_tid);
+			is_textured = (tid >= 0 && model.tmgr.get_tex_avg_color(tid) != WHITE); // no texture, or all white texture
+		}
+		return 1;
+	}
+	bool add_mat_lib(string const &mat_lib, unsigned approx_line) {
+		if (mat_lib.empty()) {
+			cerr << "Error reading material library from object file " << filename << " near line " << approx_line << endl;
+			return 0;
+		}
+		if (!try_load_mat_lib(mat_lib, loaded_mat_libs, approx_line)) {
+			//return 0; // nonfatal
+		}
+		return 1;
+	}
+
+	bool parse_serial(geom_xform_t const &xf, int recalc_normals) {
 		char s[MAX_CHARS];
 		string material_name, mat_lib, group_name, object_name;
-		tc.push_back(point2d<float>(0.0, 0.0)); // default tex coords
-		n.push_back(zero_vector); // default normal
 		unsigned approx_line(0);
-		bool is_textured(0), had_npts_error(0);
 
 		while (read_string(s, MAX_CHARS)) {
 			++approx_line;
@@ -560,20 +853,9 @@ public:
 				read_to_newline(fp); // ignore
 			}
 			else if (strcmp(s, "f") == 0) { // face
-				model.mark_mat_as_used(cur_mat_id);
-
-				if (pblocks.empty() || pblocks.back().pts.size() >= block_size || smoothing_group != prev_smoothing_group) { // create a new block
-					if (!pblocks.empty()) {
-						remove_excess_cap(pblocks.back().polys);
-						remove_excess_cap(pblocks.back().pts);
-					}
-					pblocks.push_back(poly_data_block());
-					prev_smoothing_group = smoothing_group;
-				}
-				poly_data_block &pb(pblocks.back());
-				pb.polys.push_back(poly_header_t(cur_mat_id, obj_group_id));
+				poly_data_block &pb(start_face());
 				unsigned &npts(pb.polys.back().npts);
-				unsigned const pix((unsigned)pb.pts.size()), pts_start(pb.pts.size());
+				unsigned const pts_start(pb.pts.size());
 				int vix(0), tix(0), nix(0);
 
 				while (read_int(vix)) { // read vertex index
@@ -600,42 +882,7 @@ public:
 					pb.pts.push_back(vntc_ix);
 					++npts;
 				} // end while vertex
-				if (npts < 3) {
-					if (!had_npts_error) {cerr << "Error near line " << approx_line << ": face has only " << npts << " vertices." << endl; had_npts_error = 1;}
-					pb.pts.resize(pts_start);
-					pb.polys.pop_back(); // remove pts and polygon
-					continue; // skip it
-				}
-				vector3d &normal(pb.polys.back().n);
-				
-				for (unsigned i = pix; i < pix+npts-2; ++i) { // find a nonzero normal
-					normal = cross_product((v[pb.pts[i+1].vix] - v[pb.pts[i].vix]), (v[pb.pts[i+2].vix] - v[pb.pts[i].vix])); // backwards?
-					// if we disable this normalize() we will weight normal contributions by polygon area,
-					// but we have to change the code below and it causes problems with vertex uniquing
-					normal.normalize();
-					if (normal != zero_vector) break; // got a good normal
-				}
-				if (recalc_normals) {
-					bool const face_weight_avg(recalc_normals == 2 && (npts == 3 || npts == 4)); // only works for quads and triangles
-					float face_area(0.0);
-
-					if (face_weight_avg) {
-						point face_pts[4];
-						for (unsigned i = 0; i < npts; ++i) {face_pts[i] = v[pb.pts[i+pix].vix];}
-						face_area = polygon_area(face_pts, npts);
-					}
-					for (unsigned i = pix; i < pix+npts; ++i) {
-						unsigned const vix(pb.pts[i].vix);
-						assert((unsigned)vix < vn.size());
-						bool const using_texgen(is_textured && model_auto_tc_scale > 0.0 && pb.pts[i].tix == 0);
-
-						if (vn[vix].is_valid() && (using_texgen || dot_product(normal, vn[vix].get_norm()) < 0.25)) { // normals in disagreement (or using texgen)
-							vn[vix] = zero_vector; // zero it out so that it becomes invalid later
-						}
-						else if (face_weight_avg) {vn[vix].add_normal(face_area*normal);} // face weighted average
-						else {vn[vix].add_normal(normal);} // unweighted average of normals
-					}
-				}
+				end_face(pb, pts_start, recalc_normals, approx_line);
 			}
 			else if (strcmp(s, "v") == 0) { // vertex
 				v.push_back(point());
@@ -700,29 +947,11 @@ public:
 			}
 			else if (strcmp(s, "usemtl") == 0) { // use material
 				read_str_to_newline(fp, material_name);
-
-				if (material_name.empty()) {
-					if (!had_empty_mat_error) {cerr << "Error reading material from object file " << filename << " near line " << approx_line << endl;}
-					had_empty_mat_error = 1;
-					return 0;
-				}
-				cur_mat_id = model.find_material(material_name);
-				
-				if (cur_mat_id >= 0) { // material was valid
-					int const tid(model.get_material(cur_mat_id).d_tid);
-					is_textured = (tid >= 0 && model.tmgr.get_tex_avg_color(tid) != WHITE); // no texture, or all white texture
-				}
+				if (!use_material(material_name, approx_line)) return 0;
 			}
 			else if (strcmp(s, "mtllib") == 0) { // material library
 				read_str_to_newline(fp, mat_lib);
-
-				if (mat_lib.empty()) {
-					cerr << "Error reading material library from object file " << filename << " near line " << approx_line << endl;
-					return 0;
-				}
-				if (!try_load_mat_lib(mat_lib, loaded_mat_libs, approx_line)) {
-					//return 0; // nonfatal
-				}
+				if (!add_mat_lib(mat_lib, approx_line)) return 0;
 			}
 			else {
 				cerr << "Error: Undefined entry '" << s << "' in object file " << filename << " near line " << approx_line << endl;
@@ -730,6 +959,293 @@ public:
 				//return 0;
 			}
 		} // while
+		return 1;
+	}
+
+	// parallel parser: tokenize line aligned chunks of the file on all threads, then merge the vertex tables and replay the faces and state changes in file order
+	bool parse_parallel(mapped_file_t const &file_data, geom_xform_t const &xf, int recalc_normals) {
+		unsigned const num_chunks(min(256U, unsigned(file_data.get_size() >> 18) + 1U)); // ~256KB per chunk, independent of thread count for determinism
+		char const *const data(file_data.get_data()), *const data_end(data + file_data.get_size());
+		vector<char const *> chunk_starts(num_chunks+1, data_end);
+		chunk_starts[0] = data;
+
+		for (unsigned i = 1; i < num_chunks; ++i) { // find line aligned chunk boundaries
+			char const *pos(max(chunk_starts[i-1], data + (file_data.get_size()*i)/num_chunks));
+			pos = (char const *)memchr(pos, '\n', data_end - pos);
+			chunk_starts[i] = (pos ? pos+1 : data_end);
+		}
+		vector<obj_file_chunk_t> chunks(num_chunks);
+#pragma omp parallel for schedule(dynamic,1)
+		for (int i = 0; i < (int)num_chunks; ++i) {chunks[i].parse(chunk_starts[i], chunk_starts[i+1], xf, (recalc_normals != 0));}
+		// merge vertex tables
+		size_t nv(0), ntc(0), nn(0);
+		bool has_colors(0);
+
+		for (auto c = chunks.begin(); c != chunks.end(); ++c) {
+			nv += c->v.size(); ntc += c->tc.size(); nn += c->n.size();
+			has_colors |= !c->colors.empty();
+		}
+		v.reserve(nv); tc.reserve(ntc+1); n.reserve(nn+1);
+		if (has_colors) {colors.reserve(nv);}
+
+		for (auto c = chunks.begin(); c != chunks.end(); ++c) {
+			if (has_colors) {
+				if (c->colors.empty()) {colors.resize(colors.size() + c->v.size(), WHITE);}
+				else {colors.insert(colors.end(), c->colors.begin(), c->colors.end()); colors.resize(v.size() + c->v.size(), WHITE);} // pad the end of the chunk
+			}
+			vector_add_to(c->v,  v);
+			vector_add_to(c->tc, tc);
+			vector_add_to(c->n,  n);
+		}
+		if (recalc_normals) {vn.resize(v.size());}
+		// replay commands in file order
+		unsigned v_off(0), tc_off(0), n_off(0), line_off(0);
+
+		for (auto c = chunks.begin(); c != chunks.end(); ++c) {
+			if (!c->error.empty()) {
+				cerr << c->error << " from object file " << filename << " near line " << (line_off + c->error_line) << endl;
+				return 0;
+			}
+			for (auto i = c->cmds.begin(); i != c->cmds.end(); ++i) {
+				unsigned const approx_line(line_off + i->line);
+
+				switch (i->type) {
+				case obj_file_chunk_t::CMD_FACE: {
+					poly_data_block &pb(start_face());
+					unsigned const pts_start(pb.pts.size());
+					pb.polys.back().npts = i->npts;
+
+					for (unsigned p = 0; p < i->npts; ++p) {
+						int const *const ixs(&c->face_ixs[3*(i->start + p)]);
+						int vix(ixs[0]), tix(ixs[1]), nix(ixs[2]);
+						normalize_index(vix, v_off + i->nv);
+						vntc_ix_t vntc_ix(vix, 0, 0);
+
+						if (tix != obj_file_chunk_t::NO_IX) {
+							normalize_index(tix, tc_off + i->ntc); // account for tc[0]
+							vntc_ix.tix = tix+1; // account for tc[0]
+						}
+						if (nix != obj_file_chunk_t::NO_IX && !recalc_normals) {
+							normalize_index(nix, n_off + i->nn); // account for n[0]
+							vntc_ix.nix = nix+1; // account for n[0]
+						}
+						pb.pts.push_back(vntc_ix);
+					}
+					end_face(pb, pts_start, recalc_normals, approx_line);
+					break;
+				}
+				case obj_file_chunk_t::CMD_USEMTL: if (!use_material(c->strs[i->start], approx_line)) return 0; break;
+				case obj_file_chunk_t::CMD_MTLLIB: if (!add_mat_lib (c->strs[i->start], approx_line)) return 0; break;
+				case obj_file_chunk_t::CMD_SMOOTH: smoothing_group = i->start; break;
+				case obj_file_chunk_t::CMD_OBJECT: ++num_objects; ++obj_group_id; break;
+				case obj_file_chunk_t::CMD_GROUP:  ++num_groups;  ++obj_group_id; break;
+				case obj_file_chunk_t::CMD_UNKNOWN:
+					cerr << "Error: Undefined entry '" << c->strs[i->start] << "' in object file " << filename << " near line " << approx_line << endl;
+					break;
+				default: assert(0);
+				}
+			} // for i
+			v_off += c->v.size(); tc_off += c->tc.size(); n_off += c->n.size(); line_off += c->num_lines;
+		} // for c
+		return 1;
+	}
+
+	void build_polygon(poly_header_t const &ph, vntc_ix_t const *const pts, int recalc_normals, polygon_t &poly) const {
+		poly.resize(ph.npts);
+
+		for (unsigned p = 0; p < ph.npts; ++p) {
+			vntc_ix_t const &V(pts[p]);
+			vector3d normal;
+
+			if (recalc_normals) {
+				assert(V.vix < vn.size());
+				normal = ((ph.n != zero_vector && !vn[V.vix].is_valid()) ? ph.n : vn[V.vix]);
+			}
+			else {
+				assert(V.nix < n.size());
+				normal = n[V.nix];
+				if (normal == zero_vector) normal = ph.n;
+			}
+			assert(V.vix < v.size() && V.tix < tc.size());
+			point2d<float> tcoord;
+
+			if (V.tix == 0 && model_auto_tc_scale > 0.0) { // generate tc since it wasn't read from the file
+				unsigned const dim(get_max_dim(normal)), dimx((dim == 0) ? 1 : 0), dimy((dim == 2) ? 1 : 2); // looks better for brick textures on walls
+				tcoord.x = model_auto_tc_scale*v[V.vix][dimx];
+				tcoord.y = model_auto_tc_scale*v[V.vix][dimy];
+			}
+			else {tcoord = tc[V.tix];}
+			poly[p] = vert_norm_tc(v[V.vix], normal, tcoord.x, tcoord.y);
+			if (!colors.empty()) {assert(V.vix < colors.size()); poly.color += colors[V.vix];}
+		} // for p
+		if (!colors.empty()) {poly.color = poly.color/ph.npts; poly.color.A = 1.0;} // FIXME: uses average vertex color for each face/polygon
+	}
+
+	struct block_split_polys_t { // a block's polygons split into triangles and quads and grouped by material
+		struct mat_polys_t {
+			vector<polygon_t> polys; // split polygons
+			vector<unsigned> src_ends, obj_ids; // per source polygon: end of its split polygons in polys, and its obj_id
+			vector<unsigned> run_starts; // source polygons that start a run of consecutive polygons with this material
+		};
+		vector<unsigned> mats_used; // mat_id+1, so that unbound geometry (mat_id=-1) is at index 0
+		vector<mat_polys_t> mats; // indexed by mat_id+1
+		unsigned num_ngons; // source polygons with more than 4 vertices, which are tessellated
+		block_split_polys_t() : num_ngons(0) {}
+	};
+
+	// split_polygon() uses the global GLU tessellator, which isn't thread safe, so the polygons are split serially in file order; this also updates the model bbox
+	unsigned split_block_polygons(poly_data_block const &pd, int recalc_normals, block_split_polys_t &bsp) {
+		bsp.mats.resize(model.num_materials()+1);
+		polygon_t poly;
+		unsigned pix(0), num_added(0);
+
+		for (unsigned j = 0; j < pd.polys.size(); ++j) {
+			poly_header_t const &ph(pd.polys[j]);
+			assert(ph.mat_id+1 < (int)bsp.mats.size());
+			block_split_polys_t::mat_polys_t &mp(bsp.mats[ph.mat_id+1]);
+			if (mp.src_ends.empty()) {bsp.mats_used.push_back(ph.mat_id+1);}
+			if (j == 0 || pd.polys[j-1].mat_id != ph.mat_id) {mp.run_starts.push_back(mp.src_ends.size());}
+			build_polygon(ph, &pd.pts[pix], recalc_normals, poly);
+			num_added += model.split_polygon_and_update_bbox(poly, ph.mat_id, mp.polys);
+			mp.src_ends.push_back(mp.polys.size());
+			mp.obj_ids.push_back(ph.obj_id);
+			bsp.num_ngons += (ph.npts > 4);
+			pix += ph.npts;
+		}
+		return num_added;
+	}
+
+	// each material has its own geometry, and the vertex maps are cleared whenever the material changes, so materials can be welded in parallel;
+	// this produces the same vertex and index buffers as adding each polygon in file order
+	void weld_block_polygons(block_split_polys_t const &bsp) {
+#pragma omp parallel for schedule(dynamic,1)
+		for (int i = 0; i < (int)bsp.mats_used.size(); ++i) {
+			unsigned const mix(bsp.mats_used[i]);
+			block_split_polys_t::mat_polys_t const &mp(bsp.mats[mix]);
+			vntc_map_t vmap[2]; // {triangles, quads}
+			vntct_map_t vmap_tan[2]; // {triangles, quads}
+			unsigned next_run(0), start(0);
+
+			for (unsigned s = 0; s < mp.src_ends.size(); start = mp.src_ends[s++]) {
+				if (next_run < mp.run_starts.size() && mp.run_starts[next_run] == s) { // the material changed since the previous run
+					for (unsigned d = 0; d < 2; ++d) {vmap[d].reset(); vmap_tan[d].reset();}
+					++next_run;
+				}
+				model.add_split_polygons_mt((mp.polys.data() + start), (mp.src_ends[s] - start), vmap, vmap_tan, (int(mix) - 1), mp.obj_ids[s]);
+			}
+		} // for i
+	}
+
+	unsigned add_block_polygons(poly_data_block const &pd, int recalc_normals) {
+		unsigned num_added(0);
+
+		if (parallel_model_welding) {
+			block_split_polys_t bsp;
+			num_added = split_block_polygons(pd, recalc_normals, bsp);
+			weld_block_polygons(bsp);
+			return num_added;
+		}
+		polygon_t poly;
+		vntc_map_t vmap[2]; // {triangles, quads}
+		vntct_map_t vmap_tan[2]; // {triangles, quads}
+		unsigned pix(0);
+
+		for (vector<poly_header_t>::const_iterator j = pd.polys.begin(); j != pd.polys.end(); ++j) {
+			build_polygon(*j, &pd.pts[pix], recalc_normals, poly);
+			num_added += model.add_polygon(poly, vmap, vmap_tan, j->mat_id, j->obj_id);
+			pix += j->npts;
+		}
+		return num_added;
+	}
+
+	// compares vertex welding using the previous map<T, unsigned> with vertex_map_t, serial and parallel across materials; all should produce the same indices;
+	// polygons are split first, the same as when they're added to the model, so that the vertices of tessellated n-gons are included
+	void run_welding_benchmark(poly_data_block const &pd, int recalc_normals) {
+		int const split_start_ms(GET_TIME_MS());
+		block_split_polys_t bsp;
+		split_block_polygons(pd, recalc_normals, bsp); // adds to the model bbox, which doesn't change it when the same polygons are added after this
+		double const t_split(0.001*(GET_TIME_MS() - split_start_ms));
+		unsigned const RUN_START_BIT(1U << 31);
+		unsigned const num_mats(bsp.mats_used.size());
+		vector<vector<vert_norm_tc>> verts(num_mats);
+		vector<vector<unsigned>> clear_starts(num_mats); // vertex maps are cleared at the start of each run, and checked for size before each source polygon
+		size_t num_verts(0), num_split_polys(0);
+
+		for (unsigned i = 0; i < num_mats; ++i) {
+			block_split_polys_t::mat_polys_t const &mp(bsp.mats[bsp.mats_used[i]]);
+			unsigned next_run(0), start(0);
+
+			for (unsigned s = 0; s < mp.src_ends.size(); start = mp.src_ends[s++]) {
+				bool const run_start(next_run < mp.run_starts.size() && mp.run_starts[next_run] == s);
+				next_run += run_start;
+				clear_starts[i].push_back(run_start ? (verts[i].size() | RUN_START_BIT) : verts[i].size());
+
+				for (unsigned p = start; p < mp.src_ends[s]; ++p) {verts[i].insert(verts[i].end(), mp.polys[p].begin(), mp.polys[p].end());}
+			}
+			num_verts       += verts[i].size();
+			num_split_polys += mp.polys.size();
+		} // for i
+		typedef vector<vector<unsigned>> mat_indices_t;
+
+		auto weld_map = [&](unsigned i, vector<unsigned> &indices) {
+			map<vert_norm_tc, unsigned> vmap;
+			unsigned num_unique(0), next_src(0);
+			indices.resize(verts[i].size());
+
+			for (unsigned n = 0; n < verts[i].size(); ++n) {
+				for (; next_src < clear_starts[i].size() && (clear_starts[i][next_src] & ~RUN_START_BIT) == n; ++next_src) {
+					if ((clear_starts[i][next_src] & RUN_START_BIT) || vmap.size() >= MAX_VMAP_SIZE) {vmap.clear(); num_unique = 0;}
+				}
+				auto it(vmap.find(verts[i][n]));
+				if (it == vmap.end()) {indices[n] = num_unique; vmap[verts[i][n]] = num_unique++;} else {indices[n] = it->second;}
+			}
+		};
+		auto weld_hash = [&](unsigned i, vector<unsigned> &indices) {
+			vntc_map_t vmap;
+			unsigned num_unique(0), next_src(0);
+			indices.resize(verts[i].size());
+
+			for (unsigned n = 0; n < verts[i].size(); ++n) {
+				for (; next_src < clear_starts[i].size() && (clear_starts[i][next_src] & ~RUN_START_BIT) == n; ++next_src) {
+					if ((clear_starts[i][next_src] & RUN_START_BIT) || vmap.size() >= MAX_VMAP_SIZE) {vmap.clear(); num_unique = 0;}
+				}
+				indices[n] = vmap.find_or_insert(verts[i][n], num_unique);
+				if (indices[n] == num_unique) {++num_unique;}
+			}
+		};
+		auto run_timed = [&](mat_indices_t &indices, bool use_map, bool par) {
+			int const start_ms(GET_TIME_MS());
+			indices.resize(num_mats);
+#pragma omp parallel for schedule(dynamic,1) if (par)
+			for (int i = 0; i < (int)num_mats; ++i) {
+				if (use_map) {weld_map(i, indices[i]);} else {weld_hash(i, indices[i]);}
+			}
+			return 0.001*(GET_TIME_MS() - start_ms);
+		};
+		mat_indices_t ix_map, ix_hash, ix_par;
+		double const t_map(run_timed(ix_map, 1, 0)), t_hash(run_timed(ix_hash, 0, 0)), t_par(run_timed(ix_par, 0, 1));
+		cout << "Vertex welding benchmark " << filename << ": " << pd.polys.size() << " polygons (" << bsp.num_ngons << " n-gons) split into " << num_split_polys
+			 << " in " << t_split << "s, " << num_verts << " verts, " << num_mats << " materials: map " << t_map << "s, hash table " << t_hash << "s ("
+			 << t_map/max(t_hash, 0.001) << "x), parallel hash table " << t_par << "s (" << t_map/max(t_par, 0.001) << "x), identical: "
+			 << (((ix_hash == ix_map) && (ix_par == ix_map)) ? "yes" : "NO") << endl;
+	}
+
+	bool read(geom_xform_t const &xf, int recalc_normals, bool verbose) {
+		RESET_TIME;
+		cout << "Reading object file " << filename << endl;
+		tc.push_back(point2d<float>(0.0, 0.0)); // default tex coords
+		n.push_back(zero_vector); // default normal
+		mapped_file_t file_data;
+
+		if (file_data.open(filename, OBJ_FILE_MT_MIN_SIZE)) { // large file, use the parallel parser on a memory map of the file
+			if (!parse_parallel(file_data, xf, recalc_normals)) return 0;
+			file_data.close();
+		}
+		else {
+			if (!open_file()) return 0;
+			if (!parse_serial(xf, recalc_normals)) return 0;
+			close_file();
+		}
 		remove_excess_cap(v);
 		remove_excess_cap(n);
 		remove_excess_cap(tc);
@@ -741,44 +1257,8 @@ public:
 		model3d::proc_model_normals(vn, recalc_normals); // if recalc_normals
 
 		while (!pblocks.empty()) {
-			poly_data_block const &pd(pblocks.back());
-			unsigned pix(0);
-			polygon_t poly;
-			vntc_map_t vmap[2]; // {triangles, quads}
-			vntct_map_t vmap_tan[2]; // {triangles, quads}
-
-			for (vector<poly_header_t>::const_iterator j = pd.polys.begin(); j != pd.polys.end(); ++j) {
-				poly.resize(j->npts);
-				
-				for (unsigned p = 0; p < j->npts; ++p) {
-					vntc_ix_t const &V(pd.pts[pix+p]);
-					vector3d normal;
-
-					if (recalc_normals) {
-						assert(V.vix < vn.size());
-						normal = ((j->n != zero_vector && !vn[V.vix].is_valid()) ? j->n : vn[V.vix]);
-					}
-					else {
-						assert(V.nix < n.size());
-						normal = n[V.nix];
-						if (normal == zero_vector) normal = j->n;
-					}
-					assert(V.vix < v.size() && V.tix < tc.size());
-					point2d<float> tcoord;
-
-					if (V.tix == 0 && model_auto_tc_scale > 0.0) { // generate tc since it wasn't read from the file
-						unsigned const dim(get_max_dim(normal)), dimx((dim == 0) ? 1 : 0), dimy((dim == 2) ? 1 : 2); // looks better for brick textures on walls
-						tcoord.x = model_auto_tc_scale*v[V.vix][dimx];
-						tcoord.y = model_auto_tc_scale*v[V.vix][dimy];
-					}
-					else {tcoord = tc[V.tix];}
-					poly[p] = vert_norm_tc(v[V.vix], normal, tcoord.x, tcoord.y);
-					if (!colors.empty()) {assert(V.vix < colors.size()); poly.color += colors[V.vix];}
-				} // for p
-				if (!colors.empty()) {poly.color = poly.color/j->npts; poly.color.A = 1.0;} // FIXME: uses average vertex color for each face/polygon
-				num_faces += model.add_polygon(poly, vmap, vmap_tan, j->mat_id, j->obj_id);
-				pix += j->npts;
-			} // for j
+			if (benchmark_model_welding) {run_welding_benchmark(pblocks.back(), recalc_normals);}
+			num_faces += add_block_polygons(pblocks.back(), recalc_normals);
 			pblocks.pop_back();
 		}
 		model.finalize(); // optimize vertices, remove excess capacity, compute bounding cube, subdivide, generate LOD blocks
@@ -817,6 +1297,99 @@ bool write_model3d_file(string const &base_fn, model3d &cur_model) {
 }
 
 
+// returns the material library filenames referenced by mtllib lines in this object file, without parsing the rest of the file
+void get_obj_file_mat_libs(string const &filename, vector<string> &mat_libs) {
+
+	FILE *fp(fopen(filename.c_str(), "r"));
+	if (fp == nullptr) return;
+	char line[4096];
+	bool at_line_start(1);
+
+	while (fgets(line, sizeof(line), fp)) {
+		size_t const len(strlen(line));
+		bool const is_line_start(at_line_start);
+		at_line_start = (len > 0 && line[len-1] == '\n'); // long lines are read in multiple parts
+		if (!is_line_start) continue;
+		char const *s(line);
+		while (*s == ' ' || *s == '\t') {++s;}
+		if (strncmp(s, "mtllib", 6) != 0 || !(s[6] == ' ' || s[6] == '\t')) continue;
+		s += 7;
+		while (*s == ' ' || *s == '\t') {++s;}
+		char const *end(line + len);
+		while (end > s && isspace((unsigned char)end[-1])) {--end;}
+		if (end > s) {mat_libs.push_back(string(s, end));}
+	}
+	fclose(fp);
+}
+
+// adds the size and modification time of each material library to the hash, using the same search paths as model_from_file_t::open_include_file()
+template<typename F> void add_mat_lib_file_stats(string const &filename, F &add_bytes) {
+
+	vector<string> mat_libs;
+	get_obj_file_mat_libs(filename, mat_libs);
+	string const rel_path(model_from_file_t::get_path(filename));
+
+	for (unsigned i = 0; i < mat_libs.size(); ++i) { // Note: may grow if a line contains multiple filenames
+		string const &mat_lib(mat_libs[i]);
+		string const fns[3] = {mat_lib, (rel_path + mat_lib), ("textures/" + mat_lib)};
+		struct stat st;
+		bool found(0);
+
+		for (unsigned n = 0; n < 3 && !found; ++n) {
+			if (stat(fns[n].c_str(), &st) != 0) continue;
+			uint64_t const file_size(st.st_size), mod_time(st.st_mtime);
+			add_bytes(fns[n].data(), fns[n].size());
+			add_bytes(&file_size, sizeof(file_size));
+			add_bytes(&mod_time, sizeof(mod_time));
+			found = 1;
+		}
+		if (found) continue;
+		istringstream iss(mat_lib); // try to split by whitespace, the same as object_file_reader_model::try_load_mat_lib()
+		string str;
+		while (iss >> str) {if (str != mat_lib) {mat_libs.push_back(str);}}
+	} // for i
+}
+
+// returns the filename of the cached model3d file for this object file and load parameters, or an empty string if caching is disabled;
+// the key is a hash of the filename, file size, modification time, the size and modification time of its material libraries,
+// and the parameters that affect the generated geometry
+string get_model3d_cache_fn(string const &filename, geom_xform_t const &xf, int recalc_normals) {
+
+	if (model3d_cache_dir.empty()) return string();
+	struct stat st;
+	if (stat(filename.c_str(), &st) != 0) return string();
+	uint64_t hash(14695981039346656037ULL); // FNV-1a
+	auto add_bytes = [&hash](void const *data, size_t sz) {for (size_t i = 0; i < sz; ++i) {hash = (hash ^ ((unsigned char const *)data)[i])*1099511628211ULL;}};
+	uint64_t const file_size(st.st_size), mod_time(st.st_mtime);
+	add_bytes(filename.data(), filename.size());
+	add_bytes(&file_size, sizeof(file_size));
+	add_bytes(&mod_time, sizeof(mod_time));
+	add_mat_lib_file_stats(filename, add_bytes);
+	add_bytes(&xf, sizeof(geom_xform_t));
+	add_bytes(&recalc_normals, sizeof(recalc_normals));
+	add_bytes(&model_auto_tc_scale, sizeof(model_auto_tc_scale));
+	add_bytes(&model_calc_tan_vect, sizeof(model_calc_tan_vect));
+	size_t const name_start(filename.find_last_of("/\\") + 1), ext_start(filename.find_last_of('.'));
+	string const base_name(filename.substr(name_start, ((ext_start == string::npos || ext_start < name_start) ? string::npos : (ext_start - name_start))));
+	char hash_str[20] = {0};
+	sprintf(hash_str, "%016llx", (unsigned long long)hash);
+	return model3d_cache_dir + "/" + base_name + "_" + hash_str + ".model3d";
+}
+
+void write_model3d_cache_file(string const &cache_fn, model3d &cur_model) {
+
+	RESET_TIME;
+	string const tmp_fn(cache_fn + ".tmp");
+	if (model_calc_tan_vect) {cur_model.calc_tangent_vectors();} // tangent vectors are needed for writing
+	if (!create_dir_if_needed(model3d_cache_dir)) return;
+	// write to a temp file and rename so that an interrupted write doesn't leave a partial cache file
+	if (!cur_model.write_to_disk(tmp_fn)) {cerr << "Warning: Failed to write model3d cache file " << tmp_fn << endl; remove(tmp_fn.c_str()); return;}
+	remove(cache_fn.c_str()); // rename() fails on Windows if the destination exists
+	if (rename(tmp_fn.c_str(), cache_fn.c_str()) != 0) {cerr << "Warning: Failed to rename model3d cache file " << tmp_fn << endl; remove(tmp_fn.c_str()); return;}
+	PRINT_TIME("Model3d Cache Write");
+}
+
+
 bool read_3ds_file_model(string const &filename, model3d &model, geom_xform_t const &xf, int use_vertex_normals, bool verbose);
 bool read_3ds_file_pts(string const &filename, vector<coll_tquad> *ppts, geom_xform_t const &xf, colorRGBA const &def_c, bool verbose);
 
@@ -842,9 +1415,22 @@ bool load_model_file(string const &filename, model3ds &models, geom_xform_t cons
 		}
 		else {
 			check_obj_file_ext(filename, ext);
-			//test_other_obj_loader(filename); // placeholder for testing other object file loaders (tinyobjloader, assimp, etc.)
-			if (!reader.read(xf, recalc_normals, verbose)) {models.pop_back(); return 0;}
-			if (write_file && !write_model3d_file(filename, cur_model)) return 0; // don't need to pop the model
+			string const cache_fn(get_model3d_cache_fn(filename, xf, recalc_normals));
+
+			if (!cache_fn.empty() && check_file_exists(cache_fn)) { // use the cached model3d file
+				if (!reader.load_from_model3d_file(verbose, cache_fn)) {
+					cerr << "Warning: Removing invalid model3d cache file " << cache_fn << endl;
+					remove(cache_fn.c_str());
+					models.pop_back();
+					return load_model_file(filename, models, xf, def_tid, def_c, reflective, metalness, recalc_normals, group_cobjs_level, write_file, verbose); // reload from the object file
+				}
+			}
+			else {
+				//test_other_obj_loader(filename); // placeholder for testing other object file loaders (tinyobjloader, assimp, etc.)
+				if (!reader.read(xf, recalc_normals, verbose)) {models.pop_back(); return 0;}
+				if (write_file && !write_model3d_file(filename, cur_model)) return 0; // don't need to pop the model
+				if (!cache_fn.empty()) {write_model3d_cache_file(cache_fn, cur_model);}
+			}
 		}
 	}
 	if (model_mat_lod_thresh > 0.0) {cur_model.compute_area_per_tri();} // used for TT LOD/distance culling
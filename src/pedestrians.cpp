@@ -33,6 +33,11 @@ string pedestrian_t::str() const { // Note: no label_str()
 
 float pedestrian_t::get_speed_mult() const {return (in_the_road ? CROSS_SPEED_MULT : 1.0);}
 
+float pedestrian_t::get_prox_radius() const {
+	float const timestep(2.0*TICKS_PER_SECOND), lookahead_dist(timestep*speed); // how far we can travel in 2s
+	return (1.2*radius + lookahead_dist); // assume other ped has a similar radius
+}
+
 void pedestrian_t::stop() {
 	//dir = vel.get_norm(); // ???
 	vel = zero_vector;
@@ -133,63 +138,67 @@ void register_ped_coll(pedestrian_t &p1, pedestrian_t &p2, unsigned pid1, unsign
 	p2.collided = p2.ped_coll = 1; p2.colliding_ped = pid1;
 }
 
-bool pedestrian_t::check_ped_ped_coll_range(vector<pedestrian_t> &peds, unsigned pid, unsigned ped_start, unsigned target_plot, float prox_radius, vector3d &force) {
-	float const prox_radius_sq(prox_radius*prox_radius);
+bool pedestrian_t::check_ped_ped_coll_pair(pedestrian_t &ped, unsigned pid, unsigned ped_ix, float prox_radius, vector3d &force) {
+	float const dist_sq(p2p_dist_xy_sq(pos, ped.pos));
+	if (dist_sq > prox_radius*prox_radius) return 0; // proximity test
+	if (ped.destroyed) return 0; // dead
+	float const r_sum(0.6f*(radius + ped.radius)); // using a smaller radius to allow peds to get close to each other
+	if (dist_sq < r_sum*r_sum) {register_ped_coll(*this, ped, pid, ped_ix); return 1;} // collision
+	if (speed < TOLERANCE) return 0;
+	vector3d const delta_v(vel - ped.vel), delta_p((pos.x - ped.pos.x), (pos.y - ped.pos.y), 0.0);
+	float const dp(-dot_product_xy(delta_v, delta_p));
+	if (dp <= 0.0) return 0; // diverging, no avoidance needed
+	float const dv_mag(delta_v.mag()), dist(sqrt(dist_sq)), fmag(dist/(dist - 0.9*r_sum));
+	if (dv_mag < TOLERANCE) return 0;
+	vector3d const rejection(delta_p - (dp/(dv_mag*dv_mag))*delta_v); // component of velocity perpendicular to delta_p (avoid dir)
+	float const rmag(rejection.mag()), rel_vel(max(dv_mag/speed, 0.5f)); // higher when peds are converging
+	if (rmag < TOLERANCE) return 0;
+	float const force_mult(dp/(dv_mag*dist)); // stronger with head-on collisions
+	force += rejection*(rel_vel*force_mult*fmag/rmag);
+	//cout << TXT(r_sum) << TXT(dist) << TXT(fmag) << ", dv: " << delta_v.str() << ", dp: " << delta_p.str() << ", rej: " << rejection.str() << ", force: " << force.str() << endl;
+	return 0;
+}
 
+bool pedestrian_t::check_ped_ped_coll_range(vector<pedestrian_t> &peds, unsigned pid, unsigned ped_start, unsigned target_plot, float prox_radius, vector3d &force) {
 	for (auto i = peds.begin()+ped_start; i != peds.end(); ++i) { // check every ped until we exit target_plot
 		if (i->plot != target_plot) break; // moved to a new plot, no collision, done; since plots are globally unique across cities, we don't need to check cities
-		float const dist_sq(p2p_dist_xy_sq(pos, i->pos));
-		if (dist_sq > prox_radius_sq) continue; // proximity test
-		if (i->destroyed) continue; // dead
-		float const r_sum(0.6f*(radius + i->radius)); // using a smaller radius to allow peds to get close to each other
-		if (dist_sq < r_sum*r_sum) {register_ped_coll(*this, *i, pid, (i - peds.begin())); return 1;} // collision
-		if (speed < TOLERANCE) continue;
-		vector3d const delta_v(vel - i->vel), delta_p((pos.x - i->pos.x), (pos.y - i->pos.y), 0.0);
-		float const dp(-dot_product_xy(delta_v, delta_p));
-		if (dp <= 0.0) continue; // diverging, no avoidance needed
-		float const dv_mag(delta_v.mag()), dist(sqrt(dist_sq)), fmag(dist/(dist - 0.9*r_sum));
-		if (dv_mag < TOLERANCE) continue;
-		vector3d const rejection(delta_p - (dp/(dv_mag*dv_mag))*delta_v); // component of velocity perpendicular to delta_p (avoid dir)
-		float const rmag(rejection.mag()), rel_vel(max(dv_mag/speed, 0.5f)); // higher when peds are converging
-		if (rmag < TOLERANCE) continue;
-		float const force_mult(dp/(dv_mag*dist)); // stronger with head-on collisions
-		force += rejection*(rel_vel*force_mult*fmag/rmag);
-		//cout << TXT(r_sum) << TXT(dist) << TXT(fmag) << ", dv: " << delta_v.str() << ", dp: " << delta_p.str() << ", rej: " << rejection.str() << ", force: " << force.str() << endl;
-	} // for i
+		if (check_ped_ped_coll_pair(*i, pid, (i - peds.begin()), prox_radius, force)) return 1;
+	}
 	return 0;
 }
 
 bool pedestrian_t::check_ped_ped_coll(ped_manager_t const &ped_mgr, vector<pedestrian_t> &peds, unsigned pid, float delta_dir) {
 	if (in_building) return 0; // no ped-ped collisions in buildings (yet)
 	assert(pid < peds.size());
-	float const timestep(2.0*TICKS_PER_SECOND), lookahead_dist(timestep*speed); // how far we can travel in 2s
-	float const prox_radius(1.2*radius + lookahead_dist); // assume other ped has a similar radius
+	float const prox_radius(get_prox_radius());
 	vector3d force(zero_vector);
-	if (check_ped_ped_coll_range(peds, pid, pid+1, plot, prox_radius, force)) return 1;
-
-	if (in_the_road && next_plot != plot) {
-		// need to check for coll between two peds crossing the street from different sides, since they won't be in the same plot while in the street
-		unsigned const ped_ix(ped_mgr.get_first_ped_at_plot(next_plot));
-		assert(ped_ix <= peds.size()); // could be at the end
-		if (check_ped_ped_coll_range(peds, pid, ped_ix, next_plot, prox_radius, force)) return 1;
-	}
+	bool coll(0);
+	// Note: this includes peds in other plots, such as those crossing the street from the other side; only check peds after this one so that each pair is tested once
+	ped_mgr.get_ped_grid().query_sphere(pos, prox_radius, [&](unsigned ix) {
+		if (ix > pid) {assert(ix < peds.size()); coll = check_ped_ped_coll_pair(peds[ix], pid, ix, prox_radius, force);}
+		return coll;
+	});
+	if (coll) return 1;
 	if (force != zero_vector) {set_velocity((0.1*delta_dir)*force + ((1.0 - delta_dir)/speed)*vel);} // apply ped repulsive force
 	return 0;
 }
 
-bool pedestrian_t::check_ped_ped_coll_stopped(vector<pedestrian_t> &peds, unsigned pid) {
+bool pedestrian_t::check_ped_ped_coll_stopped(ped_manager_t const &ped_mgr, vector<pedestrian_t> &peds, unsigned pid) {
 	if (in_building) return 0; // no ped-ped collisions in buildings (yet)
 	assert(pid < peds.size());
-
-	// Note: shouldn't have to check peds in the next plot, assuming that if we're stopped, they likely are as well, and won't be walking toward us
-	for (auto i = peds.begin()+pid+1; i != peds.end(); ++i) { // check every ped until we exit target_plot
-		if (i->plot != plot) break; // moved to a new plot, no collision, done; since plots are globally unique across cities, we don't need to check cities
-		if (!dist_xy_less_than(pos, i->pos, 0.6f*(radius + i->radius))) continue; // no collision
-		if (i->destroyed) continue; // dead
-		i->collided = i->ped_coll = 1; i->colliding_ped = pid;
+	bool coll(0);
+
+	ped_mgr.get_ped_grid().query_sphere(pos, 1.2*radius, [&](unsigned ix) { // assume other ped has a similar radius
+		if (ix <= pid) return 0; // each pair is only tested once
+		assert(ix < peds.size());
+		pedestrian_t &ped(peds[ix]);
+		if (!dist_xy_less_than(pos, ped.pos, 0.6f*(radius + ped.radius))) return 0; // no collision
+		if (ped.destroyed) return 0; // dead
+		ped.collided = ped.ped_coll = 1; ped.colliding_ped = pid;
+		coll = 1;
 		return 1; // Note: could omit this return and continue processing peds
-	} // for i
-	return 0;
+	});
+	return coll;
 }
 
 bool pedestrian_t::try_place_in_plot(cube_t const &plot_cube, vect_cube_t const &colliders, unsigned plot_id, rand_gen_t &rgen) {
@@ -508,7 +517,7 @@ void pedestrian_t::next_frame(ped_manager_t &ped_mgr, vector<pedestrian_t> &peds
 			go(); // back up or turn so that we don't walk forward into the street? move() should attempt to rotate in place
 		}
 		else {
-			check_ped_ped_coll_stopped(peds, pid); // still need to check for other peds colliding with us; this doesn't always work
+			check_ped_ped_coll_stopped(ped_mgr, peds, pid); // still need to check for other peds colliding with us; this doesn't always work
 			collided = ped_coll = 0;
 			return;
 		}
@@ -675,6 +684,8 @@ void ped_manager_t::init(unsigned num_city, unsigned num_building) {
 	} // for i
 	cout << "City Pedestrians: " << peds.size() << ", Building Residents: " << peds_b.size() << endl; // testing
 	sort_by_city_and_plot();
+	build_ped_grid();
+	if (city_params.benchmark_peds) {run_ped_grid_benchmark();}
 }
 
 void ped_manager_t::assign_ped_model(pedestrian_t &ped) { // Note: non-const, modifies rgen
@@ -724,73 +735,132 @@ void ped_manager_t::sort_by_city_and_plot() {
 	need_to_sort_peds = 0; // peds are now sorted
 }
 
-bool ped_manager_t::proc_sphere_coll(point &pos, float radius, vector3d *cnorm) const { // Note: no p_last; for potential use with ped/ped collisions
-	float const rsum(get_ped_radius() + radius);
+void ped_grid_t::build(vector<pedestrian_t> const &peds, float cell_size, float margin_) {
+	clear();
+	if (peds.empty()) return;
+	assert(cell_size > 0.0);
+	margin = margin_;
+	bcube.set_from_point(peds.front().pos);
+	for (auto i = peds.begin()+1; i != peds.end(); ++i) {bcube.union_with_pt(i->pos);}
+	unsigned const max_cells(max(1024U, 4U*(unsigned)peds.size())); // limit memory usage when peds are spread out, such as in multiple cities
+	float const area(max(bcube.dx(), cell_size)*max(bcube.dy(), cell_size));
+	cell_sz     = max(cell_size, sqrt(area/max_cells));
+	inv_cell_sz = 1.0/cell_sz;
+	nx = unsigned(bcube.dx()*inv_cell_sz) + 1;
+	ny = unsigned(bcube.dy()*inv_cell_sz) + 1;
+	ped_cell.resize(peds.size());
+	cell_start.resize(nx*ny+1, 0); // already cleared
+	ped_ixs.resize(peds.size());
+#pragma omp parallel for schedule(static,1024)
+	for (int i = 0; i < (int)peds.size(); ++i) {ped_cell[i] = get_cell_y(peds[i].pos.y)*nx + get_cell_x(peds[i].pos.x);}
+	for (auto c = ped_cell.begin(); c != ped_cell.end(); ++c) {++cell_start[*c+1];} // counting sort
+	for (unsigned c = 0; c < nx*ny; ++c) {cell_start[c+1] += cell_start[c];}
+	cell_pos.assign(cell_start.begin(), cell_start.end()-1);
+	for (unsigned i = 0; i < peds.size(); ++i) {ped_ixs[cell_pos[ped_cell[i]]++] = i;} // peds within each cell are in increasing index order
+}
 
-	for (unsigned city = 0; city+1 < by_city.size(); ++city) {
-		cube_t const city_bcube(get_expanded_city_bcube_for_peds(city));
-		if (pos.z > city_bcube.z2() + rsum) continue; // above the peds
-		if (!sphere_cube_intersect_xy(pos, radius, city_bcube)) continue;
+// compares ped-ped collision queries using the grid vs. the per-plot scan over peds sorted by plot, for increasing ped density in a fixed size city
+/*static*/ void ped_manager_t::run_ped_grid_benchmark() {
+	unsigned const NUM_PLOTS_1D = 16;
+	unsigned const counts[5] = {10000, 50000, 100000, 250000, 500000};
+	float const radius(get_ped_radius()), spacing(city_params.road_spacing), city_size(NUM_PLOTS_1D*spacing);
+	float const speed((city_params.ped_speed > 0.0) ? city_params.ped_speed : 0.001*city_params.road_width);
+	if (spacing <= 0.0) return; // no roads
+	ped_grid_t grid;
 
-		for (unsigned plot = by_city[city].plot_ix; plot < by_city[city+1].plot_ix; ++plot) {
-			cube_t const plot_bcube(get_expanded_city_plot_bcube_for_peds(city, plot));
-			if (!sphere_cube_intersect_xy(pos, radius, plot_bcube)) continue;
-			unsigned const ped_start(by_plot[plot]), ped_end(by_plot[plot+1]);
+	for (unsigned n = 0; n < 5; ++n) {
+		rand_gen_t rgen;
+		vector<pedestrian_t> peds(counts[n], pedestrian_t(radius));
+		float max_prox_radius(0.0);
 
-			for (unsigned i = ped_start; i < ped_end; ++i) { // peds iteration
-				assert(i < peds.size());
-				if (!dist_less_than(pos, peds[i].pos, rsum)) continue;
-				if (cnorm) {*cnorm = (pos - peds[i].pos).get_norm();}
-				return 1; // return on first coll
-			}
-		} // for plot
-	} // for city
-	return 0;
+		for (auto i = peds.begin(); i != peds.end(); ++i) {
+			i->pos   = point(rgen.rand_uniform(0.0, city_size), rgen.rand_uniform(0.0, city_size), radius);
+			i->plot  = min(unsigned(i->pos.x/spacing), NUM_PLOTS_1D-1) + NUM_PLOTS_1D*min(unsigned(i->pos.y/spacing), NUM_PLOTS_1D-1);
+			i->speed = speed*rgen.rand_uniform(0.5, 1.0);
+			float const angle(rgen.rand_uniform(0.0, TWO_PI));
+			i->vel   = vector3d(i->speed*cosf(angle), i->speed*sinf(angle), 0.0);
+			max_eq(max_prox_radius, i->get_prox_radius());
+		}
+		sort(peds.begin(), peds.end(), ped_by_plot());
+		vector<pedestrian_t> peds2(peds);
+		unsigned num_coll[2] = {0, 0};
+		int const start_ms(GET_TIME_MS());
+
+		for (unsigned i = 0; i < peds.size(); ++i) { // per-plot scan
+			vector3d force(zero_vector);
+			num_coll[0] += peds[i].check_ped_ped_coll_range(peds, i, i+1, peds[i].plot, peds[i].get_prox_radius(), force);
+		}
+		int const plot_ms(GET_TIME_MS());
+		grid.build(peds2, max_prox_radius, radius);
+		int const build_ms(GET_TIME_MS());
+
+		for (unsigned i = 0; i < peds2.size(); ++i) { // grid
+			vector3d force(zero_vector);
+			float const prox_radius(peds2[i].get_prox_radius());
+			bool coll(0);
+			grid.query_sphere(peds2[i].pos, prox_radius, [&](unsigned ix) {
+				if (ix > i) {coll = peds2[i].check_ped_ped_coll_pair(peds2[ix], i, ix, prox_radius, force);}
+				return coll;
+			});
+			num_coll[1] += coll;
+		}
+		int const grid_ms(GET_TIME_MS());
+		cout << "Ped grid benchmark: " << counts[n] << " peds: plot scan " << (plot_ms - start_ms) << "ms (" << num_coll[0] << " colls), grid build "
+			 << (build_ms - plot_ms) << "ms, grid query " << (grid_ms - build_ms) << "ms (" << num_coll[1] << " colls)" << endl;
+	} // for n
 }
 
-bool ped_manager_t::line_intersect_peds(point const &p1, point const &p2, float &t) const {
+bool ped_manager_t::proc_sphere_coll(point &pos, float radius, vector3d *cnorm) const { // Note: no p_last; for potential use with ped/ped collisions
+	float const rsum(get_ped_radius() + radius);
 	bool ret(0);
 
-	for (unsigned city = 0; city+1 < by_city.size(); ++city) {
-		if (!get_expanded_city_bcube_for_peds(city).line_intersects(p1, p2)) continue;
+	ped_grid.query_sphere(pos, rsum, [&](unsigned i) {
+		assert(i < peds.size());
+		if (!dist_less_than(pos, peds[i].pos, rsum)) return 0;
+		if (cnorm) {*cnorm = (pos - peds[i].pos).get_norm();}
+		ret = 1;
+		return 1; // return on first coll
+	});
+	return ret;
+}
 
-		for (unsigned plot = by_city[city].plot_ix; plot < by_city[city+1].plot_ix; ++plot) {
-			if (!get_expanded_city_plot_bcube_for_peds(city, plot).line_intersects(p1, p2)) continue;
-			unsigned const ped_start(by_plot[plot]), ped_end(by_plot[plot+1]);
+bool ped_manager_t::line_intersect_peds(point const &p1, point const &p2, float &t) const {
+	bool ret(0);
 
-			for (unsigned i = ped_start; i < ped_end; ++i) { // peds iteration
-				assert(i < peds.size());
-				float tmin(0.0);
-				if (line_sphere_int_closest_pt_t(p1, p2, peds[i].pos, peds[i].radius, tmin) && tmin < t) {t = tmin; ret = 1;}
-			}
-		} // for plot
-	} // for city
+	ped_grid.query_line(p1, p2, 0.0, [&](unsigned i) { // Note: grid margin includes ped radius
+		assert(i < peds.size());
+		float tmin(0.0);
+		if (line_sphere_int_closest_pt_t(p1, p2, peds[i].pos, peds[i].radius, tmin) && tmin < t) {t = tmin; ret = 1;}
+		return 0;
+	});
 	return ret;
 }
 
 void ped_manager_t::destroy_peds_in_radius(point const &pos_in, float radius) {
 	point const pos(pos_in - get_camera_coord_space_xlate());
-	bool const is_pt(radius == 0.0);
 	float const rsum(get_ped_radius() + radius);
 
-	for (unsigned city = 0; city+1 < by_city.size(); ++city) {
-		cube_t const city_bcube(get_expanded_city_bcube_for_peds(city));
-		if (pos.z > city_bcube.z2() + rsum) continue; // above the peds
-		if (is_pt ? !city_bcube.contains_pt_xy(pos) : !sphere_cube_intersect_xy(pos, radius, city_bcube)) continue;
+	ped_grid.query_sphere(pos, rsum, [&](unsigned i) {
+		assert(i < peds.size());
+		if (!dist_less_than(pos, peds[i].pos, rsum)) return 0;
+		peds[i].destroy();
+		ped_destroyed = 1;
+		return 0;
+	});
+}
 
-		for (unsigned plot = by_city[city].plot_ix; plot < by_city[city+1].plot_ix; ++plot) {
-			cube_t const plot_bcube(get_expanded_city_plot_bcube_for_peds(city, plot));
-			if (is_pt ? !plot_bcube.contains_pt_xy(pos) : !sphere_cube_intersect_xy(pos, radius, plot_bcube)) continue;
-			unsigned const ped_start(by_plot[plot]), ped_end(by_plot[plot+1]);
+void ped_manager_t::build_ped_grid() {
+	//timer_t timer("Build Ped Grid");
+	float max_prox_radius(0.0), max_speed(0.0), max_radius(0.0);
 
-			for (unsigned i = ped_start; i < ped_end; ++i) { // peds iteration
-				assert(i < peds.size());
-				if (!dist_less_than(pos, peds[i].pos, rsum)) continue;
-				peds[i].destroy();
-				ped_destroyed = 1;
-			}
-		} // for plot
-	} // for city
+	for (auto i = peds.begin(); i != peds.end(); ++i) {
+		max_eq(max_prox_radius, i->get_prox_radius());
+		max_eq(max_speed,  i->speed);
+		max_eq(max_radius, i->radius);
+	}
+	// include the largest ped radius, and allow for peds to move for 4 frames at the current frame rate (possibly crossing the road) before the grid is rebuilt
+	float const margin(max_radius + 4.0*CROSS_SPEED_MULT*max(fticks, 1.0f)*max_speed);
+	ped_grid.build(peds, max_prox_radius, margin);
 }
 
 void ped_manager_t::remove_destroyed_peds() {
@@ -826,26 +896,21 @@ void ped_manager_t::next_frame() {
 		}
 		for (auto i = peds.begin(); i != peds.end(); ++i) {i->next_frame(*this, peds, (i - peds.begin()), rgen, delta_dir);}
 		if (need_to_sort_peds) {sort_by_city_and_plot();}
+		build_ped_grid(); // peds have moved, and may have been reordered
 		first_frame = 0;
 	}
 	if (!peds_b.empty()) {update_building_ai_state(peds_b, delta_dir);} // update people in buildings
 }
 
 pedestrian_t const *ped_manager_t::get_ped_at(point const &p1, point const &p2) const { // Note: p1/p2 in local TT space
-	for (unsigned city = 0; city+1 < by_city.size(); ++city) {
-		if (!get_expanded_city_bcube_for_peds(city).line_intersects(p1, p2)) continue; // skip
+	pedestrian_t const *ret(nullptr); // no ped found
 
-		for (unsigned plot = by_city[city].plot_ix; plot < by_city[city+1].plot_ix; ++plot) {
-			if (!get_expanded_city_plot_bcube_for_peds(city, plot).line_intersects(p1, p2)) continue; // skip
-			unsigned const ped_start(by_plot[plot]), ped_end(by_plot[plot+1]);
-
-			for (unsigned i = ped_start; i < ped_end; ++i) { // peds iteration
-				assert(i < peds.size());
-				if (line_sphere_intersect(p1, p2, peds[i].pos, peds[i].radius)) {return &peds[i];}
-			}
-		} // for plot
-	} // for city
-	return nullptr; // no ped found
+	ped_grid.query_line(p1, p2, 0.0, [&](unsigned i) { // Note: grid margin includes ped radius
+		assert(i < peds.size());
+		if (line_sphere_intersect(p1, p2, peds[i].pos, peds[i].radius)) {ret = &peds[i];}
+		return (ret != nullptr);
+	});
+	return ret;
 }
 
 void ped_manager_t::get_peds_crossing_roads(ped_city_vect_t &pcv) const {
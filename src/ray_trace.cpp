@@ -6,8 +6,10 @@
 #include "mesh.h"
 #include "model3d.h"
 #include "binary_file_io.h"
+#include "profiler.h"
 #include <atomic>
 #include <thread>
+#include <mutex>
 
 
 bool const COLOR_FROM_COBJ_TEX = 0; // 0 = fast/average color, 1 = true color
@@ -20,13 +22,16 @@ float const ICE_ALBEDO    = 0.8;
 
 bool keep_beams(0); // debugging mode
 bool kill_raytrace(0);
-bool no_stat_moving(0); // generally not thread safe for dynamic lighting update, since BVH is rebuilt per-frame; also, wrong to cache lighting for moving cobjs
+bool benchmark_packet_rays(0);
+bool lighting_work_stealing(0); // split offline sky/global/local lighting into small ray batches that are load balanced across threads
+bool no_stat_moving(0); // generally not thread safe for dynamic lighting update, since BVH is rebuilt per-frame (uses a snapshot with cobj_bvh_refit); also, wrong to cache lighting for moving cobjs
 unsigned NPTS(50000), NRAYS(40000), LOCAL_RAYS(1000000), GLOBAL_RAYS(1000000), DYNAMIC_RAYS(1000000), NUM_THREADS(1), MAX_RAY_BOUNCES(20);
+unsigned packet_light_rays(0); // 0=disabled, else number of coherent primary rays (up to 16) to trace through the BVH together for sky and global lighting
 std::atomic<unsigned long long> tot_rays(0), num_hits(0), cells_touched(0);
 unsigned const NUM_RAY_SPLITS [NUM_LIGHTING_TYPES] = {1, 1, 1, 1, 1}; // sky, global, local, cobj_accum, dynamic
 unsigned const INIT_RAY_SPLITS[NUM_LIGHTING_TYPES] = {1, 4, 1, 1, 1}; // sky, global, local, cobj_accum, dynamic
 
-extern bool has_snow, combined_gu, global_lighting_update, lighting_update_offline, store_cobj_accum_lighting_as_blocked;
+extern bool has_snow, combined_gu, global_lighting_update, lighting_update_offline, store_cobj_accum_lighting_as_blocked, chunked_lighting_files;
 extern int read_light_files[], write_light_files[], display_mode, DISABLE_WATER;
 extern float water_plane_z, temperature, snow_depth, ray_step_size_mult, first_ray_weight[];
 extern char *lighting_file[];
@@ -258,8 +263,9 @@ unsigned add_path_to_lmcs(lmap_manager_t *lmgr, cube_t *bcube, point p1, point c
 }
 
 
-void cast_light_ray(lmap_manager_t *lmgr, point p1, point p2, float weight, float weight0, colorRGBA color, float line_length,
-	int ignore_cobj, int ltype, unsigned depth, rand_gen_t &rgen, cobj_ray_accum_map_t *accum_map, cube_t *bcube=nullptr)
+// if precomp is non-null, the cobj intersection for this (depth 0) ray was already computed with a packet query at index precomp_ix
+void cast_light_ray(lmap_manager_t *lmgr, point p1, point p2, float weight, float weight0, colorRGBA color, float line_length, int ignore_cobj, int ltype,
+	unsigned depth, rand_gen_t &rgen, cobj_ray_accum_map_t *accum_map, cube_t *bcube=nullptr, line_query_packet_t const *precomp=nullptr, unsigned precomp_ix=0)
 {
 	if (depth > MAX_RAY_BOUNCES) return;
 	if (ltype == LIGHTING_DYNAMIC && depth > 4) return; // use a sensible default since this is running during rendering
@@ -276,7 +282,14 @@ void cast_light_ray(lmap_manager_t *lmgr, point p1, point p2, float weight, floa
 	float t(0.0), zval(0.0);
 	bool snow_coll(0), ice_coll(0), water_coll(0), mesh_coll(0);
 	vector3d const dir((p2 - p1).get_norm());
-	bool coll(check_coll_line_exact(p1, p2, cpos, cnorm, cindex, 0.0, ignore_cobj, 1, 0, 1, 1, (p1 == orig_p1), no_stat_moving)); // fast=1, exclude voxels, maybe skip init colls
+	bool coll(0);
+
+	if (precomp) {
+		assert(precomp_ix < precomp->num && precomp->p1[precomp_ix] == p1 && precomp->p2[precomp_ix] == p2);
+		coll = precomp->coll[precomp_ix];
+		if (coll) {cpos = precomp->cpos[precomp_ix]; cnorm = precomp->cnorm[precomp_ix]; cindex = precomp->cindex[precomp_ix];}
+	}
+	else {coll = check_coll_line_exact(p1, p2, cpos, cnorm, cindex, 0.0, ignore_cobj, 1, 0, 1, 1, (p1 == orig_p1), no_stat_moving);} // fast=1, exclude voxels, maybe skip init colls
 	assert(coll ? (cindex >= 0 && cindex < (int)coll_objects.size()) : (cindex == -1));
 
 	// find the intersection point with the model3ds
@@ -494,6 +507,62 @@ void cast_light_ray(lmap_manager_t *lmgr, point p1, point p2, float weight, floa
 }
 
 
+// accumulates coherent primary rays that share a weight and color, and traces them with a single packet BVH query
+class light_ray_packet_t {
+
+	lmap_manager_t *lmgr;
+	colorRGBA color;
+	float weight, line_length;
+	int ltype;
+	unsigned max_rays, num;
+	cobj_ray_accum_map_t *accum_map;
+	point starts[line_query_packet_t::MAX_RAYS], ends[line_query_packet_t::MAX_RAYS];
+	line_query_packet_t lqp;
+
+public:
+	light_ray_packet_t(lmap_manager_t *lmgr_, colorRGBA const &color_, float weight_, float line_length_, int ltype_, cobj_ray_accum_map_t *accum_map_) :
+		lmgr(lmgr_), color(color_), weight(weight_), line_length(line_length_), ltype(ltype_),
+		max_rays(min(packet_light_rays, line_query_packet_t::MAX_RAYS)), num(0), accum_map(accum_map_) {assert(max_rays > 0);}
+	~light_ray_packet_t() {assert(num == 0);} // must be flushed by the caller
+
+	void add_ray(point const &p1, point const &p2, rand_gen_t &rgen) {
+		starts[num] = p1;
+		ends  [num] = p2;
+		if (++num == max_rays) {flush(rgen);}
+	}
+	void flush(rand_gen_t &rgen) {
+		if (num == 0) return;
+		unsigned lqp_ix[line_query_packet_t::MAX_RAYS];
+		lqp.clear();
+
+		for (unsigned r = 0; r < num; ++r) { // same clipping as cast_light_ray(); rays that are clipped away don't need a query
+			point p1(starts[r]), p2(ends[r]);
+			lqp_ix[r] = line_query_packet_t::MAX_RAYS; // invalid
+
+			if (do_line_clip_scene(p1, p2, min(zbottom, czmin), max(ztop, czmax)) && !((display_mode & 0x01) && is_under_mesh(p1))) {
+				lqp_ix[r] = lqp.num;
+				lqp.add(p1, p2, -1, (p1 == starts[r]));
+			}
+		}
+		if (!lqp.empty() && world_mode == WMODE_GROUND) {check_coll_line_exact_tree_packet(lqp, 0, 0, 1, 0, no_stat_moving);} // same flags as check_coll_line_exact() in cast_light_ray()
+
+		for (unsigned r = 0; r < num; ++r) {
+			bool const has_query(lqp_ix[r] < line_query_packet_t::MAX_RAYS);
+			cast_light_ray(lmgr, starts[r], ends[r], weight, weight, color, line_length, -1, ltype, 0, rgen, accum_map, nullptr, (has_query ? &lqp : nullptr), lqp_ix[r]);
+		}
+		num = 0;
+	}
+};
+
+// sort by binned x, then by y, so that consecutive directions are close to each other, which is better for packet traversal than a lexical sort
+bool packet_dir_less(vector3d const &a, vector3d const &b) {
+	int const xa(int(32.0*(a.x + 1.0))), xb(int(32.0*(b.x + 1.0)));
+	if (xa != xb) return (xa < xb);
+	if ((a.z < 0.0) != (b.z < 0.0)) return (a.z < 0.0);
+	return ((xa & 1) ? (a.y > b.y) : (a.y < b.y)); // serpentine order
+}
+
+
 struct rt_data {
 	unsigned ix, num, job_id, checksum;
 	int rseed, ltype;
@@ -553,6 +622,105 @@ public:
 thread_manager_t<rt_data> thread_manager;
 lmap_manager_t thread_temp_lmap;
 
+
+struct rt_task_t { // a small batch of rays from a single light source
+	unsigned src_ix, sub_ix, num; // meaning of src_ix/sub_ix depends on ltype; num is the number of rays or sky points
+	rt_task_t(unsigned s=0, unsigned ss=0, unsigned n=0) : src_ix(s), sub_ix(ss), num(n) {}
+};
+
+// work-stealing task pool: each thread owns a deque of tasks and takes from the front; when empty, it steals from the back of another thread's deque;
+// each task has its own random number stream seeded from its task index, so results don't depend on which thread runs which task
+class rt_task_pool_t {
+
+	struct thread_queue_t {
+		std::mutex mutex;
+		deque<unsigned> tasks; // indices into the tasks vector
+		unsigned num_run=0, num_stolen=0;
+		double busy_time=0.0; // in seconds
+	};
+	vector<rt_task_t> tasks;
+	unique_ptr<thread_queue_t[]> queues;
+	unsigned num_queues=0;
+	std::atomic<unsigned> num_done;
+	high_resolution_clock::time_point start_time;
+
+	bool pop_front(thread_queue_t &q, unsigned &task_ix) {
+		std::lock_guard<std::mutex> lock(q.mutex);
+		if (q.tasks.empty()) return 0;
+		task_ix = q.tasks.front();
+		q.tasks.pop_front();
+		return 1;
+	}
+	bool pop_back(thread_queue_t &q, unsigned &task_ix) {
+		std::lock_guard<std::mutex> lock(q.mutex);
+		if (q.tasks.empty()) return 0;
+		task_ix = q.tasks.back();
+		q.tasks.pop_back();
+		return 1;
+	}
+public:
+	rt_task_pool_t() : num_done(0) {}
+	bool empty() const {return tasks.empty();}
+	unsigned size() const {return tasks.size();}
+	unsigned get_num_done() const {return num_done;}
+	rt_task_t const &get_task(unsigned task_ix) const {assert(task_ix < tasks.size()); return tasks[task_ix];}
+
+	void clear() {
+		tasks.clear();
+		queues.reset();
+		num_queues = 0;
+	}
+	void add_tasks(unsigned src_ix, unsigned sub_ix, unsigned num, unsigned max_per_task) { // split num rays/points into batches
+		assert(max_per_task > 0);
+		for (unsigned n = 0; n < num; n += max_per_task) {tasks.emplace_back(src_ix, sub_ix, min(max_per_task, num-n));}
+	}
+	void start(unsigned num_threads) {
+		assert(num_threads > 0);
+		queues.reset(new thread_queue_t[num_threads]);
+		num_queues = num_threads;
+		num_done   = 0;
+		// assign contiguous ranges of tasks to each thread for locality; stealing will rebalance them
+		for (unsigned t = 0; t < num_threads; ++t) {
+			unsigned const start_ix(t*tasks.size()/num_threads), end_ix((t+1)*tasks.size()/num_threads);
+			for (unsigned i = start_ix; i < end_ix; ++i) {queues[t].tasks.push_back(i);}
+		}
+		start_time = high_resolution_clock::now();
+	}
+	bool get_next_task(unsigned thread_ix, unsigned &task_ix) {
+		assert(thread_ix < num_queues);
+		if (pop_front(queues[thread_ix], task_ix)) return 1;
+
+		for (unsigned n = 1; n < num_queues; ++n) { // our queue is empty; try to steal from the other threads in round robin order
+			if (!pop_back(queues[(thread_ix + n) % num_queues], task_ix)) continue;
+			++queues[thread_ix].num_stolen;
+			return 1;
+		}
+		return 0; // all queues are empty
+	}
+	void end_task(unsigned thread_ix, high_resolution_clock::time_point const &task_start) {
+		assert(thread_ix < num_queues);
+		thread_queue_t &q(queues[thread_ix]);
+		q.busy_time += duration_cast<duration<double>>(high_resolution_clock::now() - task_start).count();
+		++q.num_run;
+		++num_done;
+	}
+	void print_stats() const {
+		double const elapsed(duration_cast<duration<double>>(high_resolution_clock::now() - start_time).count());
+		cout << "Lighting task pool: " << tasks.size() << " tasks on " << num_queues << " threads in " << elapsed << "s" << endl;
+		if (elapsed <= 0.0) return;
+		double tot_busy(0.0);
+
+		for (unsigned t = 0; t < num_queues; ++t) {
+			thread_queue_t const &q(queues[t]);
+			cout << "thread " << t << ": tasks: " << q.num_run << ", stolen: " << q.num_stolen << ", busy: " << q.busy_time << "s, utilization: " << 100.0*q.busy_time/elapsed << "%" << endl;
+			tot_busy += q.busy_time;
+		}
+		cout << "average utilization: " << 100.0*tot_busy/(num_queues*elapsed) << "%" << endl;
+	}
+};
+
+rt_task_pool_t rt_task_pool;
+
 bool indir_lighting_updated() {return (global_lighting_update && (lmap_manager.was_updated || thread_temp_lmap.was_updated));} // only for global updates
 
 
@@ -641,11 +809,12 @@ bool cube_light_src_vect::ray_intersects_any(point const &start_pt, point const
 
 
 void trace_one_global_ray(lmap_manager_t *lmgr, point const &pos, point const &pt, colorRGBA const &color, float ray_wt,
-	int ltype, bool is_scene_cube, rand_gen_t &rgen, cobj_ray_accum_map_t *accum_map, float line_length)
+	int ltype, bool is_scene_cube, rand_gen_t &rgen, cobj_ray_accum_map_t *accum_map, float line_length, light_ray_packet_t *packet)
 {
 	point const end_pt(pt + (pt - pos).get_norm()*line_length);
 	if (is_scene_cube && global_cube_lights.ray_intersects_any(pt, end_pt)) return; // don't double count
-	cast_light_ray(lmgr, pos, end_pt, ray_wt, ray_wt, color, line_length, -1, ltype, 0, rgen, accum_map);
+	if (packet) {packet->add_ray(pos, end_pt, rgen);}
+	else {cast_light_ray(lmgr, pos, end_pt, ray_wt, ray_wt, color, line_length, -1, ltype, 0, rgen, accum_map);}
 }
 
 
@@ -655,6 +824,8 @@ void trace_ray_block_global_cube(lmap_manager_t *lmgr, cube_t const &bnds, point
 	float const line_length(2.0*get_scene_radius());
 	vector3d const ldir((bnds.get_cube_center() - pos).get_norm());
 	float proj_area[3] = {0}, tot_area(0.0);
+	unique_ptr<light_ray_packet_t> packet; // only used with stratified rays, since randomized rays aren't spatially coherent
+	if (packet_light_rays > 0 && !randomized) {packet.reset(new light_ray_packet_t(lmgr, color, ray_wt, line_length, ltype, accum_map));}
 
 	for (unsigned i = 0; i < 3; ++i) { // adjust the number or weight of rays based on sun/moon position, or simply modify color scale?
 		if (disabled_edges & EFLAGS[i][ldir[i] < 0.0]) continue; // should this be here, or should we just skip them later?
@@ -680,7 +851,7 @@ void trace_ray_block_global_cube(lmap_manager_t *lmgr, cube_t const &bnds, point
 				if (verbose && ((s%1000) == 0)) {increment_printed_number(s/1000);}
 				pt[d0] = rgen.rand_uniform(bnds.d[d0][0], bnds.d[d0][1]);
 				pt[d1] = rgen.rand_uniform(bnds.d[d1][0], bnds.d[d1][1]);
-				trace_one_global_ray(lmgr, pos, pt, color, ray_wt, ltype, is_scene_cube, rgen, accum_map, line_length);
+				trace_one_global_ray(lmgr, pos, pt, color, ray_wt, ltype, is_scene_cube, rgen, accum_map, line_length, nullptr);
 			}
 		}
 		else {
@@ -697,8 +868,9 @@ void trace_ray_block_global_cube(lmap_manager_t *lmgr, cube_t const &bnds, point
 					if (kill_raytrace) break;
 					if (verbose && ((num%1000) == 0)) increment_printed_number(num/1000);
 					pt[d1] = bnds.d[d1][0] + (s1 + rgen.rand_uniform(0.0, 1.0))*len1/n1;
-					trace_one_global_ray(lmgr, pos, pt, color, ray_wt, ltype, is_scene_cube, rgen, accum_map, line_length);
+					trace_one_global_ray(lmgr, pos, pt, color, ray_wt, ltype, is_scene_cube, rgen, accum_map, line_length, packet.get());
 				}
+				if (packet) {packet->flush(rgen);} // flush at the end of each row
 			}
 		}
 		if (verbose) {cout << endl;}
@@ -736,81 +908,101 @@ void trace_ray_block_global_light(rt_data *data, point const &pos, colorRGBA con
 }
 
 
+bool get_global_light(unsigned light_ix, point &pos, float &weight) { // light_ix: 0=sun, 1=moon
+
+	float const lfn(CLIP_TO_01(1.0f - 5.0f*(light_factor - 0.4f)));
+	if (light_ix == 0) {pos = sun_pos;  weight = ((light_factor >= 0.4 && !combined_gu) ? 1.0-lfn : 0.0);}
+	else               {pos = moon_pos; weight = ((light_factor <= 0.6) ? lfn : 0.0);}
+	return (pos.z >= 0.0 && weight != 0.0); // skip if below the horizon or zero weight
+}
+
 void trace_ray_block_global(rt_data *data) {
 
 	if (GLOBAL_RAYS == 0 && global_cube_lights.empty()) return; // nothing to do
 	// Note: The light color here is white because it will be multiplied by the ambient color later,
 	//       and the moon color is generally similar to the sun color so they can be approximated as equal
-	float const lfn(CLIP_TO_01(1.0f - 5.0f*(light_factor - 0.4f)));
-	if (light_factor >= 0.4 && !combined_gu) trace_ray_block_global_light(data, sun_pos,  WHITE, 1.0-lfn);
-	if (light_factor <= 0.6) trace_ray_block_global_light(data, moon_pos, WHITE, lfn);
+	for (unsigned l = 0; l < 2; ++l) { // sun, moon
+		point pos;
+		float weight(0.0);
+		if (get_global_light(l, pos, weight)) {trace_ray_block_global_light(data, pos, WHITE, weight);}
+	}
 }
 
 
 float get_sky_light_ray_weight() {return RAY_WEIGHT/(((float)NPTS)*NRAYS);}
 
-void trace_ray_block_sky(rt_data *data) {
+void trace_sky_light_points(rt_data *data, unsigned num_pts, rand_gen_t &rgen, unsigned long long &start_rays) {
 
-	assert(data);
-	rand_gen_t rgen;
-	data->pre_run(rgen);
-	float const scene_radius(get_scene_radius()), line_length(2.0*scene_radius);
-	unsigned long long start_rays(0), cube_start_rays(0);
+	float const scene_radius(get_scene_radius()), line_length(2.0*scene_radius), ray_wt(get_sky_light_ray_weight());
+	vector<point> pts(num_pts);
+	vector<vector3d> dirs(NRAYS);
+	unique_ptr<light_ray_packet_t> packet;
+	if (packet_light_rays > 0) {packet.reset(new light_ray_packet_t(data->lmgr, WHITE, ray_wt, line_length, LIGHTING_SKY, &data->accum_map));}
 
-	if (NPTS > 0 && NRAYS > 0) {
-		float const ray_wt(get_sky_light_ray_weight());
-		unsigned const block_npts(max(1U, NPTS/data->num));
-		vector<point> pts(block_npts);
-		vector<vector3d> dirs(NRAYS);
+	for (unsigned p = 0; p < num_pts; ++p) {
+		do {
+			pts[p] = rgen.signed_rand_vector_spherical(1.0).get_norm()*scene_radius; // start the ray here
+		} while (pts[p].z < zbottom); // force above zbottom
+	}
+	sort(pts.begin(), pts.end());
+	if (data->verbose) {cout << "Sky light source progress (of " << num_pts << "): 0";}
 
-		for (unsigned p = 0; p < block_npts; ++p) {
-			do {
-				pts[p] = rgen.signed_rand_vector_spherical(1.0).get_norm()*scene_radius; // start the ray here
-			} while (pts[p].z < zbottom); // force above zbottom
+	for (unsigned p = 0; p < num_pts; ++p) {
+		if (kill_raytrace) break;
+		if (data->verbose) {increment_printed_number(p);}
+		point const &pt(pts[p]);
+
+		for (unsigned r = 0; r < NRAYS; ++r) {
+			point const target_pt(X_SCENE_SIZE*rgen.signed_rand_float(), Y_SCENE_SIZE*rgen.signed_rand_float(), rgen.rand_uniform(czmin, czmax));
+			dirs[r] = (target_pt - pt).get_norm();
+			//dirs[r].z = -fabs(dirs[r].z); // pointing down
 		}
-		sort(pts.begin(), pts.end());
-		if (data->verbose) {cout << "Sky light source progress (of " << block_npts << "): 0";}
+		if (packet) {sort(dirs.begin(), dirs.end(), packet_dir_less);} else {sort(dirs.begin(), dirs.end());}
 
-		for (unsigned p = 0; p < block_npts; ++p) {
+		for (unsigned r = 0; r < NRAYS; ++r) {
 			if (kill_raytrace) break;
-			if (data->verbose) {increment_printed_number(p);}
-			point const &pt(pts[p]);
+			if (dot_product(dirs[r], pt) >= 0.0) continue; // can get here when (-Z_SCENE_SIZE, Z_SCENE_SIZE) does not contain (czmin, czmax)
+			point const end_pt(pt + dirs[r]*line_length);
+			if (sky_cube_lights.ray_intersects_any(pt, end_pt)) continue; // don't double count
+			if (packet) {packet->add_ray(pt, end_pt, rgen);}
+			else {cast_light_ray(data->lmgr, pt, end_pt, ray_wt, ray_wt, WHITE, line_length, -1, LIGHTING_SKY, 0, rgen, &data->accum_map);}
+			++start_rays;
+		}
+		if (packet) {packet->flush(rgen);}
+	}
+	if (data->verbose) {cout << endl;}
+}
 
-			for (unsigned r = 0; r < NRAYS; ++r) {
-				point const target_pt(X_SCENE_SIZE*rgen.signed_rand_float(), Y_SCENE_SIZE*rgen.signed_rand_float(), rgen.rand_uniform(czmin, czmax));
-				dirs[r] = (target_pt - pt).get_norm();
-				//dirs[r].z = -fabs(dirs[r].z); // pointing down
-			}
-			sort(dirs.begin(), dirs.end());
+void trace_sky_cube_light(rt_data *data, cube_light_src const &cl, unsigned num_rays, rand_gen_t &rgen) {
 
-			for (unsigned r = 0; r < NRAYS; ++r) {
-				if (kill_raytrace) break;
-				if (dot_product(dirs[r], pt) >= 0.0) continue; // can get here when (-Z_SCENE_SIZE, Z_SCENE_SIZE) does not contain (czmin, czmax)
-				point const end_pt(pt + dirs[r]*line_length);
-				if (sky_cube_lights.ray_intersects_any(pt, end_pt)) continue; // don't double count
-				cast_light_ray(data->lmgr, pt, end_pt, ray_wt, ray_wt, WHITE, line_length, -1, LIGHTING_SKY, 0, rgen, &data->accum_map);
-				++start_rays;
-			}
-		}
-		if (data->verbose) {cout << endl;}
+	float const line_length(2.0*get_scene_radius()), cube_weight(RAY_WEIGHT*cl.intensity/cl.num_rays);
+
+	for (unsigned p = 0; p < num_rays; ++p) {
+		if (kill_raytrace) break;
+		if (data->verbose && ((p%1000) == 0)) {increment_printed_number(p/1000);}
+		point const pt(rgen.gen_rand_cube_point(cl.bounds));
+		vector3d dir(rgen.signed_rand_vector_spherical().get_norm()); // need high quality distribution
+		dir.z = -fabs(dir.z); // make sure z is negative since this is supposed to be light from the sky
+		point const end_pt(pt + dir*line_length);
+		cast_light_ray(data->lmgr, pt, end_pt, cube_weight, cube_weight, cl.color, line_length, -1, LIGHTING_SKY, 0, rgen, &data->accum_map);
 	}
+}
+
+void trace_ray_block_sky(rt_data *data) {
+
+	assert(data);
+	rand_gen_t rgen;
+	data->pre_run(rgen);
+	unsigned long long start_rays(0), cube_start_rays(0);
+	if (NPTS > 0 && NRAYS > 0) {trace_sky_light_points(data, max(1U, NPTS/data->num), rgen, start_rays);}
+
 	for (cube_light_src_vect::const_iterator i = sky_cube_lights.begin(); i != sky_cube_lights.end(); ++i) {
 		if (kill_raytrace) break;
 		if (data->num == 0 || i->num_rays == 0) continue; // disabled
 		unsigned const num_rays(i->num_rays/data->num);
-		float const cube_weight(RAY_WEIGHT*i->intensity/i->num_rays);
 		if (data->verbose) {cout << "Cube volume light source " << (i - sky_cube_lights.begin()) << " of " << sky_cube_lights.size() << ", progress (of " << 1+num_rays/1000 << "): 0";}
 		cube_start_rays += num_rays;
-
-		for (unsigned p = 0; p < num_rays; ++p) {
-			if (kill_raytrace) break;
-			if (data->verbose && ((p%1000) == 0)) {increment_printed_number(p/1000);}
-			point const pt(rgen.gen_rand_cube_point(i->bounds));
-			vector3d dir(rgen.signed_rand_vector_spherical().get_norm()); // need high quality distribution
-			dir.z = -fabs(dir.z); // make sure z is negative since this is supposed to be light from the sky
-			point const end_pt(pt + dir*line_length);
-			cast_light_ray(data->lmgr, pt, end_pt, cube_weight, cube_weight, i->color, line_length, -1, LIGHTING_SKY, 0, rgen, &data->accum_map);
-		}
+		trace_sky_cube_light(data, *i, num_rays, rgen);
 		if (data->verbose) {cout << endl;}
 	}
 	if (data->verbose) {
@@ -1040,16 +1232,211 @@ void trace_ray_block_dynamic(rt_data *data) {
 }
 
 
+void run_rt_task(rt_data *data, rt_task_t const &task, rand_gen_t &rgen) {
+
+	float const line_length(2.0*get_scene_radius());
+
+	switch (data->ltype) {
+	case LIGHTING_SKY: // src_ix is unused; sub_ix: 0 = sky sphere points, 1+ = sky cube light index+1
+		if (task.sub_ix == 0) {
+			unsigned long long start_rays(0);
+			trace_sky_light_points(data, task.num, rgen, start_rays);
+		}
+		else {
+			assert(task.sub_ix <= sky_cube_lights.size());
+			trace_sky_cube_light(data, sky_cube_lights[task.sub_ix-1], task.num, rgen);
+		}
+		break;
+	case LIGHTING_GLOBAL: { // src_ix: 0 = sun, 1 = moon; sub_ix: 0 = scene bounds, 1+ = global cube light index+1
+		point pos;
+		float weight(0.0);
+		if (!get_global_light(task.src_ix, pos, weight)) break; // light was disabled after the tasks were created?
+
+		if (task.sub_ix == 0) {
+			float const ray_wt(RAY_WEIGHT*weight/GLOBAL_RAYS);
+			trace_ray_block_global_cube(data->lmgr, get_scene_bounds(), pos, WHITE, ray_wt, task.num, LIGHTING_GLOBAL, 0, 1, 0, data->randomized, rgen, &data->accum_map);
+		}
+		else {
+			assert(task.sub_ix <= global_cube_lights.size());
+			cube_light_src const &cl(global_cube_lights[task.sub_ix-1]);
+			float const cube_weight(RAY_WEIGHT*weight*cl.intensity/cl.num_rays);
+			trace_ray_block_global_cube(data->lmgr, cl.bounds, pos, WHITE, cube_weight, task.num, LIGHTING_GLOBAL, cl.disabled_edges, 0, 0, data->randomized, rgen, &data->accum_map);
+		}
+		break;
+	}
+	case LIGHTING_LOCAL: { // src_ix = light source index
+		assert(task.src_ix < light_sources_a.size());
+		light_source const &ls(light_sources_a[task.src_ix]);
+		unsigned const light_nrays(ls.get_num_rays()), NRAYS(light_nrays ? light_nrays : LOCAL_RAYS);
+		ray_trace_local_light_source(data->lmgr, ls, line_length, task.num, rgen, data->ltype, NRAYS);
+		break;
+	}
+	default: assert(0); // unsupported ltype
+	}
+}
+
+void set_rt_task_rgen_state(rand_gen_t &rgen, unsigned task_ix) {
+
+	pcg32_random_t pcg_state{(uint64_t)task_ix, 0x2545F4914F6CDD1DULL}; // hash the task index to decorrelate adjacent streams
+	long const s1(1 + pcg32_random_r(&pcg_state) % 2147483562), s2(1 + pcg32_random_r(&pcg_state) % 2147483398);
+	rgen.set_state(s1, s2);
+}
+
+void trace_ray_block_pooled(rt_data *data) {
+
+	assert(data);
+	rand_gen_t rgen;
+	data->pre_run(rgen);
+	bool const verbose(data->verbose);
+	data->verbose = 0; // progress is printed per-pool rather than per-task
+	unsigned const num_tasks(rt_task_pool.size());
+	unsigned task_ix(0), last_pct(0);
+	if (verbose) {cout << "Lighting tasks progress (of " << num_tasks << "): 0%"; cout.flush();}
+
+	while (!kill_raytrace && rt_task_pool.get_next_task(data->ix, task_ix)) {
+		auto const task_start(high_resolution_clock::now());
+		set_rt_task_rgen_state(rgen, task_ix); // per-task random stream, independent of thread assignment
+		run_rt_task(data, rt_task_pool.get_task(task_ix), rgen);
+		rt_task_pool.end_task(data->ix, task_start);
+		if (!verbose) continue;
+		unsigned const pct(10*(100*rt_task_pool.get_num_done()/num_tasks/10)); // round down to 10%
+
+		if (pct > last_pct) {
+			cout << " " << pct << "%";
+			cout.flush();
+			last_pct = pct;
+		}
+	}
+	if (verbose) {cout << endl;}
+	data->verbose = verbose;
+	data->post_run();
+}
+
+bool setup_rt_task_pool(int ltype) { // returns true if ltype is supported
+
+	unsigned const RAYS_PER_TASK = 16384;
+	rt_task_pool.clear();
+
+	switch (ltype) {
+	case LIGHTING_SKY:
+		if (NPTS > 0 && NRAYS > 0) {rt_task_pool.add_tasks(0, 0, NPTS, max(1U, RAYS_PER_TASK/NRAYS));}
+
+		for (unsigned i = 0; i < sky_cube_lights.size(); ++i) {
+			rt_task_pool.add_tasks(0, i+1, sky_cube_lights[i].num_rays, RAYS_PER_TASK);
+		}
+		return 1;
+	case LIGHTING_GLOBAL:
+		for (unsigned l = 0; l < 2; ++l) { // sun, moon
+			point pos;
+			float weight(0.0);
+			if (!get_global_light(l, pos, weight)) continue;
+			rt_task_pool.add_tasks(l, 0, GLOBAL_RAYS, RAYS_PER_TASK);
+
+			for (unsigned i = 0; i < global_cube_lights.size(); ++i) {
+				rt_task_pool.add_tasks(l, i+1, global_cube_lights[i].num_rays, RAYS_PER_TASK);
+			}
+		}
+		return 1;
+	case LIGHTING_LOCAL:
+		for (unsigned i = 0; i < light_sources_a.size(); ++i) {
+			unsigned const light_nrays(light_sources_a[i].get_num_rays());
+			rt_task_pool.add_tasks(i, 0, (light_nrays ? light_nrays : LOCAL_RAYS), RAYS_PER_TASK);
+		}
+		return 1;
+	}
+	return 0;
+}
+
+// blocking job that splits the rays into small batches and distributes them across threads using work stealing;
+// this balances the load when some threads get rays that hit dense geometry and take much longer than others
+void launch_pooled_job(unsigned num_threads, bool verbose, int ltype) {
+
+	kill_current_raytrace_threads();
+	bool const supported(setup_rt_task_pool(ltype));
+	assert(supported);
+	if (rt_task_pool.empty()) return; // nothing to do
+	rt_task_pool.start(num_threads);
+	launch_threaded_job(num_threads, trace_ray_block_pooled, verbose, 1, 0, 0, ltype);
+	if (verbose) {rt_task_pool.print_stats();}
+	rt_task_pool.clear();
+}
+
+
 typedef void (*ray_trace_func)(rt_data *);
 ray_trace_func const rt_funcs[NUM_LIGHTING_TYPES] = {trace_ray_block_sky, trace_ray_block_global, trace_ray_block_local, trace_ray_block_cobj_accum, trace_ray_block_dynamic};
 
 
+// compares rays/sec of packet BVH queries vs. scalar queries for sky light rays, and checks that the results are identical
+void run_packet_ray_benchmark() {
+
+	unsigned const num_pts = 64, rays_per_pt = 4096;
+	float const scene_radius(get_scene_radius()), line_length(2.0*scene_radius);
+	rand_gen_t rgen;
+	vector<pair<point, point>> rays;
+	vector<vector3d> dirs(rays_per_pt);
+	cout << "Generating packet benchmark rays" << endl;
+
+	for (unsigned p = 0; p < num_pts; ++p) { // same ray distribution as sky lighting
+		point pt;
+		do {pt = rgen.signed_rand_vector_spherical(1.0).get_norm()*scene_radius;} while (pt.z < zbottom);
+
+		for (unsigned r = 0; r < rays_per_pt; ++r) {
+			point const target_pt(X_SCENE_SIZE*rgen.signed_rand_float(), Y_SCENE_SIZE*rgen.signed_rand_float(), rgen.rand_uniform(czmin, czmax));
+			dirs[r] = (target_pt - pt).get_norm();
+		}
+		sort(dirs.begin(), dirs.end(), packet_dir_less);
+
+		for (unsigned r = 0; r < rays_per_pt; ++r) {
+			point p1(pt), p2(pt + dirs[r]*line_length);
+			if (do_line_clip_scene(p1, p2, min(zbottom, czmin), max(ztop, czmax))) {rays.emplace_back(p1, p2);}
+		}
+	}
+	if (rays.empty()) return;
+	unsigned const num_rays(rays.size());
+	vector<int> ref_cindex(num_rays, -1);
+	vector<point> ref_cpos(num_rays);
+	unsigned ref_hits(0);
+	auto const scalar_start(high_resolution_clock::now());
+
+	for (unsigned r = 0; r < num_rays; ++r) {
+		vector3d cnorm;
+		ref_cpos[r] = rays[r].second;
+		ref_hits += check_coll_line_exact_tree(rays[r].first, rays[r].second, ref_cpos[r], cnorm, ref_cindex[r], -1, 0, 0, 0, 1, 0, 0, 1);
+	}
+	double const scalar_time(duration_cast<duration<double>>(high_resolution_clock::now() - scalar_start).count());
+	cout << "Scalar: " << num_rays << " rays, " << ref_hits << " hits, " << num_rays/max(scalar_time, 1.0E-6) << " rays/sec" << endl;
+
+	for (unsigned packet_sz = 4; packet_sz <= line_query_packet_t::MAX_RAYS; packet_sz *= 2) {
+		line_query_packet_t lqp;
+		unsigned hits(0), mismatches(0);
+		auto const packet_start(high_resolution_clock::now());
+
+		for (unsigned r = 0; r < num_rays; r += packet_sz) {
+			unsigned const end_r(min(r+packet_sz, num_rays));
+			lqp.clear();
+			for (unsigned i = r; i < end_r; ++i) {lqp.add(rays[i].first, rays[i].second);}
+			hits += check_coll_line_exact_tree_packet(lqp, 0, 0, 1, 0, 1);
+
+			for (unsigned i = r; i < end_r; ++i) {
+				if (lqp.cindex[i-r] != ref_cindex[i] || lqp.cpos[i-r] != ref_cpos[i]) {++mismatches;}
+			}
+		}
+		double const packet_time(duration_cast<duration<double>>(high_resolution_clock::now() - packet_start).count());
+		cout << "Packet size " << packet_sz << ": " << hits << " hits, " << num_rays/max(packet_time, 1.0E-6) << " rays/sec, speedup: "
+			 << scalar_time/max(packet_time, 1.0E-6) << ", mismatches: " << mismatches << endl;
+	}
+}
+
+
 void compute_ray_trace_lighting(unsigned ltype, bool verbose) {
 
 	bool const dynamic(is_ltype_dynamic(ltype));
 	unsigned const c_ltype(clamp_ltype_range(ltype));
 	assert(c_ltype < NUM_LIGHTING_TYPES);
 	const char *fn(lighting_file[c_ltype]);
+	if (benchmark_packet_rays && c_ltype == LIGHTING_SKY) {run_packet_ray_benchmark();}
+
+	bool was_read(0);
 
 	if (!dynamic && read_light_files[c_ltype]) {
 		if (c_ltype == LIGHTING_COBJ_ACCUM) {
@@ -1059,14 +1446,19 @@ void compute_ray_trace_lighting(unsigned ltype, bool verbose) {
 				timer_t t("Cobj Accum Lighting");
 				launch_threaded_job(NUM_THREADS, rt_funcs[c_ltype], verbose, 1, 0, 0, ltype); // update fully blocked lighting with currently blocked portion
 			}
+			was_read = 1;
+		}
+		else {
+			was_read = lmap_manager.read_data_from_file(fn, c_ltype);
+			if (!was_read) {cerr << "Failed to read lighting file " << fn << "; computing lighting instead." << endl;}
 		}
-		else {lmap_manager.read_data_from_file(fn, c_ltype);}
 	}
-	else {
+	if (!was_read) {
 		if (c_ltype != LIGHTING_LOCAL && !dynamic) {cout << X_SCENE_SIZE << " " << Y_SCENE_SIZE << " " << Z_SCENE_SIZE << " " << czmin << " " << czmax << endl;}
 		all_models.build_cobj_trees(1);
 		if (enable_platform_lights(ltype)) {pre_rt_bvh_build_hook();}
-		launch_threaded_job(NUM_THREADS, rt_funcs[c_ltype], verbose, 1, 0, 0, ltype);
+		if (lighting_work_stealing && c_ltype <= LIGHTING_LOCAL) {launch_pooled_job(NUM_THREADS, verbose, ltype);}
+		else {launch_threaded_job(NUM_THREADS, rt_funcs[c_ltype], verbose, 1, 0, 0, ltype);}
 		if (enable_platform_lights(ltype)) {post_rt_bvh_build_hook();}
 	}
 	if (!dynamic && write_light_files[c_ltype]) {
@@ -1098,6 +1490,8 @@ void check_update_global_lighting(unsigned lights) {
 	if (!pre_lighting_update()) return; // lmap is not yet allocated
 	// Note: we could check if the sun/moon is visible, but it might have been visible previously and now is not, and in that case we still need to update lighting
 	no_stat_moving = 1; // disable static moving cobjs for async updates, which aren't thread safe because the BVH is rebuilt every frame; no need to set back after first frame
+	kill_current_raytrace_threads(); // must be done before updating the snapshot
+	update_static_moving_cobj_snapshot(); // async updates use a copy of the static moving cobjs if cobj_bvh_refit is enabled
 	lmap_manager.clear_lighting_values(LIGHTING_GLOBAL);
 	launch_threaded_job(max(1U, NUM_THREADS-1), rt_funcs[LIGHTING_GLOBAL], 0, 0, lighting_update_offline, 0, LIGHTING_GLOBAL); // reserve a thread for rendering
 }
@@ -1134,6 +1528,14 @@ void check_all_platform_cobj_lighting_update() {
 bool lmap_manager_t::read_data_from_file(char const *const fn, int ltype) {
 
 	assert(fn != nullptr);
+	chunked_lighting_file_t clf;
+
+	if (clf.open(fn)) {
+		timer_t timer("Read Lighting File");
+		cout << "Reading lighting file from " << fn << endl;
+		float *const data(vldata_alloc.empty() ? nullptr : vldata_alloc.front().get_offset(ltype)); // cells are sizeof(lmcell) apart
+		return clf.read_cells(fn, ltype, data, vldata_alloc.size(), sizeof(lmcell)/sizeof(float));
+	}
 	binary_file_reader reader;
 	if (!reader.open(fn)) return 0;
 	cout << "Reading lighting file from " << fn << endl;
@@ -1165,6 +1567,12 @@ bool lmap_manager_t::read_data_from_file(char const *const fn, int ltype) {
 bool lmap_manager_t::write_data_to_file(char const *const fn, int ltype) const {
 
 	if (fn == nullptr || strcmp(fn, "''") == 0 || strcmp(fn, "\"\"") == 0) return 0; // don't write
+
+	if (chunked_lighting_files && !binary_file_io::is_gz_file(fn)) {
+		cout << "Writing lighting file to " << fn << endl;
+		float const *const data(vldata_alloc.empty() ? nullptr : vldata_alloc.front().get_offset(ltype));
+		return chunked_lighting_file_t::write(fn, ltype, data, vldata_alloc.size(), lmcell::get_dsz(ltype), sizeof(lmcell)/sizeof(float));
+	}
 	binary_file_writer writer;
 	if (!writer.open(fn)) return 0;
 	cout << "Writing lighting file to " << fn << endl;
@@ -3,6 +3,7 @@
 // 11/20/18
 #include "city.h"
 #include "lightmap.h"
+#include <cfloat> // for FLT_MAX
 
 float const STREETLIGHT_BEAMWIDTH       = 0.25;
 float const SLIGHT_DIST_TO_CORNER_SCALE = 2.0;
@@ -603,6 +604,71 @@ void road_isec_t::draw_stoplights(quad_batch_draw &qbd, draw_state_t &dstate, bo
 }
 
 
+
+void car_route_graph_t::init(unsigned num_nodes, float left_turn_cost, float right_turn_cost) {
+	assert(num_nodes < 65536); // must fit in unsigned short
+	node_conn.clear();
+	node_conn.resize(num_nodes, 0);
+	in_edges.clear();
+	in_edges.resize(num_nodes);
+	next_orient.clear();
+	next_orient.resize(num_nodes);
+	turn_cost[TURN_NONE ] = 0.0;
+	turn_cost[TURN_LEFT ] = left_turn_cost;
+	turn_cost[TURN_RIGHT] = right_turn_cost;
+}
+
+void car_route_graph_t::add_edge(unsigned from, unsigned to, unsigned orient, float cost) {
+	assert(from < size() && to < size() && orient < 4);
+	assert(node_conn[from] & (1<<orient));
+	in_edges[to].emplace_back(from, orient, cost);
+}
+
+// reverse Dijkstra from dest over {node, arrival orient} states, which is needed because cars can't make U-turns
+void car_route_graph_t::calc_routes_to(unsigned dest) const {
+	unsigned const num_states(4*size());
+	vector<unsigned char> &next(next_orient[dest]);
+	next.resize(num_states, 255); // start with no path
+	dist.clear();
+	dist.resize(num_states, FLT_MAX);
+	heap.clear();
+	for (unsigned a = 0; a < 4; ++a) {dist[4*dest + a] = 0.0; heap.emplace_back(0.0, 4*dest + a);}
+
+	while (!heap.empty()) {
+		pop_heap(heap.begin(), heap.end());
+		state_t const s(heap.back());
+		heap.pop_back();
+		if (s.dist > dist[s.ix]) continue; // stale entry
+		unsigned const node(s.ix >> 2), orient(s.ix & 3); // arrived at node in orient
+
+		for (auto e = in_edges[node].begin(); e != in_edges[node].end(); ++e) {
+			if (e->orient != orient) continue; // doesn't arrive in this orient
+			unsigned char const conn(node_conn[e->node]);
+
+			for (unsigned a = 0; a < 4; ++a) { // orient the car arrived at the source node in
+				unsigned const orient_in(a^1); // side of the isec the car enters from
+				if (!(conn & (1<<orient_in)) || orient == orient_in) continue; // no road on this side, or U-turn
+				unsigned const tdir((orient == a) ? TURN_NONE : ((orient == stoplight_ns::conn_left[orient_in]) ? TURN_LEFT : TURN_RIGHT));
+				unsigned const ix(4*e->node + a);
+				float const new_dist(s.dist + e->cost + turn_cost[tdir]);
+				if (new_dist >= dist[ix]) continue; // not shorter
+				dist[ix] = new_dist;
+				next[ix] = orient;
+				heap.emplace_back(new_dist, ix);
+				push_heap(heap.begin(), heap.end());
+			} // for a
+		} // for e
+	} // while
+}
+
+int car_route_graph_t::get_next_orient(unsigned cur_node, unsigned arrival_orient, unsigned dest_node) const { // returns -1 if there's no path
+	assert(cur_node < size() && dest_node < size() && arrival_orient < 4);
+	if (cur_node == dest_node) return -1; // already there
+	if (next_orient[dest_node].empty()) {calc_routes_to(dest_node);}
+	unsigned char const orient(next_orient[dest_node][4*cur_node + arrival_orient]);
+	return ((orient == 255) ? -1 : (int)orient);
+}
+
 float road_connector_t::get_player_zval(point const &center, cube_t const &c) const {
 	float const t((center[dim] - c.d[dim][0])/c.get_sz_dim(dim));
 	float const za(slope ? c.z2() : c.z1()), zb(slope ? c.z1() : c.z2()), zval(za + (zb - za)*t); // z-value at x/y location
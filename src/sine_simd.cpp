@@ -0,0 +1,273 @@
+// 3D World - SIMD kernels for the sum of sine products noise, with the instruction set selected at runtime
+#include "sine_simd.h"
+
+// the AVX kernels are built with a target attribute when AVX isn't enabled for the whole file, and are only used if the CPU supports AVX
+#if defined(__GNUC__) && defined(__SSE2__) && !defined(__AVX__)
+#define SINE_SIMD_DISPATCH
+#define AVX_TARGET __attribute__((target("avx")))
+#else
+#define AVX_TARGET
+#endif
+#if defined(__AVX__) || defined(SINE_SIMD_DISPATCH)
+#define SINE_SIMD_AVX
+#endif
+#if defined(__SSE2__) || defined(_M_X64)
+#define SINE_SIMD_SSE
+#endif
+#if defined(SINE_SIMD_AVX) || defined(SINE_SIMD_SSE)
+#include <immintrin.h>
+#endif
+
+
+unsigned const NUM_LANES = 8; // partial sums for sum_of_products(); the same for all instruction sets so that they produce the same values
+
+float const SIN_POLY_INV_TWO_PI = 0.159154943f;
+float const SIN_POLY_TWO_PI_HI  = 6.28125f; // exactly representable, so that q*TWO_PI_HI has no rounding error for small q
+float const SIN_POLY_TWO_PI_LO  = 0.00193530718f; // TWO_PI - TWO_PI_HI
+float const SIN_POLY_PI  = 3.14159265f;
+float const SIN_POLY_C3  = -1.66666667e-1f; // Taylor series coefficients
+float const SIN_POLY_C5  =  8.33333333e-3f;
+float const SIN_POLY_C7  = -1.98412698e-4f;
+float const SIN_POLY_C9  =  2.75573192e-6f;
+
+
+// copies the last n < width values of each array to zero padded arrays of size width so that they can be processed with a full SIMD width
+void pad_arrays(float const *const src[3], unsigned num_arrays, unsigned start, unsigned n, unsigned width, float dest[3][NUM_LANES]) {
+	assert(n < width && width <= NUM_LANES);
+
+	for (unsigned d = 0; d < num_arrays; ++d) {
+		for (unsigned i = 0; i < width; ++i) {dest[d][i] = ((i < n) ? src[d][start+i] : 0.0f);}
+	}
+}
+
+float hsum_lanes(float const vals[NUM_LANES]) { // fixed order so that results are deterministic
+	return (((vals[0] + vals[1]) + (vals[2] + vals[3])) + ((vals[4] + vals[5]) + (vals[6] + vals[7])));
+}
+
+
+// sin(x) for |x| < ~1E6: reduce to [-pi, pi], fold into [-pi/2, pi/2], then evaluate a degree 9 polynomial;
+// max error is ~4E-6, vs. ~2E-4 for the table lookup in SINF()
+#ifdef SINE_SIMD_AVX
+AVX_TARGET inline __m256 sin_poly_avx(__m256 x) {
+	__m256 const q(_mm256_cvtepi32_ps(_mm256_cvtps_epi32(_mm256_mul_ps(x, _mm256_set1_ps(SIN_POLY_INV_TWO_PI))))); // round to nearest even
+	__m256 r(_mm256_sub_ps(_mm256_sub_ps(x, _mm256_mul_ps(q, _mm256_set1_ps(SIN_POLY_TWO_PI_HI))), _mm256_mul_ps(q, _mm256_set1_ps(SIN_POLY_TWO_PI_LO))));
+	r = _mm256_min_ps(r, _mm256_sub_ps(_mm256_set1_ps( SIN_POLY_PI), r)); // (pi/2, pi] => [0, pi/2)
+	r = _mm256_max_ps(r, _mm256_sub_ps(_mm256_set1_ps(-SIN_POLY_PI), r)); // [-pi, -pi/2) => (-pi/2, 0]
+	__m256 const r2(_mm256_mul_ps(r, r));
+	__m256 p(_mm256_add_ps(_mm256_set1_ps(SIN_POLY_C7), _mm256_mul_ps(r2, _mm256_set1_ps(SIN_POLY_C9))));
+	p = _mm256_add_ps(_mm256_set1_ps(SIN_POLY_C5), _mm256_mul_ps(r2, p));
+	p = _mm256_add_ps(_mm256_set1_ps(SIN_POLY_C3), _mm256_mul_ps(r2, p));
+	return _mm256_add_ps(r, _mm256_mul_ps(_mm256_mul_ps(r, r2), p));
+}
+AVX_TARGET float hsum_avx(__m256 v) {
+	float vals[NUM_LANES];
+	_mm256_storeu_ps(vals, v);
+	return hsum_lanes(vals);
+}
+
+AVX_TARGET float sum_of_products2_avx(float const *a, float const *b, unsigned n) {
+	__m256 vsum(_mm256_setzero_ps());
+	unsigned k(0);
+	for (; k+8 <= n; k += 8) {vsum = _mm256_add_ps(vsum, _mm256_mul_ps(_mm256_loadu_ps(a+k), _mm256_loadu_ps(b+k)));}
+
+	if (k < n) {
+		float const *const src[3] = {a, b, nullptr};
+		float pad[3][NUM_LANES];
+		pad_arrays(src, 2, k, n-k, 8, pad);
+		vsum = _mm256_add_ps(vsum, _mm256_mul_ps(_mm256_loadu_ps(pad[0]), _mm256_loadu_ps(pad[1])));
+	}
+	return hsum_avx(vsum);
+}
+AVX_TARGET float sum_of_products3_avx(float const *a, float const *b, float const *c, unsigned n) {
+	__m256 vsum(_mm256_setzero_ps());
+	unsigned k(0);
+	for (; k+8 <= n; k += 8) {vsum = _mm256_add_ps(vsum, _mm256_mul_ps(_mm256_mul_ps(_mm256_loadu_ps(a+k), _mm256_loadu_ps(b+k)), _mm256_loadu_ps(c+k)));}
+
+	if (k < n) {
+		float const *const src[3] = {a, b, c};
+		float pad[3][NUM_LANES];
+		pad_arrays(src, 3, k, n-k, 8, pad);
+		vsum = _mm256_add_ps(vsum, _mm256_mul_ps(_mm256_mul_ps(_mm256_loadu_ps(pad[0]), _mm256_loadu_ps(pad[1])), _mm256_loadu_ps(pad[2])));
+	}
+	return hsum_avx(vsum);
+}
+
+AVX_TARGET void eval_sine_terms_block_avx(sine_terms_t const &t, float const *const pos[3], unsigned i, float *vals) {
+	__m256 p[3];
+	for (unsigned d = 0; d < t.num_dims; ++d) {p[d] = _mm256_loadu_ps(pos[d]+i);}
+	__m256 sum(_mm256_setzero_ps());
+
+	for (unsigned k = 0; k < t.num; ++k) { // performance critical
+		float const *const params(t.params + k*t.param_stride);
+		__m256 prod(_mm256_set1_ps(t.mags[k*t.mag_stride]));
+
+		for (unsigned d = 0; d < t.num_dims; ++d) {
+			__m256 const arg(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(params[t.freq_ix[d]]), p[d]), _mm256_set1_ps(params[t.phase_ix[d]])));
+			prod = _mm256_mul_ps(prod, sin_poly_avx(arg));
+		}
+		sum = _mm256_add_ps(sum, prod);
+	}
+	_mm256_storeu_ps(vals, sum);
+}
+AVX_TARGET void eval_sine_terms_avx(sine_terms_t const &t, float const *const pos[3], unsigned num, float *vals) {
+	unsigned i(0);
+	for (; i+8 <= num; i += 8) {eval_sine_terms_block_avx(t, pos, i, vals+i);}
+	if (i == num) return;
+	float pad[3][NUM_LANES], pad_vals[NUM_LANES];
+	pad_arrays(pos, t.num_dims, i, num-i, 8, pad);
+	float const *const pad_pos[3] = {pad[0], pad[1], pad[2]};
+	eval_sine_terms_block_avx(t, pad_pos, 0, pad_vals);
+	for (unsigned j = 0; j < num-i; ++j) {vals[i+j] = pad_vals[j];}
+}
+#endif // SINE_SIMD_AVX
+
+#ifdef SINE_SIMD_SSE
+inline __m128 sin_poly_sse(__m128 x) { // same operations as sin_poly_avx()
+	__m128 const q(_mm_cvtepi32_ps(_mm_cvtps_epi32(_mm_mul_ps(x, _mm_set1_ps(SIN_POLY_INV_TWO_PI)))));
+	__m128 r(_mm_sub_ps(_mm_sub_ps(x, _mm_mul_ps(q, _mm_set1_ps(SIN_POLY_TWO_PI_HI))), _mm_mul_ps(q, _mm_set1_ps(SIN_POLY_TWO_PI_LO))));
+	r = _mm_min_ps(r, _mm_sub_ps(_mm_set1_ps( SIN_POLY_PI), r));
+	r = _mm_max_ps(r, _mm_sub_ps(_mm_set1_ps(-SIN_POLY_PI), r));
+	__m128 const r2(_mm_mul_ps(r, r));
+	__m128 p(_mm_add_ps(_mm_set1_ps(SIN_POLY_C7), _mm_mul_ps(r2, _mm_set1_ps(SIN_POLY_C9))));
+	p = _mm_add_ps(_mm_set1_ps(SIN_POLY_C5), _mm_mul_ps(r2, p));
+	p = _mm_add_ps(_mm_set1_ps(SIN_POLY_C3), _mm_mul_ps(r2, p));
+	return _mm_add_ps(r, _mm_mul_ps(_mm_mul_ps(r, r2), p));
+}
+float hsum_sse(__m128 v0, __m128 v1) { // v0 holds lanes 0-3 and v1 holds lanes 4-7
+	float vals[NUM_LANES];
+	_mm_storeu_ps(vals,   v0);
+	_mm_storeu_ps(vals+4, v1);
+	return hsum_lanes(vals);
+}
+
+// uses two 4-wide vectors as 8 lanes, the same as the AVX version
+float sum_of_products2_sse(float const *a, float const *b, unsigned n) {
+	__m128 vsum0(_mm_setzero_ps()), vsum1(_mm_setzero_ps());
+	float pad[3][NUM_LANES];
+
+	for (unsigned k = 0; k < n; k += 8) {
+		float const *pa(a+k), *pb(b+k);
+
+		if (k+8 > n) {
+			float const *const src[3] = {a, b, nullptr};
+			pad_arrays(src, 2, k, n-k, 8, pad);
+			pa = pad[0]; pb = pad[1];
+		}
+		vsum0 = _mm_add_ps(vsum0, _mm_mul_ps(_mm_loadu_ps(pa  ), _mm_loadu_ps(pb  )));
+		vsum1 = _mm_add_ps(vsum1, _mm_mul_ps(_mm_loadu_ps(pa+4), _mm_loadu_ps(pb+4)));
+	}
+	return hsum_sse(vsum0, vsum1);
+}
+float sum_of_products3_sse(float const *a, float const *b, float const *c, unsigned n) {
+	__m128 vsum0(_mm_setzero_ps()), vsum1(_mm_setzero_ps());
+	float pad[3][NUM_LANES];
+
+	for (unsigned k = 0; k < n; k += 8) {
+		float const *pa(a+k), *pb(b+k), *pc(c+k);
+
+		if (k+8 > n) {
+			float const *const src[3] = {a, b, c};
+			pad_arrays(src, 3, k, n-k, 8, pad);
+			pa = pad[0]; pb = pad[1]; pc = pad[2];
+		}
+		vsum0 = _mm_add_ps(vsum0, _mm_mul_ps(_mm_mul_ps(_mm_loadu_ps(pa  ), _mm_loadu_ps(pb  )), _mm_loadu_ps(pc  )));
+		vsum1 = _mm_add_ps(vsum1, _mm_mul_ps(_mm_mul_ps(_mm_loadu_ps(pa+4), _mm_loadu_ps(pb+4)), _mm_loadu_ps(pc+4)));
+	}
+	return hsum_sse(vsum0, vsum1);
+}
+
+inline __m128 eval_sine_terms_lanes_sse(sine_terms_t const &t, __m128 const p[3]) {
+	__m128 sum(_mm_setzero_ps());
+
+	for (unsigned k = 0; k < t.num; ++k) { // performance critical
+		float const *const params(t.params + k*t.param_stride);
+		__m128 prod(_mm_set1_ps(t.mags[k*t.mag_stride]));
+
+		for (unsigned d = 0; d < t.num_dims; ++d) {
+			__m128 const arg(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(params[t.freq_ix[d]]), p[d]), _mm_set1_ps(params[t.phase_ix[d]])));
+			prod = _mm_mul_ps(prod, sin_poly_sse(arg));
+		}
+		sum = _mm_add_ps(sum, prod);
+	}
+	return sum;
+}
+void eval_sine_terms_block_sse(sine_terms_t const &t, float const *const pos[3], unsigned i, float *vals) {
+	__m128 p[3];
+	for (unsigned d = 0; d < t.num_dims; ++d) {p[d] = _mm_loadu_ps(pos[d]+i);}
+	_mm_storeu_ps(vals, eval_sine_terms_lanes_sse(t, p));
+}
+// evaluates one sample in lane 0; also used with the AVX kernels, since each lane uses the same operations in the same order as sin_poly_avx()
+float eval_sine_terms_single_sse(sine_terms_t const &t, float const pos[3]) {
+	__m128 p[3];
+	for (unsigned d = 0; d < t.num_dims; ++d) {p[d] = _mm_set_ss(pos[d]);}
+	return _mm_cvtss_f32(eval_sine_terms_lanes_sse(t, p));
+}
+void eval_sine_terms_sse(sine_terms_t const &t, float const *const pos[3], unsigned num, float *vals) {
+	unsigned i(0);
+	for (; i+4 <= num; i += 4) {eval_sine_terms_block_sse(t, pos, i, vals+i);}
+	if (i == num) return;
+	float pad[3][NUM_LANES], pad_vals[NUM_LANES];
+	pad_arrays(pos, t.num_dims, i, num-i, 4, pad);
+	float const *const pad_pos[3] = {pad[0], pad[1], pad[2]};
+	eval_sine_terms_block_sse(t, pad_pos, 0, pad_vals);
+	for (unsigned j = 0; j < num-i; ++j) {vals[i+j] = pad_vals[j];}
+}
+#endif // SINE_SIMD_SSE
+
+#if !defined(SINE_SIMD_AVX) && !defined(SINE_SIMD_SSE)
+float sin_poly(float x) { // scalar version of sin_poly_avx(); nearbyintf() rounds to nearest even, the same as _mm_cvtps_epi32()
+	float const q(nearbyintf(x*SIN_POLY_INV_TWO_PI));
+	float r((x - q*SIN_POLY_TWO_PI_HI) - q*SIN_POLY_TWO_PI_LO);
+	r = min(r,  SIN_POLY_PI - r);
+	r = max(r, -SIN_POLY_PI - r);
+	float const r2(r*r);
+	return r + (r*r2)*(SIN_POLY_C3 + r2*(SIN_POLY_C5 + r2*(SIN_POLY_C7 + r2*SIN_POLY_C9)));
+}
+float sum_of_products2_scalar(float const *a, float const *b, unsigned n) {
+	float lanes[NUM_LANES] = {0};
+	for (unsigned k = 0; k < n; ++k) {lanes[k%NUM_LANES] += a[k]*b[k];}
+	return hsum_lanes(lanes);
+}
+float sum_of_products3_scalar(float const *a, float const *b, float const *c, unsigned n) {
+	float lanes[NUM_LANES] = {0};
+	for (unsigned k = 0; k < n; ++k) {lanes[k%NUM_LANES] += (a[k]*b[k])*c[k];}
+	return hsum_lanes(lanes);
+}
+void eval_sine_terms_scalar(sine_terms_t const &t, float const *const pos[3], unsigned num, float *vals) {
+	for (unsigned i = 0; i < num; ++i) {
+		float sum(0.0);
+
+		for (unsigned k = 0; k < t.num; ++k) {
+			float const *const params(t.params + k*t.param_stride);
+			float prod(t.mags[k*t.mag_stride]);
+			for (unsigned d = 0; d < t.num_dims; ++d) {prod *= sin_poly(params[t.freq_ix[d]]*pos[d][i] + params[t.phase_ix[d]]);}
+			sum += prod;
+		}
+		vals[i] = sum;
+	}
+}
+float eval_sine_terms_single_scalar(sine_terms_t const &t, float const pos[3]) {
+	float const *const pos_ptrs[3] = {pos, pos+1, pos+2};
+	float val(0.0);
+	eval_sine_terms_scalar(t, pos_ptrs, 1, &val);
+	return val;
+}
+#endif
+
+
+sine_simd_funcs_t select_sine_simd_funcs() {
+#if defined(SINE_SIMD_DISPATCH)
+	__builtin_cpu_init(); // may be called before other static constructors
+	if (__builtin_cpu_supports("avx")) {return {"AVX", 8, sum_of_products2_avx, sum_of_products3_avx, eval_sine_terms_avx, eval_sine_terms_single_sse};}
+	return {"SSE2", 4, sum_of_products2_sse, sum_of_products3_sse, eval_sine_terms_sse, eval_sine_terms_single_sse};
+#elif defined(SINE_SIMD_AVX) // AVX is enabled for the whole build
+	return {"AVX", 8, sum_of_products2_avx, sum_of_products3_avx, eval_sine_terms_avx, eval_sine_terms_single_sse};
+#elif defined(SINE_SIMD_SSE)
+	return {"SSE2", 4, sum_of_products2_sse, sum_of_products3_sse, eval_sine_terms_sse, eval_sine_terms_single_sse};
+#else
+	return {"scalar", 1, sum_of_products2_scalar, sum_of_products3_scalar, eval_sine_terms_scalar, eval_sine_terms_single_scalar};
+#endif
+}
+
+sine_simd_funcs_t const sine_simd_funcs(select_sine_simd_funcs());
+
@@ -0,0 +1,47 @@
+// 3D World - SIMD kernels for the sum of sine products noise used for planet surfaces and sine wave terrain
+#pragma once
+
+#include "3DWorld.h"
+
+
+// a sum of num terms mag*sin(freq0*x + phase0)*sin(freq1*y + phase1)[*sin(freq2*z + phase2)], where each term's values are read from strided arrays:
+// mag = mags[k*mag_stride], freqD = params[k*param_stride + freq_ix[D]], phaseD = params[k*param_stride + phase_ix[D]]
+struct sine_terms_t {
+	float const *mags=nullptr, *params=nullptr;
+	unsigned num=0, mag_stride=1, param_stride=1, num_dims=0;
+	unsigned freq_ix[3] = {0}, phase_ix[3] = {0};
+
+	sine_terms_t(float const *mags_, unsigned mag_stride_, float const *params_, unsigned param_stride_, unsigned num_) :
+		mags(mags_), params(params_), num(num_), mag_stride(mag_stride_), param_stride(param_stride_) {}
+	void add_dim(unsigned freq, unsigned phase) {assert(num_dims < 3); freq_ix[num_dims] = freq; phase_ix[num_dims] = phase; ++num_dims;}
+};
+
+// kernels for one instruction set, selected at startup based on what the CPU supports;
+// every value, including single samples and the remainder of arrays that aren't a multiple of the SIMD width, goes through the same per-lane operations,
+// and the SSE version accumulates into the same 8 lanes as the AVX version, so the results don't depend on the array size, alignment, or CPU
+struct sine_simd_funcs_t {
+	char const *isa_name;
+	unsigned width;
+	float (*sum_of_products2)(float const *a, float const *b, unsigned n);
+	float (*sum_of_products3)(float const *a, float const *b, float const *c, unsigned n);
+	void  (*eval_sine_terms )(sine_terms_t const &t, float const *const pos[3], unsigned num, float *vals);
+	float (*eval_sine_terms_single)(sine_terms_t const &t, float const pos[3]); // one sample, without padding to the full SIMD width
+};
+extern sine_simd_funcs_t const sine_simd_funcs;
+
+// returns the sum of a[k]*b[k] for k in [0, n)
+inline float sum_of_products(float const *a, float const *b, unsigned n) {return sine_simd_funcs.sum_of_products2(a, b, n);}
+// returns the sum of a[k]*b[k]*c[k] for k in [0, n)
+inline float sum_of_products(float const *a, float const *b, float const *c, unsigned n) {return sine_simd_funcs.sum_of_products3(a, b, c, n);}
+
+// vals[i] = sum of all terms evaluated at (pos[0][i], pos[1][i], pos[2][i]) for i in [0, num); each SIMD lane evaluates a different sample
+inline void eval_sine_terms(sine_terms_t const &t, float const *const pos[3], unsigned num, float *vals) {
+	assert(t.num_dims > 0);
+	sine_simd_funcs.eval_sine_terms(t, pos, num, vals);
+}
+// returns the sum of all terms evaluated at (pos[0], pos[1], pos[2]); the same value as eval_sine_terms() for this sample
+inline float eval_sine_terms(sine_terms_t const &t, float const pos[3]) {
+	assert(t.num_dims > 0);
+	return sine_simd_funcs.eval_sine_terms_single(t, pos);
+}
+
@@ -24,7 +24,7 @@ float const SMOKE_DIS_ZD     = 0.03;
 float const SMOKE_THRESH     = 1.0/255.0;
 
 
-bool smoke_visible(0), smoke_exists(0), have_indir_smoke_tex(0);
+bool smoke_visible(0), smoke_exists(0), have_indir_smoke_tex(0), parallel_smoke(0), benchmark_smoke(0), smoke_benchmark_done(0);
 unsigned smoke_tid(0), last_smoke_update(0);
 colorRGB const_indir_color(BLACK);
 cube_t cur_smoke_bb;
@@ -60,8 +60,21 @@ struct smoke_entry_t {
 	void update(short zval) {zmin = min(zmin, zval); zmax = max(zmax, short(zval+1));}
 };
 
+struct smoke_target_t { // a column that may receive smoke in the current step
+	unsigned ix, buf_off;
+	short zmin, zmax;
+	smoke_target_t(unsigned ix_, short zmin_, short zmax_) : ix(ix_), buf_off(0), zmin(zmin_), zmax(zmax_) {}
+	bool operator<(smoke_target_t const &t) const {return (ix < t.ix);}
+};
+
 class smoke_grid_t {
 	vector<smoke_entry_t> zrng; // z smoke ranges for each xy grid element
+	vector<unsigned> active; // xy indices of columns with smoke; may contain duplicates and cleared columns until compacted
+	// scratch space for distribute_parallel(), kept across calls to avoid reallocating every frame
+	vector<int> col_target; // index into targets for each xy grid element, or -1
+	vector<smoke_target_t> targets;
+	vector<float> next_smoke;
+	vector<unsigned> next_active;
 public:
 	void ensure_zrng() {
 		if (zrng.empty()) {zrng.resize(XY_MULT_SIZE);} else {assert((int)zrng.size() == XY_MULT_SIZE);}
@@ -69,13 +82,35 @@ public:
 	void register_smoke(int x, int y, int z) {
 		ensure_zrng();
 		assert(!point_outside_mesh(x, y));
-		zrng[y*MESH_X_SIZE + x].update(z);
+		unsigned const ix(y*MESH_X_SIZE + x);
+		if (!zrng[ix].valid()) {active.push_back(ix);} // newly active column
+		zrng[ix].update(z);
 	}
 	smoke_entry_t &get_z_range(int x, int y) {
 		ensure_zrng();
 		assert(!point_outside_mesh(x, y));
 		return zrng[y*MESH_X_SIZE + x];
 	}
+	vector<unsigned> const &get_active() const {return active;}
+	void distribute_parallel();
+
+	void compact_active() { // remove cleared columns and duplicates, and sort for determinism and memory locality
+		auto const is_inactive([this](unsigned ix) {return !zrng[ix].valid();});
+		active.erase(std::remove_if(active.begin(), active.end(), is_inactive), active.end());
+		sort(active.begin(), active.end());
+		active.erase(std::unique(active.begin(), active.end()), active.end());
+	}
+	void clear_all_smoke() { // zeros the smoke channel of the lightmap
+		compact_active();
+
+		for (auto i = active.begin(); i != active.end(); ++i) {
+			smoke_entry_t &e(zrng[*i]);
+			lmcell *vldata(lmap_manager.get_column((*i)%MESH_X_SIZE, (*i)/MESH_X_SIZE));
+			if (vldata) {for (int z = e.zmin; z < e.zmax; ++z) {vldata[z].smoke = 0.0;}}
+			e.clear();
+		}
+		active.clear();
+	}
 };
 
 smoke_grid_t smoke_grid;
@@ -98,18 +133,27 @@ struct smoke_manager {
 		enabled   = 0;
 		smoke_vis = 0;
 	}
-	void add_smoke(int x, int y, int z, float smoke_amt) {
+	void add_smoke(int x, int y, int z, float smoke_amt, bool update_cur_bb=1) { // update_cur_bb=0 for thread-local copies
 		if (smoke_amt == 0) return; // can't happen?
 		point const pos(get_xval(x), get_yval(y), get_zval(z));
 
 		if (is_smoke_visible(pos) && check_smoke_bounds(pos)) {
 			bbox.union_with_pt(pos);
-			cur_smoke_bb.union_with_pt(pos);
+			if (update_cur_bb) {cur_smoke_bb.union_with_pt(pos);}
 			smoke_vis = 1;
 		}
 		tot_smoke += smoke_amt;
 		enabled    = 1;
 	}
+	void merge(smoke_manager const &sm) { // merge a thread-local copy
+		if (sm.smoke_vis) {
+			bbox.union_with_cube(sm.bbox);
+			cur_smoke_bb.union_with_cube(sm.bbox);
+			smoke_vis = 1;
+		}
+		tot_smoke += sm.tot_smoke;
+		enabled   |= sm.enabled;
+	}
 	void adj_bbox() {
 		for (unsigned i = 0; i < 3; ++i) {
 			float const dval(SCENE_SIZE[i]/MESH_SIZE[i]);
@@ -127,6 +171,7 @@ inline void adjust_smoke_val(float &val, float delta) {val = max(0.0f, min(SMOKE
 void add_smoke(point const &pos, float val) {
 
 	if (!DYNAMIC_SMOKE || (display_mode & 0x80) || !game_mode || val == 0.0 || pos.z >= czmax) return;
+	if (lmap_manager.is_compact()) return; // compact lightmap is read-only, so no dynamic smoke
 	lmcell *const lmc(lmap_manager.get_lmcell(pos));
 	if (!lmc) return;
 	int const xpos(get_xpos(pos.x)), ypos(get_ypos(pos.y));
@@ -182,30 +227,12 @@ void diffuse_smoke_z(int x, int y, int z, lmcell &adj, lmcell *vldata, float pos
 }
 
 
-void distribute_smoke() { // called at most once per frame
+void distribute_smoke_serial(int cur_skip) { // in-place update of one in every SMOKE_SKIPVAL rows
 
-	//RESET_TIME;
-	if (!DYNAMIC_SMOKE || !smoke_exists || !animate2) return;
-	assert(SMOKE_SKIPVAL > 0);
-	static int cur_skip(0);
 	static rand_gen_t rgen;
-	
-	if (cur_skip == 0) {
-		//cout << "tot_smoke: " << smoke_man.tot_smoke << ", enabled: " << smoke_exists << ", visible: " << smoke_visible << endl;
-		smoke_man     = next_smoke_man;
-		smoke_man.adj_bbox();
-		smoke_visible = smoke_man.smoke_vis;
-		smoke_exists  = smoke_man.enabled;
-		next_smoke_man.reset();
-	}
-	/*if ((display_mode & 0x10) && !smoke_bounds.empty()) {
-		cur_smoke_bb = smoke_bounds[0];
-		for (vector<cube_t>::const_iterator i = smoke_bounds.begin()+1; i != smoke_bounds.end(); ++i) {cur_smoke_bb.union_with_cube(*i);}
-	}*/
 	float const xy_rate(SMOKE_DIS_XY*SMOKE_SKIPVAL);
 	int const dx(rgen.rand() & 1), dy(rgen.rand() & 1); // randomize the processing order
 	
-	// openmp doesn't really help here
 	for (int y = cur_skip; y < MESH_Y_SIZE; y += SMOKE_SKIPVAL) { // split the computation across several frames
 		for (int x = 0; x < MESH_X_SIZE; ++x) {
 			lmcell *vldata(lmap_manager.get_column(x, y));
@@ -243,7 +270,201 @@ void distribute_smoke() { // called at most once per frame
 			if (!any_z_has_smoke) {zrange.clear();} // mark this xy as not having smoke
 		} // for x
 	} // for y
-	cur_skip = (cur_skip+1) % SMOKE_SKIPVAL;
+	if (cur_skip == 0) {smoke_grid.compact_active();} // the active list is only used by the parallel path, but must be kept bounded
+}
+
+
+// computes the next smoke value of cell z in column (x,y) from current values only, so that all cells can be updated in parallel;
+// flow between two cells uses the pflow of the lower cell, which makes the exchange symmetric like the in-place version
+float calc_next_smoke_val(int x, int y, int z, lmcell const *const vldata) {
+
+	lmcell const &lmc(vldata[z]);
+	float const cur_smoke(lmc.smoke);
+	float delta(0.0);
+
+	for (unsigned dim = 0; dim < 2; ++dim) {
+		for (unsigned dir = 0; dir < 2; ++dir) {
+			int const nx(x + ((dim == 0) ? (dir ? 1 : -1) : 0)), ny(y + ((dim == 1) ? (dir ? 1 : -1) : 0));
+			lmcell const *const adj_col(point_outside_mesh(nx, ny) ? nullptr : lmap_manager.get_column(nx, ny));
+
+			if (adj_col == nullptr) { // edge cell has infinite smoke capacity and zero total smoke
+				if (cur_smoke > 0.0) {delta -= SMOKE_DIS_XY;}
+				continue;
+			}
+			lmcell const &adj(adj_col[z]);
+			unsigned char const flow(dir ? lmc.pflow[dim] : adj.pflow[dim]);
+			delta += SMOKE_DIS_XY*(flow/255.0f)*(adj.smoke - cur_smoke);
+		} // for dir
+	} // for dim
+	for (unsigned dir = 0; dir < 2; ++dir) { // smoke moves up at rate SMOKE_DIS_ZU and down at rate SMOKE_DIS_ZD
+		int const nz(z + (dir ? 1 : -1));
+
+		if (nz < 0 || nz >= MESH_SIZE[2]) { // edge cell
+			if (cur_smoke > 0.0) {delta -= 0.5f*(SMOKE_DIS_ZU + SMOKE_DIS_ZD);}
+			continue;
+		}
+		lmcell const &adj(vldata[nz]);
+		unsigned char const flow(dir ? lmc.pflow[2] : adj.pflow[2]);
+		float const dz((flow/255.0f)*(adj.smoke - cur_smoke)); // positive = flow into this cell
+		delta += dz*(((dz > 0.0) == (dir != 0)) ? SMOKE_DIS_ZD : SMOKE_DIS_ZU);
+	}
+	return max(0.0f, min(SMOKE_MAX_VAL, (cur_smoke + delta)));
+}
+
+// double-buffered update of every cell in active columns and their neighbors, run in parallel;
+// cost is proportional to the volume of smoke rather than the size of the scene
+void smoke_grid_t::distribute_parallel() {
+
+	if ((int)col_target.size() != XY_MULT_SIZE) {col_target.assign(XY_MULT_SIZE, -1);}
+	compact_active();
+	int const dxs[5] = {0, -1, 1, 0, 0}, dys[5] = {0, 0, 0, -1, 1};
+	targets.clear();
+
+	for (auto i = active.begin(); i != active.end(); ++i) {
+		int const x((*i)%MESH_X_SIZE), y((*i)/MESH_X_SIZE);
+		smoke_entry_t const &zr(zrng[*i]);
+		short const zmin(max(0, zr.zmin-1)), zmax(min(MESH_SIZE[2], zr.zmax+1)); // smoke can diffuse one cell per step
+
+		for (unsigned n = 0; n < 5; ++n) {
+			int const nx(x + dxs[n]), ny(y + dys[n]);
+			if (point_outside_mesh(nx, ny) || lmap_manager.get_column(nx, ny) == nullptr) continue;
+			unsigned const nix(ny*MESH_X_SIZE + nx);
+
+			if (col_target[nix] < 0) {
+				col_target[nix] = (int)targets.size();
+				targets.push_back(smoke_target_t(nix, zmin, zmax));
+			}
+			else {
+				smoke_target_t &t(targets[col_target[nix]]);
+				t.zmin = min(t.zmin, zmin);
+				t.zmax = max(t.zmax, zmax);
+			}
+		} // for n
+	} // for i
+	for (auto t = targets.begin(); t != targets.end(); ++t) {col_target[t->ix] = -1;} // reset for next frame
+	sort(targets.begin(), targets.end()); // row-major order, so that each thread's block of columns is a compact xy tile
+	unsigned buf_sz(0);
+	for (auto t = targets.begin(); t != targets.end(); ++t) {t->buf_off = buf_sz; buf_sz += (t->zmax - t->zmin);}
+	next_smoke.resize(buf_sz);
+	int const num_targets((int)targets.size());
+
+#pragma omp parallel for schedule(dynamic,16)
+	for (int i = 0; i < num_targets; ++i) { // pass 1: compute new values from the current values
+		smoke_target_t const &t(targets[i]);
+		int const x(t.ix%MESH_X_SIZE), y(t.ix/MESH_X_SIZE);
+		lmcell const *const vldata(lmap_manager.get_column(x, y));
+		for (int z = t.zmin; z < t.zmax; ++z) {next_smoke[t.buf_off + z - t.zmin] = calc_next_smoke_val(x, y, z, vldata);}
+	}
+#pragma omp parallel
+	{
+		smoke_manager thread_smoke_man;
+
+#pragma omp for schedule(dynamic,16)
+		for (int i = 0; i < num_targets; ++i) { // pass 2: write back and update z ranges; each column is owned by one thread
+			smoke_target_t const &t(targets[i]);
+			int const x(t.ix%MESH_X_SIZE), y(t.ix/MESH_X_SIZE);
+			lmcell *const vldata(lmap_manager.get_column(x, y));
+			smoke_entry_t &zrange(zrng[t.ix]);
+			zrange.clear();
+
+			for (int z = t.zmin; z < t.zmax; ++z) {
+				float &smoke(vldata[z].smoke);
+				smoke = next_smoke[t.buf_off + z - t.zmin];
+				if (smoke < SMOKE_THRESH) {smoke = 0.0; continue;}
+				zrange.update(z);
+				thread_smoke_man.add_smoke(x, y, z, smoke, 0);
+			}
+		} // for i
+#pragma omp critical(smoke_man_merge)
+		next_smoke_man.merge(thread_smoke_man);
+	} // omp parallel
+	next_active.clear();
+
+	for (auto t = targets.begin(); t != targets.end(); ++t) {
+		if (zrng[t->ix].valid()) {next_active.push_back(t->ix);}
+	}
+	active.swap(next_active);
+}
+
+
+void run_smoke_benchmark() {
+
+	if (!lmap_manager.is_allocated() || lmap_manager.is_compact()) return;
+	unsigned const num_steps(200), max_fires(100);
+	vector<pair<int, int>> fire_cols;
+	vector<int> fire_zs;
+	rand_gen_t rgen;
+
+	for (unsigned n = 0; n < 100*max_fires && fire_cols.size() < max_fires; ++n) { // choose random fire locations on the mesh
+		int const x(rgen.rand()%MESH_X_SIZE), y(rgen.rand()%MESH_Y_SIZE);
+		if (lmap_manager.get_column(x, y) == nullptr) continue;
+		fire_cols.push_back(make_pair(x, y));
+		fire_zs.push_back(max(0, min(MESH_SIZE[2]-1, get_zpos(mesh_height[y][x])+1)));
+	}
+	if (fire_cols.empty()) return;
+	smoke_grid.clear_all_smoke();
+	unsigned const num_fires[3] = {1, 10, 100};
+
+	for (unsigned f = 0; f < 3; ++f) {
+		unsigned const nf(min(num_fires[f], (unsigned)fire_cols.size()));
+		double ms_per_step[2] = {0.0, 0.0};
+		size_t num_active[2] = {0, 0};
+
+		for (unsigned par = 0; par < 2; ++par) {
+			int const start_ms(GET_TIME_MS());
+
+			for (unsigned step = 0; step < num_steps; ++step) {
+				for (unsigned i = 0; i < nf; ++i) { // fires add smoke every frame
+					int const x(fire_cols[i].first), y(fire_cols[i].second), z(fire_zs[i]);
+					adjust_smoke_val(lmap_manager.get_lmcell(x, y, z).smoke, SMOKE_DENSITY);
+					smoke_grid.register_smoke(x, y, z);
+				}
+				if (par) {smoke_grid.distribute_parallel();}
+				else { // each serial call updates one in every SMOKE_SKIPVAL rows, so make SMOKE_SKIPVAL calls to update the full grid once per step
+					for (int skip = 0; skip < SMOKE_SKIPVAL; ++skip) {distribute_smoke_serial(skip);}
+				}
+			}
+			ms_per_step[par] = double(GET_TIME_MS() - start_ms)/num_steps;
+			smoke_grid.compact_active();
+			num_active[par] = smoke_grid.get_active().size();
+			smoke_grid.clear_all_smoke();
+		} // for par
+		cout << "Smoke benchmark " << nf << " fires, " << num_steps << " full grid steps: serial " << ms_per_step[0] << " ms/step (" << num_active[0]
+			 << " columns), parallel " << ms_per_step[1] << " ms/step (" << num_active[1] << " columns)" << endl;
+	} // for f
+	next_smoke_man.reset();
+}
+
+
+void distribute_smoke() { // called at most once per frame
+
+	//RESET_TIME;
+	if (benchmark_smoke && !smoke_benchmark_done) { // run once, before any smoke is added
+		run_smoke_benchmark();
+		smoke_benchmark_done = 1;
+	}
+	if (!DYNAMIC_SMOKE || !smoke_exists || !animate2) return;
+	assert(SMOKE_SKIPVAL > 0);
+	static int cur_skip(0);
+	if (parallel_smoke) {cur_skip = 0;} // all rows are updated every frame
+	
+	if (cur_skip == 0) {
+		//cout << "tot_smoke: " << smoke_man.tot_smoke << ", enabled: " << smoke_exists << ", visible: " << smoke_visible << endl;
+		smoke_man     = next_smoke_man;
+		smoke_man.adj_bbox();
+		smoke_visible = smoke_man.smoke_vis;
+		smoke_exists  = smoke_man.enabled;
+		next_smoke_man.reset();
+	}
+	/*if ((display_mode & 0x10) && !smoke_bounds.empty()) {
+		cur_smoke_bb = smoke_bounds[0];
+		for (vector<cube_t>::const_iterator i = smoke_bounds.begin()+1; i != smoke_bounds.end(); ++i) {cur_smoke_bb.union_with_cube(*i);}
+	}*/
+	if (parallel_smoke) {smoke_grid.distribute_parallel();}
+	else {
+		distribute_smoke_serial(cur_skip); // openmp doesn't really help here
+		cur_skip = (cur_skip+1) % SMOKE_SKIPVAL;
+	}
 	//PRINT_TIME("Distribute Smoke");
 }
 
@@ -254,8 +475,8 @@ float get_smoke_at_pos(point const &pos) {
 	if (pos.z <= czmin0 || pos.z >= czmax) return 0.0;
 	int const x(get_xpos(pos.x)), y(get_ypos(pos.y)), z(get_zpos(pos.z));
 	if (point_outside_mesh(x, y) || z < 0 || z >= MESH_SIZE[2]) return 0.0;
-	lmcell const *const vldata(lmap_manager.get_column(x, y));
-	return ((vldata == NULL) ? 0.0 : vldata[z].smoke);
+	lmcell lmc;
+	return (lmap_manager.get_cell_decoded(x, y, z, lmc) ? lmc.smoke : 0.0);
 }
 
 
@@ -272,9 +493,10 @@ void update_smoke_row(vector<unsigned char> &data, vector<unsigned> const &llvol
 	bool const do_lighting(update_lighting || lmap_manager.was_updated);
 	colorRGB default_color;
 	default_lmc.get_final_color(default_color, 1.0);
+	vector<lmcell> decode_buf(lmap_manager.is_compact() ? zsize : 0); // only used in compact mode
 
 	for (unsigned x = x_start; x < x_end; ++x) {
-		lmcell const *const vlm(lmap_manager.get_column(x, y));
+		lmcell const *const vlm(lmap_manager.get_column_decoded(x, y, decode_buf.data()));
 		if (vlm == NULL && !update_lighting) continue; // x/y pairs that get into here should also be constant
 		unsigned const off(zsize*(y*MESH_X_SIZE + x));
 		bool const check_z_thresh((display_mode & 0x01) && !is_mesh_disabled(x, y));
@@ -6,6 +6,10 @@
 #include "gl_ext_arb.h"
 #include "shaders.h"
 #include "model3d.h"
+#include <climits> // for INT_MAX, SHRT_MIN
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 
 unsigned const VOXELS_PER_DIV = 8; // 1024 for 128 vertex mesh
@@ -46,6 +50,12 @@ struct zval_avg {
 	//       so we can have at max 64M snowflakes.
 	//       However, we can get snow to stack up at a vertical edge so we need to clamp the count
 	void update(float zval) {if (c < MAX_COUNT) {++c; z += zval;}}
+	void merge(zval_avg const &v) { // add another partial sum, applying the same count clamp
+		unsigned const num_add(min((unsigned)v.c, (MAX_COUNT - c)));
+		if (num_add == 0) return;
+		z += ((num_add == v.c) ? v.z : v.z*float(num_add)/v.c); // scale by the fraction that fits
+		c += num_add;
+	}
 	bool valid() const {return (c > 0);}
 	float getz() const {return z/c;}
 };
@@ -81,8 +91,33 @@ struct voxel_z_pair {
 	zval_avg z;
 	voxel_z_pair() {}
 	voxel_z_pair(voxel_t const &v_, zval_avg const &z_=zval_avg()) : v(v_), z(z_) {}
+	bool operator<(voxel_z_pair const &vz) const {return (v < vz.v);}
 };
 
+typedef vector<voxel_z_pair> voxel_z_vect_t;
+
+#ifdef _OPENMP
+int get_max_snow_threads() {return omp_get_max_threads();}
+#else
+int get_max_snow_threads() {return 1;}
+#endif
+
+void merge_adj_voxels(voxel_z_vect_t &vals) { // vals must be sorted
+
+	if (vals.empty()) return;
+	size_t dix(0);
+
+	for (size_t i = 1; i < vals.size(); ++i) {
+		if (vals[i].v == vals[dix].v) {vals[dix].z.merge(vals[i].z);} else {vals[++dix] = vals[i];}
+	}
+	vals.resize(dix+1);
+}
+
+void sort_and_merge_voxels(voxel_z_vect_t &vals) {
+	sort(vals.begin(), vals.end());
+	merge_adj_voxels(vals);
+}
+
 
 struct strip_entry {
 	point p;
@@ -230,8 +265,22 @@ public:
 };
 
 
-class voxel_map : public map<voxel_t, zval_avg> { // must be a sorted map
+// flat array of voxels sorted by {x, y, z}; consumed entries are marked invalid (c=0) rather than erased
+class voxel_map {
+	voxel_z_vect_t vals;
+	size_t first_ix = 0, num_valid = 0; // all entries before first_ix are invalid
+
+	void remove(voxel_z_vect_t::iterator it) {assert(it->z.valid()); it->z.c = 0; --num_valid;}
 public:
+	bool empty() const {return (num_valid == 0);}
+	size_t size() const {return num_valid;}
+	void clear() {vals.clear(); first_ix = num_valid = 0;}
+	void swap(voxel_map &m) {vals.swap(m.vals); std::swap(first_ix, m.first_ix); std::swap(num_valid, m.num_valid);}
+	void add_unsorted(voxel_z_pair const &vz) {vals.push_back(vz);} // finalize() must be called after adding
+	void finalize();
+	void insert(voxel_t const &v, zval_avg const &z);
+	voxel_z_pair pop_front();
+	void merge_sorted_parts(vector<voxel_z_vect_t> const &parts);
 	zval_avg find_adj_z(voxel_t &v, zval_avg const &zv_old, float depth, voxel_map *cur_x_map=NULL);
 	bool read(char const *const fn);
 	bool write(char const *const fn) const;
@@ -246,16 +295,94 @@ struct data_block { // packed voxel_z_pair for read/write
 	void add_to_map(voxel_map &vmap) const {
 		voxel_t v;
 		for (unsigned i = 0; i < 3; ++i) v.p[i] = p[i];
-		vmap[v] = zval_avg(c, z);
+		vmap.add_unsorted(voxel_z_pair(v, zval_avg(c, z)));
 	}
-	void set_from_map_iter(voxel_map::const_iterator it) {
-		for (unsigned i = 0; i < 3; ++i) p[i] = it->first.p[i];
-		c = it->second.c;
-		z = it->second.z;
+	void set_from_pair(voxel_z_pair const &vz) {
+		for (unsigned i = 0; i < 3; ++i) p[i] = vz.v.p[i];
+		c = vz.z.c;
+		z = vz.z.z;
 	}
 };
 
 
+void voxel_map::finalize() {
+
+	sort_and_merge_voxels(vals);
+	first_ix  = 0;
+	num_valid = vals.size();
+}
+
+
+void voxel_map::insert(voxel_t const &v, zval_avg const &z) { // fast when v is at or near the end
+
+	assert(z.valid());
+	auto it(std::upper_bound(vals.begin(), vals.end(), voxel_z_pair(v)));
+
+	if (it != vals.begin() && (it-1)->v == v) { // existing voxel - overwrite
+		if (!(it-1)->z.valid()) {++num_valid;}
+		(it-1)->z = z;
+		first_ix  = min(first_ix, size_t(it - vals.begin() - 1));
+		return;
+	}
+	first_ix = min(first_ix, size_t(it - vals.begin()));
+	vals.insert(it, voxel_z_pair(v, z));
+	++num_valid;
+}
+
+
+voxel_z_pair voxel_map::pop_front() {
+
+	assert(!empty());
+	while (!vals[first_ix].z.valid()) {++first_ix; assert(first_ix < vals.size());}
+	voxel_z_pair const ret(vals[first_ix]);
+	remove(vals.begin() + first_ix);
+	++first_ix;
+	return ret;
+}
+
+
+// merge per-thread voxel lists, each sorted with no duplicates; ranges of x values are merged in parallel
+void voxel_map::merge_sorted_parts(vector<voxel_z_vect_t> const &parts) {
+
+	int xmin(INT_MAX), xmax(INT_MIN);
+
+	for (auto p = parts.begin(); p != parts.end(); ++p) {
+		if (p->empty()) continue;
+		xmin = min(xmin, (int)p->front().v.p[0]);
+		xmax = max(xmax, (int)p->back ().v.p[0]);
+	}
+	clear();
+	if (xmin > xmax) return; // no voxels
+	int const num_x(xmax - xmin + 1), num_ranges(min(num_x, 8*get_max_snow_threads()));
+	vector<voxel_z_vect_t> ranges(num_ranges);
+
+#pragma omp parallel for schedule(dynamic,1)
+	for (int r = 0; r < num_ranges; ++r) {
+		bool const is_last(r+1 == num_ranges);
+		voxel_z_pair const vs(voxel_t(xmin + (r*num_x)/num_ranges, SHRT_MIN, SHRT_MIN));
+		voxel_z_pair const ve(voxel_t(xmin + ((r+1)*num_x)/num_ranges, SHRT_MIN, SHRT_MIN)); // unused for the last range
+		voxel_z_vect_t &out(ranges[r]);
+
+		for (auto p = parts.begin(); p != parts.end(); ++p) {
+			auto const s(std::lower_bound(p->begin(), p->end(), vs)), e(is_last ? p->end() : std::lower_bound(s, p->end(), ve));
+			size_t const prev_sz(out.size());
+			out.insert(out.end(), s, e);
+			std::inplace_merge(out.begin(), out.begin()+prev_sz, out.end());
+		}
+		merge_adj_voxels(out);
+	} // for r
+	size_t tot_sz(0);
+	for (auto r = ranges.begin(); r != ranges.end(); ++r) {tot_sz += r->size();}
+	vals.reserve(tot_sz);
+
+	for (auto r = ranges.begin(); r != ranges.end(); ++r) {
+		vals.insert(vals.end(), r->begin(), r->end());
+		voxel_z_vect_t().swap(*r); // free memory
+	}
+	num_valid = vals.size();
+}
+
+
 // this tends to take a large fraction of the preprocessing time
 zval_avg voxel_map::find_adj_z(voxel_t &v, zval_avg const &zv_old, float depth, voxel_map *cur_x_map) {
 
@@ -265,16 +392,16 @@ zval_avg voxel_map::find_adj_z(voxel_t &v, zval_avg const &zv_old, float depth,
 	v2_s.p[2] -= min(Z_CHECK_RANGE, (int)v2_s.p[2]);
 	v2_e.p[2] += Z_CHECK_RANGE+1; // one past the end
 
-	for (iterator it = lower_bound(v2_s); it != end() && it->first < v2_e;) { // Note: no increment of it
-		zval_avg const z2(it->second);
-		assert(z2.valid());
-		if (zv_old.valid() && fabs(z2.getz() - zv_old.getz()) > depth) {++it; continue;} // delta z too large
-		voxel_t const v2(it->first);
+	for (auto it = std::lower_bound(vals.begin()+first_ix, vals.end(), voxel_z_pair(v2_s)); it != vals.end() && it->v < v2_e; ++it) {
+		zval_avg const z2(it->z);
+		if (!z2.valid()) continue; // already consumed
+		if (zv_old.valid() && fabs(z2.getz() - zv_old.getz()) > depth) continue; // delta z too large
+		voxel_t const v2(it->v);
 
 		if (cur_x_map) {
-			erase(it++);
-			(*cur_x_map)[v2] = z2;
-		} else {++it;}
+			remove(it);
+			cur_x_map->insert(v2, z2);
+		}
 		coord_type const dz(v2.p[2] - v.p[2]);
 		if (!res.valid() || abs(dz) < abs(best_dz)) {best_dz = dz;}
 		res.c += z2.c;
@@ -297,6 +424,8 @@ bool voxel_map::read(char const *const fn) {
 	size_t const sz_read(fread(&map_size, sizeof(unsigned), 1, fp));
 	assert(sz_read == 1);
 	data_block data;
+	clear();
+	vals.reserve(map_size);
 	
 	for (unsigned i = 0; i < map_size; ++i) {
 		size_t const nr(fread(&data, sizeof(data_block), 1, fp));
@@ -304,6 +433,7 @@ bool voxel_map::read(char const *const fn) {
 		data.add_to_map(*this);
 	}
 	checked_fclose(fp);
+	finalize(); // should already be sorted
 	return 1;
 }
 
@@ -321,8 +451,9 @@ bool voxel_map::write(char const *const fn) const {
 	assert(sz_write == 1);
 	data_block data;
 
-	for (const_iterator i = begin(); i != end(); ++i) {
-		data.set_from_map_iter(i);
+	for (auto i = vals.begin(); i != vals.end(); ++i) {
+		if (!i->z.valid()) continue; // consumed
+		data.set_from_pair(*i);
 		size_t const nw(fwrite(&data, sizeof(data_block), 1, fp));
 		assert(nw == 1);
 	}
@@ -495,11 +626,17 @@ void create_snow_map(voxel_map &vmap) {
 	vector3d wind_vector(0.25*(zval - zbottom)*wind);
 	wind_vector.z = 0.0; // zval is unused/ignored
 	all_models.build_cobj_trees(1);
+	// each thread accumulates hits into its own list, which is periodically sorted and merged to bound memory usage
+	vector<voxel_z_vect_t> thread_hits(get_max_snow_threads());
+	vector<size_t> merged_sz(thread_hits.size(), 0);
 	cout << "Snow accumulation progress (out of " << num_per_dim << "):     0";
 
 #pragma omp parallel for schedule(dynamic,1)
 	for (int y = 0; y < num_per_dim; ++y) {
-		if (omp_get_thread_num_3dw() == 0) {increment_printed_number(y);} // progress for thread 0
+		unsigned const thread_id(omp_get_thread_num_3dw());
+		assert(thread_id < thread_hits.size());
+		if (thread_id == 0) {increment_printed_number(y);} // progress for thread 0
+		voxel_z_vect_t &hits(thread_hits[thread_id]);
 		rand_gen_t rgen;
 		rgen.set_state(123, y);
 
@@ -537,14 +674,17 @@ void create_snow_map(voxel_map &vmap) {
 				}
 				++iter;
 			} // end while
-			if (!invalid) {
-				voxel_t const voxel(pos2);
-#pragma omp critical(snow_map_update)
-				vmap[voxel].update(pos2.z);
-			}
+			if (!invalid) {hits.push_back(voxel_z_pair(voxel_t(pos2), zval_avg(1, pos2.z)));}
 		} // for x
+		if (hits.size() > 2*merged_sz[thread_id] + 65536) { // sort and merge once the list has grown enough
+			sort_and_merge_voxels(hits);
+			merged_sz[thread_id] = hits.size();
+		}
 	} // for y
 	cout << endl;
+#pragma omp parallel for schedule(dynamic,1)
+	for (int i = 0; i < (int)thread_hits.size(); ++i) {sort_and_merge_voxels(thread_hits[i]);}
+	vmap.merge_sorted_parts(thread_hits);
 }
 
 
@@ -570,9 +710,9 @@ void create_snow_strips(voxel_map &vmap) {
 	snow_strips.reserve(8*num_xy_voxels/MAX_STRIP_LEN); // should be more than enough
 
 	while (!vmap.empty()) {
-		pair<voxel_t, zval_avg> start(*vmap.begin());
-		voxel_t v1(start.first);
-		zval_avg zv(start.second);
+		voxel_z_pair const start(vmap.pop_front());
+		voxel_t v1(start.v);
+		zval_avg zv(start.z);
 		assert(zv.valid());
 
 		if (v1.p[0] != last_x) { // we moved on to the next x-value, so update the x maps
@@ -582,8 +722,7 @@ void create_snow_strips(voxel_map &vmap) {
 			bool const did_ins(x_strip_map.insert(make_pair(last_x, (unsigned)snow_strips.size())).second);
 			assert(did_ins); // map should guarantee strictly increasing x
 		}
-		vmap.erase(vmap.begin());
-		cur_x_map[v1] = zv;
+		cur_x_map.insert(v1, zv);
 		vs.resize(0);
 		--v1.p[1];
 		vs.push_back(voxel_z_pair(v1)); // zero start
@@ -0,0 +1,224 @@
+// 3D World - Planet and Moon Surface Texture Cache: generates surface textures and heightmaps on worker threads and caches them by seed and size
+
+#include "3DWorld.h"
+#include "upsurface.h"
+#include "file_utils.h"
+#include <cstring> // for memcpy()
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+using std::string;
+using std::cerr;
+
+
+unsigned const SURFACE_TEX_CACHE_MAGIC   = 0x58455453; // "STEX"
+unsigned const SURFACE_TEX_CACHE_VERSION = 1; // increment when the file format or texture generation changes
+
+unsigned planet_tex_cache_mb(64); // size of the in-memory LRU cache
+string planet_tex_cache_dir; // if nonempty, generated surface textures are cached here
+
+surface_tex_cache_t surface_tex_cache;
+
+
+unsigned surface_color_gen_t::get_hash() const { // FNV-1a of the values that affect surface colors
+
+	unsigned hash(2166136261U);
+	auto add = [&hash](void const *v, unsigned sz) {for (unsigned i = 0; i < sz; ++i) {hash = (hash ^ ((unsigned char const *)v)[i])*16777619U;}};
+	add(a, sizeof(a));
+	add(b, sizeof(b));
+	float const vals[6] = {temp, water, lava, atmos, snow_thresh, wr_scale};
+	add(vals, sizeof(vals));
+	return hash;
+}
+
+surface_tex_key_t::surface_tex_key_t(rand_gen_t const &rgen, unsigned size_, surface_color_gen_t const &cgen, float mcut) :
+	rseed1(rgen.rseed1), rseed2(rgen.rseed2), size(size_)
+{
+	unsigned mcut_bits(0);
+	memcpy(&mcut_bits, &mcut, sizeof(float));
+	params_hash = cgen.get_hash()*31 + mcut_bits;
+}
+
+
+string get_surface_tex_cache_fn(surface_tex_key_t const &key) {
+	assert(!planet_tex_cache_dir.empty());
+	char key_str[64] = {0};
+	sprintf(key_str, "%08x_%08x_%u_%08x", unsigned(key.rseed1), unsigned(key.rseed2), key.size, key.params_hash);
+	return planet_tex_cache_dir + "/surface_" + key_str + ".bin";
+}
+
+bool read_surface_tex_file(string const &fn, surface_tex_key_t const &key, surface_tex_data_t &data) {
+	FILE *fp(fopen(fn.c_str(), "rb"));
+	if (fp == nullptr) return 0; // not yet cached
+	unsigned header[6] = {0};
+	unsigned const num_texels(key.size*key.size);
+	bool success(fread(header, sizeof(unsigned), 6, fp) == 6);
+	success &= (header[0] == SURFACE_TEX_CACHE_MAGIC && header[1] == SURFACE_TEX_CACHE_VERSION && header[2] == unsigned(key.rseed1) &&
+		header[3] == unsigned(key.rseed2) && header[4] == key.size && header[5] == key.params_hash);
+
+	if (success) {
+		data.tex_data.resize(3*num_texels);
+		data.heightmap.resize(num_texels);
+		success &= (fread(data.tex_data.data(), 1, data.tex_data.size(), fp) == data.tex_data.size());
+		success &= (fread(data.heightmap.data(), sizeof(float), num_texels, fp) == num_texels);
+		success &= (fgetc(fp) == EOF); // should be at the end of the file
+	}
+	fclose(fp);
+	if (!success) {cerr << "Warning: Ignoring invalid surface texture cache file " << fn << endl;}
+	return success;
+}
+
+bool write_surface_tex_file(string const &fn, surface_tex_key_t const &key, surface_tex_data_t const &data) {
+	if (!create_dir_if_needed(planet_tex_cache_dir)) return 0; // Note: may be called by multiple workers at once
+	string const tmp_fn(fn + ".tmp");
+	// write to a temp file and rename so that an interrupted write doesn't leave a partial cache file
+	FILE *fp(fopen(tmp_fn.c_str(), "wb"));
+	if (fp == nullptr) {cerr << "Warning: Failed to write surface texture cache file " << tmp_fn << endl; return 0;}
+	unsigned const header[6] = {SURFACE_TEX_CACHE_MAGIC, SURFACE_TEX_CACHE_VERSION, unsigned(key.rseed1), unsigned(key.rseed2), key.size, key.params_hash};
+	bool success(fwrite(header, sizeof(unsigned), 6, fp) == 6);
+	success &= (fwrite(data.tex_data.data(), 1, data.tex_data.size(), fp) == data.tex_data.size());
+	success &= (fwrite(data.heightmap.data(), sizeof(float), data.heightmap.size(), fp) == data.heightmap.size());
+	success &= (fclose(fp) == 0);
+	if (!success) {cerr << "Warning: Failed to write surface texture cache file " << tmp_fn << endl; remove(tmp_fn.c_str()); return 0;}
+	remove(fn.c_str()); // rename() fails on Windows if the destination exists
+	if (rename(tmp_fn.c_str(), fn.c_str()) != 0) {cerr << "Warning: Failed to rename surface texture cache file " << tmp_fn << endl; remove(tmp_fn.c_str()); return 0;}
+	return 1;
+}
+
+
+// Note: called on worker threads; surface is owned by the caller
+p_surface_tex_data surface_tex_cache_t::load_or_gen(surface_tex_key_t const &key, upsurface &surface, surface_color_gen_t const &cgen, float mcut) {
+
+	std::shared_ptr<surface_tex_data_t> data(new surface_tex_data_t);
+	string const fn(planet_tex_cache_dir.empty() ? string() : get_surface_tex_cache_fn(key));
+	if (!fn.empty() && read_surface_tex_file(fn, key, *data)) return data;
+	data->tex_data.resize(3*key.size*key.size);
+	surface.gen_texture_data_and_heightmap(cgen, mcut, data->tex_data.data(), key.size);
+	data->heightmap.swap(surface.heightmap);
+	if (!fn.empty()) {write_surface_tex_file(fn, key, *data);}
+	return data;
+}
+
+p_surface_tex_data surface_tex_cache_t::find(surface_tex_key_t const &key) {
+
+	drain_done();
+	auto it(lru_map.find(key));
+	if (it == lru_map.end()) return nullptr;
+	lru.splice(lru.begin(), lru, it->second); // move to the front
+	return it->second->second;
+}
+
+p_surface_tex_data surface_tex_cache_t::generate(surface_tex_key_t const &key, upsurface const &surface, surface_color_gen_t const &cgen, float mcut) {
+
+	upsurface temp_surface(surface.type); // don't modify the caller's surface
+	temp_surface.copy_noise_from(surface);
+	p_surface_tex_data const data(load_or_gen(key, temp_surface, cgen, mcut));
+	add(key, data);
+	return data;
+}
+
+void surface_tex_cache_t::request(surface_tex_key_t const &key, void const *owner, upsurface const &surface, surface_color_gen_t const &cgen, float mcut) {
+
+	if (lru_map.find(key) != lru_map.end()) return; // already cached
+	if (requested.find(key) != requested.end()) return; // already requested
+	remove_pending(owner); // the owner no longer needs its previous request, for example a different size
+	requested.insert(key);
+	if (workers.empty()) { // start on first use
+		kill_threads = 0;
+		unsigned const num_threads(max(1U, std::thread::hardware_concurrency()/4)); // background work; leave most cores for the main thread
+		for (unsigned i = 0; i < num_threads; ++i) {workers.emplace_back(&surface_tex_cache_t::worker_thread, this);}
+	}
+	{
+		std::lock_guard<std::mutex> lock(pending_mutex);
+		pending.push_back(new job_t(key, owner, surface, cgen, mcut));
+	}
+	pending_cv.notify_one();
+}
+
+void surface_tex_cache_t::remove_pending(void const *owner) { // main thread only
+
+	vector<job_t *> removed;
+	{
+		std::lock_guard<std::mutex> lock(pending_mutex);
+
+		for (auto i = pending.begin(); i != pending.end();) {
+			if ((*i)->owner == owner) {removed.push_back(*i); i = pending.erase(i);} else {++i;}
+		}
+	}
+	for (auto i = removed.begin(); i != removed.end(); ++i) {
+		requested.erase((*i)->key);
+		delete *i;
+	}
+}
+
+void surface_tex_cache_t::cancel(void const *owner) {
+	if (!workers.empty()) {remove_pending(owner);} // nothing can be pending if the workers haven't been started
+}
+
+void surface_tex_cache_t::add(surface_tex_key_t const &key, p_surface_tex_data const &data) {
+
+	assert(data != nullptr);
+	if (lru_map.find(key) != lru_map.end()) return; // already added
+	lru.emplace_front(key, data);
+	lru_map[key] = lru.begin();
+	mem_used += data->get_mem_usage();
+	size_t const max_mem(size_t(planet_tex_cache_mb) << 20);
+
+	while (mem_used > max_mem && lru.size() > 1) { // evict least recently used, but keep the entry we just added; in-use entries stay alive until released
+		mem_used -= lru.back().second->get_mem_usage();
+		lru_map.erase(lru.back().first);
+		lru.pop_back();
+	}
+}
+
+void surface_tex_cache_t::stop() {
+
+	if (workers.empty()) return;
+	{
+		std::lock_guard<std::mutex> lock(pending_mutex);
+		kill_threads = 1;
+	}
+	pending_cv.notify_all();
+	for (auto i = workers.begin(); i != workers.end(); ++i) {i->join();}
+	workers.clear();
+	for (auto i = pending.begin(); i != pending.end(); ++i) {delete *i;}
+	pending.clear();
+	drain_done(); // keep finished results
+	requested.clear();
+}
+
+void surface_tex_cache_t::worker_thread() {
+#ifdef _OPENMP
+	omp_set_num_threads(1); // run in the background with one core per worker
+#endif
+	while (1) {
+		job_t *job(nullptr);
+		{
+			std::unique_lock<std::mutex> lock(pending_mutex);
+			pending_cv.wait(lock, [this] {return (kill_threads || !pending.empty());});
+			if (kill_threads) return;
+			job = pending.back(); // most recent first, since older requests are more likely to be for objects that are no longer visible
+			pending.pop_back();
+		}
+		job->result = load_or_gen(job->key, job->surface, job->cgen, job->mcut);
+		push_done(job);
+	} // end while
+}
+
+void surface_tex_cache_t::push_done(job_t *job) {
+	job->next = done_head.load(std::memory_order_relaxed);
+	while (!done_head.compare_exchange_weak(job->next, job, std::memory_order_release, std::memory_order_relaxed)) {}
+}
+
+void surface_tex_cache_t::drain_done() { // main thread only
+
+	for (job_t *job = done_head.exchange(nullptr, std::memory_order_acquire); job != nullptr;) {
+		job_t *const next(job->next);
+		add(job->key, job->result);
+		requested.erase(job->key);
+		delete job;
+		job = next;
+	}
+}
+
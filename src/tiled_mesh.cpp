@@ -8,6 +8,9 @@
 #include "openal_wrap.h"
 #include "heightmap.h"
 #include "profiler.h"
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 
 bool const DEBUG_TILES        = 0;
@@ -24,6 +27,8 @@ float const DRAW_DIST_TILES   = 1.5;
 float const CREATE_DIST_TILES = 1.6;
 float const CLEAR_DIST_TILES  = 1.6;
 float const DELETE_DIST_TILES = 1.8;
+float const ASYNC_SYNC_DIST_TILES = 0.25; // tiles closer than this are generated synchronously in async mode so that the camera always has ground under it
+float const PREFETCH_FRAMES   = 30.0; // how far ahead to predict camera motion for async tile prefetch
 float const GRASS_LOD_SCALE   = 15.0; // smaller = more grass detail
 float const GRASS_DIST_SLOPE  = 0.25;
 float const GRASS_THRESH      = 1.6;
@@ -52,6 +57,7 @@ struct clear_area_t : public sphere_t {
 
 bool tt_lightning_enabled(0), check_tt_mesh_occlusion(1);
 unsigned inf_terrain_fire_mode(0); // none, increase height, decrease height
+unsigned async_tile_gen_threads(0); // 0 = generate tiles synchronously in the frame
 string read_hmap_modmap_fn, write_hmap_modmap_fn("heightmap.mod");
 hmap_brush_param_t cur_brush_param;
 tile_offset_t model3d_offset;
@@ -659,32 +665,68 @@ void tile_t::calc_shadows_for_light(unsigned l) {
 }
 
 
-void tile_t::proc_tile_queue(tile_t *init_tile, unsigned l) {
-
-	point const lpos(get_light_pos(l));
-	deque<tile_t *> tile_queue;
-	tile_queue.push_front(init_tile);
-	init_tile->in_queue = 1;
+int tile_t::get_shadow_wavefront(point const &lpos) const { // increases moving away from the light
+	tile_xy_pair const tp(get_tile_xy_pair());
+	return -(tp.x*((lpos.x < 0.0) ? -1 : 1) + tp.y*((lpos.y < 0.0) ? -1 : 1));
+}
 
-	while (!tile_queue.empty()) {
-		tile_t *t(tile_queue.back());
-		tile_queue.pop_back();
-		assert(t->in_queue);
-		t->in_queue = 0;
-		vector<float> const prev_sh_out[2] = {t->sh_out[l][0], t->sh_out[l][1]};
-		t->calc_shadows_for_light(l);
-		tile_xy_pair const tp(t->x1/int(t->size), t->y1/int(t->size));
-		tile_xy_pair const adj_tp2[2] = {tile_xy_pair((tp.x + ((lpos.x < 0.0) ? 1 : -1)), tp.y),
-										 tile_xy_pair(tp.x, (tp.y + ((lpos.y < 0.0) ? 1 : -1)))}; // away from the light source
+// tiles are processed in anti-diagonal wavefronts moving away from the light; each tile only reads the sh_out edges of its two neighbors
+// toward the light, which are in the previous wavefront, so all tiles in a wavefront can be computed in parallel;
+// if propagate=1, tiles away from the light are recomputed when one of their input edges has changed
+void tile_t::calc_shadows_wavefront(vector<tile_t *> const &init_tiles, unsigned l, bool propagate) {
 
-		for (unsigned d = 0; d < 2; ++d) { // d = tile adjacency dimension, shared edge is in !d
-			if (t->sh_out[l][!d] == prev_sh_out[!d]) continue; // unchanged, no update needed
-			tile_t *adj_tile(get_tile_from_xy(adj_tp2[d]));
-			if (adj_tile == NULL || adj_tile->is_distant || adj_tile->smask[l].empty() || adj_tile->in_queue) continue; // no adjacent tile, not initialized, or already in queue
-			tile_queue.push_front(adj_tile); // changed, push to adjacent tiles
-			adj_tile->in_queue = 1;
+	point const lpos(get_light_pos(l));
+	map<int, vector<tile_t *>> wavefronts; // sorted by wavefront index
+	vector<unsigned char> changed;
+
+	for (auto i = init_tiles.begin(); i != init_tiles.end(); ++i) {
+		if ((*i)->in_queue) continue; // duplicate
+		assert(!(*i)->smask[l].empty()); // caller must init
+		wavefronts[(*i)->get_shadow_wavefront(lpos)].push_back(*i);
+		(*i)->in_queue = 1;
+	}
+	for (auto w = wavefronts.begin(); w != wavefronts.end(); ++w) { // Note: may add wavefronts after w
+		vector<tile_t *> const &wf(w->second);
+
+		for (auto i = wf.begin(); i != wf.end(); ++i) { // serially calculate any uninitialized neighbors toward the light so that calc_shadows_for_light() won't recurse
+			if ((*i)->is_distant) continue;
+			tile_xy_pair const tp((*i)->get_tile_xy_pair());
+			tile_xy_pair const adj_tp[2] = {tile_xy_pair((tp.x + ((lpos.x < 0.0) ? -1 : 1)), tp.y),
+											tile_xy_pair(tp.x, (tp.y + ((lpos.y < 0.0) ? -1 : 1)))}; // toward the light source
+
+			for (unsigned d = 0; d < 2; ++d) {
+				tile_t *adj_tile(get_tile_from_xy(adj_tp[d]));
+				if (adj_tile == NULL || adj_tile->is_distant || !adj_tile->sh_out[l][!d].empty()) continue;
+				adj_tile->calc_shadows((l == LIGHT_SUN), (l == LIGHT_MOON), 1);
+			}
+		}
+		changed.resize(wf.size());
+
+#pragma omp parallel for schedule(dynamic,1) if (wf.size() > 1)
+		for (int i = 0; i < (int)wf.size(); ++i) {
+			tile_t *const t(wf[i]);
+			vector<float> const prev_sh_out[2] = {t->sh_out[l][0], t->sh_out[l][1]};
+			t->calc_shadows_for_light(l);
+			changed[i] = ((t->sh_out[l][0] != prev_sh_out[0]) ? 1 : 0) | ((t->sh_out[l][1] != prev_sh_out[1]) ? 2 : 0);
 		}
-	} // end while()
+		for (unsigned i = 0; i < wf.size(); ++i) {
+			tile_t *const t(wf[i]);
+			assert(t->in_queue);
+			t->in_queue = 0;
+			if (!propagate) continue;
+			tile_xy_pair const tp(t->get_tile_xy_pair());
+			tile_xy_pair const adj_tp2[2] = {tile_xy_pair((tp.x + ((lpos.x < 0.0) ? 1 : -1)), tp.y),
+											 tile_xy_pair(tp.x, (tp.y + ((lpos.y < 0.0) ? 1 : -1)))}; // away from the light source
+
+			for (unsigned d = 0; d < 2; ++d) { // d = tile adjacency dimension, shared edge is in !d
+				if (!(changed[i] & (1 << (!d)))) continue; // unchanged, no update needed
+				tile_t *adj_tile(get_tile_from_xy(adj_tp2[d]));
+				if (adj_tile == NULL || adj_tile->is_distant || adj_tile->smask[l].empty() || adj_tile->in_queue) continue; // no adjacent tile, not initialized, or already queued
+				wavefronts[w->first + 1].push_back(adj_tile); // changed, push to adjacent tiles in the next wavefront
+				adj_tile->in_queue = 1;
+			}
+		} // for i
+	} // for w
 }
 
 
@@ -699,7 +741,7 @@ void tile_t::calc_shadows(bool calc_sun, bool calc_moon, bool no_push) {
 		if (!smask[l].empty()) continue; // already calculated (cached)
 		smask[l].resize(zvals.size(), 0);
 		//if (normal_zmin < 1.0 && get_light_pos(l).get_norm().xy_mag() < normal_zmin) { // terrain slope lower than sun slope
-		if (no_push) {calc_shadows_for_light(l);} else {proc_tile_queue(this, l);}
+		if (no_push) {calc_shadows_for_light(l);} else {calc_shadows_wavefront(vector<tile_t *>(1, this), l, 1);}
 	}
 }
 
@@ -2079,7 +2121,188 @@ void lightning_strike_t::end_draw() const {
 // *** tile_draw_t ***
 
 
-tile_draw_t::tile_draw_t() : buildings_valid(0), tiles_gen_prev_frame(0), terrain_zmin(0.0), lod_renderer(USE_TREE_BILLBOARDS) {
+// *** tile_gen_pool_t ***
+
+tile_gen_pool_t::job_t::job_t(tile_t *tile_) : tile(tile_), txy(tile_->get_tile_xy_pair()), priority(0.0), canceled(0), next(nullptr) {
+	int const size(get_tile_size());
+	x1 = txy.x*size; y1 = txy.y*size; x2 = x1 + size; y2 = y1 + size;
+	radius = tile->calc_radius();
+}
+
+float tile_gen_pool_t::job_t::calc_priority(point const &camera, float create_dist) const {
+	// closest first; prefetched tiles that are out of range of the current camera are generated after all in-range tiles
+	return (p2p_dist_xy(camera, get_center_xy()) + ((get_rel_dist_to_pt(camera) >= create_dist) ? FAR_CLIP : 0.0));
+}
+
+void tile_gen_pool_t::start(unsigned num_threads) {
+	assert(num_threads > 0 && workers.empty());
+	kill_threads = 0;
+	for (unsigned i = 0; i < num_threads; ++i) {workers.emplace_back(&tile_gen_pool_t::worker_thread, this);}
+}
+
+void tile_gen_pool_t::stop() {
+	if (workers.empty()) return;
+	{
+		std::lock_guard<std::mutex> lock(pending_mutex);
+		kill_threads = 1;
+	}
+	pending_cv.notify_all();
+	for (auto i = workers.begin(); i != workers.end(); ++i) {i->join();}
+	workers.clear();
+	cancel_all(); // all jobs are either pending or done now
+}
+
+void tile_gen_pool_t::worker_thread() {
+#ifdef _OPENMP
+	omp_set_num_threads(1); // parallelism comes from generating multiple tiles at once; don't oversubscribe
+#endif
+	mesh_xy_grid_cache_t height_gen; // CPU mode only, so no GPU context is needed
+
+	while (1) {
+		job_t *job(nullptr);
+		{
+			std::unique_lock<std::mutex> lock(pending_mutex);
+			pending_cv.wait(lock, [this] {return (kill_threads || !pending.empty());});
+			if (kill_threads) return;
+			auto best(pending.begin());
+
+			for (auto i = pending.begin()+1; i != pending.end(); ++i) {
+				if ((*i)->priority < (*best)->priority) {best = i;}
+			}
+			job   = *best;
+			*best = pending.back();
+			pending.pop_back();
+			++num_running;
+		}
+		if (!job->canceled) {job->tile->create_zvals(height_gen, 0);}
+		if (!job->canceled && enable_tiled_mesh_ao) {job->tile->calc_mesh_ao_lighting();}
+		push_done(job); // canceled jobs are returned too, so that the main thread can free them
+		{
+			std::lock_guard<std::mutex> lock(pending_mutex);
+			assert(num_running > 0);
+			--num_running;
+		}
+		running_cv.notify_all();
+	} // end while
+}
+
+void tile_gen_pool_t::push_done(job_t *job) {
+	job->next = done_head.load(std::memory_order_relaxed);
+	while (!done_head.compare_exchange_weak(job->next, job, std::memory_order_release, std::memory_order_relaxed)) {}
+}
+
+void tile_gen_pool_t::drain_done() {
+	for (job_t *job = done_head.exchange(nullptr, std::memory_order_acquire); job != nullptr;) {
+		job_t *const next(job->next);
+		if (job->canceled) {delete_job(job, 1);} else {ready.push_back(job);}
+		job = next;
+	}
+}
+
+void tile_gen_pool_t::delete_job(job_t *job, bool delete_tile) {
+	auto it(jobs.find(job->txy));
+	assert(it != jobs.end() && it->second == job);
+	jobs.erase(it);
+	if (delete_tile) {delete job->tile;}
+	delete job;
+}
+
+void tile_gen_pool_t::submit(tile_t *tile, point const &camera, float create_dist) {
+	assert(is_running());
+	job_t *const job(new job_t(tile));
+	job->priority = job->calc_priority(camera, create_dist);
+	bool const did_ins(jobs.insert(make_pair(job->txy, job)).second);
+	assert(did_ins); // caller must check has_job()
+	{
+		std::lock_guard<std::mutex> lock(pending_mutex);
+		pending.push_back(job);
+	}
+	pending_cv.notify_one();
+}
+
+// returns true if a job for this tile or an adjacent tile exists in any state, including canceled jobs that may still be running;
+// these jobs may read heights in this tile, so its heightmap must not be modified
+bool tile_gen_pool_t::has_job_near(tile_xy_pair const &txy) const {
+	for (int dy = -1; dy <= 1; ++dy) {
+		for (int dx = -1; dx <= 1; ++dx) {
+			if (has_job(tile_xy_pair(txy.x + dx, txy.y + dy))) return 1;
+		}
+	}
+	return 0;
+}
+
+void tile_gen_pool_t::cancel(tile_xy_pair const &txy) {
+	auto it(jobs.find(txy));
+	if (it == jobs.end()) return; // no job
+	job_t *const job(it->second);
+	bool was_pending(0);
+	{
+		std::lock_guard<std::mutex> lock(pending_mutex);
+		auto pit(std::find(pending.begin(), pending.end(), job));
+		if (pit != pending.end()) {*pit = pending.back(); pending.pop_back(); was_pending = 1;}
+	}
+	if (was_pending) {delete_job(job, 1);} // not started, free it now
+	else {job->canceled = 1;} // running or done; freed when drained
+}
+
+// cancels and frees all jobs, waiting for running jobs to finish, so that no worker accesses a tile or the heightmap on return
+void tile_gen_pool_t::cancel_all() {
+	vector<job_t *> to_delete;
+	{
+		std::lock_guard<std::mutex> lock(pending_mutex);
+		to_delete.swap(pending);
+	}
+	for (auto i = to_delete.begin(); i != to_delete.end(); ++i) {delete_job(*i, 1);}
+	for (auto i = jobs.begin(); i != jobs.end(); ++i) {i->second->canceled = 1;} // running and ready jobs
+	{
+		std::unique_lock<std::mutex> lock(pending_mutex);
+		running_cv.wait(lock, [this] {return (num_running == 0);}); // canceled jobs stop early, so this should be fast
+	}
+	drain_done();
+	for (auto i = ready.begin(); i != ready.end(); ++i) {delete_job(*i, 1);}
+	ready.clear();
+	assert(jobs.empty());
+}
+
+// cancel jobs for tiles that are out of range of both the current and predicted camera positions, and update priorities of the rest
+void tile_gen_pool_t::update_jobs(point const &camera, point const &pred_camera, float create_dist, float cancel_dist) {
+	vector<tile_xy_pair> to_cancel;
+	{
+		std::lock_guard<std::mutex> lock(pending_mutex); // for priority updates
+
+		for (auto i = jobs.begin(); i != jobs.end(); ++i) {
+			job_t *const job(i->second);
+			if (job->canceled) continue;
+			if (job->get_rel_dist_to_pt(camera) >= cancel_dist && job->get_rel_dist_to_pt(pred_camera) >= cancel_dist) {to_cancel.push_back(i->first);}
+			else {job->priority = job->calc_priority(camera, create_dist);}
+		}
+	}
+	for (auto i = to_cancel.begin(); i != to_cancel.end(); ++i) {cancel(*i);}
+}
+
+// returns up to max_tiles finished tiles in priority order; the caller takes ownership
+void tile_gen_pool_t::get_ready_tiles(vector<tile_t *> &tiles, unsigned max_tiles) {
+	drain_done();
+	unsigned num_valid(0);
+
+	for (auto i = ready.begin(); i != ready.end(); ++i) { // remove jobs canceled after they were finished
+		if ((*i)->canceled) {delete_job(*i, 1);} else {ready[num_valid++] = *i;}
+	}
+	ready.resize(num_valid);
+	if (ready.size() > max_tiles) {sort(ready.begin(), ready.end(), [](job_t const *a, job_t const *b) {return (a->priority < b->priority);});}
+	unsigned const num_ret(min(max_tiles, (unsigned)ready.size()));
+
+	for (unsigned i = 0; i < num_ret; ++i) {
+		tiles.push_back(ready[i]->tile);
+		delete_job(ready[i], 0);
+	}
+	ready.erase(ready.begin(), ready.begin()+num_ret);
+}
+
+
+// *** tile_draw_t ***
+
+tile_draw_t::tile_draw_t() : buildings_valid(0), tiles_gen_prev_frame(0), terrain_zmin(0.0), lod_renderer(USE_TREE_BILLBOARDS), last_camera(all_zeros), camera_vel(zero_vector) {
 	assert(MESH_X_SIZE == MESH_Y_SIZE && X_SCENE_SIZE == Y_SCENE_SIZE);
 }
 
@@ -2090,6 +2313,7 @@ void tile_draw_t::clear(bool no_regen_buildings) {
 	to_draw.clear();
 	tiles.clear();
 	shadow_recomp_queue.clear();
+	tile_gen_pool.cancel_all();
 	if (!no_regen_buildings && !have_cities()) {buildings_valid = 0;} // can't regenerate buildings after cities and cars have been placed
 }
 
@@ -2102,6 +2326,14 @@ void tile_draw_t::free_compute_shader() {
 	for (auto i = height_gens.begin(); i != height_gens.end(); ++i) {i->clear_context();}
 }
 
+// places buildings and flattens the heightmap under them for this tile and its neighbors; must be called before submitting an async job for the tile,
+// since create_zvals() reads heights up to AO_RAY_LEN texels into adjacent tiles; building tiles near a job aren't removed, so they're never flattened again while it runs
+void create_buildings_tile_and_neighbors(int x, int y) {
+	for (int dy = -1; dy <= 1; ++dy) {
+		for (int dx = -1; dx <= 1; ++dx) {create_buildings_tile(x+dx, y+dy, 1);}
+	}
+}
+
 float tile_draw_t::update(float &min_camera_dist) { // view-independent updates; returns terrain zmin
 
 	//timer_t timer("TT Update");
@@ -2138,8 +2370,33 @@ float tile_draw_t::update(float &min_camera_dist) { // view-independent updates;
 	bool const create_buildings_first(FLATTEN_BUILDING_TILE && using_tiled_terrain_hmap_tex());
 	unsigned num_erased(0);
 	min_camera_dist = FAR_DISTANCE;
+	bool const gpu_mode(mesh_gen_mode >= MGEN_SIMPLEX_GPU);
+	// async mode can't use GPU height generation or run while the mesh is being edited, and the first set of tiles is created synchronously
+	bool const use_async(async_tile_gen_threads > 0 && !gpu_mode && inf_terrain_fire_mode == FM_NONE && !tiles.empty());
+	vector3d const camera_delta(camera - last_camera);
+	last_camera = camera;
+	if (camera_delta.mag() > get_scaled_tile_radius()) {camera_vel = zero_vector;} // teleport or first frame
+	else {camera_vel = 0.9f*camera_vel + 0.1f*camera_delta;} // smoothed
+	vector3d pred_delta(PREFETCH_FRAMES*camera_vel);
+	pred_delta.z = 0.0;
+	float const max_pred_dist(get_scaled_tile_radius());
+	if (pred_delta.mag() > max_pred_dist) {pred_delta *= max_pred_dist/pred_delta.mag();}
+	point const pred_cpos(cpos + pred_delta); // in camera space, like tile centers
 	// Note: we may want to calculate distant low-res or larger tiles when the camera is high above the mesh
 
+	if (use_async) {
+		if (!tile_gen_pool.is_running()) {tile_gen_pool.start(async_tile_gen_threads);}
+		vector<tile_t *> ready;
+		tile_gen_pool.get_ready_tiles(ready, max_tile_gen_per_frame);
+
+		for (auto i = ready.begin(); i != ready.end(); ++i) {
+			// drop if the tile was generated synchronously in the meantime, or if it's already out of range
+			if (tiles.find((*i)->get_tile_xy_pair()) != tiles.end() || (*i)->get_rel_dist_to_camera() >= DELETE_DIST_TILES) {delete *i;}
+			else {insert_tile(*i);}
+		}
+	}
+	else if (tile_gen_pool.num_jobs() > 0) {tile_gen_pool.cancel_all();} // switched out of async mode
+
 	if (!to_gen_zvals.empty()) {
 		//ostringstream oss; oss << "Gen " << to_gen_zvals.size() << " tiles (wait)"; timer_t timer(oss.str());
 		assert(to_gen_zvals.size() <= height_gens.size());
@@ -2163,17 +2420,45 @@ float tile_draw_t::update(float &min_camera_dist) { // view-independent updates;
 			tile_xy_pair const txy(x, y);
 			if (tiles.find(txy) != tiles.end()) continue; // already exists
 			tile_t tile(get_tile_size(), x, y);
-			if (tile.get_rel_dist_to_camera() >= CREATE_DIST_TILES) continue; // too far away to create
+			float const rel_dist(tile.get_rel_dist_to_camera());
+			if (rel_dist >= CREATE_DIST_TILES) continue; // too far away to create
+
+			if (use_async) {
+				if (rel_dist > ASYNC_SYNC_DIST_TILES) { // generate in the background
+					if (tile_gen_pool.has_job(txy)) continue; // already queued
+					if (create_buildings_first) {create_buildings_tile_and_neighbors(x, y);}
+					tile_gen_pool.submit(new tile_t(tile), cpos, CREATE_DIST_TILES);
+					continue;
+				}
+				tile_gen_pool.cancel(txy); // needed now, generate it below instead
+			}
 			tile_t *new_tile(new tile_t(tile));
 			to_gen_zvals.push_back(make_pair(new_tile->get_draw_priority(), new_tile));
 			// in this mode, we need to place buildings and flatten the heightmap before calculating tile heights
 			if (create_buildings_first) {create_buildings_tile(x, y, 1);}
 		} // for x
 	} // for y
+	if (use_async) {
+		int const ptoffx(int(0.5*(camera.x + pred_delta.x)/X_SCENE_SIZE)), ptoffy(int(0.5*(camera.y + pred_delta.y)/Y_SCENE_SIZE));
+
+		if (ptoffx != toffx || ptoffy != toffy) { // prefetch tiles along the predicted camera path
+			for (int y = -tile_radius + ptoffy; y <= tile_radius + ptoffy; ++y) {
+				for (int x = -tile_radius + ptoffx; x <= tile_radius + ptoffx; ++x) {
+					tile_xy_pair const txy(x, y);
+					if (tiles.find(txy) != tiles.end() || tile_gen_pool.has_job(txy)) continue; // already exists or queued
+					tile_t tile(get_tile_size(), x, y);
+					if (tile.get_rel_dist_to_pt(pred_cpos) >= CREATE_DIST_TILES) continue; // not needed soon
+					if (tile.get_rel_dist_to_camera() >= DELETE_DIST_TILES) continue; // would be deleted before it's used
+					if (create_buildings_first) {create_buildings_tile_and_neighbors(x, y);}
+					tile_gen_pool.submit(new tile_t(tile), cpos, CREATE_DIST_TILES);
+				}
+			}
+		}
+		tile_gen_pool.update_jobs(cpos, pred_cpos, CREATE_DIST_TILES, DELETE_DIST_TILES);
+	}
 	//if (to_gen_zvals.size() < max_cpu_tiles) {to_gen_zvals.clear();} // block until at least max_cpu_tiles tiles to generate (lower average gen time, but causes more slow frames/lag)
 	unsigned const num_to_gen(to_gen_zvals.size());
 	unsigned gen_this_frame(min(num_to_gen, max_tile_gen_per_frame));
-	bool const gpu_mode(mesh_gen_mode >= MGEN_SIMPLEX_GPU);
 	
 	// to balance tile gen time across frames, generate a number of tiles equal to the average of this frame and the previous frame
 	if (gen_this_frame > 1 && gen_this_frame < max_tile_gen_per_frame && inf_terrain_fire_mode == FM_NONE) { // disable this mode when editing mesh height to prevent visual artifacts
@@ -2218,7 +2503,7 @@ float tile_draw_t::update(float &min_camera_dist) { // view-independent updates;
 			if (!camera_surf_collide) {min_camera_dist = min(min_camera_dist, i->second->get_min_dist_to_pt(cpos, 0, 0));}
 			create_buildings_tile(i->first.x, i->first.y, 0); // create, or re-create if create_buildings_first; should already be flat
 		}
-		else if (rel_dist > CLEAR_DIST_TILES) {remove_buildings_tile(i->first.x, i->first.y);}
+		else if (rel_dist > CLEAR_DIST_TILES && !tile_gen_pool.has_job_near(i->first)) {remove_buildings_tile(i->first.x, i->first.y);} // re-creating it would flatten again
 	}
 	if (DEBUG_TILES && (tiles.size() != init_tiles || num_erased > 0)) {
 		cout << "update: tiles: " << init_tiles << " to " << tiles.size() << ", erased: " << num_erased << endl;
@@ -2234,9 +2519,9 @@ float tile_draw_t::update(float &min_camera_dist) { // view-independent updates;
 	if (mesh_shadows_enabled() && (sun_change || moon_change) && shadow_recomp_queue.empty()) { // light source change
 		if (auto_time_adv && !moon_change) { // auto time advance shadow map update for sun change only - triger a shadow recompute
 			for (auto i = tiles.begin(); i != tiles.end(); ++i) { // triger a shadow recompute
-				shadow_recomp_queue.emplace_back(-p2p_dist(sun_pos, i->second->get_center()), i->second->get_tile_xy_pair());
+				shadow_recomp_queue.emplace_back(-i->second->get_shadow_wavefront(sun_pos), i->second->get_tile_xy_pair());
 			}
-			sort(shadow_recomp_queue.begin(), shadow_recomp_queue.end()); // sort by decreasing distance to light source
+			sort(shadow_recomp_queue.begin(), shadow_recomp_queue.end()); // sort by decreasing wavefront index, so that the back is closest to the light source
 		}
 		else { // invalidate and recompute all shadows on moon change (infrequent) or user sun pos change
 			for (tile_map::iterator i = tiles.begin(); i != tiles.end(); ++i) {i->second->clear_shadows(sun_change, moon_change);}
@@ -2244,17 +2529,29 @@ float tile_draw_t::update(float &min_camera_dist) { // view-independent updates;
 		last_sun  = sun_pos;
 		last_moon = moon_pos;
 	}
-	unsigned num_shadow_updates = 12; // hard max per frame
-
-	while (!shadow_recomp_queue.empty() && num_shadow_updates > 0) { // perform some queued shadow map updates, starting at light source
-		tile_xy_pair const tp(shadow_recomp_queue.back().second);
-		shadow_recomp_queue.pop_back();
-		tile_map::const_iterator it(tiles.find(tp));
-		if (it == tiles.end()) continue; // tile no longer exists/was deleted
-		// recompute shadows; tiles feeding in (closer to the light) should have already been calculated
-		it->second->clear_shadows(1, 0); // update sun shadows only
-		it->second->check_shadow_map_and_normal_texture(1); // no_push=1
-		--num_shadow_updates;
+	if (!shadow_recomp_queue.empty()) { // perform some queued shadow map updates, one wavefront at a time starting at light source
+#ifdef _OPENMP
+		unsigned const num_shadow_updates(12*omp_get_max_threads()); // max per frame, but always finish the current wavefront
+#else
+		unsigned const num_shadow_updates(12);
+#endif
+		vector<tile_t *> to_update;
+		float last_wavefront(0.0);
+
+		while (!shadow_recomp_queue.empty() && (to_update.size() < num_shadow_updates || shadow_recomp_queue.back().first == last_wavefront)) {
+			last_wavefront = shadow_recomp_queue.back().first;
+			tile_xy_pair const tp(shadow_recomp_queue.back().second);
+			shadow_recomp_queue.pop_back();
+			tile_map::const_iterator it(tiles.find(tp));
+			if (it == tiles.end()) continue; // tile no longer exists/was deleted
+			tile_t *const tile(it->second.get());
+			tile->clear_shadows(1, 0); // update sun shadows only
+			tile->init_smask(LIGHT_SUN);
+			to_update.push_back(tile);
+		}
+		// recompute shadows; tiles feeding in (closer to the light) have already been calculated in previous wavefronts
+		tile_t::calc_shadows_wavefront(to_update, LIGHT_SUN, 0); // no propagation, since the following tiles are in the queue
+		for (auto i = to_update.begin(); i != to_update.end(); ++i) {(*i)->check_shadow_map_and_normal_texture(1);} // texture upload; no_push=1
 	}
 	// Note: we could regen trees and scenery if water was just turned on to remove underwater vegetation
 	//if ((GET_TIME_MS() - timer1) > 100) {PRINT_TIME("Tiled Terrain Update");}
@@ -13,6 +13,10 @@
 #include "tree_3dw.h"
 #include "shadow_map.h"
 #include "animals.h"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
 
 
 bool const ENABLE_TREE_LOD    = 1; // faster but has popping artifacts
@@ -294,7 +298,9 @@ public:
 	// *** shadows ***
 	void calc_mesh_ao_lighting();
 	void calc_shadows_for_light(unsigned l);
-	static void proc_tile_queue(tile_t *init_tile, unsigned l);
+	int get_shadow_wavefront(point const &lpos) const;
+	void init_smask(unsigned l) {if (smask[l].empty()) {smask[l].resize(zvals.size(), 0);}}
+	static void calc_shadows_wavefront(vector<tile_t *> const &init_tiles, unsigned l, bool propagate);
 	void calc_shadows(bool calc_sun, bool calc_moon, bool no_push=0);
 
 	tile_xy_pair get_tile_xy_pair(int dx=0, int dy=0) const {
@@ -328,9 +334,10 @@ public:
 	void create_or_update_weight_tex();
 	void calc_avg_mesh_color();
 
-	float get_rel_dist_to_camera(bool xy_dist=1) const {
-		return max(0.0f, (xy_dist ? p2p_dist_xy(get_camera_pos(), get_center()) : p2p_dist(get_camera_pos(), get_center())) - radius)/get_scaled_tile_radius();
+	float get_rel_dist_to_pt(point const &pt, bool xy_dist=1) const {
+		return max(0.0f, (xy_dist ? p2p_dist_xy(pt, get_center()) : p2p_dist(pt, get_center())) - radius)/get_scaled_tile_radius();
 	}
+	float get_rel_dist_to_camera(bool xy_dist=1) const {return get_rel_dist_to_pt(get_camera_pos(), xy_dist);}
 	float get_bsphere_radius_inc_water() const;
 	bool use_as_occluder() const;
 	bool mesh_sphere_intersect(point const &pos, float rradius) const;
@@ -407,6 +414,53 @@ public:
 }; // tile_t
 
 
+// background generation of tile zvals and AO on worker threads; used for CPU mesh generation modes
+class tile_gen_pool_t {
+
+	struct job_t {
+		tile_t *tile;
+		tile_xy_pair txy;
+		int x1, y1, x2, y2; // copies of tile bounds, so that the main thread doesn't need to read the tile while it's being generated
+		float radius, priority; // priority is only modified with the mutex locked
+		std::atomic<bool> canceled;
+		job_t *next; // in done stack
+
+		job_t(tile_t *tile_);
+		point get_center_xy() const {return point(get_xval(((x1+x2)>>1) + (xoff - xoff2)), get_yval(((y1+y2)>>1) + (yoff - yoff2)), 0.0);}
+		float get_rel_dist_to_pt(point const &pt) const {return max(0.0f, p2p_dist_xy(pt, get_center_xy()) - radius)/get_scaled_tile_radius();}
+		float calc_priority(point const &camera, float create_dist) const;
+	};
+	vector<std::thread> workers;
+	std::mutex pending_mutex;
+	std::condition_variable pending_cv, running_cv;
+	vector<job_t *> pending; // not yet started; guarded by pending_mutex
+	unsigned num_running; // jobs taken by workers that have not yet been pushed to done_head; guarded by pending_mutex
+	std::atomic<job_t *> done_head; // lock-free stack of finished or canceled jobs: pushed by workers, drained by the main thread
+	bool kill_threads;
+	map<tile_xy_pair, job_t *> jobs; // all jobs that have not been drained; main thread only
+	vector<job_t *> ready; // finished jobs whose tiles have not yet been handed out; main thread only
+
+	void worker_thread();
+	void push_done(job_t *job);
+	void drain_done();
+	void delete_job(job_t *job, bool delete_tile);
+public:
+	tile_gen_pool_t() : num_running(0), done_head(nullptr), kill_threads(0) {}
+	~tile_gen_pool_t() {stop();}
+	bool is_running() const {return !workers.empty();}
+	unsigned num_jobs() const {return (unsigned)jobs.size();}
+	bool has_job(tile_xy_pair const &txy) const {return (jobs.find(txy) != jobs.end());}
+	bool has_job_near(tile_xy_pair const &txy) const;
+	void start(unsigned num_threads);
+	void stop();
+	void submit(tile_t *tile, point const &camera, float create_dist);
+	void cancel(tile_xy_pair const &txy);
+	void cancel_all();
+	void update_jobs(point const &camera, point const &pred_camera, float create_dist, float cancel_dist);
+	void get_ready_tiles(vector<tile_t *> &tiles, unsigned max_tiles);
+};
+
+
 class tile_draw_t : public indexed_vbo_manager_t {
 
 	typedef map<tile_xy_pair, std::unique_ptr<tile_t> > tile_map;
@@ -429,6 +483,9 @@ class tile_draw_t : public indexed_vbo_manager_t {
 	crack_ibuf_t crack_ibuf;
 	tile_shadow_map_manager smap_manager;
 	vector<pair<float, tile_xy_pair>> shadow_recomp_queue;
+	tile_gen_pool_t tile_gen_pool;
+	point last_camera;
+	vector3d camera_vel; // smoothed camera motion per frame, used to prefetch tiles
 
 	struct occluder_pts_t {
 		point cube_pts[4];
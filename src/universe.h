@@ -198,11 +198,8 @@ struct rotated_obj { // size = 48
 };
 
 
-class urev_body : public uobj_solid, public color_gen_class, public rotated_obj { // size = 360
+class urev_body : public uobj_solid, public rotated_obj { // size = 360
 
-	// for textures/colors
-	unsigned char a[3], b[3];
-	
 protected:
 	void calc_snow_thresh();
 
@@ -210,14 +207,13 @@ public:
 	bool gas_giant; // planets only?
 	int owner;
 	unsigned orbiting_refs, tid, tsize;
-	float orbit, rot_rate, rev_rate, atmos, water, lava, resources, cloud_density, cloud_scale, wr_scale, snow_thresh, population, prev_pop;
+	float orbit, rot_rate, rev_rate, atmos, water, lava, resources, cloud_density, cloud_scale, snow_thresh, population, prev_pop;
 	vector3d rev_axis, v_orbit, orbit_scale;
 	std::shared_ptr<upsurface> surface;
 	string comment;
 
 	urev_body(char type_) : uobj_solid(type_), gas_giant(0), owner(NO_OWNER), orbiting_refs(0), tid(0), tsize(0), orbit(0.0), rot_rate(0.0), rev_rate(0.0), atmos(0.0),
-		water(0.0), lava(0.0), resources(0.0), cloud_density(1.0), cloud_scale(1.0), wr_scale(1.0), snow_thresh(0.0), population(0.0), prev_pop(0.0), orbit_scale(all_ones)
-	{a[0] = a[1] = a[2] = b[0] = b[1] = b[2] = 0;}
+		water(0.0), lava(0.0), resources(0.0), cloud_density(1.0), cloud_scale(1.0), snow_thresh(0.0), population(0.0), prev_pop(0.0), orbit_scale(all_ones) {}
 	virtual ~urev_body() {unset_owner();}
 	void gen_rotrev();
 	template<typename T> bool create_orbit(vector<T> const &objs, int i, point const &pos0, vector3d const &raxis,
@@ -226,7 +222,6 @@ public:
 	void check_gen_texture(unsigned size);
 	void create_rocky_texture(unsigned size);
 	void create_gas_giant_texture();
-	void gen_texture_data_and_heightmap(unsigned char *data, unsigned size);
 	bool has_heightmap() const {return (surface != nullptr && surface->has_heightmap() && !use_procedural_shader());}
 	bool surface_test(float rad, point const &p, float &coll_r, bool simple) const;
 	float get_radius_at(point const &p, bool exact=0) const;
@@ -251,7 +246,7 @@ public:
 	bool use_procedural_shader() const;
 	bool use_vert_shader_offset() const;
 	void upload_colors_to_shader(shader_t &s) const;
-	void get_surface_color(unsigned char *data, float val, float phi) const;
+	surface_color_gen_t get_color_gen() const;
 	bool draw(point_d pos_, ushader_group &usg, pt_line_drawer planet_plds[2], shadow_vars_t const &svars, bool use_light2, bool enable_text_tag);
 	void draw_surface(point_d const &pos_, float size, int ndiv);
 	void show_colonizable_liveable(point const &pos_, float radius0, ushader_group &usg) const;
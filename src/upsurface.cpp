@@ -5,12 +5,15 @@
 #include "upsurface.h"
 #include "universe.h"
 #include "sinf.h"
+#include "sine_simd.h"
 #include "textures.h"
 
 
 float const M_ATTEN_FACTOR = 0.5;
 float const F_ATTEN_FACTOR = 0.4;
 
+bool benchmark_sine_noise(0), sine_noise_benchmark_done(0);
+
 extern int display_mode;
 
 
@@ -60,31 +63,92 @@ void noise_gen_3d::gen_xyz_vals(point const &start, vector3d const &step, unsign
 
 float noise_gen_3d::get_val(unsigned x, unsigned y, unsigned z, vector<float> const xyz_vals[3]) const {
 
-	float val(0.0);
 	unsigned const xyz[3] = {x, y, z};
 	UNROLL_3X(assert(num_sines*xyz[i_]+num_sines <= xyz_vals[i_].size()););
 	float const *const xv(&xyz_vals[0][x*num_sines]);
 	float const *const yv(&xyz_vals[1][y*num_sines]);
 	float const *const zv(&xyz_vals[2][z*num_sines]);
-	for (unsigned k = 0; k < num_sines; ++k) {val += xv[k]*yv[k]*zv[k];} // performance critical
-	return val;
+	return sum_of_products(xv, yv, zv, num_sines); // performance critical
 }
 
 
 float noise_gen_3d::get_val(point const &pt) const {
 
+	sine_terms_t terms(rdata, NUM_SINE_PARAMS, rdata, NUM_SINE_PARAMS, num_sines);
+	terms.add_dim(1, 2); // x
+	terms.add_dim(3, 4); // y
+	terms.add_dim(5, 6); // z
+	float const xyz[3] = {pt.x, pt.y, pt.z};
+	return eval_sine_terms(terms, xyz); // same sin() approximation as get_vals(), so that single and batched queries agree
+}
+
+
+// evaluates many points at once, which is much faster than calling get_val(pt) for each point when SIMD is available
+void noise_gen_3d::get_vals(point const *pts, unsigned num, float *vals) const {
+
+	unsigned const BLOCK_SIZE = 64;
+	sine_terms_t terms(rdata, NUM_SINE_PARAMS, rdata, NUM_SINE_PARAMS, num_sines);
+	terms.add_dim(1, 2); // x
+	terms.add_dim(3, 4); // y
+	terms.add_dim(5, 6); // z
+	float xyz[3][BLOCK_SIZE];
+	float const *const pos[3] = {xyz[0], xyz[1], xyz[2]};
+
+	for (unsigned i = 0; i < num; i += BLOCK_SIZE) {
+		unsigned const n(min(BLOCK_SIZE, num-i));
+		for (unsigned j = 0; j < n; ++j) {UNROLL_3X(xyz[i_][j] = pts[i+j][i_];)} // transpose points into x, y, and z arrays
+		eval_sine_terms(terms, pos, n, vals+i);
+	}
+}
+
+
+// the previous scalar version of get_val(pt), used as the reference for run_sine_noise_benchmark()
+float get_val_scalar_ref(noise_gen_3d const &ngen, point const &pt) {
+
 	float val(0.0);
 
-	for (unsigned k = 0; k < num_sines; ++k) { // performance critical
+	for (unsigned k = 0; k < ngen.num_sines; ++k) {
 		unsigned const index2(NUM_SINE_PARAMS*k);
-		float const x(SINF(rdata[index2+1]*pt.x + rdata[index2+2])); // faster sinf() calls
-		float const y(SINF(rdata[index2+3]*pt.y + rdata[index2+4]));
-		float const z(SINF(rdata[index2+5]*pt.z + rdata[index2+6]));
-		val += rdata[index2]*x*y*z;
+		float const x(SINF(ngen.rdata[index2+1]*pt.x + ngen.rdata[index2+2])); // faster sinf() calls
+		float const y(SINF(ngen.rdata[index2+3]*pt.y + ngen.rdata[index2+4]));
+		float const z(SINF(ngen.rdata[index2+5]*pt.z + ngen.rdata[index2+6]));
+		val += ngen.rdata[index2]*x*y*z;
 	}
 	return val;
 }
 
+void run_sine_noise_benchmark(noise_gen_3d const &ngen) {
+
+	unsigned const NUM_PTS = (1<<18);
+	rand_gen_t rgen;
+	vector<point> pts(NUM_PTS);
+	vector<float> ref_vals(NUM_PTS), simd_vals(NUM_PTS);
+	for (auto i = pts.begin(); i != pts.end(); ++i) {*i = rgen.signed_rand_vector_norm();} // points on the unit sphere, the same as for planet surfaces
+	int const start_ms(GET_TIME_MS());
+	for (unsigned i = 0; i < NUM_PTS; ++i) {ref_vals[i] = get_val_scalar_ref(ngen, pts[i]);}
+	int const ref_ms(GET_TIME_MS());
+	ngen.get_vals(pts.data(), NUM_PTS, simd_vals.data());
+	int const simd_ms(GET_TIME_MS());
+	double ref_err(0.0), simd_err(0.0), max_ref_err(0.0), max_simd_err(0.0), max_val(0.0);
+
+	for (unsigned i = 0; i < NUM_PTS; ++i) { // compare to a double precision reference
+		double val(0.0);
+
+		for (unsigned k = 0; k < ngen.num_sines; ++k) {
+			float const *const rd(ngen.rdata + NUM_SINE_PARAMS*k);
+			val += double(rd[0])*sin(double(rd[1])*pts[i].x + rd[2])*sin(double(rd[3])*pts[i].y + rd[4])*sin(double(rd[5])*pts[i].z + rd[6]);
+		}
+		double const re(fabs(ref_vals[i] - val)), se(fabs(simd_vals[i] - val));
+		ref_err  += re; max_ref_err  = max(max_ref_err,  re);
+		simd_err += se; max_simd_err = max(max_simd_err, se);
+		max_val   = max(max_val, fabs(val));
+	}
+	double const ref_secs(0.001*max(1, (ref_ms - start_ms))), simd_secs(0.001*max(1, (simd_ms - ref_ms)));
+	cout << "Sine noise benchmark: " << NUM_PTS << " points, " << ngen.num_sines << " sines: scalar " << 1.0E-6*NUM_PTS/ref_secs << " Mpts/s, "
+		 << sine_simd_funcs.isa_name << " SIMD " << 1.0E-6*NUM_PTS/simd_secs << " Mpts/s (" << ref_secs/simd_secs << "x); max/mean error relative to max value " << max_val
+		 << ": scalar " << max_ref_err/max_val << "/" << ref_err/(NUM_PTS*max_val) << ", SIMD " << max_simd_err/max_val << "/" << simd_err/(NUM_PTS*max_val) << endl;
+}
+
 
 void upsurface::gen(float mag, float freq, unsigned ntests, float mm_scale) {
 
@@ -151,8 +215,7 @@ float upsurface::get_height_at(point const &pt, bool use_cache) const {
 		cache_index = ce.hash()%CACHE_SIZE;
 		if (val_cache[cache_index].p == pt) {return val_cache[cache_index].val;}
 	}
-	float val(get_val(pt)); // performance critical
-	val = 0.5*(max(-1.0f, min(1.0f, (1.5f/max_mag)*val)) + 1.0); // duplicate code
+	float const val(scale_height(get_val(pt))); // performance critical
 	
 	if (use_cache) {
 		ce.val = val;
@@ -162,6 +225,14 @@ float upsurface::get_height_at(point const &pt, bool use_cache) const {
 }
 
 
+// Note: doesn't use the cache
+void upsurface::get_heights_at(point const *pts, unsigned num, float *heights) const {
+
+	get_vals(pts, num, heights);
+	for (unsigned i = 0; i < num; ++i) {heights[i] = scale_height(heights[i]);}
+}
+
+
 void upsurface::setup_draw_sphere(point const &pos, float radius, float dp, int ndiv, float const *const pmap) {
 
 	sd.set_data(pos, radius, ndiv, pmap, dp, (pmap ? NULL : this));
@@ -183,29 +254,30 @@ void urev_body::gen_surface() {
 	float mag(SURFACE_HEIGHT*radius), freq(((type == UTYPE_MOON) ? 1.5 : 1.0)*INITIAL_FREQ*TWO_PI);
 	surface->rgen = rgen; // just copy it?
 	surface->gen(mag, freq);
+
+	if (benchmark_sine_noise && !sine_noise_benchmark_done) { // run once, using the first planet or moon
+		run_sine_noise_benchmark(*surface);
+		sine_noise_benchmark_done = 1;
+	}
 }
 
 
 // Note: many planet/sphere renderers use a texture with width = 2*height, which yields square regions at the equator
 // here we use a square texture for simplicity, so that this code can be shared with (and be similar to)
 // the rest of the 3DWorld sphere generation and drawing code; it also produces more uniform regions near the poles
-void urev_body::gen_texture_data_and_heightmap(unsigned char *data, unsigned size) {
+// Note: may be called on a background thread, so must not modify any shared state
+void upsurface::gen_texture_data_and_heightmap(color_gen_class const &cgen, float mcut, unsigned char *data, unsigned size) {
 
 	//RESET_TIME;
-	get_colors(a, b);
 	unsigned size_p2(0);
 	for (unsigned sz = size; sz > 1; sz >>= 1, ++size_p2);
 	assert((1U<<size_p2) == size); // size must be a power of 2
-	assert(surface != nullptr);
 	unsigned const table_size(MAX_TEXTURE_SIZE << 1); // larger is more accurate
-	static float xtable[TOT_NUM_SINES*table_size], ytable[TOT_NUM_SINES*table_size];
-	surface->setup(size, max(water, lava), 1); // use_heightmap=1
-	unsigned const num_sines(surface->num_sines);
-	float const *const rdata(surface->rdata);
-	float const mt2(0.5*(table_size-1)), scale(1.5/surface->max_mag);
+	setup(size, mcut, 1); // use_heightmap=1
+	vector<float> xtable(num_sines*table_size), ytable(num_sines*table_size);
+	float const mt2(0.5*(table_size-1));
 	float const delta(TWO_PI/size), sin_ds(sin(delta)), cos_ds(cos(delta));
 	unsigned const pole_thresh(size>>3);
-	wr_scale = 1.0/max(0.01, (1.0 - water));
 
 	for (unsigned i = 0; i < table_size; ++i) { // build sin table
 		unsigned const offset(i*num_sines);
@@ -225,34 +297,40 @@ void urev_body::gen_texture_data_and_heightmap(unsigned char *data, unsigned siz
 		float const sin_phi((i == int(size-1)) ? 0.0 : sinf(phi)), zval((i == int(size-1)) ? -1.0 : cosf(phi));
 		float sin_s(0.0), cos_s(1.0);
 		float ztable[TOT_NUM_SINES];
+		vector<float> row_data(3*size); // x, y, and val for each theta
+		float *const xvals(row_data.data()), *const yvals(xvals + size), *const vals(yvals + size);
 
 		for (unsigned k = 0; k < num_sines; ++k) { // create z table
 			unsigned const index2(NUM_SINE_PARAMS*k);
 			ztable[k] = rdata[index2]*SINF(rdata[index2+5]*zval + rdata[index2+6]);
 		}
 		for (unsigned j = 0; j < size; ++j) { // theta values, Note: x and y are swapped because theta is out of phase by 90 degrees to match tex coords
-			float const s(sin_s), c(cos_s), xval(sin_phi*s), yval(sin_phi*c);
-			unsigned const tj(size-j-1), index(3*(texoff + tj));
-			unsigned const ox1((unsigned((xval+1.0)*mt2))*num_sines), oy1((unsigned((yval+1.0)*mt2))*num_sines);
-			float val(0.0);
-
-			if (i <= (int)pole_thresh || i >= int(size-pole_thresh-1)) { // slower version near the poles
-				for (unsigned k = 0; k < num_sines; ++k) {
-					unsigned const index2(NUM_SINE_PARAMS*k);
-					val += ztable[k]*SINF(rdata[index2+1]*xval + rdata[index2+2])*SINF(rdata[index2+3]*yval + rdata[index2+4]);
-				}
-			}
-			else {
+			float const s(sin_s), c(cos_s);
+			xvals[j] = sin_phi*s;
+			yvals[j] = sin_phi*c;
+			sin_s = s*cos_ds + c*sin_ds;
+			cos_s = c*cos_ds - s*sin_ds;
+		}
+		if (i <= (int)pole_thresh || i >= int(size-pole_thresh-1)) { // slower version near the poles, evaluated for multiple theta values at once
+			sine_terms_t terms(ztable, 1, rdata, NUM_SINE_PARAMS, num_sines);
+			terms.add_dim(1, 2); // x
+			terms.add_dim(3, 4); // y
+			float const *const pos[3] = {xvals, yvals, nullptr};
+			eval_sine_terms(terms, pos, size, vals);
+		}
+		else {
+			for (unsigned j = 0; j < size; ++j) {
 				// Note: chooses the closest precomputed grid point for efficiency -
 				// no interpolation, so has artifacts closer to the poles
-				for (unsigned k = 0; k < num_sines; ++k) {val += ztable[k]*xtable[ox1+k]*ytable[oy1+k];}
+				unsigned const ox1((unsigned((xvals[j]+1.0)*mt2))*num_sines), oy1((unsigned((yvals[j]+1.0)*mt2))*num_sines);
+				vals[j] = sum_of_products(ztable, &xtable[ox1], &ytable[oy1], num_sines);
 			}
-			val = 0.5*(max(-1.0f, min(1.0f, scale*val)) + 1.0);
-			surface->heightmap[hmoff + j] = val;
-			get_surface_color((data + index), val, phi);
-			sin_s = s*cos_ds + c*sin_ds;
-			cos_s = c*cos_ds - s*sin_ds;
-		} // for j
+		}
+		for (unsigned j = 0; j < size; ++j) {
+			float const val(scale_height(vals[j]));
+			heightmap[hmoff + j] = val;
+			cgen.get_surface_color((data + 3*(texoff + size-j-1)), val, phi);
+		}
 	} // for i
 	//if (size >= MAX_TEXTURE_SIZE) PRINT_TIME("Gen");
 }
@@ -5,6 +5,11 @@
 
 #include "3DWorld.h"
 #include "subdiv.h"
+#include <list>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
 
 unsigned const MAX_TEXTURE_SIZE  = 256; // must be a power of 2
 unsigned const SINES_PER_FREQ    = 12;
@@ -25,6 +30,16 @@ public:
 };
 
 
+// copy of the urev_body values used to color its surface, so that textures can be generated on a background thread
+struct surface_color_gen_t : public color_gen_class {
+	unsigned char a[3] = {0}, b[3] = {0};
+	float temp=0.0, water=0.0, lava=0.0, atmos=0.0, snow_thresh=0.0, wr_scale=1.0;
+
+	void get_surface_color(unsigned char *data, float val, float phi) const;
+	unsigned get_hash() const;
+};
+
+
 class ref_counted_obj {
 
 	unsigned ref_count;
@@ -49,6 +64,7 @@ public:
 	void gen_xyz_vals(point const &start, vector3d const &step, unsigned const xyz_num[3], vector<float> xyz_vals[3]);
 	float get_val(unsigned x, unsigned y, unsigned z, vector<float> const xyz_vals[3]) const;
 	float get_val(point const &pt) const;
+	void get_vals(point const *pts, unsigned num, float *vals) const;
 };
 
 
@@ -77,11 +93,16 @@ public:
 	~upsurface();
 	void gen(float mag, float freq, unsigned ntests=N_RAND_MAG_TESTS, float mm_scale=1.0);
 	void setup(unsigned size, float mcut, bool alloc_hmap);
+	void copy_noise_from(upsurface const &s) {static_cast<noise_gen_3d &>(*this) = s; max_mag = s.max_mag;}
+	void gen_texture_data_and_heightmap(color_gen_class const &cgen, float mcut, unsigned char *data, unsigned size);
 	float get_one_minus_cutoff() const {return 1.0/max(0.01, (1.0 - min_cutoff));} // avoid div-by-zero
+	float scale_height(float val) const {return 0.5*(max(-1.0f, min(1.0f, (1.5f/max_mag)*val)) + 1.0);}
 	float get_height_at(point const &pt, bool use_cache=0) const;
+	void get_heights_at(point const *pts, unsigned num, float *heights) const;
 	void setup_draw_sphere(point const &pos, float radius, float dp, int ndiv, float const *const pmap);
 	void calc_rmax() {rmax = sd.get_rmax();}
 	void free_context() {sd.clear_vbos();}
+	void clear_draw_sphere() {free_context(); sd.set_data(all_zeros, 1.0, 0, nullptr);} // force the sphere to be rebuilt from a new heightmap
 	void clear_cache() {vector<cache_entry>().swap(val_cache);}
 	bool has_heightmap() const {return (!heightmap.empty());}
 	void make_faceted() {sd.make_faceted();}
@@ -89,3 +110,71 @@ public:
 
 typedef std::shared_ptr<upsurface> p_upsurface;
 
+
+struct surface_tex_key_t {
+	int rseed1, rseed2;
+	unsigned size, params_hash; // params_hash covers the colors and cutoff, which are normally derived from the seeds
+
+	surface_tex_key_t(rand_gen_t const &rgen, unsigned size_, surface_color_gen_t const &cgen, float mcut);
+	bool operator<(surface_tex_key_t const &k) const {
+		if (rseed1 != k.rseed1) return (rseed1 < k.rseed1);
+		if (rseed2 != k.rseed2) return (rseed2 < k.rseed2);
+		if (size   != k.size  ) return (size   < k.size  );
+		return (params_hash < k.params_hash);
+	}
+};
+
+struct surface_tex_data_t { // generated texture colors and heightmap for one surface at one size
+	vector<unsigned char> tex_data; // RGB
+	vector<float> heightmap;
+	size_t get_mem_usage() const {return (tex_data.size() + heightmap.size()*sizeof(float));}
+};
+typedef std::shared_ptr<surface_tex_data_t const> p_surface_tex_data;
+
+// planet and moon surface textures and heightmaps, which are generated on worker threads and kept in an LRU cache in memory and optionally on disk,
+// so that bodies that are revisited or freed and recreated with the same seed don't need to be regenerated
+class surface_tex_cache_t {
+	struct job_t {
+		surface_tex_key_t key;
+		void const *owner; // the object that requested this texture; only used for comparison
+		upsurface surface; // private copy of the noise parameters
+		surface_color_gen_t cgen;
+		float mcut;
+		p_surface_tex_data result;
+		job_t *next; // in done stack
+
+		job_t(surface_tex_key_t const &key_, void const *owner_, upsurface const &surface_, surface_color_gen_t const &cgen_, float mcut_) :
+			key(key_), owner(owner_), surface(surface_.type), cgen(cgen_), mcut(mcut_), next(nullptr) {surface.copy_noise_from(surface_);}
+	};
+	typedef std::list<pair<surface_tex_key_t, p_surface_tex_data>> lru_list_t;
+	lru_list_t lru; // most recently used first
+	map<surface_tex_key_t, lru_list_t::iterator> lru_map;
+	set<surface_tex_key_t> requested; // submitted but not yet added to the cache; main thread only
+	size_t mem_used;
+
+	vector<std::thread> workers;
+	std::mutex pending_mutex;
+	std::condition_variable pending_cv;
+	deque<job_t *> pending; // not yet started, in request order; workers take the most recent first; guarded by pending_mutex
+	std::atomic<job_t *> done_head; // lock-free stack of finished jobs: pushed by workers, drained by the main thread
+	bool kill_threads;
+
+	static p_surface_tex_data load_or_gen(surface_tex_key_t const &key, upsurface &surface, surface_color_gen_t const &cgen, float mcut);
+	void worker_thread();
+	void push_done(job_t *job);
+	void drain_done();
+	void add(surface_tex_key_t const &key, p_surface_tex_data const &data);
+	void remove_pending(void const *owner);
+public:
+	surface_tex_cache_t() : mem_used(0), done_head(nullptr), kill_threads(0) {}
+	~surface_tex_cache_t() {stop();}
+	p_surface_tex_data find(surface_tex_key_t const &key); // returns null if not cached
+	p_surface_tex_data generate(surface_tex_key_t const &key, upsurface const &surface, surface_color_gen_t const &cgen, float mcut); // blocking
+	// non-blocking; result is returned by find(); replaces any pending request from the same owner
+	void request(surface_tex_key_t const &key, void const *owner, upsurface const &surface, surface_color_gen_t const &cgen, float mcut);
+	void cancel(void const *owner); // drops pending requests from this owner; jobs that have already started still finish and are cached
+	void stop(); // unfinished jobs are discarded
+};
+
+extern surface_tex_cache_t surface_tex_cache;
+
@@ -12,6 +12,10 @@
 #include "openal_wrap.h"
 #include "cobj_bsp_tree.h"
 #include <glm/gtc/noise.hpp>
+#include <chrono>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 
 bool const DEBUG_BLOCKS    = 0;
@@ -27,7 +31,7 @@ unsigned char const UNDER_MESH_BIT = 0x08;
 voxel_params_t global_voxel_params;
 voxel_model_ground terrain_voxel_model(GROUND_NUM_LOD);
 voxel_brush_params_t voxel_brush_params;
-bool voxel_ppb_enable_falling(0);
+bool voxel_ppb_enable_falling(0), benchmark_voxel_remesh(0);
 
 extern bool group_back_face_cull, voxel_shadows_updated;
 extern int dynamic_mesh_scroll, rand_gen_index, scrolling, display_mode, display_framerate, voxel_editing, mesh_gen_mode, mesh_freq_filter;
@@ -78,28 +82,185 @@ float noise_texture_manager_t::eval_at(point const &pos) const {
 }
 
 
-template<typename V> void voxel_grid<V>::init_grid(unsigned nx_, unsigned ny_, unsigned nz_, V default_val, unsigned num_blocks) {
+template<typename V> void voxel_grid<V>::init_grid(unsigned nx_, unsigned ny_, unsigned nz_, V default_val, unsigned num_blocks, bool sparse) {
 	nx = nx_; ny = ny_; nz = nz_;
 	xblocks = 1+(nx-1)/num_blocks; // ceil
 	yblocks = 1+(ny-1)/num_blocks; // ceil
 	unsigned const tot_size(nx * ny * nz);
 	assert(tot_size > 0);
 	clear();
-	resize(tot_size, default_val);
+
+	if (sparse) { // all bricks start out collapsed to default_val
+		calc_num_bricks();
+		bricks.resize(bnx*bny*bnz);
+		for (auto i = bricks.begin(); i != bricks.end(); ++i) {i->val = default_val;}
+	}
+	else {resize(tot_size, default_val);}
+}
+
+template<typename V> void voxel_grid<V>::calc_num_bricks() {
+	bnx = 1+((nx-1) >> VOXEL_BRICK_BITS); // ceil
+	bny = 1+((ny-1) >> VOXEL_BRICK_BITS); // ceil
+	bnz = 1+((nz-1) >> VOXEL_BRICK_BITS); // ceil
+}
+
+template<typename V> void voxel_grid<V>::copy_dense_to_brick(brick_t &b, unsigned bx, unsigned by, unsigned bz) const {
+
+	b.data.resize(VOXEL_BRICK_VOL);
+	unsigned ix(0);
+
+	// partial bricks at the upper edges are padded with the edge values so that they can still be collapsed
+	for (unsigned y = 0; y < VOXEL_BRICK_SZ; ++y) {
+		for (unsigned x = 0; x < VOXEL_BRICK_SZ; ++x) {
+			for (unsigned z = 0; z < VOXEL_BRICK_SZ; ++z, ++ix) {
+				b.data[ix] = vector<V>::operator[](get_ix(min(nx-1, bx*VOXEL_BRICK_SZ+x), min(ny-1, by*VOXEL_BRICK_SZ+y), min(nz-1, bz*VOXEL_BRICK_SZ+z)));
+			}
+		}
+	}
+}
+
+// sets the voxels of a partial brick at the upper edges that are outside the grid to the nearest edge values, the same as copy_dense_to_brick()
+template<typename V> void voxel_grid<V>::pad_partial_brick(brick_t &b, unsigned bx, unsigned by, unsigned bz) const {
+
+	unsigned const x0(bx*VOXEL_BRICK_SZ), y0(by*VOXEL_BRICK_SZ), z0(bz*VOXEL_BRICK_SZ);
+	if (x0+VOXEL_BRICK_SZ <= nx && y0+VOXEL_BRICK_SZ <= ny && z0+VOXEL_BRICK_SZ <= nz) return; // not a partial brick
+	assert(b.data.size() == VOXEL_BRICK_VOL);
+	unsigned ix(0);
+
+	for (unsigned y = 0; y < VOXEL_BRICK_SZ; ++y) {
+		for (unsigned x = 0; x < VOXEL_BRICK_SZ; ++x) {
+			for (unsigned z = 0; z < VOXEL_BRICK_SZ; ++z, ++ix) {
+				b.data[ix] = b.data[get_ix_in_brick(min(nx-1-x0, x), min(ny-1-y0, y), min(nz-1-z0, z))]; // the clamped voxel is inside the grid
+			}
+		}
+	}
+}
+
+template<typename V> void voxel_grid<V>::collapse_if_uniform(brick_t &b) {
+
+	assert(!b.data.empty());
+	for (auto i = b.data.begin()+1; i != b.data.end(); ++i) {if (!(*i == b.data.front())) return;}
+	b.val = b.data.front();
+	vector<V>().swap(b.data); // free the memory
+}
+
+// converts to sparse storage; if already sparse, collapses any bricks that were expanded by writes and now have a single value
+template<typename V> void voxel_grid<V>::make_sparse() {
+
+	if (is_sparse()) {
+		for (auto i = expanded_bricks.begin(); i != expanded_bricks.end(); ++i) {collapse_if_uniform(bricks[*i]);}
+		expanded_bricks.clear();
+		return;
+	}
+	if (empty()) return;
+	calc_num_bricks();
+	vector<brick_t> new_bricks(bnx*bny*bnz);
+
+#pragma omp parallel for schedule(dynamic,1)
+	for (int by = 0; by < (int)bny; ++by) {
+		for (unsigned bx = 0; bx < bnx; ++bx) {
+			for (unsigned bz = 0; bz < bnz; ++bz) {
+				brick_t &b(new_bricks[bz + (bx + by*bnx)*bnz]);
+				copy_dense_to_brick(b, bx, by, bz);
+				collapse_if_uniform(b);
+			} // for bz
+		} // for bx
+	} // for by
+	vector<V>().swap(static_cast<vector<V> &>(*this)); // free the dense data
+	bricks.swap(new_bricks);
+}
+
+template<typename V> void voxel_grid<V>::make_dense() {
+
+	if (!is_sparse()) return;
+	vector<V> data(size());
+
+	for (unsigned y = 0; y < ny; ++y) {
+		for (unsigned x = 0; x < nx; ++x) {
+			for (unsigned z = 0; z < nz; ++z) {data[get_ix(x, y, z)] = get_sparse(x, y, z);}
+		}
+	}
+	bricks.clear();
+	expanded_bricks.clear();
+	vector<V>::swap(data);
+}
+
+// calls f(x, y, z, num, vals) for runs of num voxels starting at (x,y,z) and going up in z, where vals points to their values, which f can modify;
+// sparse grids are processed in parallel one brick at a time, where each brick is expanded, updated, and collapsed by the thread that owns it,
+// so writes are thread safe and the peak memory is one brick per thread rather than the dense grid
+template<typename V> template<typename F> void voxel_grid<V>::update_columns(F const &f) {
+
+	if (!is_sparse()) {
+#pragma omp parallel for schedule(static)
+		for (int y = 0; y < (int)ny; ++y) {
+			for (unsigned x = 0; x < nx; ++x) {f(x, y, 0, nz, &vector<V>::operator[](get_ix(x, y, 0)));}
+		}
+		return;
+	}
+#pragma omp parallel for schedule(dynamic,1)
+	for (int bix = 0; bix < (int)bricks.size(); ++bix) {
+		unsigned const bz(bix%bnz), bx((bix/bnz)%bnx), by(bix/(bnz*bnx));
+		unsigned const x0(bx*VOXEL_BRICK_SZ), y0(by*VOXEL_BRICK_SZ), z0(bz*VOXEL_BRICK_SZ);
+		unsigned const x_end(min(nx, x0+VOXEL_BRICK_SZ)), y_end(min(ny, y0+VOXEL_BRICK_SZ)), z_end(min(nz, z0+VOXEL_BRICK_SZ));
+		brick_t &b(bricks[bix]);
+		if (b.data.empty()) {b.data.resize(VOXEL_BRICK_VOL, b.val);}
+
+		for (unsigned y = y0; y < y_end; ++y) {
+			for (unsigned x = x0; x < x_end; ++x) {f(x, y, z0, z_end-z0, &b.data[get_ix_in_brick(x, y, z0)]);} // z is contiguous within a brick
+		}
+		pad_partial_brick(b, bx, by, bz);
+		collapse_if_uniform(b);
+	} // for bix
+}
+
+// makes this a sparse grid with the same dimensions and position as src that contains copies of the bricks overlapping x range [x1, x2) and y range [y1, y2);
+// voxels in other bricks read as default values, so callers must stay within the copied range
+template<typename V> void voxel_grid<V>::copy_region(voxel_grid<V> const &src, unsigned x1, unsigned y1, unsigned x2, unsigned y2) {
+
+	clear();
+	nx = src.nx; ny = src.ny; nz = src.nz; xblocks = src.xblocks; yblocks = src.yblocks;
+	vsz = src.vsz; center = src.center; lo_pos = src.lo_pos;
+	if (src.empty()) return;
+	assert(x1 <= x2 && x2 <= nx && y1 <= y2 && y2 <= ny); // may be empty for partial blocks at the upper edges
+	calc_num_bricks();
+	bricks.resize(bnx*bny*bnz);
+
+	for (unsigned by = (y1 >> VOXEL_BRICK_BITS); by <= ((y2-1) >> VOXEL_BRICK_BITS); ++by) {
+		for (unsigned bx = (x1 >> VOXEL_BRICK_BITS); bx <= ((x2-1) >> VOXEL_BRICK_BITS); ++bx) {
+			for (unsigned bz = 0; bz < bnz; ++bz) {
+				unsigned const bix(bz + (bx + by*bnx)*bnz);
+				if (src.is_sparse()) {bricks[bix] = src.bricks[bix];} else {src.copy_dense_to_brick(bricks[bix], bx, by, bz);}
+			}
+		}
+	}
+}
+
+template<typename V> size_t voxel_grid<V>::get_mem_usage() const {
+
+	size_t mem(vector<V>::capacity()*sizeof(V) + bricks.capacity()*sizeof(brick_t) + expanded_bricks.capacity()*sizeof(unsigned));
+	for (auto i = bricks.begin(); i != bricks.end(); ++i) {mem += i->data.capacity()*sizeof(V);}
+	return mem;
+}
+
+template<typename V> unsigned voxel_grid<V>::get_num_collapsed_bricks() const {
+
+	unsigned num(0);
+	for (auto i = bricks.begin(); i != bricks.end(); ++i) {num += i->data.empty();}
+	return num;
 }
 
 template<typename V> void voxel_grid<V>::init(unsigned nx_, unsigned ny_, unsigned nz_, vector3d const &vsz_,
-	point const &center_, V const &default_val, unsigned num_blocks)
+	point const &center_, V const &default_val, unsigned num_blocks, bool sparse)
 {
-	init_grid(nx_, ny_, nz_, default_val, num_blocks);
+	init_grid(nx_, ny_, nz_, default_val, num_blocks, sparse);
 	vsz = vsz_;
 	assert(vsz.x > 0.0 && vsz.y > 0.0 && vsz.z > 0.0);
 	center = center_;
 	lo_pos = center - 0.5*vector3d((nx-1)*vsz.x, (ny-1)*vsz.y, (nz-1)*vsz.z);
 }
 
-template<typename V> void voxel_grid<V>::init(unsigned nx_, unsigned ny_, unsigned nz_, cube_t const &bcube, V const &default_val, unsigned num_blocks) {
-	init_grid(nx_, ny_, nz_, default_val, num_blocks);
+template<typename V> void voxel_grid<V>::init(unsigned nx_, unsigned ny_, unsigned nz_, cube_t const &bcube, V const &default_val, unsigned num_blocks, bool sparse) {
+	init_grid(nx_, ny_, nz_, default_val, num_blocks, sparse);
 	assert(!bcube.is_zero_area());
 	vector3d const csz(bcube.get_size());
 	center = bcube.get_cube_center();
@@ -152,6 +313,7 @@ template<> void voxel_grid<float>::downsample_2x() { // modify in place, perserv
 
 	assert(nx > 1 && ny > 1 && nz > 1);
 	assert(!(nx&1) && !(ny&1) && !(nz&1));
+	make_dense();
 	unsigned const dsnx(nx/2), dsny(ny/2), dsnz(nz/2);
 	vector<value_type> dsv(dsnx*dsny*dsnz, 0);
 
@@ -207,6 +369,7 @@ template<typename V> bool voxel_grid<V>::read(FILE *fp) {
 	if (!read_pod(xblocks, fp, "voxel xblocks") || !read_pod(yblocks, fp, "voxel yblocks")) return 0;
 	if (!read_pod(vsz, fp, "voxel vsz") || !read_pod(center, fp, "voxel center") || !read_pod(lo_pos, fp, "voxel lo_pos")) return 0;
 	if (!read_pod(sz, fp, "voxel_grid size")) return 0;
+	make_dense(); // read directly into the dense data
 	
 	if (empty()) {
 		resize(sz);
@@ -232,6 +395,21 @@ template<typename V> bool voxel_grid<V>::write(FILE *fp) const {
 	if (!write_pod(vsz, fp, "voxel vsz") || !write_pod(center, fp, "voxel center") || !write_pod(lo_pos, fp, "voxel lo_pos")) return 0;
 	if (!write_pod(sz, fp, "voxel_grid size")) return 0;
 	
+	if (is_sparse()) { // write one x,y column at a time
+		vector<V> column(nz);
+
+		for (unsigned y = 0; y < ny; ++y) {
+			for (unsigned x = 0; x < nx; ++x) {
+				for (unsigned z = 0; z < nz; ++z) {column[z] = get_sparse(x, y, z);}
+
+				if (fwrite(&column.front(), sizeof(V), nz, fp) != nz) {
+					cerr << "Error writing voxel_grid data" << endl;
+					return 0;
+				}
+			}
+		}
+		return 1;
+	}
 	if (fwrite(&front(), sizeof(V), size(), fp) != size()) {
 		cerr << "Error writing voxel_grid data" << endl;
 		return 0;
@@ -301,46 +479,46 @@ void voxel_manager::create_procedural(float mag, float freq, vector3d const &off
 		cshader.add_uniform_float("start_freq", 0.25*freq);
 		cshader.add_uniform_float("rx", rx);
 		cshader.add_uniform_float("ry", ry);
+		bool const was_sparse(is_sparse());
+		make_dense(); // the results are read back into the dense data
 		cshader.gen_matrix_R32F(*this, tid); // write directly to voxel values
 		if (normalize_to_1) {for (iterator i = begin(); i != end(); ++i) {*i = CLIP_TO_pm1(*i);}}
+		if (was_sparse) {make_sparse();}
 		cshader.end_shader();
 		free_texture(tid);
 		return;
 	}
-	#pragma omp parallel for schedule(static,1)
-	for (int y = 0; y < (int)ny; ++y) { // generate voxel values
-		for (unsigned x = 0; x < nx; ++x) {
-			for (unsigned z = 0; z < nz; ++z) {
-				float val(0.0);
+	update_columns([&](unsigned x, unsigned y, unsigned z0, unsigned num, float *vals) { // generate voxel values
+		for (unsigned z = z0; z < z0+num; ++z) {
+			float val(0.0);
 
-				if (gen_mode == MGEN_SINE) { // sines
+			if (gen_mode == MGEN_SINE) { // sines
 #if 1
-					val = ngen.get_val(x, y, z, xyz_vals);
+				val = ngen.get_val(x, y, z, xyz_vals);
 #else
-					point pos(get_pt_at(x, y, z));
-					pos += 20.0*fabs(ngen.get_val(0.01*pos))*vector3d(1,1,1); // warp
-					val = ngen.get_val(pos);
+				point pos(get_pt_at(x, y, z));
+				pos += 20.0*fabs(ngen.get_val(0.01*pos))*vector3d(1,1,1); // warp
+				val = ngen.get_val(pos);
 #endif
+			}
+			else { // GLM perlin/simplex (slow)
+				point const pos(get_pt_at(x, y, z) + offset);
+				glm::vec3 const v(pos.x, pos.y, pos.z);
+				float nmag(mag), nfreq(0.25*freq);
+				float const lacunarity(1.92), gain(0.5);
+
+				for (int n = 0; n < max(1, ((int)MAX_FREQ_BINS - mesh_freq_filter)); ++n) {
+					glm::vec3 const nv(nfreq*v + glm::vec3(rx, ry, rx-ry));
+					val   += nmag*((gen_mode == MGEN_PERLIN) ? glm::perlin(nv) : glm::simplex(nv));
+					nmag  *= gain;
+					nfreq *= lacunarity;
 				}
-				else { // GLM perlin/simplex (slow)
-					point const pos(get_pt_at(x, y, z) + offset);
-					glm::vec3 const v(pos.x, pos.y, pos.z);
-					float nmag(mag), nfreq(0.25*freq);
-					float const lacunarity(1.92), gain(0.5);
-
-					for (int n = 0; n < max(1, ((int)MAX_FREQ_BINS - mesh_freq_filter)); ++n) {
-						glm::vec3 const nv(nfreq*v + glm::vec3(rx, ry, rx-ry));
-						val   += nmag*((gen_mode == MGEN_PERLIN) ? glm::perlin(nv) : glm::simplex(nv));
-						nmag  *= gain;
-						nfreq *= lacunarity;
-					}
-				}
-				val += z*zscale;
-				if (normalize_to_1) {val = CLIP_TO_pm1(val);}
-				set(x, y, z, val); // scale value?
 			}
+			val += z*zscale;
+			if (normalize_to_1) {val = CLIP_TO_pm1(val);}
+			vals[z-z0] = val; // scale value?
 		}
-	}
+	});
 }
 
 
@@ -400,54 +578,47 @@ void voxel_manager::add_cobj_voxels(coll_obj &cobj, float filled_val) {
 
 void voxel_manager::atten_at_edges(float val) { // and top (5 edges)
 
-#pragma omp parallel for schedule(static)
-	for (int y = 0; y < (int)ny; ++y) {
+	update_columns([&](unsigned x, unsigned y, unsigned z0, unsigned num, float *vals) {
 		float const vy(1.0 - 2.0*fabs(y - 0.5*ny)/float(ny)); // 0 at edges, 1 at center
+		float const vx(1.0 - 2.0*fabs(x - 0.5*nx)/float(nx)); // 0 at edges, 1 at center
 
-		for (unsigned x = 0; x < nx; ++x) {
-			float const vx(1.0 - 2.0*fabs(x - 0.5*nx)/float(nx)); // 0 at edges, 1 at center
-
-			for (unsigned z = 0; z < nz; ++z) {
-				float const vz(1.0 - 2.0*fabs(z - 0.5*nz)/float(nz)), v(0.25f - vx*vy*vz);
-				if (v > 0.0) get_ref(x, y, z) += 8.0*val*v;
-			}
+		for (unsigned z = z0; z < z0+num; ++z) {
+			float const vz(1.0 - 2.0*fabs(z - 0.5*nz)/float(nz)), v(0.25f - vx*vy*vz);
+			if (v > 0.0) vals[z-z0] += 8.0*val*v;
 		}
-	}
+	});
 }
 
 
 void voxel_manager::atten_at_top_only(float val) {
 
-#pragma omp parallel for schedule(static)
-	for (int y = 0; y < (int)ny; ++y) {
-		for (unsigned x = 0; x < nx; ++x) {
-			float top_atten_val(0.0);
+	update_columns([&](unsigned x, unsigned y, unsigned z0, unsigned num, float *vals) {
+		float top_atten_val(0.0); // Note: recomputed for each brick of a sparse grid
 
+		if (params.atten_top_mode == 1) { // atten to mesh
+			point const pos(get_pt_at(x, y, 0));
+			top_atten_val = interpolate_mesh_zval(pos.x, pos.y, 0.0, 0, 1);
+		}
+		else if (params.atten_top_mode == 2) { // atten to random
+			point const pos(get_pt_at(x, y, 0));
+			top_atten_val = 2.0*eval_mesh_sin_terms(params.height_eval_freq*pos.x, params.height_eval_freq*pos.y);
+		}
+		for (unsigned z = z0; z < z0+num; ++z) {
+			float &v(vals[z-z0]);
+	
 			if (params.atten_top_mode == 1) { // atten to mesh
-				point const pos(get_pt_at(x, y, 0));
-				top_atten_val = interpolate_mesh_zval(pos.x, pos.y, 0.0, 0, 1);
+				float const z_atten(((get_zv(z)) - top_atten_val)/(vsz.z*nz) - 0.5);
+				if (z_atten > 0.0) v += val*z_atten;
 			}
 			else if (params.atten_top_mode == 2) { // atten to random
-				point const pos(get_pt_at(x, y, 0));
-				top_atten_val = 2.0*eval_mesh_sin_terms(params.height_eval_freq*pos.x, params.height_eval_freq*pos.y);
+				v += top_atten_val + val*(z/float(nz) - 0.5);
 			}
-			for (unsigned z = 0; z < nz; ++z) {
-				float &v(get_ref(x, y, z));
-	
-				if (params.atten_top_mode == 1) { // atten to mesh
-					float const z_atten(((get_zv(z)) - top_atten_val)/(vsz.z*nz) - 0.5);
-					if (z_atten > 0.0) v += val*z_atten;
-				}
-				else if (params.atten_top_mode == 2) { // atten to random
-					v += top_atten_val + val*(z/float(nz) - 0.5);
-				}
-				else {
-					float const z_atten(z/float(nz) - 0.75);
-					if (z_atten > 0.0) v += val*z_atten;
-				}
+			else {
+				float const z_atten(z/float(nz) - 0.75);
+				if (z_atten > 0.0) v += val*z_atten;
 			}
 		}
-	}
+	});
 }
 
 
@@ -455,28 +626,24 @@ void voxel_manager::atten_to_sphere(float val, float inner_radius, bool atten_in
 
 	float const two_nz_inv(2.0/float(nz));
 
-#pragma omp parallel for schedule(static)
-	for (int y = 0; y < (int)ny; ++y) {
+	update_columns([&](unsigned x, unsigned y, unsigned z0, unsigned num, float *vals) {
 		float const vy(2.0*fabs(y - 0.5*ny)/float(ny)); // 1 at edges, 0 at center
+		float const vx(2.0*fabs(x - 0.5*nx)/float(nx)); // 1 at edges, 0 at center
 
-		for (unsigned x = 0; x < nx; ++x) {
-			float const vx(2.0*fabs(x - 0.5*nx)/float(nx)); // 1 at edges, 0 at center
-
-			for (unsigned z = 0; z < nz; ++z) {
-				float const deltaz(z - 0.5*nz), zval(no_atten_zbot ? max(0.0f, deltaz) : fabs(deltaz));
-				float const vz(zval*two_nz_inv), radius(sqrt(vx*vx + vy*vy + vz*vz)); // vz: 1 at edges, 0 at center
-				float adj(0.0);
+		for (unsigned z = z0; z < z0+num; ++z) {
+			float const deltaz(z - 0.5*nz), zval(no_atten_zbot ? max(0.0f, deltaz) : fabs(deltaz));
+			float const vz(zval*two_nz_inv), radius(sqrt(vx*vx + vy*vy + vz*vz)); // vz: 1 at edges, 0 at center
+			float adj(0.0);
 				
-				if (radius > inner_radius) {
-					adj = (radius - inner_radius)/(1.0f - inner_radius);
-				}
-				else if (atten_inner) {
-					adj = (radius - inner_radius)/inner_radius;
-				}
-				get_ref(x, y, z) += val*adj;
+			if (radius > inner_radius) {
+				adj = (radius - inner_radius)/(1.0f - inner_radius);
+			}
+			else if (atten_inner) {
+				adj = (radius - inner_radius)/inner_radius;
 			}
+			vals[z-z0] += val*adj;
 		}
-	}
+	});
 }
 
 
@@ -570,12 +737,12 @@ bool val_is_outside(float val, voxel_params_t const &params) {
 }
 
 
-void voxel_manager::calc_outside_val(unsigned x, unsigned y, unsigned z, bool is_under_mesh) {
+unsigned char voxel_manager::get_outside_val(unsigned x, unsigned y, unsigned z, bool is_under_mesh) const {
 
 	bool const on_edge(params.make_closed_surface && ((x == 0 || x == nx-1) || (y == 0 || y == ny-1) || (z == 0 || z == nz-1)));
 	unsigned char ival(on_edge ? ON_EDGE_BIT : val_is_outside(get(x, y, z), params)); // Note: on_edge is considered outside
 	if (is_under_mesh) {ival |= UNDER_MESH_BIT;}
-	outside.set(x, y, z, ival);
+	return ival;
 }
 
 
@@ -583,19 +750,16 @@ void voxel_manager::determine_voxels_outside() { // determine inside/outside poi
 
 	assert(!empty());
 	assert(vsz.x > 0.0 && vsz.y > 0.0 && vsz.z > 0.0);
-	outside.init(nx, ny, nz, vsz, center, 0, params.num_blocks);
+	outside.init(nx, ny, nz, vsz, center, 0, params.num_blocks, is_sparse()); // sparse if the voxel data is sparse
 	bool const sphere_mode(params.atten_sphere_mode());
 
-#pragma omp parallel for schedule(static)
-	for (int y = 0; y < (int)ny; ++y) {
-		for (unsigned x = 0; x < nx; ++x) {
-			point const pos(get_pt_at(x, y, 0));
-			int const xpos(get_xpos(pos.x)), ypos(get_xpos(pos.y));
-			bool const no_zix(sphere_mode || !use_mesh || point_outside_mesh(xpos, ypos));
-			unsigned const zix(no_zix ? 0 : max(0, int((z_min_matrix[ypos][xpos] - lo_pos.z)/vsz.z)));
-			for (unsigned z = 0; z < nz; ++z) {calc_outside_val(x, y, z, (z < zix));}
-		}
-	}
+	outside.update_columns([&](unsigned x, unsigned y, unsigned z0, unsigned num, unsigned char *vals) {
+		point const pos(get_pt_at(x, y, 0));
+		int const xpos(get_xpos(pos.x)), ypos(get_xpos(pos.y));
+		bool const no_zix(sphere_mode || !use_mesh || point_outside_mesh(xpos, ypos));
+		unsigned const zix(no_zix ? 0 : max(0, int((z_min_matrix[ypos][xpos] - lo_pos.z)/vsz.z)));
+		for (unsigned z = z0; z < z0+num; ++z) {vals[z-z0] = get_outside_val(x, y, z, (z < zix));}
+	});
 }
 
 
@@ -726,22 +890,23 @@ void voxel_model::remove_unconnected_outside_modified_blocks(bool postproc_brush
 #define FLOOD_FILL_INNER(pos, min_range, max_range, step) \
 	if (pos >= min_range + 1) { \
 		unsigned const ix(cur - step); \
-		if (outside[ix] == fill_val) {work.push_back(ix); outside[ix] |= bit_mask;} \
+		if (outside_ro[ix] == fill_val) {work.push_back(ix); outside[ix] |= bit_mask;} \
 	} \
 	if (pos + 1 < max_range) { \
 		unsigned const ix(cur + step); \
-		if (outside[ix] == fill_val) {work.push_back(ix); outside[ix] |= bit_mask;} \
+		if (outside_ro[ix] == fill_val) {work.push_back(ix); outside[ix] |= bit_mask;} \
 	}
 
 void voxel_manager::flood_fill_range(unsigned x1, unsigned y1, unsigned x2, unsigned y2, vector<unsigned> &work, unsigned char fill_val, unsigned char bit_mask) {
 
 	unsigned const nxnz(nx*nz);
+	voxel_grid<unsigned char> const &outside_ro(outside); // const so that reads don't expand sparse bricks
 
 	while (!work.empty()) {
 		unsigned const cur(work.back());
 		work.pop_back();
 		assert(cur < outside.size());
-		assert(outside[cur] & bit_mask);
+		assert(outside_ro[cur] & bit_mask);
 		assert(nxnz > 0 && nz > 0);
 		unsigned const y(cur/nxnz), cur_xz(cur - y*nxnz), x(cur_xz/nz), z(cur_xz - x*nz);
 		FLOOD_FILL_INNER(x, x1, x2, nz);
@@ -760,13 +925,14 @@ void voxel_manager::remove_unconnected_outside_range(bool keep_at_edge, unsigned
 	assert(!outside.empty());
 	vector<unsigned> &work(temp_work); // stack of voxels to process
 	assert(work.empty());
+	voxel_grid<unsigned char> const &outside_ro(outside); // const so that reads don't expand sparse bricks
 
 	if (params.atten_sphere_mode() || !use_mesh) { // sphere mode / not mesh mode
 		unsigned const x(nx/2), y(ny/2); // add a single point at the center of the sphere (will only work for filled sphere center)
 
 		if (x >= x1 && x <= x2 && y >= y1 && y <= y2) {
 			unsigned const ix(outside.get_ix(x, y, nz/2));
-			assert(outside[ix] != UNDER_MESH_BIT); // outside or above mesh
+			assert(outside_ro[ix] != UNDER_MESH_BIT); // outside or above mesh
 			work.push_back(ix); // inside, anchored to the mesh
 			outside[ix] |= ANCHORED_BIT; // mark as anchored
 		}
@@ -777,7 +943,7 @@ void voxel_manager::remove_unconnected_outside_range(bool keep_at_edge, unsigned
 				unsigned ix(outside.get_ix(x, y, 0));
 
 				for (unsigned z = 0; z < nz; ++z, ++ix) {
-					if (outside[ix] != UNDER_MESH_BIT) continue; // outside or above mesh
+					if (outside_ro[ix] != UNDER_MESH_BIT) continue; // outside or above mesh
 					work.push_back(ix); // inside, anchored to the mesh
 					outside[ix] |= ANCHORED_BIT; // mark as anchored
 				}
@@ -793,7 +959,7 @@ void voxel_manager::remove_unconnected_outside_range(bool keep_at_edge, unsigned
 
 				for (unsigned z = 0; z < nz; ++z) {
 					unsigned const ix(outside.get_ix(x, y, z));
-					if (outside[ix] == 1) continue; // outside
+					if (outside_ro[ix] == 1) continue; // outside
 					work.push_back(ix); // inside, anchored to the mesh
 					outside[ix] |= ANCHORED_BIT; // mark as anchored
 				}
@@ -810,10 +976,10 @@ void voxel_manager::remove_unconnected_outside_range(bool keep_at_edge, unsigned
 			for (unsigned z = 0; z < nz; ++z) {
 				unsigned const ix(outside.get_ix(x, y, z));
 
-				if (outside[ix] > 1) { // anchored, on edge, or under mesh
-					outside[ix] &= ~ANCHORED_BIT; // remove anchored bit
+				if (outside_ro[ix] > 1) { // anchored, on edge, or under mesh
+					if (outside_ro[ix] & ANCHORED_BIT) {outside[ix] &= ~ANCHORED_BIT;} // remove anchored bit
 				}
-				else if (outside[ix] != 1) { // inside and non-anchored
+				else if (outside_ro[ix] != 1) { // inside and non-anchored
 					if (updated_pts) {updated_pts->push_back(pt_ix_t(get_pt_at(x, y, z), ix));}
 					if (!mark_only ) {make_voxel_outside(ix);}
 					had_update = 1;
@@ -829,12 +995,13 @@ void voxel_manager::remove_interior_holes() {
 
 	vector<unsigned> &work(temp_work); // stack of voxels to process
 	assert(work.empty());
+	voxel_grid<unsigned char> const &outside_ro(outside); // const so that reads don't expand sparse bricks
 
 	for (unsigned y = 0; y < ny; ++y) { // seed with +z plane
 		for (unsigned x = 0; x < nx; ++x) {
 			unsigned const ix(outside.get_ix(x, y, nz-1));
 
-			if (outside[ix]) {
+			if (outside_ro[ix]) {
 				work.push_back(ix);
 				outside[ix] |= ANCHORED_BIT; // mark as anchored
 			}
@@ -845,10 +1012,10 @@ void voxel_manager::remove_interior_holes() {
 
 	// if inside but not anchored mark as outside
 	for (unsigned ix = 0; ix < size(); ++ix) {
-		if (outside[ix] & ANCHORED_BIT) { // anchored
+		if (outside_ro[ix] & ANCHORED_BIT) { // anchored
 			outside[ix] &= ~ANCHORED_BIT; // remove anchored bit
 		}
-		else if (outside[ix] == 1) { // outside, not on edge or under mesh, and non-anchored
+		else if (outside_ro[ix] == 1) { // outside, not on edge or under mesh, and non-anchored
 			make_voxel_inside(ix);
 		}
 	}
@@ -868,8 +1035,9 @@ void voxel_manager::make_voxel_inside(unsigned ix) {
 bool voxel_manager::point_inside_volume(point const &pos) const {
 
 	if (outside.empty()) return 0;
-	unsigned ix(0);
-	return (outside.get_ix(pos, ix) && !is_outside(ix));
+	int i[3]; // x,y,z
+	outside.get_xyz(pos, i);
+	return (outside.is_valid_range(i) && !is_outside(i[0], i[1], i[2]));
 }
 
 
@@ -892,12 +1060,11 @@ bool voxel_manager::sphere_intersect(point const &center, float radius, point *i
 
 	for (int y = llc[1]; y <= urc[1]; ++y) {
 		for (int x = llc[0]; x <= urc[0]; ++x) {
-			unsigned const xy_offset((x + y*nx)*nz);
 			point p(get_pt_at(x, y, llc[2]));
 
 			for (int z = llc[2]; z <= urc[2]; ++z) {
 				p.z += vsz.z;
-				if (is_outside(xy_offset+z) || !dist_less_than(p, center, radius)) continue;
+				if (is_outside(x, y, z) || !dist_less_than(p, center, radius)) continue;
 				if (int_pt) {*int_pt = p;}
 				return 1;
 			}
@@ -974,6 +1141,14 @@ bool voxel_model::has_triangles() const {
 }
 
 
+unsigned voxel_model::get_num_triangles() const {
+
+	unsigned num(0);
+	for (tri_data_t::const_iterator i = tri_data[0].begin(); i != tri_data[0].end(); ++i) {num += i->num_verts()/3;}
+	return num;
+}
+
+
 bool voxel_model::has_filled_at_edges() const {
 
 	for (tri_data_t::const_iterator i = tri_data[0].begin(); i != tri_data[0].end(); ++i) {
@@ -1034,6 +1209,9 @@ void voxel_model::clear() {
 
 void voxel_model_ground::clear() {
 	
+	remesh_pool.stop(); // wait for worker threads before freeing the blocks
+	remesh_version.clear();
+	shown_version.clear();
 	voxel_model::clear();
 	for (unsigned i = 0; i < data_blocks.size(); ++i) {clear_block(i);} // unnecessary?
 	data_blocks.clear();
@@ -1071,13 +1249,9 @@ bool voxel_model_ground::clear_block(unsigned block_ix) {
 }
 
 
-// returns the number of triangles created
-unsigned voxel_model::create_block(voxel_ix_cache &vix_cache, unsigned block_ix, bool first_create, bool count_only, unsigned lod_level) {
+// adds the triangles for one block and LOD level to tri_block, which doesn't need to be part of tri_data; returns the number of triangles
+unsigned voxel_model::create_block_tris(tri_data_t::value_type &tri_block, voxel_ix_cache &vix_cache, unsigned block_ix, bool count_only, unsigned lod_level) const {
 
-	assert(lod_level < tri_data.size());
-	tri_data_t &td(tri_data[lod_level]);
-	assert(block_ix < td.size());
-	auto &tri_block(td[block_ix]);
 	assert(tri_block.empty());
 	vix_cache.init(xblocks+1, yblocks+1, nz, vsz, zero_vector, vert_ix_cache_entry(), 1);
 	unsigned const xbix(block_ix%params.num_blocks), ybix(block_ix/params.num_blocks), step(1 << lod_level);
@@ -1090,8 +1264,22 @@ unsigned voxel_model::create_block(voxel_ix_cache &vix_cache, unsigned block_ix,
 			}
 		}
 	}
+	return count;
+}
+
+
+// returns the number of triangles created
+unsigned voxel_model::create_block(voxel_ix_cache &vix_cache, unsigned block_ix, bool first_create, bool count_only, unsigned lod_level) {
+
+	assert(lod_level < tri_data.size());
+	tri_data_t &td(tri_data[lod_level]);
+	assert(block_ix < td.size());
+	auto &tri_block(td[block_ix]);
+	unsigned const count(create_block_tris(tri_block, vix_cache, block_ix, count_only, lod_level));
+
 	if (!count_only) {
 		if (first_create) { // after the first creation pt_to_ix is out of order
+			unsigned const xbix(block_ix%params.num_blocks), ybix(block_ix/params.num_blocks);
 			assert(lod_level < pt_to_ix.size());
 			pt_to_ix[lod_level][block_ix].pt = (point((xbix+0.5)*xblocks, (ybix+0.5)*yblocks, nz/2)*vsz + lo_pos);
 			pt_to_ix[lod_level][block_ix].ix = block_ix;
@@ -1202,6 +1390,7 @@ void voxel_model::calc_ao_lighting_for_block(unsigned block_ix, bool increase_on
 	unsigned const zstep(use_mesh ? max(1U, nz/MESH_SIZE[2]) : 1U);
 	unsigned const x_end(min(nx, (xbix+1)*xblocks)), y_end(min(ny, (ybix+1)*yblocks));
 	unsigned const voxel_sz[3] = {nx, ny, nz};
+	voxel_grid<unsigned char> const &outside_ro(outside); // const so that reads don't expand sparse bricks, which isn't thread safe
 	
 	#pragma omp parallel for schedule(dynamic,1)
 	for (int yi = ybix*yblocks; yi < (int)y_end; yi += ystep) {
@@ -1232,7 +1421,7 @@ void voxel_model::calc_ao_lighting_for_block(unsigned block_ix, bool increase_on
 						for (unsigned s = 0; s < max_steps; ++s) { // take steps in this direction
 							ix += i->dist_per_step; // increment first to skip the current voxel
 						
-							if (outside[ix] == 0 || (outside[ix] & end_ray_flags)) {
+							if (outside_ro[ix] == 0 || (outside_ro[ix] & end_ray_flags)) {
 								cur_val = s*i->nsteps_inv; // Note: ambient obscurance - uses actual distance to occluder
 								break; // voxel known to be inside the volume or under the mesh
 							}
@@ -1370,6 +1559,7 @@ unsigned voxel_model::get_texture_at(point const &pos) const {
 
 void voxel_model::proc_pending_updates(bool postproc_brushes_mode) {
 
+	apply_async_remesh_results(); // swap in blocks that were rebuilt in the background since the last call
 	if (modified_blocks.empty()) return;
 	//RESET_TIME;
 
@@ -1389,8 +1579,19 @@ void voxel_model::proc_pending_updates(bool postproc_brushes_mode) {
 			remove_unconnected_outside_modified_blocks(0);
 		}
 	}
+	vector<unsigned> const blocks_to_update(modified_blocks.begin(), modified_blocks.end());
+	// brushes are applied at load time, so wait for them rather than drawing the unmodified blocks for the first few frames
+	if (postproc_brushes_mode || !submit_async_remesh(blocks_to_update, !volume_added)) {rebuild_blocks(blocks_to_update);}
+	if (is_sparse()) {make_sparse();} // collapse bricks that were expanded by this update
+	modified_blocks = next_frame_modified_blocks;
+	next_frame_modified_blocks.clear();
+	volume_added = 0;
+}
+
+
+void voxel_model::rebuild_blocks(vector<unsigned> const &blocks_to_update) {
+
 	bool something_removed(0);
-	vector<unsigned> blocks_to_update(modified_blocks.begin(), modified_blocks.end());
 	
 	// FIXME: can we only remove/add voxels within the modified region of each block?
 	//        or, create the block first and only remove triangles that don't exist in the new block + add triangles that don't exist in the old block?
@@ -1418,11 +1619,191 @@ void voxel_model::proc_pending_updates(bool postproc_brushes_mode) {
 			calc_ao_lighting_for_block(blocks_to_update[i], !volume_added); // update can only remove, so lighting can only increase
 		}
 		update_blocks_hook(blocks_to_update, tot_num_added);
-		//PRINT_TIME(postproc_brushes_mode ? "  Process Voxel Updates" : "Process Voxel Updates");
+		//PRINT_TIME("Process Voxel Updates");
 	}
-	modified_blocks = next_frame_modified_blocks;
-	next_frame_modified_blocks.clear();
-	volume_added = 0;
+}
+
+
+// copies the voxel data needed to rebuild the triangles and AO lighting of this block; the snapshot has the same dimensions and position as this model,
+// so rebuilt vertices match those of the neighboring blocks exactly
+voxel_model *voxel_model::create_remesh_snapshot(unsigned block_ix) const {
+
+	voxel_model *const snapshot(new voxel_model(noise_tex_gen, use_mesh, tri_data.size()));
+	snapshot->params  = params;
+	snapshot->ao_dirs = ao_dirs;
+	for (unsigned lod = 0; lod < tri_data.size(); ++lod) {snapshot->tri_data[lod].resize(1, indexed_vntc_vect_t<vertex_type_t>(0));}
+	unsigned const xbix(block_ix%params.num_blocks), ybix(block_ix/params.num_blocks);
+	unsigned const x1(xbix*xblocks), y1(ybix*yblocks), x2(min(nx, x1+xblocks+1)), y2(min(ny, y1+yblocks+1)); // +1 for the voxels shared with the next block
+	unsigned border(0);
+
+	if (!ao_lighting.empty()) { // AO rays can leave the block
+		for (auto i = ao_dirs.begin(); i != ao_dirs.end(); ++i) {border = max(border, i->nsteps+1);} // +1 for the positive step bias
+	}
+	snapshot->copy_region(*this, max(x1, border)-border, max(y1, border)-border, min(nx, x2+border), min(ny, y2+border));
+	snapshot->outside.copy_region(outside, max(x1, border)-border, max(y1, border)-border, min(nx, x2+border), min(ny, y2+border));
+	snapshot->ao_lighting.copy_region(ao_lighting, x1, y1, x2, y2);
+	return snapshot;
+}
+
+// called by worker threads on snapshots from create_remesh_snapshot(); the block is rebuilt into tri_data[lod][0]
+void voxel_model::remesh_snapshot_block(unsigned block_ix, bool increase_ao_only) {
+
+	voxel_ix_cache vix_cache; // reused across LODs
+
+	for (unsigned lod = 0; lod < tri_data.size(); ++lod) {
+		assert(tri_data[lod].size() == 1);
+		create_block_tris(tri_data[lod].front(), vix_cache, block_ix, 0, lod);
+		tri_data[lod].front().finalize(3); // needed to compute bounding sphere and vertex normals
+	}
+	calc_ao_lighting_for_block(block_ix, increase_ao_only);
+}
+
+// called on the main thread after clear_block(); returns true if the rebuilt block has triangles
+bool voxel_model::swap_in_remesh_snapshot(unsigned block_ix, voxel_model &snapshot) {
+
+	assert(snapshot.tri_data.size() == tri_data.size());
+
+	for (unsigned lod = 0; lod < tri_data.size(); ++lod) {
+		assert(block_ix < tri_data[lod].size() && tri_data[lod][block_ix].empty());
+		std::swap(tri_data[lod][block_ix], snapshot.tri_data[lod].front());
+	}
+	create_block_hook(block_ix); // adds cobjs, which isn't thread safe
+	
+	if (!ao_lighting.empty()) {
+		unsigned const xbix(block_ix%params.num_blocks), ybix(block_ix/params.num_blocks);
+		unsigned const x_end(min(nx, (xbix+1)*xblocks)), y_end(min(ny, (ybix+1)*yblocks));
+
+		for (unsigned y = ybix*yblocks; y < y_end; ++y) {
+			for (unsigned x = xbix*xblocks; x < x_end; ++x) {
+				for (unsigned z = 0; z < nz; ++z) {ao_lighting.set(x, y, z, snapshot.ao_lighting.get(x, y, z));}
+			}
+		}
+	}
+	return !tri_data[0][block_ix].empty();
+}
+
+
+bool voxel_model_ground::submit_async_remesh(vector<unsigned> const &blocks_to_update, bool increase_ao_only) {
+
+	if (!params.async_remesh) return 0;
+	if (!remesh_pool.is_running()) {remesh_pool.start(max(1U, std::thread::hardware_concurrency()/2));} // leave some cores for the main thread
+	unsigned const tot_blocks(tri_data[0].size());
+	remesh_version.resize(tot_blocks, 0);
+	shown_version .resize(tot_blocks, 0);
+
+	for (auto i = blocks_to_update.begin(); i != blocks_to_update.end(); ++i) {
+		assert(*i < tot_blocks);
+		remesh_pool.submit(new voxel_remesh_pool_t::job_t(*i, ++remesh_version[*i], increase_ao_only, create_remesh_snapshot(*i)));
+	}
+	return 1;
+}
+
+void voxel_model_ground::apply_async_remesh_results() {
+
+	if (!remesh_pool.is_running()) return;
+	vector<voxel_remesh_pool_t::job_t *> done;
+	remesh_pool.drain_done(done);
+	if (done.empty()) return;
+	vector<unsigned> blocks_updated;
+	unsigned num_added(0);
+	bool something_removed(0);
+
+	for (auto i = done.begin(); i != done.end(); ++i) {
+		voxel_remesh_pool_t::job_t &job(**i);
+
+		// a block that's edited every frame may never have its latest version finish first, so draw any version newer than the current one
+		if (job.version > shown_version[job.block_ix]) {
+			shown_version[job.block_ix] = job.version;
+			something_removed |= clear_block(job.block_ix);
+			num_added += swap_in_remesh_snapshot(job.block_ix, *job.snapshot);
+			blocks_updated.push_back(job.block_ix);
+		}
+		delete *i;
+	}
+	if (something_removed) {purge_coll_freed(0);}
+	if (num_added == 0 && !something_removed) return;
+	sort(blocks_updated.begin(), blocks_updated.end()); // update_blocks_hook() requires blocks sorted by y then x
+	blocks_updated.erase(std::unique(blocks_updated.begin(), blocks_updated.end()), blocks_updated.end());
+
+	if (!boundary_vnmap[0].empty()) { // fix block boundary vertex normals
+		for (auto i = blocks_updated.begin(); i != blocks_updated.end(); ++i) {update_boundary_normals_for_block(*i, 0);}
+	}
+	update_blocks_hook(blocks_updated, num_added);
+}
+
+
+// *** voxel_remesh_pool_t ***
+
+voxel_remesh_pool_t::job_t::~job_t() {delete snapshot;}
+
+void voxel_remesh_pool_t::start(unsigned num_threads) {
+	assert(num_threads > 0 && workers.empty());
+	kill_threads = 0;
+	for (unsigned i = 0; i < num_threads; ++i) {workers.emplace_back(&voxel_remesh_pool_t::worker_thread, this);}
+}
+
+void voxel_remesh_pool_t::stop() { // unfinished jobs are discarded
+	if (workers.empty()) return;
+	{
+		std::lock_guard<std::mutex> lock(pending_mutex);
+		kill_threads = 1;
+	}
+	pending_cv.notify_all();
+	for (auto i = workers.begin(); i != workers.end(); ++i) {i->join();}
+	workers.clear();
+	assert(num_jobs >= pending.size());
+	num_jobs -= pending.size();
+	for (auto i = pending.begin(); i != pending.end(); ++i) {delete *i;}
+	pending.clear();
+	vector<job_t *> done;
+	drain_done(done);
+	for (auto i = done.begin(); i != done.end(); ++i) {delete *i;}
+	assert(num_jobs == 0);
+}
+
+void voxel_remesh_pool_t::worker_thread() {
+#ifdef _OPENMP
+	omp_set_num_threads(1); // parallelism comes from rebuilding multiple blocks at once; don't oversubscribe
+#endif
+	while (1) {
+		job_t *job(nullptr);
+		{
+			std::unique_lock<std::mutex> lock(pending_mutex);
+			pending_cv.wait(lock, [this] {return (kill_threads || !pending.empty());});
+			if (kill_threads) return;
+			job = pending.front();
+			pending.pop_front();
+		}
+		job->snapshot->remesh_snapshot_block(job->block_ix, job->increase_ao_only);
+		push_done(job);
+	} // end while
+}
+
+void voxel_remesh_pool_t::push_done(job_t *job) {
+	job->next = done_head.load(std::memory_order_relaxed);
+	while (!done_head.compare_exchange_weak(job->next, job, std::memory_order_release, std::memory_order_relaxed)) {}
+}
+
+void voxel_remesh_pool_t::drain_done(vector<job_t *> &done) {
+	done.clear();
+	for (job_t *job = done_head.exchange(nullptr, std::memory_order_acquire); job != nullptr; job = job->next) {done.push_back(job);}
+	std::reverse(done.begin(), done.end()); // the stack is in reverse finish order
+	assert(num_jobs >= done.size());
+	num_jobs -= done.size();
+}
+
+void voxel_remesh_pool_t::submit(job_t *job) {
+	assert(is_running());
+	job_t *replaced(nullptr);
+	{
+		std::lock_guard<std::mutex> lock(pending_mutex);
+		auto it(std::find_if(pending.begin(), pending.end(), [job](job_t const *j) {return (j->block_ix == job->block_ix);}));
+		if (it != pending.end()) {replaced = *it; *it = job;} // not started yet and superseded by this job, which takes its place in the queue
+		else {pending.push_back(job);}
+	}
+	if (replaced) {delete replaced; return;}
+	++num_jobs;
+	pending_cv.notify_one();
 }
 
 
@@ -1562,6 +1943,21 @@ void voxel_model::build(bool verbose, bool do_ao_lighting) {
 		calc_ao_lighting();
 		if (verbose) {PRINT_TIME("  Voxel AO Lighting");}
 	}
+	if (params.sparse_storage) {
+		// the grids are generated directly into bricks, and the serial passes above only expand the bricks they write, so this is about the peak usage
+		size_t const dense_mem(size()*(sizeof(float) + sizeof(unsigned char))), peak_mem(get_mem_usage());
+		make_sparse(); // collapse bricks expanded by serial writes such as create_from_cobjs() and remove_unconnected_outside()
+
+		if (verbose) {
+			PRINT_TIME("  Make Sparse");
+			size_t const sparse_mem(get_mem_usage());
+			cout << "Voxel memory: " << dense_mem/1024 << "KB dense, " << peak_mem/1024 << "KB peak, " << sparse_mem/1024 << "KB sparse ("
+				 << float(dense_mem)/max(sparse_mem, size_t(1)) << "x), "
+				 << get_num_collapsed_bricks() << " of " << ((nx+VOXEL_BRICK_MASK)/VOXEL_BRICK_SZ)*((ny+VOXEL_BRICK_MASK)/VOXEL_BRICK_SZ)*((nz+VOXEL_BRICK_MASK)/VOXEL_BRICK_SZ)
+				 << " bricks collapsed" << endl;
+		}
+	}
+	else if (verbose) {cout << "Voxel memory: " << get_mem_usage()/1024 << "KB" << endl;}
 }
 
 
@@ -1868,7 +2264,72 @@ void setup_voxel_landscape(voxel_params_t const &params, float default_val) {
 	point const center(-0.5f*DX_VAL, -0.5f*DY_VAL, 0.5f*(zlo + zhi));
 	terrain_voxel_model.clear();
 	terrain_voxel_model.set_params(params);
-	terrain_voxel_model.init(nx, ny, nz, vsz, center, default_val, params.num_blocks);
+	terrain_voxel_model.init(nx, ny, nz, vsz, center, default_val, params.num_blocks, params.sparse_storage);
+}
+
+
+// applies the same stream of random terrain edits with synchronous and then asynchronous remeshing, and reports the time spent on voxel updates in each
+// simulated 60Hz frame; the landscape is regenerated before each run and again at the end, since the edits modify it
+void run_voxel_remesh_benchmark() {
+
+	typedef std::chrono::high_resolution_clock hr_clock;
+	unsigned const num_frames(300), edit_rates[2] = {20, 120}; // edits per second
+	double const frame_secs(1.0/60.0);
+	unsigned const max_edits(unsigned(num_frames*frame_secs*edit_rates[1]));
+	vector3d const gen_offset(DX_VAL*xoff2, DY_VAL*yoff2, 0.0);
+	cube_t const bcube(terrain_voxel_model.get_raw_bbox());
+	float const edit_radius(2.0*terrain_voxel_model.vsz.mag());
+	vector<point> edits;
+	rand_gen_t rgen;
+
+	for (unsigned n = 0; n < 10*max_edits && edits.size() < max_edits; ++n) { // choose random edit locations on the voxel surface
+		point const top(rgen.rand_uniform(bcube.x1(), bcube.x2()), rgen.rand_uniform(bcube.y1(), bcube.y2()), bcube.z2());
+		point pos;
+		if (terrain_voxel_model.line_intersect(top, point(top.x, top.y, bcube.z1()), &pos)) {edits.push_back(pos);}
+	}
+	if (edits.empty()) return;
+
+	auto regen = [&](bool async_remesh) {
+		voxel_params_t params(global_voxel_params);
+		params.async_remesh = async_remesh;
+		setup_voxel_landscape(params, 0.0);
+		terrain_voxel_model.create_procedural(params.mag, params.freq, gen_offset, params.normalize_to_1, params.geom_rseed, 456+rand_gen_index, mesh_gen_mode);
+		terrain_voxel_model.build(params.add_cobjs, 0, 0);
+	};
+	for (unsigned r = 0; r < 2; ++r) {
+		double worst_ms[2] = {0.0, 0.0}, avg_ms[2] = {0.0, 0.0}, finish_ms[2] = {0.0, 0.0};
+		unsigned num_tris[2] = {0, 0};
+
+		for (unsigned async = 0; async < 2; ++async) {
+			regen(async != 0);
+			unsigned edit_ix(0);
+
+			for (unsigned frame = 0; frame < num_frames; ++frame) {
+				auto const start(hr_clock::now());
+				unsigned const edits_end(min((unsigned)edits.size(), unsigned((frame+1)*frame_secs*edit_rates[r])));
+
+				for (; edit_ix < edits_end; ++edit_ix) { // alternate between removing and adding material
+					terrain_voxel_model.update_voxel_sphere_region(edits[edit_ix], edit_radius, ((edit_ix & 1) ? 1.0 : -1.0), 1, 1);
+				}
+				terrain_voxel_model.proc_pending_updates();
+				double const ms(std::chrono::duration<double, std::milli>(hr_clock::now() - start).count());
+				worst_ms[async] = max(worst_ms[async], ms);
+				avg_ms  [async] += ms/num_frames;
+			}
+			auto const start(hr_clock::now());
+
+			while (terrain_voxel_model.has_modified_blocks() || !terrain_voxel_model.async_remesh_idle()) { // finish falling voxels and background remeshing
+				std::this_thread::yield();
+				terrain_voxel_model.proc_pending_updates();
+			}
+			finish_ms[async] = std::chrono::duration<double, std::milli>(hr_clock::now() - start).count();
+			num_tris [async] = terrain_voxel_model.get_num_triangles();
+		} // for async
+		cout << "Voxel remesh benchmark " << edit_rates[r] << " edits/s, " << num_frames << " frames: sync worst " << worst_ms[0] << " ms/frame avg " << avg_ms[0]
+			 << " (+" << finish_ms[0] << " ms to finish), async worst " << worst_ms[1] << " ms/frame avg " << avg_ms[1] << " (+" << finish_ms[1]
+			 << " ms to finish), " << num_tris[0] << " triangles, same result: " << ((num_tris[0] == num_tris[1]) ? "yes" : "NO") << endl;
+	} // for r
+	regen(global_voxel_params.async_remesh); // restore the unedited landscape
 }
 
 
@@ -1882,6 +2343,7 @@ void gen_voxel_landscape() {
 	PRINT_TIME(" Voxel Gen");
 	terrain_voxel_model.build(global_voxel_params.add_cobjs, 0, 1);
 	PRINT_TIME(" Voxels to Triangles/Cobjs");
+	if (benchmark_voxel_remesh) {run_voxel_remesh_benchmark();}
 	
 	if (read_voxel_brushes()) {
 		PRINT_TIME(" Read Voxel Brushes");
@@ -1926,7 +2388,7 @@ void gen_voxel_spherical(voxel_model &model, voxel_params_t &params, point const
 	float const vsz(2.0*radius/size);
 	assert(model.empty());
 	model.set_params(params);
-	model.init(size, size, size, vector3d(vsz, vsz, vsz), center, -1.0, params.num_blocks);
+	model.init(size, size, size, vector3d(vsz, vsz, vsz), center, -1.0, params.num_blocks, params.sparse_storage);
 	model.create_procedural(params.mag, params.freq, zero_vector, params.normalize_to_1, params.geom_rseed, rseed, gen_mode);
 }
 
@@ -2037,6 +2499,12 @@ bool parse_voxel_option(FILE *fp) {
 	else if (str == "make_closed_surface") {
 		if (!read_bool(fp, global_voxel_params.make_closed_surface)) voxel_file_err("make_closed_surface", error);
 	}
+	else if (str == "sparse_storage") {
+		if (!read_bool(fp, global_voxel_params.sparse_storage)) voxel_file_err("sparse_storage", error);
+	}
+	else if (str == "async_remesh") {
+		if (!read_bool(fp, global_voxel_params.async_remesh)) voxel_file_err("async_remesh", error);
+	}
 	else if (str == "remove_unconnected") {
 		if (!read_uint(fp, global_voxel_params.remove_unconnected) || global_voxel_params.remove_unconnected > 3) voxel_file_err("remove_unconnected", error);
 	}
@@ -5,11 +5,20 @@
 
 #include "3DWorld.h"
 #include "model3d.h"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
 
 struct coll_tquad;
 
 enum {VB_SHAPE_CUBE=0, VB_SHAPE_CONSTANT, VB_SHAPE_LINEAR, VB_SHAPE_QUADRATIC, NUM_VB_SHAPES};
 
+unsigned const VOXEL_BRICK_BITS = 3; // sparse voxel grids use bricks of 8x8x8 voxels
+unsigned const VOXEL_BRICK_SZ   = (1 << VOXEL_BRICK_BITS);
+unsigned const VOXEL_BRICK_MASK = (VOXEL_BRICK_SZ - 1);
+unsigned const VOXEL_BRICK_VOL  = VOXEL_BRICK_SZ*VOXEL_BRICK_SZ*VOXEL_BRICK_SZ;
+
 
 struct voxel_params_t {
 
@@ -17,7 +26,7 @@ struct voxel_params_t {
 	unsigned xsize, ysize, zsize, num_blocks; // num_blocks is in x and y
 	float isolevel, elasticity, mag, freq, atten_thresh, tex_scale, noise_scale, noise_freq, tex_mix_saturate, z_gradient, height_eval_freq, radius_val;
 	float ao_radius, ao_weight_scale, ao_atten_power, spec_mag, spec_exp;
-	bool make_closed_surface, invert, remove_under_mesh, add_cobjs, normalize_to_1, top_tex_used, detail_normal_map;
+	bool make_closed_surface, invert, remove_under_mesh, add_cobjs, normalize_to_1, top_tex_used, detail_normal_map, sparse_storage, async_remesh;
 	unsigned remove_unconnected; // 0=never, 1=init only, 2=always, 3=always, including interior holes
 	unsigned atten_at_edges; // 0=no atten, 1=top only, 2=all 5 edges (excludes the bottom), 3=sphere (outer), 4=sphere (inner and outer), 5=sphere (inner and outer, excludes the bottom)
 	unsigned keep_at_scene_edge; // 0=don't keep, 1=always keep, 2=only when scrolling
@@ -34,7 +43,7 @@ struct voxel_params_t {
 	voxel_params_t() : xsize(0), ysize(0), zsize(0), num_blocks(12), isolevel(0.0), elasticity(0.5), mag(1.0), freq(1.0), atten_thresh(1.0), tex_scale(1.0), noise_scale(0.1),
 		noise_freq(1.0), tex_mix_saturate(5.0), z_gradient(0.0), height_eval_freq(1.0), radius_val(0.5), ao_radius(1.0), ao_weight_scale(2.0), ao_atten_power(1.0),
 		spec_mag(0.0), spec_exp(1.0), make_closed_surface(1), invert(0), remove_under_mesh(0), add_cobjs(1), normalize_to_1(1), top_tex_used(0), detail_normal_map(1),
-		remove_unconnected(1), atten_at_edges(0), keep_at_scene_edge(0), atten_top_mode(0), enable_falling(1), geom_rseed(123), texture_rseed(321), base_color(WHITE)
+		sparse_storage(0), async_remesh(0), remove_unconnected(1), atten_at_edges(0), keep_at_scene_edge(0), atten_top_mode(0), enable_falling(1), geom_rseed(123), texture_rseed(321), base_color(WHITE)
 	{
 			tids[0] = tids[1] = tids[2] = 0; colors[0] = colors[1] = WHITE;
 	}
@@ -113,27 +122,67 @@ public:
 };
 
 
-// stored internally in yxz order
+// stored internally in yxz order; after make_sparse(), the data is stored in bricks, and bricks where all voxels have the same value are collapsed to that value;
+// the iterators and resize() only work on dense grids, and writes to sparse grids aren't thread safe since they may expand a collapsed brick;
+// init() can also create a sparse grid directly, which is then filled in parallel with update_columns() without ever allocating the dense data
 template<typename V> class voxel_grid : public vector<V> {
-	void init_grid(unsigned nx_, unsigned ny_, unsigned nz_, V default_val, unsigned num_blocks);
+
+	struct brick_t {
+		V val; // value of every voxel when data is empty
+		vector<V> data; // VOXEL_BRICK_VOL values in yxz order, or empty if collapsed
+		brick_t() : val() {}
+	};
+	vector<brick_t> bricks; // nonempty for sparse grids, which have an empty base vector
+	vector<unsigned> expanded_bricks; // bricks expanded by writes since the last call to make_sparse()
+	unsigned bnx, bny, bnz; // number of bricks in x,y,z
+
+	void init_grid(unsigned nx_, unsigned ny_, unsigned nz_, V default_val, unsigned num_blocks, bool sparse);
+	void calc_num_bricks();
+	void copy_dense_to_brick(brick_t &b, unsigned bx, unsigned by, unsigned bz) const;
+	void pad_partial_brick(brick_t &b, unsigned bx, unsigned by, unsigned bz) const;
+	static void collapse_if_uniform(brick_t &b);
+	unsigned get_brick_ix(unsigned x, unsigned y, unsigned z) const {return ((z >> VOXEL_BRICK_BITS) + ((x >> VOXEL_BRICK_BITS) + (y >> VOXEL_BRICK_BITS)*bnx)*bnz);}
+	static unsigned get_ix_in_brick(unsigned x, unsigned y, unsigned z) {return ((z & VOXEL_BRICK_MASK) + ((x & VOXEL_BRICK_MASK) + (y & VOXEL_BRICK_MASK)*VOXEL_BRICK_SZ)*VOXEL_BRICK_SZ);}
+	void get_xyz_from_ix(unsigned ix, unsigned &x, unsigned &y, unsigned &z) const {z = ix % nz; ix /= nz; x = ix % nx; y = ix / nx;}
+
+	V const &get_sparse(unsigned x, unsigned y, unsigned z) const {
+		brick_t const &b(bricks[get_brick_ix(x, y, z)]);
+		return (b.data.empty() ? b.val : b.data[get_ix_in_brick(x, y, z)]);
+	}
+	V &get_sparse_ref(unsigned x, unsigned y, unsigned z) { // expands the brick so that it can be written
+		unsigned const bix(get_brick_ix(x, y, z));
+		brick_t &b(bricks[bix]);
+		if (b.data.empty()) {b.data.resize(VOXEL_BRICK_VOL, b.val); expanded_bricks.push_back(bix);}
+		return b.data[get_ix_in_brick(x, y, z)];
+	}
+	V const &get_sparse_ix(unsigned ix) const {unsigned x, y, z; get_xyz_from_ix(ix, x, y, z); return get_sparse(x, y, z);}
+	V &get_sparse_ix_ref(unsigned ix) {unsigned x, y, z; get_xyz_from_ix(ix, x, y, z); return get_sparse_ref(x, y, z);}
 public:
 	unsigned nx, ny, nz, xblocks, yblocks;
 	vector3d vsz; // size of a voxel in x,y,z
 	point center, lo_pos;
 
-	using vector<V>::clear;
-	using vector<V>::empty;
-	using vector<V>::size;
 	using vector<V>::at;
-	using vector<V>::operator[];
 	using vector<V>::resize;
 	using vector<V>::begin;
 	using vector<V>::end;
 	using vector<V>::front;
 
-	voxel_grid() : nx(0), ny(0), nz(0), xblocks(0), yblocks(0), vsz(zero_vector) {}
-	void init(unsigned nx_, unsigned ny_, unsigned nz_, vector3d const &vsz_, point const &center_, V const &default_val, unsigned num_blocks=1);
-	void init(unsigned nx_, unsigned ny_, unsigned nz_, cube_t const &bcube, V const &default_val, unsigned num_blocks=1);
+	voxel_grid() : bnx(0), bny(0), bnz(0), nx(0), ny(0), nz(0), xblocks(0), yblocks(0), vsz(zero_vector) {}
+	void clear() {vector<V>::clear(); bricks.clear(); expanded_bricks.clear();}
+	bool is_sparse() const {return !bricks.empty();}
+	size_t size() const {return (is_sparse() ? size_t(nx)*ny*nz : vector<V>::size());}
+	bool empty() const {return (size() == 0);}
+	V const &operator[](unsigned ix) const {return (is_sparse() ? get_sparse_ix(ix) : vector<V>::operator[](ix));}
+	V &operator[](unsigned ix) {return (is_sparse() ? get_sparse_ix_ref(ix) : vector<V>::operator[](ix));}
+	void make_sparse();
+	void make_dense();
+	template<typename F> void update_columns(F const &f);
+	void copy_region(voxel_grid<V> const &src, unsigned x1, unsigned y1, unsigned x2, unsigned y2);
+	size_t get_mem_usage() const;
+	unsigned get_num_collapsed_bricks() const;
+	void init(unsigned nx_, unsigned ny_, unsigned nz_, vector3d const &vsz_, point const &center_, V const &default_val, unsigned num_blocks=1, bool sparse=0);
+	void init(unsigned nx_, unsigned ny_, unsigned nz_, cube_t const &bcube, V const &default_val, unsigned num_blocks=1, bool sparse=0);
 	void init_from_heightmap(float **height, unsigned mesh_nx, unsigned mesh_ny, unsigned zsteps, float mesh_xsize, float mesh_ysize, unsigned num_blocks=1, bool invert=0);
 	void downsample_2x();
 	bool is_valid_range(int i[3]) const {return (i[0] >= 0 && i[1] >= 0 && i[2] >= 0 && i[0] < (int)nx && i[1] < (int)ny && i[2] < (int)nz);}
@@ -157,9 +206,17 @@ public:
 	}
 	void get_bcube_ix_bounds(cube_t const &bcube, int llc[3], int urc[3]) const;
 	point get_pt_at(unsigned x, unsigned y, unsigned z) const  {return (point(x, y, z)*vsz + lo_pos);}
-	V const &get   (unsigned x, unsigned y, unsigned z) const  {return operator[](get_ix(x, y, z));}
-	V &get_ref     (unsigned x, unsigned y, unsigned z)        {return operator[](get_ix(x, y, z));}
-	void set       (unsigned x, unsigned y, unsigned z, V const &val) {operator[](get_ix(x, y, z)) = val;}
+	V const &get   (unsigned x, unsigned y, unsigned z) const  {return (is_sparse() ? get_sparse    (x, y, z) : vector<V>::operator[](get_ix(x, y, z)));}
+	V &get_ref     (unsigned x, unsigned y, unsigned z)        {return (is_sparse() ? get_sparse_ref(x, y, z) : vector<V>::operator[](get_ix(x, y, z)));}
+
+	void set(unsigned x, unsigned y, unsigned z, V const &val) {
+		if (is_sparse()) {
+			brick_t const &b(bricks[get_brick_ix(x, y, z)]);
+			if (b.data.empty() && b.val == val) return; // no change, don't expand the brick
+			get_sparse_ref(x, y, z) = val;
+		}
+		else {vector<V>::operator[](get_ix(x, y, z)) = val;}
+	}
 	cube_t get_raw_bbox() const {return cube_t(lo_pos, center + (center - lo_pos));}
 	bool read(FILE *fp);
 	bool write(FILE *fp) const;
@@ -193,7 +250,8 @@ protected:
 	};
 
 	point interpolate_pt(float isolevel, point const &pt1, point const &pt2, float const val1, float const val2) const;
-	void calc_outside_val(unsigned x, unsigned y, unsigned z, bool is_under_mesh);
+	unsigned char get_outside_val(unsigned x, unsigned y, unsigned z, bool is_under_mesh) const;
+	void calc_outside_val(unsigned x, unsigned y, unsigned z, bool is_under_mesh) {outside.set(x, y, z, get_outside_val(x, y, z, is_under_mesh));}
 	void flood_fill_range(unsigned x1, unsigned y1, unsigned x2, unsigned y2, vector<unsigned> &work, unsigned char fill_val, unsigned char bit_mask);
 	void remove_unconnected_outside_range(bool keep_at_edge, unsigned x1, unsigned y1, unsigned x2, unsigned y2,
 		vector<unsigned> *xy_updated, vector<pt_ix_t> *updated_pts, bool mark_only=0);
@@ -216,11 +274,14 @@ public:
 	void remove_unconnected_outside();
 	void remove_interior_holes();
 	bool is_outside(unsigned ix) const {assert(ix < outside.size()); return((outside[ix]&3) != 0);}
+	bool is_outside(unsigned x, unsigned y, unsigned z) const {return((outside.get(x, y, z)&3) != 0);} // faster for sparse grids
 	bool point_inside_volume(point const &pos) const;
 	bool point_intersect(point const &center, point *int_pt) const;
 	bool sphere_intersect(point const &center, float radius, point *int_pt) const;
 	bool line_intersect(point const &p1, point const &p2, point *int_pt) const;
 	unsigned upload_to_3d_texture(int wrap) const;
+	void make_sparse() {float_voxel_grid::make_sparse(); outside.make_sparse();}
+	size_t get_mem_usage() const {return (float_voxel_grid::get_mem_usage() + outside.get_mem_usage());}
 	voxel_params_t const &get_params() const {return params;}
 };
 
@@ -241,8 +302,49 @@ public:
 };
 
 
+class voxel_model;
+
+// background remeshing of modified voxel blocks on worker threads; each job owns a snapshot of the voxel data around its block,
+// so the main thread can continue to edit voxels while the block is rebuilt
+class voxel_remesh_pool_t {
+public:
+	struct job_t {
+		unsigned block_ix, version;
+		bool increase_ao_only;
+		voxel_model *snapshot; // owned by the job; the rebuilt triangles and AO lighting are returned in the snapshot
+		job_t *next; // in done stack
+
+		job_t(unsigned block_ix_, unsigned version_, bool increase_ao_only_, voxel_model *snapshot_) :
+			block_ix(block_ix_), version(version_), increase_ao_only(increase_ao_only_), snapshot(snapshot_), next(nullptr) {}
+		~job_t();
+	};
+private:
+	vector<std::thread> workers;
+	std::mutex pending_mutex;
+	std::condition_variable pending_cv;
+	deque<job_t *> pending; // not yet started, in submit order, at most one per block; guarded by pending_mutex
+	std::atomic<job_t *> done_head; // lock-free stack of finished jobs: pushed by workers, drained by the main thread
+	bool kill_threads;
+	unsigned num_jobs; // submitted but not yet drained; main thread only
+
+	void worker_thread();
+	void push_done(job_t *job);
+public:
+	voxel_remesh_pool_t() : done_head(nullptr), kill_threads(0), num_jobs(0) {}
+	~voxel_remesh_pool_t() {stop();}
+	bool is_running() const {return !workers.empty();}
+	bool is_idle() const {return (num_jobs == 0);}
+	void start(unsigned num_threads);
+	void stop();
+	void submit(job_t *job);
+	void drain_done(vector<job_t *> &done); // returns jobs in the order they finished; the caller takes ownership
+};
+
+
 class voxel_model : public voxel_manager {
 
+	friend class voxel_remesh_pool_t; // for remesh_snapshot_block()
+
 protected:
 	bool volume_added;
 	vector<tri_data_t> tri_data; // one per LOD level
@@ -283,8 +385,13 @@ protected:
 	void remove_unconnected_outside_modified_blocks(bool postproc_brushes_mode);
 	unsigned get_block_ix(unsigned voxel_ix) const;
 	virtual bool clear_block(unsigned block_ix);
+	unsigned create_block_tris(tri_data_t::value_type &tri_block, voxel_ix_cache &vix_cache, unsigned block_ix, bool count_only, unsigned lod_level) const;
 	unsigned create_block(voxel_ix_cache &vix_cache, unsigned block_ix, bool first_create, bool count_only, unsigned lod_level);
 	unsigned create_block_all_lods(unsigned block_ix, bool first_create, bool count_only);
+	void rebuild_blocks(vector<unsigned> const &blocks_to_update);
+	voxel_model *create_remesh_snapshot(unsigned block_ix) const;
+	void remesh_snapshot_block(unsigned block_ix, bool increase_ao_only);
+	bool swap_in_remesh_snapshot(unsigned block_ix, voxel_model &snapshot);
 	void update_boundary_normals_for_block(unsigned block_ix, bool calc_average);
 	void finalize_boundary_vmap();
 	void calc_ao_dirs();
@@ -296,6 +403,8 @@ protected:
 	virtual void update_blocks_hook(vector<unsigned> const &blocks_to_update, unsigned num_added) {}
 	virtual void pre_build_hook() {}
 	virtual void pre_render(bool is_shadow_pass) {}
+	virtual bool submit_async_remesh(vector<unsigned> const &blocks_to_update, bool increase_ao_only) {return 0;} // returns 1 if the blocks will be rebuilt in the background
+	virtual void apply_async_remesh_results() {}
 
 public:
 	voxel_model(noise_texture_manager_t *ntg, bool use_mesh_, unsigned num_lod_levels);
@@ -315,6 +424,7 @@ public:
 	cube_t get_bcube() const {return ((tri_data[0].empty()) ? cube_t(center, center) : tri_data[0].get_bcube());}
 	sphere_t get_bsphere() const;
 	bool has_triangles() const;
+	unsigned get_num_triangles() const;
 	bool has_filled_at_edges() const;
 	bool from_file(string const &fn);
 	bool to_file(string const &fn) const;
@@ -334,17 +444,22 @@ class voxel_model_ground : public voxel_model {
 		void clear() {cids.clear();}
 	};
 	vector<data_block_t> data_blocks;
+	voxel_remesh_pool_t remesh_pool;
+	vector<unsigned> remesh_version, shown_version; // per block: last submitted and currently drawn remesh job versions
 
 	virtual bool clear_block(unsigned block_ix);
 	virtual void maybe_create_fragments(point const &center, float radius, int shooter, unsigned num_fragments, bool directly_from_update) const;
 	virtual void create_block_hook(unsigned block_ix);
 	virtual void update_blocks_hook(vector<unsigned> const &blocks_to_update, unsigned num_added);
 	virtual void pre_build_hook();
+	virtual bool submit_async_remesh(vector<unsigned> const &blocks_to_update, bool increase_ao_only);
+	virtual void apply_async_remesh_results();
 
 public:
 	voxel_model_ground(unsigned num_lod_levels=1);
 	void clear();
 	void build(bool add_cobjs_, bool add_as_fixed_, bool verbose);
+	bool async_remesh_idle() const {return remesh_pool.is_idle();}
 	bool check_coll_line(point const &p1, point const &p2, point &cpos, vector3d &cnorm, int &cindex, int ignore_cobj, bool exact) const {
 		return cobj_tree.check_coll_line(p1, p2, cpos, cnorm, cindex, ignore_cobj, exact);
 	}